@@ -0,0 +1,214 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Cross-process benchmark through the addon: one producer process and N
+// reader processes on one mapping, swept over frame sizes, channel counts,
+// wait policies and slot counts. bench/shm_bench.cc measures the same ring
+// without Node.
+//
+//   node bench/bench.js [--sizes 720p,1080p,4k] [--channels 3,4]
+//                       [--waits block,spin] [--slots 3] [--readers 1]
+//                       [--read copy|acquire] [--write slot|frame]
+//                       [--seconds 2] [--fps 0]
+//
+// The producer stamps a frame counter into the first 8 bytes of every frame,
+// readers count the gaps as drops. --write frame has it render into a buffer
+// of its own and hand that to writeFrame() instead of drawing into the slot.
+// Latency is publish -> wake as reported by getWaitStats().lastLatencyUs.
+
+'use strict';
+
+const { fork } = require('child_process');
+const path = require('path');
+
+const SIZES = {
+  '720p': [1280, 720], '1080p': [1920, 1080], '1440p': [2560, 1440],
+  '4k': [3840, 2160], '8k': [7680, 4320],
+};
+
+function loadAddon() {
+  return require(path.join(__dirname, '..', 'build', 'Release', 'shared_memory.node'));
+}
+
+function parseArgs(argv) {
+  const opts = {
+    sizes: ['720p', '1080p', '1440p', '4k', '8k'], channels: [3, 4], waits: ['block', 'spin'],
+    slots: [3], readers: [1], read: 'copy', write: 'slot', seconds: 2, fps: 0,
+  };
+  for (let i = 0; i < argv.length; i += 2) {
+    const key = argv[i].replace(/^--/, '');
+    const value = argv[i + 1];
+    if (value === undefined || !(key in opts)) {
+      console.error('usage: node bench/bench.js [--sizes 720p,1080p,...] [--channels 3,4] [--waits block,spin]\n' +
+                    '                           [--slots 3] [--readers 1] [--read copy|acquire] [--write slot|frame]\n' +
+                    '                           [--seconds 2] [--fps 0]');
+      process.exit(2);
+    }
+    if (Array.isArray(opts[key])) {
+      opts[key] = value.split(',').map((v) => (typeof opts[key][0] === 'number' ? Number(v) : v));
+    } else {
+      opts[key] = typeof opts[key] === 'number' ? Number(value) : value;
+    }
+  }
+  return opts;
+}
+
+function percentile(sorted, p) {
+  return sorted.length ? sorted[Math.floor(p * (sorted.length - 1))] : 0;
+}
+
+// --- child roles ---
+
+function runProducer(cfg) {
+  const { SharedMemory } = loadAddon();
+  const shm = new SharedMemory();
+  const bytes = cfg.width * cfg.height * cfg.channels;
+  shm.create(cfg.name, bytes, cfg.width, cfg.height, cfg.channels, { slots: cfg.slots });
+  process.send({ ready: true });
+
+  process.on('message', (msg) => {
+    if (msg.exit) {
+      shm.close();
+      process.exit(0);
+    }
+    if (!msg.go) return;
+    cfg.start = msg.start;
+
+    while (Date.now() < cfg.start) {}
+    const end = cfg.start + cfg.seconds * 1000;
+    const interval = cfg.fps ? 1e9 / cfg.fps : 0;
+    const t0 = process.hrtime.bigint();
+    let published = 0, full = 0;
+    const own = cfg.write === 'frame' ? Buffer.alloc(bytes) : null;
+    while (Date.now() < end) {
+      const buf = own || shm.getFrameBuffer();
+      if (!buf) { full++; continue; }
+      buf.fill(published & 0xff, 8, bytes);
+      buf.writeDoubleLE(published + 1, 0);
+      if (own ? !shm.writeFrame(own) : !shm.publishFrame(bytes)) { full++; continue; }
+      published++;
+      if (interval) {
+        const next = t0 + BigInt(Math.round(published * interval));
+        while (process.hrtime.bigint() < next) {}
+      }
+    }
+    process.send({ published, full, elapsed: Number(process.hrtime.bigint() - t0) / 1e9 });
+  });
+}
+
+function runReader(cfg) {
+  const { SharedMemory } = loadAddon();
+  const shm = new SharedMemory();
+  const bytes = cfg.width * cfg.height * cfg.channels;
+  shm.create(cfg.name, bytes, cfg.width, cfg.height, cfg.channels, { slots: cfg.slots });
+  shm.setWaitPolicy({ wait: cfg.wait });
+  shm.readFrame(0); // registers the reader before the clock starts
+  process.send({ ready: true });
+
+  process.on('message', (msg) => {
+    if (!msg.go) return;
+    cfg.start = msg.start;
+    const end = cfg.start + cfg.seconds * 1000;
+    const latencies = [];
+    let frames = 0, dropped = 0, last = 0;
+    while (Date.now() < end) {
+      const frame = cfg.read === 'acquire' ? shm.acquireFrame(100) : shm.readFrame(100);
+      if (!frame || frame.length < 8) continue;
+      const counter = frame.readDoubleLE(0);
+      if (counter <= last) continue; // the same frame again after a timeout
+      if (last && counter > last + 1) dropped += counter - last - 1;
+      last = counter;
+      frames++;
+      latencies.push(shm.getWaitStats().lastLatencyUs);
+    }
+    if (cfg.read === 'acquire') shm.release();
+    shm.close();
+    process.send({ frames, dropped, latencies });
+    process.exit(0);
+  });
+}
+
+// --- driver ---
+
+function spawn(role, cfg) {
+  const child = fork(__filename, ['--role', role, JSON.stringify(cfg)]);
+  const ready = new Promise((resolve) => child.once('message', resolve));
+  return { child, ready };
+}
+
+async function runOne(cfg) {
+  const producer = spawn('producer', cfg);
+  await producer.ready;
+  const readers = [];
+  for (let i = 0; i < cfg.readers; i++) readers.push(spawn('reader', cfg));
+  await Promise.all(readers.map((r) => r.ready));
+
+  const start = Date.now() + 200;
+  const done = readers.map((r) => new Promise((resolve) => r.child.once('message', resolve)));
+  const produced = new Promise((resolve) => producer.child.once('message', resolve));
+  // the start time travels with 'go' so every process begins together
+  for (const p of [producer, ...readers]) p.child.send({ go: true, start });
+  const results = await Promise.all(done);
+  const prod = await produced;
+  producer.child.send({ exit: true });
+
+  const latencies = [].concat(...results.map((r) => r.latencies)).sort((a, b) => a - b);
+  const frames = results.reduce((n, r) => n + r.frames, 0);
+  const dropped = results.reduce((n, r) => n + r.dropped, 0);
+  const bytes = cfg.width * cfg.height * cfg.channels;
+  return {
+    pubFps: prod.published / prod.elapsed,
+    readFps: frames / prod.elapsed / cfg.readers,
+    gbps: frames * bytes / prod.elapsed / 1e9,
+    p50: percentile(latencies, 0.5), p99: percentile(latencies, 0.99), p999: percentile(latencies, 0.999),
+    dropped, full: prod.full,
+  };
+}
+
+function pad(value, width, digits) {
+  const s = typeof value === 'number' ? value.toFixed(digits === undefined ? 1 : digits) : String(value);
+  return s.length >= width ? s : ' '.repeat(width - s.length) + s;
+}
+
+async function main() {
+  const opts = parseArgs(process.argv.slice(2));
+  console.log(['size', 'ch', 'slots', 'readers', 'wait', 'pub/s', 'read/s', 'GB/s', 'p50 us', 'p99 us',
+               'p99.9 us', 'dropped', 'full'].map((h, i) => pad(h, i === 0 ? 6 : 8)).join(' '));
+
+  let run = 0;
+  for (const size of opts.sizes) {
+    if (!SIZES[size]) throw new Error('unknown size ' + size);
+    for (const channels of opts.channels) {
+      for (const wait of opts.waits) {
+        for (const slots of opts.slots) {
+          for (const readers of opts.readers) {
+            const [width, height] = SIZES[size];
+            const cfg = {
+              name: 'shm_bench_js_' + process.pid + '_' + run++, width, height, channels, wait, slots, readers,
+              read: opts.read, write: opts.write, seconds: opts.seconds, fps: opts.fps,
+            };
+            const r = await runOne(cfg);
+            console.log([pad(size, 6), pad(channels, 8, 0), pad(slots, 8, 0), pad(readers, 8, 0), pad(wait, 8),
+                         pad(r.pubFps, 8), pad(r.readFps, 8), pad(r.gbps, 8, 2), pad(r.p50, 8), pad(r.p99, 8),
+                         pad(r.p999, 8), pad(r.dropped, 8, 0), pad(r.full, 8, 0)].join(' '));
+          }
+        }
+      }
+    }
+  }
+}
+
+if (process.argv[2] === '--role') {
+  const cfg = JSON.parse(process.argv[4]);
+  if (process.argv[3] === 'producer') runProducer(cfg);
+  else runReader(cfg);
+} else {
+  main().catch((err) => {
+    console.error(err);
+    process.exit(1);
+  });
+}
@@ -0,0 +1,243 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Native benchmark of the ring protocol: one producer thread and N reader
+// threads on a real named mapping, without Node in the way. bench/bench.js
+// runs the cross-process version through the addon. Both ends are the
+// client library's (shm_image::Writer / Reader), the protocol the addon
+// speaks too.
+//
+//   shm_bench [--size 720p|1080p|1440p|4k|8k|WxH] [--channels 3|4]
+//             [--slots N] [--readers N] [--wait block|spin]
+//             [--seconds S] [--fps N] [--realtime] [--cores 0,2]
+//
+// Without --size/--channels it sweeps 720p..8K at 3 and 4 channels.
+// --realtime / --cores run the readers as setLatencyOptions() runs the
+// addon's watcher (MMCSS / SCHED_FIFO, pinned), to compare wake latency.
+
+#include "../src/platform.h"
+#include "../src/shm_image.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Config {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t channels = 0;
+  uint32_t slots = SHARED_DEFAULT_SLOTS;
+  uint32_t readers = 1;
+  bool spin = false;
+  double seconds = 2.0;
+  uint32_t fps = 0; // 0 = as fast as possible
+  platform::ThreadLatency latency; // the reader threads'
+};
+
+struct ReaderStats {
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped = 0; // frames published but never seen (latest-only reads)
+  std::vector<uint64_t> latencyNs; // publish -> wake
+};
+
+static const struct { const char* name; uint32_t w, h; } SIZES[] = {
+  { "720p", 1280, 720 }, { "1080p", 1920, 1080 }, { "1440p", 2560, 1440 },
+  { "4k", 3840, 2160 }, { "8k", 7680, 4320 },
+};
+
+// --- one run ---
+
+static double Percentile(const std::vector<uint64_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = (size_t)(p * (sorted.size() - 1));
+  return sorted[i] / 1000.0;
+}
+
+static bool Run(const Config& cfg, const char* label) {
+  uint64_t frameBytes = (uint64_t)cfg.width * cfg.height * cfg.channels;
+
+  // the ring as any native producer/consumer sets it up: the client library's
+  // Writer and Readers, pins booked on reader entries, readers woken through
+  // their own events
+  shm_image::WriterOptions options;
+  options.width = cfg.width;
+  options.height = cfg.height;
+  options.pixelFormat = cfg.channels == 3 ? PIXEL_FORMAT_BGR8 : PIXEL_FORMAT_BGRA8;
+  options.slots = cfg.slots;
+  shm_image::Writer writer;
+  std::string error;
+  std::string name = "shm_bench_" + std::to_string(platform::CurrentProcessId());
+  if (!writer.open(name, options, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return false;
+  }
+
+  std::vector<ReaderStats> stats(cfg.readers);
+  std::vector<std::thread> readers;
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> attached{0};
+  std::atomic<bool> failed{false};
+
+  for (uint32_t r = 0; r < cfg.readers; r++) {
+    readers.emplace_back([&, r]() {
+      ReaderStats& st = stats[r];
+      shm_image::Reader reader;
+      std::string error;
+      bool opened = reader.open(name, &error);
+      if (!opened) {
+        fprintf(stderr, "reader %u: %s\n", r, error.c_str());
+        failed = true;
+      }
+      attached++;
+      if (!opened) return;
+      platform::ThreadLatencyState latency;
+      if (!platform::SetThreadLatency(cfg.latency, &latency, &error)) fprintf(stderr, "reader %u: %s\n", r, error.c_str());
+      std::vector<uint8_t> frame((size_t)frameBytes);
+      uint64_t lastSeen = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (!reader.wait(cfg.spin ? 0 : 10)) {
+          if (cfg.spin) platform::CpuRelax();
+          continue;
+        }
+        uint64_t woke = platform::MonotonicNs();
+        shm_image::FrameInfo info;
+        if (reader.read(frame.data(), frame.size(), &info) <= 0) continue;
+
+        if (lastSeen && info.frameIndex > lastSeen + 1) st.dropped += info.frameIndex - lastSeen - 1;
+        lastSeen = info.frameIndex;
+        st.frames++;
+        st.bytes += frameBytes;
+        if (woke > info.publishNs) st.latencyNs.push_back(woke - info.publishNs);
+      }
+      platform::ResetThreadLatency(&latency);
+    });
+  }
+  // every reader attached before the first frame, so none starts late
+  while (attached.load() < cfg.readers) platform::YieldThread();
+
+  // producer: fill a slot from a source frame, publish, wake everyone
+  std::vector<uint8_t> source((size_t)frameBytes, 0x5a);
+  uint64_t start = platform::MonotonicNs();
+  uint64_t end = failed ? start : start + (uint64_t)(cfg.seconds * 1e9);
+  uint64_t interval = cfg.fps ? 1000000000ull / cfg.fps : 0;
+  uint64_t published = 0, busy = 0;
+  for (uint64_t now = start; now < end; now = platform::MonotonicNs()) {
+    uint8_t* slot = writer.frameBuffer();
+    if (!slot) { busy++; platform::YieldThread(); continue; }
+    memcpy(slot, source.data(), (size_t)frameBytes);
+    writer.publish((uint32_t)frameBytes, 0);
+    published++;
+    if (interval) {
+      uint64_t next = start + published * interval;
+      while (platform::MonotonicNs() < next) {
+        if (!cfg.spin && next - platform::MonotonicNs() > 2000000) platform::SleepMs(1);
+        else platform::CpuRelax();
+      }
+    }
+  }
+  double elapsed = (platform::MonotonicNs() - start) / 1e9;
+
+  stop = true;
+  for (std::thread& t : readers) t.join(); // blocked ones time out within 10 ms
+  writer.close();
+  if (failed) return false;
+
+  ReaderStats total;
+  for (ReaderStats& st : stats) {
+    total.frames += st.frames;
+    total.bytes += st.bytes;
+    total.dropped += st.dropped;
+    total.latencyNs.insert(total.latencyNs.end(), st.latencyNs.begin(), st.latencyNs.end());
+  }
+  std::sort(total.latencyNs.begin(), total.latencyNs.end());
+
+  printf("%-10s %2u %5u %7u %-5s %9.1f %9.1f %7.2f %8.1f %8.1f %8.1f %8llu %6llu\n",
+         label, cfg.channels, cfg.slots, cfg.readers, cfg.spin ? "spin" : "block",
+         published / elapsed, total.frames / elapsed / cfg.readers,
+         total.bytes / elapsed / 1e9,
+         Percentile(total.latencyNs, 0.50), Percentile(total.latencyNs, 0.99), Percentile(total.latencyNs, 0.999),
+         (unsigned long long)total.dropped, (unsigned long long)busy);
+  return true;
+}
+
+static bool ParseSize(const std::string& value, Config* cfg) {
+  for (auto& s : SIZES) {
+    if (value == s.name) { cfg->width = s.w; cfg->height = s.h; return true; }
+  }
+  return sscanf(value.c_str(), "%ux%u", &cfg->width, &cfg->height) == 2 && cfg->width && cfg->height;
+}
+
+int main(int argc, char** argv) {
+  Config cfg;
+  std::string size;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : "";
+    if (arg == "--size") { size = value; i++; }
+    else if (arg == "--channels") { cfg.channels = (uint32_t)atoi(value); i++; }
+    else if (arg == "--slots") { cfg.slots = (uint32_t)atoi(value); i++; }
+    else if (arg == "--readers") { cfg.readers = (uint32_t)atoi(value); i++; }
+    else if (arg == "--wait") { cfg.spin = strcmp(value, "spin") == 0; i++; }
+    else if (arg == "--seconds") { cfg.seconds = atof(value); i++; }
+    else if (arg == "--fps") { cfg.fps = (uint32_t)atoi(value); i++; }
+    else if (arg == "--realtime") { cfg.latency.realtime = cfg.latency.timerResolution = true; }
+    else if (arg == "--cores") {
+      for (const char* p = value; *p; p++) {
+        if (*p >= '0' && *p <= '9') {
+          int core = atoi(p);
+          if (core < 64) cfg.latency.cores |= 1ull << core;
+          while (p[1] >= '0' && p[1] <= '9') p++;
+        }
+      }
+      i++;
+    }
+    else {
+      fprintf(stderr, "usage: shm_bench [--size 720p|1080p|1440p|4k|8k|WxH] [--channels 3|4] [--slots N]\n"
+                      "                 [--readers N] [--wait block|spin] [--seconds S] [--fps N]\n"
+                      "                 [--realtime] [--cores 0,2]\n");
+      return 2;
+    }
+  }
+  if (cfg.slots < 1 || cfg.slots > SHARED_MAX_SLOTS || cfg.readers < 1 || cfg.readers > SHARED_MAX_READERS) {
+    fprintf(stderr, "slots must be 1..%d, readers 1..%d\n", SHARED_MAX_SLOTS, SHARED_MAX_READERS);
+    return 2;
+  }
+  Config one = cfg;
+  if (!size.empty() && !ParseSize(size, &one)) {
+    fprintf(stderr, "bad --size %s\n", size.c_str());
+    return 2;
+  }
+
+  printf("%-10s %2s %5s %7s %-5s %9s %9s %7s %8s %8s %8s %8s %6s\n",
+         "size", "ch", "slots", "readers", "wait", "pub/s", "read/s", "GB/s",
+         "p50 us", "p99 us", "p99.9 us", "dropped", "full");
+
+  for (uint32_t ch = 3; ch <= 4; ch++) {
+    if (cfg.channels && cfg.channels != ch) continue;
+    for (auto& s : SIZES) {
+      if (!size.empty() && (one.width != s.w || one.height != s.h)) continue;
+      Config run = cfg;
+      run.width = s.w;
+      run.height = s.h;
+      run.channels = ch;
+      if (!Run(run, s.name)) return 1;
+    }
+    bool named = std::any_of(std::begin(SIZES), std::end(SIZES),
+                             [&](decltype(SIZES[0]) s) { return one.width == s.w && one.height == s.h; });
+    if (!size.empty() && !named) {
+      Config run = one;
+      run.channels = ch;
+      if (!Run(run, size.c_str())) return 1;
+    }
+  }
+  return 0;
+}
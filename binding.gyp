@@ -1,8 +1,55 @@
 {
   "targets": [
+    {
+      "target_name": "shm_image",
+      "type": "static_library",
+      "sources": [ "src/shm_image.cc", "src/shm_image_c.cc" ],
+      "direct_dependent_settings": {
+        "include_dirs": [ "src" ]
+      },
+      "conditions": [
+        [ "OS=='win'", {
+          "sources": [ "src/platform_win.cc" ],
+          "link_settings": {
+            "libraries": [ "avrt.lib", "winmm.lib" ]
+          }
+        }, {
+          "sources": [ "src/platform_posix.cc" ],
+          "cflags": [ "-fPIC" ]
+        }],
+        [ "OS=='linux'", {
+          "link_settings": {
+            "libraries": [ "-lrt", "-pthread" ]
+          }
+        }]
+      ]
+    },
     {
       "target_name": "shared_memory",
-      "sources": [ "src/shared_memory_image.cc" ]
+      "dependencies": [ "shm_image" ],
+      "sources": [ "src/shared_memory_image.cc", "src/codec.cc", "src/convert.cc", "src/recording.cc", "src/worker_pool.cc" ],
+      "defines": [ "NAPI_VERSION=8" ]
+    },
+    {
+      "target_name": "shm_bench",
+      "type": "executable",
+      "win_delay_load_hook": "false",
+      "dependencies": [ "shm_image" ],
+      "sources": [ "bench/shm_bench.cc" ]
+    },
+    {
+      "target_name": "codec_test",
+      "type": "executable",
+      "win_delay_load_hook": "false",
+      "dependencies": [ "shm_image" ],
+      "sources": [ "test/codec_test.cc", "src/codec.cc" ]
+    },
+    {
+      "target_name": "ring_test",
+      "type": "executable",
+      "win_delay_load_hook": "false",
+      "dependencies": [ "shm_image" ],
+      "sources": [ "test/ring_test.cc" ]
     }
   ]
-}
\ No newline at end of file
+}
@@ -0,0 +1,332 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "codec.h"
+#include <cstring>
+#include <vector>
+
+namespace codec {
+
+uint64_t Bound(uint64_t frameBytes) {
+  // QOI: 5 bytes per 4-byte pixel, 4 per 3-byte one; LZ4 adds 1/255
+  return frameBytes + frameBytes / 3 + 64;
+}
+
+// helper: bytes per pixel of the formats QOI takes, 0 for the others
+static uint32_t QoiChannels(const FrameFormat& fmt) {
+  switch (fmt.pixel_format) {
+    case PIXEL_FORMAT_BGRA8: case PIXEL_FORMAT_RGBA8: return 4;
+    case PIXEL_FORMAT_BGR8: case PIXEL_FORMAT_RGB8: return 3;
+    case PIXEL_FORMAT_UNKNOWN: return fmt.channels == 3 || fmt.channels == 4 ? fmt.channels : 0;
+    default: return 0;
+  }
+}
+
+uint32_t Pick(const FrameFormat& fmt) {
+  return QoiChannels(fmt) ? CODEC_QOI : CODEC_LZ4;
+}
+
+const char* Name(uint32_t codec) {
+  switch (codec) {
+    case CODEC_QOI: return "qoi";
+    case CODEC_LZ4: return "lz4";
+    default: return "none";
+  }
+}
+
+// --- QOI (qoiformat.org) ---
+
+static const uint8_t QOI_OP_INDEX = 0x00, QOI_OP_DIFF = 0x40, QOI_OP_LUMA = 0x80, QOI_OP_RUN = 0xc0;
+static const uint8_t QOI_OP_RGB = 0xfe, QOI_OP_RGBA = 0xff;
+static const size_t QOI_HEADER = 14, QOI_END = 8;
+
+static inline uint32_t QoiHash(uint32_t px) {
+  return ((px & 0xff) * 3 + ((px >> 8) & 0xff) * 5 + ((px >> 16) & 0xff) * 7 + (px >> 24) * 11) & 63;
+}
+
+static inline void PutBE32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static inline uint32_t GetBE32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static size_t QoiEncode(const FrameFormat& fmt, const uint8_t* src, uint32_t frameBytes, uint8_t* dst, size_t capacity) {
+  uint32_t bpp = QoiChannels(fmt);
+  uint32_t w = fmt.width, h = fmt.height;
+  uint64_t rowBytes = (uint64_t)w * bpp;
+  uint64_t stride = fmt.plane_stride[0] ? fmt.plane_stride[0] : rowBytes;
+  uint64_t pixels = (uint64_t)w * h;
+  if (!bpp || !pixels || stride < rowBytes || stride * (h - 1) + rowBytes > frameBytes) return 0;
+  // worst case up front, so the loop needs no bounds checks
+  if (QOI_HEADER + QOI_END + pixels * (bpp + 1) > capacity) return 0;
+  bool swap = fmt.pixel_format == PIXEL_FORMAT_BGRA8 || fmt.pixel_format == PIXEL_FORMAT_BGR8;
+  uint32_t ri = swap ? 2 : 0, bi = swap ? 0 : 2;
+
+  uint8_t* o = dst;
+  memcpy(o, "qoif", 4);
+  PutBE32(o + 4, w);
+  PutBE32(o + 8, h);
+  o[12] = (uint8_t)bpp;
+  o[13] = 0; // sRGB with linear alpha
+  o += QOI_HEADER;
+
+  uint32_t index[64] = {};
+  uint32_t prev = 0xff000000u; // r, g, b, a from the low byte up
+  uint32_t run = 0;
+  for (uint32_t y = 0; y < h; y++) {
+    const uint8_t* row = src + y * stride;
+    for (uint32_t x = 0; x < w; x++) {
+      const uint8_t* s = row + (size_t)x * bpp;
+      uint32_t a = bpp == 4 ? s[3] : 255;
+      uint32_t px = (uint32_t)s[ri] | (uint32_t)s[1] << 8 | (uint32_t)s[bi] << 16 | a << 24;
+      if (px == prev) {
+        if (++run == 62) { *o++ = (uint8_t)(QOI_OP_RUN | (run - 1)); run = 0; }
+        continue;
+      }
+      if (run) { *o++ = (uint8_t)(QOI_OP_RUN | (run - 1)); run = 0; }
+
+      uint32_t hash = QoiHash(px);
+      if (index[hash] == px) {
+        *o++ = (uint8_t)(QOI_OP_INDEX | hash);
+      } else {
+        index[hash] = px;
+        if ((px >> 24) == (prev >> 24)) {
+          int8_t vr = (int8_t)((px & 0xff) - (prev & 0xff));
+          int8_t vg = (int8_t)(((px >> 8) & 0xff) - ((prev >> 8) & 0xff));
+          int8_t vb = (int8_t)(((px >> 16) & 0xff) - ((prev >> 16) & 0xff));
+          int vgr = vr - vg, vgb = vb - vg;
+          if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+            *o++ = (uint8_t)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+          } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+            *o++ = (uint8_t)(QOI_OP_LUMA | (vg + 32));
+            *o++ = (uint8_t)((vgr + 8) << 4 | (vgb + 8));
+          } else {
+            *o++ = QOI_OP_RGB;
+            *o++ = (uint8_t)px; *o++ = (uint8_t)(px >> 8); *o++ = (uint8_t)(px >> 16);
+          }
+        } else {
+          *o++ = QOI_OP_RGBA;
+          *o++ = (uint8_t)px; *o++ = (uint8_t)(px >> 8); *o++ = (uint8_t)(px >> 16); *o++ = (uint8_t)(px >> 24);
+        }
+      }
+      prev = px;
+    }
+  }
+  if (run) *o++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+  memset(o, 0, QOI_END - 1);
+  o[QOI_END - 1] = 1;
+  return (size_t)(o + QOI_END - dst);
+}
+
+static bool QoiHeader(const uint8_t* src, size_t size, uint32_t* w, uint32_t* h, uint32_t* channels) {
+  if (size < QOI_HEADER + QOI_END || memcmp(src, "qoif", 4) != 0) return false;
+  *w = GetBE32(src + 4);
+  *h = GetBE32(src + 8);
+  *channels = src[12];
+  return (*channels == 3 || *channels == 4) && (uint64_t)*w * *h <= (1ull << 32);
+}
+
+static bool QoiDecode(const uint8_t* src, size_t size, bool swapRB, uint8_t* dst, size_t capacity) {
+  uint32_t w, h, bpp;
+  if (!QoiHeader(src, size, &w, &h, &bpp)) return false;
+  uint64_t pixels = (uint64_t)w * h;
+  if (pixels * bpp > capacity) return false;
+  uint32_t ri = swapRB ? 2 : 0, bi = swapRB ? 0 : 2;
+
+  uint32_t index[64] = {};
+  uint32_t px = 0xff000000u;
+  const uint8_t* p = src + QOI_HEADER;
+  const uint8_t* end = src + size - QOI_END;
+  uint32_t run = 0;
+  uint8_t* o = dst;
+  for (uint64_t i = 0; i < pixels; i++) {
+    if (run) {
+      run--;
+    } else {
+      if (p >= end) return false;
+      uint8_t b = *p++;
+      if (b == QOI_OP_RGB) {
+        if (end - p < 3) return false;
+        px = (px & 0xff000000u) | (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+        p += 3;
+      } else if (b == QOI_OP_RGBA) {
+        if (end - p < 4) return false;
+        px = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        p += 4;
+      } else if ((b & 0xc0) == QOI_OP_INDEX) {
+        px = index[b];
+      } else if ((b & 0xc0) == QOI_OP_DIFF) {
+        uint32_t r = ((px & 0xff) + ((b >> 4) & 3) - 2) & 0xff;
+        uint32_t g = (((px >> 8) & 0xff) + ((b >> 2) & 3) - 2) & 0xff;
+        uint32_t bl = (((px >> 16) & 0xff) + (b & 3) - 2) & 0xff;
+        px = (px & 0xff000000u) | r | g << 8 | bl << 16;
+      } else if ((b & 0xc0) == QOI_OP_LUMA) {
+        if (p >= end) return false;
+        int vg = (b & 0x3f) - 32;
+        int vgr = (*p >> 4) - 8, vgb = (*p & 0x0f) - 8;
+        p++;
+        uint32_t r = ((px & 0xff) + vg + vgr) & 0xff;
+        uint32_t g = (((px >> 8) & 0xff) + vg) & 0xff;
+        uint32_t bl = (((px >> 16) & 0xff) + vg + vgb) & 0xff;
+        px = (px & 0xff000000u) | r | g << 8 | bl << 16;
+      } else {
+        run = b & 0x3f;
+      }
+      index[QoiHash(px)] = px;
+    }
+    o[ri] = (uint8_t)px;
+    o[1] = (uint8_t)(px >> 8);
+    o[bi] = (uint8_t)(px >> 16);
+    if (bpp == 4) o[3] = (uint8_t)(px >> 24);
+    o += bpp;
+  }
+  return true;
+}
+
+// --- LZ4 block format (github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md) ---
+
+static const size_t LZ4_MIN_MATCH = 4;
+static const size_t LZ4_LAST_LITERALS = 5; // a block ends with at least this many literals
+static const size_t LZ4_MF_LIMIT = 12;     // and its last match starts this far from the end
+static const uint32_t LZ4_HASH_LOG = 16;
+
+static inline uint32_t Read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+// helper: one sequence, `literals` bytes from `lit` followed by a match (or
+// none, for the last one). False when it would not fit.
+static bool Lz4Emit(uint8_t** o, const uint8_t* oend, const uint8_t* lit, size_t literals, size_t offset, size_t match) {
+  size_t need = 1 + literals + literals / 255 + 1 + (match ? 2 + match / 255 + 1 : 0);
+  if ((size_t)(oend - *o) < need) return false;
+  uint8_t* p = *o;
+  uint8_t* token = p++;
+  size_t ml = match ? match - LZ4_MIN_MATCH : 0;
+  *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4 | (ml >= 15 ? 15 : ml));
+  if (literals >= 15) {
+    size_t n = literals - 15;
+    for (; n >= 255; n -= 255) *p++ = 255;
+    *p++ = (uint8_t)n;
+  }
+  memcpy(p, lit, literals);
+  p += literals;
+  if (match) {
+    *p++ = (uint8_t)offset;
+    *p++ = (uint8_t)(offset >> 8);
+    if (ml >= 15) {
+      size_t n = ml - 15;
+      for (; n >= 255; n -= 255) *p++ = 255;
+      *p++ = (uint8_t)n;
+    }
+  }
+  *o = p;
+  return true;
+}
+
+static size_t Lz4Encode(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+  // positions + 1, 0 = empty; one table per compressing thread
+  thread_local std::vector<uint32_t> table;
+  table.assign((size_t)1 << LZ4_HASH_LOG, 0);
+  uint8_t* o = dst;
+  const uint8_t* oend = dst + capacity;
+  size_t anchor = 0;
+  if (size > LZ4_MF_LIMIT && size <= UINT32_MAX - 1) {
+    size_t limit = size - LZ4_MF_LIMIT, matchLimit = size - LZ4_LAST_LITERALS;
+    size_t ip = 0;
+    while (ip < limit) {
+      uint32_t seq = Read32(src + ip);
+      uint32_t hash = (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+      size_t ref = table[hash];
+      table[hash] = (uint32_t)(ip + 1);
+      if (!ref-- || ip - ref > 65535 || Read32(src + ref) != seq) {
+        ip += 1 + ((ip - anchor) >> 6); // skip faster through data that doesn't compress
+        continue;
+      }
+      while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) { ip--; ref--; }
+      size_t len = LZ4_MIN_MATCH;
+      while (ip + len < matchLimit && src[ip + len] == src[ref + len]) len++;
+      if (!Lz4Emit(&o, oend, src + anchor, ip - anchor, ip - ref, len)) return 0;
+      ip += len;
+      anchor = ip;
+    }
+  }
+  if (!Lz4Emit(&o, oend, src + anchor, size - anchor, 0, 0)) return 0;
+  return (size_t)(o - dst);
+}
+
+static bool Lz4Decode(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+  const uint8_t* p = src;
+  const uint8_t* end = src + size;
+  size_t o = 0;
+  while (p < end) {
+    uint8_t token = *p++;
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do {
+        if (p >= end) return false;
+        b = *p++;
+        literals += b;
+      } while (b == 255);
+    }
+    if ((size_t)(end - p) < literals || capacity - o < literals) return false;
+    memcpy(dst + o, p, literals);
+    p += literals;
+    o += literals;
+    if (p == end) break; // the last sequence has no match
+
+    if (end - p < 2) return false;
+    size_t offset = (size_t)p[0] | (size_t)p[1] << 8;
+    p += 2;
+    size_t match = (token & 15) + LZ4_MIN_MATCH;
+    if ((token & 15) == 15) {
+      uint8_t b;
+      do {
+        if (p >= end) return false;
+        b = *p++;
+        match += b;
+      } while (b == 255);
+    }
+    if (offset == 0 || offset > o || capacity - o < match) return false;
+    uint8_t* d = dst + o;
+    const uint8_t* s = d - offset;
+    if (offset >= match) memcpy(d, s, match);
+    else for (size_t i = 0; i < match; i++) d[i] = s[i]; // overlapping: repeats the pattern
+    o += match;
+  }
+  return o == capacity;
+}
+
+// --- Dispatch ---
+
+size_t Compress(uint32_t codec, const FrameFormat& fmt, const uint8_t* src, uint32_t frameBytes,
+                uint8_t* dst, size_t capacity) {
+  switch (codec) {
+    case CODEC_QOI: return QoiEncode(fmt, src, frameBytes, dst, capacity);
+    case CODEC_LZ4: return Lz4Encode(src, frameBytes, dst, capacity);
+    default: return 0;
+  }
+}
+
+size_t DecompressedSize(uint32_t codec, const uint8_t* src, size_t size, size_t rawBytes) {
+  uint32_t w, h, channels;
+  switch (codec) {
+    case CODEC_QOI: return QoiHeader(src, size, &w, &h, &channels) ? (size_t)w * h * channels : 0;
+    case CODEC_LZ4: return rawBytes;
+    default: return 0;
+  }
+}
+
+bool Decompress(uint32_t codec, const uint8_t* src, size_t size, bool swapRB, uint8_t* dst, size_t capacity) {
+  switch (codec) {
+    case CODEC_QOI: return QoiDecode(src, size, swapRB, dst, capacity);
+    case CODEC_LZ4: return Lz4Decode(src, size, dst, capacity);
+    default: return false;
+  }
+}
+
+}  // namespace codec
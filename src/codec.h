@@ -0,0 +1,44 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Fast lossless frame compression for consumers that forward frames over a
+// network: QOI for 8-bit RGB(A)/BGR(A) frames, the LZ4 block format for
+// everything else. Both are the standard formats, so the far end can decode
+// them with any QOI / LZ4 library. QOI streams are RGB(A) ordered and carry
+// packed rows; LZ4 ones are the frame bytes as stored, row padding included.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "shared_header.h"
+
+namespace codec {
+
+// Bytes a compressed frame of up to `frameBytes` bytes can take, any codec.
+uint64_t Bound(uint64_t frameBytes);
+
+// The codec (CODEC_*) frames of `fmt` are compressed with.
+uint32_t Pick(const FrameFormat& fmt);
+
+// Compresses the `frameBytes` bytes frame of `fmt` at `src` into dst.
+// Returns the compressed size, 0 when it did not fit `capacity`.
+size_t Compress(uint32_t codec, const FrameFormat& fmt, const uint8_t* src, uint32_t frameBytes,
+                uint8_t* dst, size_t capacity);
+
+// Size Decompress() produces (0 for a malformed stream). For LZ4 that is
+// `rawBytes`, the frame size stored next to the stream.
+size_t DecompressedSize(uint32_t codec, const uint8_t* src, size_t size, size_t rawBytes);
+
+// Decompresses into dst (DecompressedSize() bytes); swapRB turns QOI's RGB
+// order back into BGR. False for a malformed stream.
+bool Decompress(uint32_t codec, const uint8_t* src, size_t size, bool swapRB, uint8_t* dst, size_t capacity);
+
+// "qoi", "lz4" or "none"
+const char* Name(uint32_t codec);
+
+}  // namespace codec
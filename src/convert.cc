@@ -0,0 +1,684 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "convert.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CONVERT_AVX2_FN
+#else
+#define CONVERT_AVX2_FN __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace convert {
+
+enum Op { OP_COPY, OP_SWAP4, OP_SWAP3, OP_EXPAND, OP_PACK, OP_YUV };
+
+// BT.601 limited range, 8-bit fixed point
+static const int Y_R = 66, Y_G = 129, Y_B = 25;
+static const int U_R = -38, U_G = -74, U_B = 112;
+static const int V_R = 112, V_G = -94, V_B = -18;
+
+// --- scalar kernels, also the tails of the SIMD ones: pixels [i, w) ---
+
+static void Swap4Scalar(const uint8_t* s, uint8_t* d, uint32_t i, uint32_t w) {
+  for (; i < w; i++) {
+    uint8_t r = s[i * 4], b = s[i * 4 + 2];
+    d[i * 4] = b; d[i * 4 + 1] = s[i * 4 + 1]; d[i * 4 + 2] = r; d[i * 4 + 3] = s[i * 4 + 3];
+  }
+}
+
+static void Swap3Scalar(const uint8_t* s, uint8_t* d, uint32_t i, uint32_t w) {
+  for (; i < w; i++) {
+    uint8_t r = s[i * 3], b = s[i * 3 + 2];
+    d[i * 3] = b; d[i * 3 + 1] = s[i * 3 + 1]; d[i * 3 + 2] = r;
+  }
+}
+
+static void ExpandScalar(const uint8_t* s, uint8_t* d, uint32_t i, uint32_t w, bool swap) {
+  int r = swap ? 2 : 0, b = swap ? 0 : 2;
+  for (; i < w; i++) {
+    d[i * 4] = s[i * 3 + r]; d[i * 4 + 1] = s[i * 3 + 1]; d[i * 4 + 2] = s[i * 3 + b]; d[i * 4 + 3] = 255;
+  }
+}
+
+static void PackScalar(const uint8_t* s, uint8_t* d, uint32_t i, uint32_t w, bool swap) {
+  int r = swap ? 2 : 0, b = swap ? 0 : 2;
+  for (; i < w; i++) {
+    d[i * 3] = s[i * 4 + r]; d[i * 3 + 1] = s[i * 4 + 1]; d[i * 3 + 2] = s[i * 4 + b];
+  }
+}
+
+// c * a / 255, rounded
+static inline uint8_t MulDiv255(uint32_t c, uint32_t a) {
+  uint32_t t = c * a + 128;
+  return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void PremultiplyScalar(uint8_t* d, uint32_t i, uint32_t w) {
+  for (; i < w; i++) {
+    uint8_t a = d[i * 4 + 3];
+    d[i * 4] = MulDiv255(d[i * 4], a);
+    d[i * 4 + 1] = MulDiv255(d[i * 4 + 1], a);
+    d[i * 4 + 2] = MulDiv255(d[i * 4 + 2], a);
+  }
+}
+
+static void YScalar(const uint8_t* s, uint8_t* d, uint32_t i, uint32_t w, uint32_t bpp, bool bgr) {
+  int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+  for (; i < w; i++) {
+    const uint8_t* p = s + i * bpp;
+    d[i] = (uint8_t)(((Y_R * p[r] + Y_G * p[1] + Y_B * p[b] + 128) >> 8) + 16);
+  }
+}
+
+// chroma of rows s0/s1 from 2x2 averages; u/v advance by `step` per sample
+// (2 with u/v interleaved for NV12)
+static void UVScalar(const uint8_t* s0, const uint8_t* s1, uint8_t* u, uint8_t* v, uint32_t step,
+                     uint32_t w, uint32_t bpp, bool bgr) {
+  int ri = bgr ? 2 : 0, bi = bgr ? 0 : 2;
+  for (uint32_t x = 0; x < w; x += 2) {
+    uint32_t x1 = x + 1 < w ? x + 1 : x;
+    const uint8_t* p[4] = { s0 + x * bpp, s0 + x1 * bpp, s1 + x * bpp, s1 + x1 * bpp };
+    int r = (p[0][ri] + p[1][ri] + p[2][ri] + p[3][ri] + 2) >> 2;
+    int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+    int b = (p[0][bi] + p[1][bi] + p[2][bi] + p[3][bi] + 2) >> 2;
+    u[(x / 2) * step] = (uint8_t)(((U_R * r + U_G * g + U_B * b + 128) >> 8) + 128);
+    v[(x / 2) * step] = (uint8_t)(((V_R * r + V_G * g + V_B * b + 128) >> 8) + 128);
+  }
+}
+
+// 2x2 box average of 8-bit channels, dst pixels [i, w)
+static void HalfScalar(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t i, uint32_t w, uint32_t bpp) {
+  for (; i < w; i++) {
+    const uint8_t* a = s0 + (size_t)i * 2 * bpp;
+    const uint8_t* b = s1 + (size_t)i * 2 * bpp;
+    for (uint32_t c = 0; c < bpp; c++) d[i * bpp + c] = (uint8_t)((a[c] + a[c + bpp] + b[c] + b[c + bpp] + 2) >> 2);
+  }
+}
+
+// --- x86: SSE2 baseline, AVX2 where pshufb pays off ---
+
+#if defined(CONVERT_X86)
+
+static bool DetectAvx2() {
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 1);
+  bool osAvx = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+  if (!osAvx) return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const bool kAvx2 = DetectAvx2();
+
+static uint32_t Swap4Sse2(const uint8_t* s, uint8_t* d, uint32_t w) {
+  const __m128i ag = _mm_set1_epi32((int)0xFF00FF00), rb = _mm_set1_epi32(0x00FF00FF);
+  uint32_t i = 0;
+  for (; i + 4 <= w; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 4));
+    __m128i c = _mm_and_si128(x, rb);
+    c = _mm_or_si128(_mm_slli_epi32(c, 16), _mm_srli_epi32(c, 16));
+    _mm_storeu_si128((__m128i*)(d + i * 4), _mm_or_si128(_mm_and_si128(x, ag), c));
+  }
+  return i;
+}
+
+// 8 pixels of 16-bit lanes times alpha, alpha lanes times 255
+static inline __m128i PremultiplySse2(__m128i x16, __m128i keepAlpha, __m128i alpha255) {
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x16, 0xFF), 0xFF);
+  a = _mm_or_si128(_mm_and_si128(a, keepAlpha), alpha255);
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(x16, a), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static uint32_t PremultiplyRowSse2(uint8_t* d, uint32_t w) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i keep = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+  const __m128i a255 = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+  uint32_t i = 0;
+  for (; i + 4 <= w; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(d + i * 4));
+    __m128i lo = PremultiplySse2(_mm_unpacklo_epi8(x, zero), keep, a255);
+    __m128i hi = PremultiplySse2(_mm_unpackhi_epi8(x, zero), keep, a255);
+    _mm_storeu_si128((__m128i*)(d + i * 4), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+// luma of 4 four-byte pixels as 32-bit lanes
+static inline __m128i Luma4Sse2(__m128i x, __m128i k) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), k); // r*cr+g*cg, b*cb per pixel
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), k);
+  __m128i even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i y = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(128)), 8);
+  return _mm_add_epi32(y, _mm_set1_epi32(16));
+}
+
+static uint32_t Y4Sse2(const uint8_t* s, uint8_t* d, uint32_t w, bool bgr) {
+  const __m128i k = bgr ? _mm_setr_epi16(Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0)
+                        : _mm_setr_epi16(Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0);
+  uint32_t i = 0;
+  for (; i + 8 <= w; i += 8) {
+    __m128i a = Luma4Sse2(_mm_loadu_si128((const __m128i*)(s + i * 4)), k);
+    __m128i b = Luma4Sse2(_mm_loadu_si128((const __m128i*)(s + i * 4 + 16)), k);
+    __m128i y = _mm_packs_epi32(a, b);
+    _mm_storel_epi64((__m128i*)(d + i), _mm_packus_epi16(y, y));
+  }
+  return i;
+}
+
+// 2 dst pixels of four bytes from 4 source pixels of each row, 16-bit sums
+static inline __m128i Half4Sse2(__m128i a, __m128i b) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // pixels 0, 1
+  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // pixels 2, 3
+  lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+  hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+  return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+static uint32_t Half4RowSse2(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 4 <= w; i += 4) {
+    __m128i p = Half4Sse2(_mm_loadu_si128((const __m128i*)(s0 + i * 8)), _mm_loadu_si128((const __m128i*)(s1 + i * 8)));
+    __m128i q = Half4Sse2(_mm_loadu_si128((const __m128i*)(s0 + i * 8 + 16)),
+                          _mm_loadu_si128((const __m128i*)(s1 + i * 8 + 16)));
+    _mm_storeu_si128((__m128i*)(d + i * 4), _mm_packus_epi16(p, q));
+  }
+  return i;
+}
+
+// 8 dst bytes from 16 source bytes of each row, 16-bit sums
+static inline __m128i Half1Sse2(__m128i a, __m128i b) {
+  const __m128i even = _mm_set1_epi16(0x00FF);
+  __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, even), _mm_srli_epi16(a, 8)),
+                              _mm_add_epi16(_mm_and_si128(b, even), _mm_srli_epi16(b, 8)));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+static uint32_t Half1RowSse2(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    __m128i p = Half1Sse2(_mm_loadu_si128((const __m128i*)(s0 + i * 2)), _mm_loadu_si128((const __m128i*)(s1 + i * 2)));
+    __m128i q = Half1Sse2(_mm_loadu_si128((const __m128i*)(s0 + i * 2 + 16)),
+                          _mm_loadu_si128((const __m128i*)(s1 + i * 2 + 16)));
+    _mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(p, q));
+  }
+  return i;
+}
+
+CONVERT_AVX2_FN static uint32_t Swap4Avx2(const uint8_t* s, uint8_t* d, uint32_t w) {
+  const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  uint32_t i = 0;
+  for (; i + 8 <= w; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(s + i * 4));
+    _mm256_storeu_si256((__m256i*)(d + i * 4), _mm256_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+
+// 3-byte pixels: 16-byte loads/stores stepping 12 bytes, the 4 extra bytes
+// get rewritten by the next step (or the scalar tail)
+CONVERT_AVX2_FN static uint32_t Swap3Avx2(const uint8_t* s, uint8_t* d, uint32_t w) {
+  const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+  uint32_t i = 0;
+  for (; (i + 4) * 3 + 4 <= w * 3; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 3));
+    _mm_storeu_si128((__m128i*)(d + i * 3), _mm_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+
+CONVERT_AVX2_FN static uint32_t ExpandAvx2(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  const __m256i mask = swap
+      ? _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+      : _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+  uint32_t i = 0;
+  for (; i * 3 + 28 <= w * 3; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(s + i * 3));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(s + i * 3 + 12));
+    __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256((__m256i*)(d + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(x, mask), alpha));
+  }
+  return i;
+}
+
+CONVERT_AVX2_FN static uint32_t PackAvx2(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  const __m256i mask = swap
+      ? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+      : _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  uint32_t i = 0;
+  for (; i * 3 + 28 <= w * 3; i += 8) {
+    __m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(s + i * 4)), mask);
+    _mm_storeu_si128((__m128i*)(d + i * 3), _mm256_castsi256_si128(x));
+    _mm_storeu_si128((__m128i*)(d + i * 3 + 12), _mm256_extracti128_si256(x, 1));
+  }
+  return i;
+}
+
+CONVERT_AVX2_FN static inline __m256i PremultiplyAvx2(__m256i x16, __m256i keepAlpha, __m256i alpha255) {
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x16, 0xFF), 0xFF);
+  a = _mm256_or_si256(_mm256_and_si256(a, keepAlpha), alpha255);
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x16, a), _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+CONVERT_AVX2_FN static uint32_t PremultiplyRowAvx2(uint8_t* d, uint32_t w) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i keep = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0);
+  const __m256i a255 = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+  uint32_t i = 0;
+  for (; i + 8 <= w; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(d + i * 4));
+    // unpack/pack both work per 128-bit lane, so they undo each other
+    __m256i lo = PremultiplyAvx2(_mm256_unpacklo_epi8(x, zero), keep, a255);
+    __m256i hi = PremultiplyAvx2(_mm256_unpackhi_epi8(x, zero), keep, a255);
+    _mm256_storeu_si256((__m256i*)(d + i * 4), _mm256_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+// non-temporal stores from a 32-byte aligned d + i on, a cache line per
+// step; where it stopped
+CONVERT_AVX2_FN static size_t StreamAvx2(const uint8_t* s, uint8_t* d, size_t i, size_t n) {
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+    _mm256_stream_si256((__m256i*)(d + i), a);
+    _mm256_stream_si256((__m256i*)(d + i + 32), b);
+  }
+  return i;
+}
+
+#endif  // CONVERT_X86
+
+// --- ARM64: NEON structure loads do the (de)interleaving ---
+
+#if defined(CONVERT_NEON)
+
+static uint32_t Swap4Neon(const uint8_t* s, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16x4_t p = vld4q_u8(s + i * 4);
+    uint8x16_t t = p.val[0]; p.val[0] = p.val[2]; p.val[2] = t;
+    vst4q_u8(d + i * 4, p);
+  }
+  return i;
+}
+
+static uint32_t Swap3Neon(const uint8_t* s, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16x3_t p = vld3q_u8(s + i * 3);
+    uint8x16_t t = p.val[0]; p.val[0] = p.val[2]; p.val[2] = t;
+    vst3q_u8(d + i * 3, p);
+  }
+  return i;
+}
+
+static uint32_t ExpandNeon(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16x3_t p = vld3q_u8(s + i * 3);
+    uint8x16x4_t q;
+    q.val[0] = swap ? p.val[2] : p.val[0];
+    q.val[1] = p.val[1];
+    q.val[2] = swap ? p.val[0] : p.val[2];
+    q.val[3] = vdupq_n_u8(255);
+    vst4q_u8(d + i * 4, q);
+  }
+  return i;
+}
+
+static uint32_t PackNeon(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16x4_t p = vld4q_u8(s + i * 4);
+    uint8x16x3_t q;
+    q.val[0] = swap ? p.val[2] : p.val[0];
+    q.val[1] = p.val[1];
+    q.val[2] = swap ? p.val[0] : p.val[2];
+    vst3q_u8(d + i * 3, q);
+  }
+  return i;
+}
+
+static inline uint8x8_t MulDiv255Neon(uint8x8_t c, uint8x8_t a) {
+  uint16x8_t t = vaddq_u16(vmull_u8(c, a), vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+
+static uint32_t PremultiplyRowNeon(uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16x4_t p = vld4q_u8(d + i * 4);
+    for (int c = 0; c < 3; c++) {
+      p.val[c] = vcombine_u8(MulDiv255Neon(vget_low_u8(p.val[c]), vget_low_u8(p.val[3])),
+                             MulDiv255Neon(vget_high_u8(p.val[c]), vget_high_u8(p.val[3])));
+    }
+    vst4q_u8(d + i * 4, p);
+  }
+  return i;
+}
+
+static inline uint8x8_t LumaNeon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+  uint16x8_t y = vmull_u8(r, vdup_n_u8(Y_R));
+  y = vmlal_u8(y, g, vdup_n_u8(Y_G));
+  y = vmlal_u8(y, b, vdup_n_u8(Y_B));
+  return vadd_u8(vshrn_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+}
+
+static uint32_t YNeon(const uint8_t* s, uint8_t* d, uint32_t w, uint32_t bpp, bool bgr) {
+  uint32_t i = 0;
+  int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+  for (; i + 16 <= w; i += 16) {
+    uint8x16_t c[3];
+    if (bpp == 4) {
+      uint8x16x4_t p = vld4q_u8(s + i * 4);
+      c[0] = p.val[r]; c[1] = p.val[1]; c[2] = p.val[b];
+    } else {
+      uint8x16x3_t p = vld3q_u8(s + i * 3);
+      c[0] = p.val[r]; c[1] = p.val[1]; c[2] = p.val[b];
+    }
+    vst1q_u8(d + i, vcombine_u8(LumaNeon(vget_low_u8(c[0]), vget_low_u8(c[1]), vget_low_u8(c[2])),
+                                LumaNeon(vget_high_u8(c[0]), vget_high_u8(c[1]), vget_high_u8(c[2]))));
+  }
+  return i;
+}
+
+// pairwise sums down both rows, rounded: 4 dst pixels (16 bytes) at a time
+static uint32_t Half4RowNeon(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 4 <= w; i += 4) {
+    uint32x4x2_t a = vld2q_u32((const uint32_t*)(s0 + i * 8)); // even, odd pixels
+    uint32x4x2_t b = vld2q_u32((const uint32_t*)(s1 + i * 8));
+    uint8x16_t a0 = vreinterpretq_u8_u32(a.val[0]), a1 = vreinterpretq_u8_u32(a.val[1]);
+    uint8x16_t b0 = vreinterpretq_u8_u32(b.val[0]), b1 = vreinterpretq_u8_u32(b.val[1]);
+    uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a0), vget_low_u8(a1)), vaddl_u8(vget_low_u8(b0), vget_low_u8(b1)));
+    uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(a0), vget_high_u8(a1)), vaddl_u8(vget_high_u8(b0), vget_high_u8(b1)));
+    vst1q_u8(d + i * 4, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+  }
+  return i;
+}
+
+static uint32_t Half1RowNeon(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+  for (; i + 8 <= w; i += 8) {
+    uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(s0 + i * 2)), vpaddlq_u8(vld1q_u8(s1 + i * 2)));
+    vst1_u8(d + i, vrshrn_n_u16(sum, 2));
+  }
+  return i;
+}
+
+#endif  // CONVERT_NEON
+
+// --- row dispatch ---
+
+static void Swap4Row(const uint8_t* s, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  i = kAvx2 ? Swap4Avx2(s, d, w) : Swap4Sse2(s, d, w);
+#elif defined(CONVERT_NEON)
+  i = Swap4Neon(s, d, w);
+#endif
+  Swap4Scalar(s, d, i, w);
+}
+
+static void Swap3Row(const uint8_t* s, uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  if (kAvx2) i = Swap3Avx2(s, d, w);
+#elif defined(CONVERT_NEON)
+  i = Swap3Neon(s, d, w);
+#endif
+  Swap3Scalar(s, d, i, w);
+}
+
+static void ExpandRow(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  if (kAvx2) i = ExpandAvx2(s, d, w, swap);
+#elif defined(CONVERT_NEON)
+  i = ExpandNeon(s, d, w, swap);
+#endif
+  ExpandScalar(s, d, i, w, swap);
+}
+
+static void PackRow(const uint8_t* s, uint8_t* d, uint32_t w, bool swap) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  if (kAvx2) i = PackAvx2(s, d, w, swap);
+#elif defined(CONVERT_NEON)
+  i = PackNeon(s, d, w, swap);
+#endif
+  PackScalar(s, d, i, w, swap);
+}
+
+static void PremultiplyRow(uint8_t* d, uint32_t w) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  i = kAvx2 ? PremultiplyRowAvx2(d, w) : PremultiplyRowSse2(d, w);
+#elif defined(CONVERT_NEON)
+  i = PremultiplyRowNeon(d, w);
+#endif
+  PremultiplyScalar(d, i, w);
+}
+
+static void YRow(const uint8_t* s, uint8_t* d, uint32_t w, uint32_t bpp, bool bgr) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  if (bpp == 4) i = Y4Sse2(s, d, w, bgr);
+#elif defined(CONVERT_NEON)
+  i = YNeon(s, d, w, bpp, bgr);
+#endif
+  YScalar(s, d, i, w, bpp, bgr);
+}
+
+static void HalfRow(const uint8_t* s0, const uint8_t* s1, uint8_t* d, uint32_t w, uint32_t bpp) {
+  uint32_t i = 0;
+#if defined(CONVERT_X86)
+  if (bpp == 4) i = Half4RowSse2(s0, s1, d, w);
+  else if (bpp == 1) i = Half1RowSse2(s0, s1, d, w);
+#elif defined(CONVERT_NEON)
+  if (bpp == 4) i = Half4RowNeon(s0, s1, d, w);
+  else if (bpp == 1) i = Half1RowNeon(s0, s1, d, w);
+#endif
+  HalfScalar(s0, s1, d, i, w, bpp);
+}
+
+// helper: memcpy with non-temporal stores; callers end with StreamFence()
+static void StreamRow(const uint8_t* s, uint8_t* d, size_t n) {
+#if defined(CONVERT_X86)
+  size_t align = kAvx2 ? 32 : 16;
+  size_t head = (align - ((uintptr_t)d & (align - 1))) & (align - 1);
+  if (head > n) head = n;
+  memcpy(d, s, head);
+  size_t i = kAvx2 ? StreamAvx2(s, d, head, n) : head;
+  for (; i + 64 <= n; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(s + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(s + i + 32));
+    __m128i e = _mm_loadu_si128((const __m128i*)(s + i + 48));
+    _mm_stream_si128((__m128i*)(d + i), a);
+    _mm_stream_si128((__m128i*)(d + i + 16), b);
+    _mm_stream_si128((__m128i*)(d + i + 32), c);
+    _mm_stream_si128((__m128i*)(d + i + 48), e);
+  }
+  memcpy(d + i, s + i, n - i);
+#else
+  // no portable streaming store here; the plain copy has to do
+  memcpy(d, s, n);
+#endif
+}
+
+// helper: orders the streaming stores before whatever hands the buffer on
+static void StreamFence() {
+#if defined(CONVERT_X86)
+  _mm_sfence();
+#endif
+}
+
+const char* Isa() {
+#if defined(CONVERT_X86)
+  return kAvx2 ? "avx2" : "sse2";
+#elif defined(CONVERT_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+// helper: bytes per pixel and R/B order of the packed 8-bit formats
+static bool PackedFormat(uint32_t format, uint32_t* bpp, bool* bgr) {
+  switch (format) {
+  case PIXEL_FORMAT_RGBA8: *bpp = 4; *bgr = false; return true;
+  case PIXEL_FORMAT_BGRA8: *bpp = 4; *bgr = true; return true;
+  case PIXEL_FORMAT_RGB8: *bpp = 3; *bgr = false; return true;
+  case PIXEL_FORMAT_BGR8: *bpp = 3; *bgr = true; return true;
+  default: return false;
+  }
+}
+
+bool MakePlan(uint32_t srcFormat, uint32_t srcChannels, uint32_t dstFormat, uint32_t w, uint32_t h,
+              uint32_t srcStride, bool premultiply, Plan* out) {
+  if (srcFormat == PIXEL_FORMAT_UNKNOWN) {
+    if (srcChannels == 4) srcFormat = PIXEL_FORMAT_RGBA8;
+    else if (srcChannels == 3) srcFormat = PIXEL_FORMAT_RGB8;
+  }
+  if (dstFormat == PIXEL_FORMAT_UNKNOWN) dstFormat = srcFormat;
+  Plan p;
+  bool srcBgr = false;
+  if (!PackedFormat(srcFormat, &p.srcBpp, &srcBgr)) return false;
+  if (srcStride < (uint64_t)w * p.srcBpp) return false;
+  p.width = w;
+  p.height = h;
+  p.srcStride = srcStride;
+  p.dstFormat = dstFormat;
+
+  bool dstBgr = false;
+  if (PackedFormat(dstFormat, &p.dstBpp, &dstBgr)) {
+    p.swap = srcBgr != dstBgr;
+    if (p.srcBpp == p.dstBpp) p.op = !p.swap ? OP_COPY : p.srcBpp == 4 ? OP_SWAP4 : OP_SWAP3;
+    else p.op = p.srcBpp == 3 ? OP_EXPAND : OP_PACK;
+    p.premultiply = premultiply && p.srcBpp == 4 && p.dstBpp == 4;
+    p.dstStride[0] = w * p.dstBpp;
+    p.dstBytes = (uint64_t)p.dstStride[0] * h;
+  } else if (dstFormat == PIXEL_FORMAT_NV12 || dstFormat == FORMAT_I420) {
+    uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    p.op = OP_YUV;
+    p.swap = srcBgr;
+    p.dstStride[0] = w;
+    p.dstOffset[1] = (uint64_t)w * h;
+    if (dstFormat == PIXEL_FORMAT_NV12) {
+      p.planes = 2;
+      p.dstStride[1] = cw * 2;
+      p.dstBytes = p.dstOffset[1] + (uint64_t)p.dstStride[1] * ch;
+    } else {
+      p.planes = 3;
+      p.dstStride[1] = p.dstStride[2] = cw;
+      p.dstOffset[2] = p.dstOffset[1] + (uint64_t)cw * ch;
+      p.dstBytes = p.dstOffset[2] + (uint64_t)cw * ch;
+    }
+  } else {
+    return false;
+  }
+  *out = p;
+  return true;
+}
+
+uint64_t SourceBytes(const Plan& plan) {
+  if (!plan.height) return 0;
+  return (uint64_t)plan.srcStride * (plan.height - 1) + (uint64_t)plan.width * plan.srcBpp;
+}
+
+// helper: converts w pixels of a row of a packed plan
+static void ConvertRow(const Plan& plan, const uint8_t* s, uint8_t* d, uint32_t w) {
+  switch (plan.op) {
+  case OP_COPY: memcpy(d, s, (size_t)w * plan.dstBpp); break;
+  case OP_SWAP4: Swap4Row(s, d, w); break;
+  case OP_SWAP3: Swap3Row(s, d, w); break;
+  case OP_EXPAND: ExpandRow(s, d, w, plan.swap); break;
+  case OP_PACK: PackRow(s, d, w, plan.swap); break;
+  }
+  if (plan.premultiply) PremultiplyRow(d, w);
+}
+
+void Run(const Plan& plan, const uint8_t* src, uint8_t* dst, uint32_t rowBegin, uint32_t rowEnd) {
+  if (rowEnd > plan.height) rowEnd = plan.height;
+  uint32_t w = plan.width;
+
+  if (plan.op == OP_YUV) {
+    bool nv12 = plan.dstFormat == PIXEL_FORMAT_NV12;
+    for (uint32_t y = rowBegin; y < rowEnd; y++) {
+      const uint8_t* s = src + (uint64_t)y * plan.srcStride;
+      YRow(s, dst + (uint64_t)y * plan.dstStride[0], w, plan.srcBpp, plan.swap);
+      if (y & 1) continue;
+      // chroma from this row and the next (itself on an odd last row)
+      const uint8_t* s1 = y + 1 < plan.height ? s + plan.srcStride : s;
+      uint8_t* u = dst + plan.dstOffset[1] + (uint64_t)(y / 2) * plan.dstStride[1];
+      uint8_t* v = nv12 ? u + 1 : dst + plan.dstOffset[2] + (uint64_t)(y / 2) * plan.dstStride[2];
+      UVScalar(s, s1, u, v, nv12 ? 2 : 1, w, plan.srcBpp, plan.swap);
+    }
+    return;
+  }
+
+  for (uint32_t y = rowBegin; y < rowEnd; y++) {
+    const uint8_t* s = src + (uint64_t)y * plan.srcStride;
+    uint8_t* d = dst + (uint64_t)y * plan.dstStride[0];
+    if (plan.op == OP_COPY && !plan.premultiply) {
+      if (plan.streaming) StreamRow(s, d, (size_t)w * plan.dstBpp);
+      else memcpy(d, s, (size_t)w * plan.dstBpp);
+      continue;
+    }
+    if (!plan.streaming) {
+      ConvertRow(plan, s, d, w);
+      continue;
+    }
+    // streaming: a chunk at a time converted in L1, then streamed out
+    alignas(64) uint8_t chunk[4096];
+    uint32_t step = (uint32_t)sizeof(chunk) / plan.dstBpp;
+    for (uint32_t x = 0; x < w; x += step) {
+      uint32_t n = w - x < step ? w - x : step;
+      ConvertRow(plan, s + (size_t)x * plan.srcBpp, chunk, n);
+      StreamRow(chunk, d + (size_t)x * plan.dstBpp, (size_t)n * plan.dstBpp);
+    }
+  }
+  if (plan.streaming) StreamFence();
+}
+
+void StreamCopy(void* dst, const void* src, size_t n) {
+  StreamRow((const uint8_t*)src, (uint8_t*)dst, n);
+  StreamFence();
+}
+
+void Downscale2x(const uint8_t* src, uint32_t srcStride, uint8_t* dst, uint32_t dstStride, uint32_t dstW,
+                 uint32_t bpp, uint32_t rowBegin, uint32_t rowEnd) {
+  for (uint32_t y = rowBegin; y < rowEnd; y++) {
+    const uint8_t* s0 = src + (uint64_t)y * 2 * srcStride;
+    HalfRow(s0, s0 + srcStride, dst + (uint64_t)y * dstStride, dstW, bpp);
+  }
+}
+
+}  // namespace convert
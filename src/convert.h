@@ -0,0 +1,71 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Pixel format conversion: RGB <-> BGR swizzles, 24 <-> 32-bit expand/pack,
+// alpha premultiplication, RGB(A) -> NV12/I420 and 2x box downscaling.
+// Kernels are SSE2 with AVX2 picked at run time on x86, NEON on ARM64,
+// scalar elsewhere. They work row by row straight from the source, so a
+// conversion runs fused with the copy out of the mapping and a frame can be
+// split into row ranges.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "shared_header.h"
+
+namespace convert {
+
+// targets beyond the header's PIXEL_FORMAT_* (conversion output only)
+static const uint32_t FORMAT_I420 = PIXEL_FORMAT_COUNT; // Y, then U and V at half resolution
+static const uint32_t FORMAT_COUNT = PIXEL_FORMAT_COUNT + 1;
+
+struct Plan {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t srcStride = 0;
+  uint32_t srcBpp = 0;
+  uint32_t dstFormat = 0;
+  uint32_t dstBpp = 0;        // packed targets
+  uint32_t planes = 1;
+  uint32_t dstStride[3] = {};
+  uint64_t dstOffset[3] = {};
+  uint64_t dstBytes = 0;      // packed output, no row padding
+  int op = 0;
+  bool swap = false;          // source R/B order differs from the target's
+  bool premultiply = false;
+  bool streaming = false;     // packed stores bypass the caches (set by the caller)
+};
+
+// Plans converting a w x h frame of `srcFormat` (PIXEL_FORMAT_UNKNOWN with 3
+// or 4 channels counts as RGB8/RGBA8), rows `srcStride` bytes apart, to
+// `dstFormat` (PIXEL_FORMAT_UNKNOWN: the source format, e.g. to only
+// premultiply). False when the pair is not supported.
+bool MakePlan(uint32_t srcFormat, uint32_t srcChannels, uint32_t dstFormat, uint32_t w, uint32_t h,
+              uint32_t srcStride, bool premultiply, Plan* out);
+
+// Source bytes the plan reads.
+uint64_t SourceBytes(const Plan& plan);
+
+// Converts source rows [rowBegin, rowEnd) into their place in `dst`. YUV
+// targets need an even rowBegin (chroma comes from row pairs).
+void Run(const Plan& plan, const uint8_t* src, uint8_t* dst, uint32_t rowBegin, uint32_t rowEnd);
+
+// Box-filters 8-bit pixels of `bpp` bytes to half size: dst row y (dstW
+// pixels, each the rounded average of a 2x2 block) from source rows 2y and
+// 2y + 1, for dst rows [rowBegin, rowEnd). Mip levels build one from another.
+void Downscale2x(const uint8_t* src, uint32_t srcStride, uint8_t* dst, uint32_t dstStride, uint32_t dstW,
+                 uint32_t bpp, uint32_t rowBegin, uint32_t rowEnd);
+
+// memcpy with non-temporal stores (plain memcpy off x86), for copies much
+// larger than the caches whose destination is not read back right away.
+void StreamCopy(void* dst, const void* src, size_t n);
+
+// "avx2", "sse2", "neon" or "scalar": the kernels in use
+const char* Isa();
+
+}  // namespace convert
@@ -0,0 +1,211 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Platform layer: named shared mappings, cross-process auto-reset events,
+// scheduling and clocks, and the file I/O recordings use. platform_win.cc
+// backs it with Win32, platform_posix.cc with shm_open/mmap and futex
+// (Linux) / __ulock (macOS). The SharedHeader wire layout is identical on
+// every backend.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#if defined(_MSC_VER) && defined(_M_ARM64)
+#include <intrin.h> // __yield()
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h> // _mm_pause()
+#endif
+
+namespace platform {
+
+static const uint32_t kInfinite = 0xFFFFFFFF;
+
+// Shared state is plain std::atomic placed in the mapping, which needs the
+// lock-free (address-free) specializations.
+static_assert(std::atomic<int32_t>::is_always_lock_free, "32-bit atomics must be lock-free");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64-bit atomics must be lock-free");
+static_assert(sizeof(std::atomic<uint64_t>) == 8, "std::atomic must not change the layout");
+
+// --- Scheduling and time ---
+
+// spin-wait hint
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+  __yield();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+void YieldThread();            // Sleep(0) / sched_yield()
+void SleepMs(uint32_t ms);
+uint64_t MonotonicNs();        // same clock in every process on the machine
+uint32_t CurrentProcessId();
+// What tells a process apart beyond its pid, recorded next to it in the
+// header: on Linux the inode of its pid namespace and its start time (clock
+// ticks since boot), so pid reuse and processes in other pid namespaces
+// sharing /dev/shm (--ipc=host) aren't mistaken for the owner. Zero where
+// there is none (Windows, macOS).
+struct ProcessToken {
+  uint64_t ns = 0;
+  uint64_t start = 0;
+};
+ProcessToken CurrentProcessToken();
+// False only when process `pid` (`token`, when known) is certainly gone. A
+// process in another pid namespace counts as alive: its entries are never
+// taken over, even after it died.
+bool ProcessAlive(uint32_t pid, const ProcessToken& token);
+size_t SmallPageSize();
+
+// What a thread that waits for frames asks of the scheduler
+// (SetThreadLatency()). realtime: registered with MMCSS under `task` ("Pro
+// Audio", "Capture", ...) on Windows, SCHED_FIFO at `priority` on Linux
+// (needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance), the user-interactive
+// QoS class on macOS. cores: the cores it may run on, bit i = core i, 0 = any.
+// timerResolution: the 1 ms system timer (timeBeginPeriod) while set, Windows
+// only; the other timers are fine-grained already.
+struct ThreadLatency {
+  bool realtime = false;
+  std::string task = "Pro Audio";
+  int priority = 10;
+  uint64_t cores = 0;
+  bool timerResolution = false;
+};
+// What SetThreadLatency() changed on its thread.
+struct ThreadLatencyState {
+  intptr_t mmcss = 0;    // AvSetMmThreadCharacteristics() handle
+  bool realtime = false;
+  bool pinned = false;
+  bool timer = false;
+  // what the thread had before, for ResetThreadLatency() to put back
+  int policy = 0;              // scheduling policy (the QoS class on macOS)
+  int priority = 0;            // its priority (the relative priority on macOS)
+  uint64_t affinity[16] = {};  // cpu mask, room for CPU_SETSIZE (1024) cores
+};
+// Gives the calling thread `latency`, dropping what `state` says it had
+// before. False with *error naming what the OS refused; the rest still holds.
+bool SetThreadLatency(const ThreadLatency& latency, ThreadLatencyState* state, std::string* error);
+// Back to what the thread had before, on the thread SetThreadLatency() ran on.
+void ResetThreadLatency(ThreadLatencyState* state);
+
+// helper: takes the page faults of [base, base + size) now; writing is only
+// safe while nobody else uses the memory (a fresh mapping is all zeroes)
+static inline void TouchPages(void* base, size_t size, size_t pageSize, bool write) {
+  volatile uint8_t* p = static_cast<volatile uint8_t*>(base);
+  for (size_t off = 0; off < size; off += pageSize) {
+    if (write) p[off] = 0;
+    else (void)p[off];
+  }
+}
+
+// --- Shared mappings ---
+
+struct MappingOptions {
+  bool largePages = false; // SEC_LARGE_PAGES / hugetlbfs, THP hint as a fallback
+  bool prefault = false;   // fault the whole view in now and try to lock it
+  bool openOnly = false;   // fail instead of creating a missing mapping
+  // SEC_RESERVE: only address space up front, pages committed through
+  // CommitRange(); `commitBytes` from the start are committed at open.
+  // POSIX shm pages are allocated on first touch anyway, so it's a no-op there.
+  bool reserve = false;
+  uint64_t commitBytes = 0;
+};
+
+struct Mapping {
+  void* base = nullptr;
+  size_t size = 0;         // bytes actually mapped
+  intptr_t handle = 0;     // HANDLE of the section / shm file descriptor
+  std::string name;        // backend object name
+  bool counted = false;    // POSIX: we hold a use of the name (the last user removes it)
+  bool largePages = false; // the view is backed by large pages
+  size_t pageSize = 0;     // page size backing the view
+  bool prefaulted = false; // every page was faulted in at open
+  bool locked = false;     // and is locked in RAM
+  bool reserved = false;   // pages past the committed ones need CommitRange()
+};
+
+// Opens the mapping `name`, or creates it with `size` bytes when it does not
+// exist yet (*created says which). Large pages are only a request: without
+// the privilege, reserved huge pages or OS support the mapping silently uses
+// normal pages, `out` says what was obtained. On failure *error names the
+// failed call.
+bool OpenOrCreateMapping(const std::string& name, uint64_t size, const MappingOptions& options,
+                         Mapping* out, bool* created, std::string* error);
+// A mapping lives as long as somebody has it open, whoever created it: a
+// Windows section goes with its last handle, on POSIX every open holds a
+// shared flock on the object and the close that finds no other holder
+// unlinks the name (the kernel drops the locks of crashed processes too).
+void CloseMapping(Mapping* mapping);
+// Commits [offset, offset + size) of a reserved mapping (true for any other).
+bool CommitRange(Mapping* mapping, uint64_t offset, uint64_t size);
+
+// --- Events ---
+
+// Auto-reset event shared between processes: a named kernel event on Windows,
+// a futex-style word inside the mapping (`word`) elsewhere.
+struct Event;
+
+enum class WaitStatus { kSignaled, kWoken, kTimedOut };
+
+// Opens the shared event `name`; `create` creates it when missing.
+Event* OpenSharedEvent(const std::string& name, std::atomic<int32_t>* word, bool create);
+// Process-local event used to interrupt a WaitEvent() on `forwardTo`
+// (backends that can only wait on one object also signal that one).
+Event* CreateLocalEvent(Event* forwardTo);
+void SignalEvent(Event* ev);
+void ClearEvent(Event* ev);
+// Waits for `ev` (kSignaled) or `wake` (kWoken, may be null).
+WaitStatus WaitEvent(Event* ev, Event* wake, uint32_t timeoutMs);
+void CloseEvent(Event* ev);
+
+// --- GPU handles ---
+
+// A shared texture's NT handle (Windows) or dma-buf fd (Linux) only means
+// something inside the process that made it. ImportHandle() opens our own
+// copy of process `pid`'s `value` (DuplicateHandle / pidfd_getfd), it fails
+// when the OS or the permissions don't allow that.
+bool ImportHandle(uint32_t pid, uint64_t value, uint64_t* out, std::string* error);
+void CloseImportedHandle(uint64_t handle);
+
+// --- Files ---
+
+// Streaming output file (recordings): positional writes straight from the
+// caller's memory, no user space buffer in between.
+struct File {
+  intptr_t handle = -1;    // HANDLE / file descriptor, -1 = closed
+};
+
+// Creates `path`, replacing an existing file. uncached: writes bypass the
+// file cache where DropWritten() can't trim it (FILE_FLAG_NO_BUFFERING on
+// Windows); WriteAt() offsets, sizes and data addresses must then be
+// multiples of 4096.
+bool CreateOutputFile(const std::string& path, File* out, std::string* error, bool uncached = false);
+// Whether uncached files are (and have those alignment rules) here
+#if defined(_WIN32)
+static const bool kUncachedFiles = true;
+#else
+static const bool kUncachedFiles = false;
+#endif
+bool WriteAt(File* file, uint64_t offset, const void* data, size_t size);
+// Starts writing [offset, offset + size) back to disk without waiting.
+void StartWriteback(File* file, uint64_t offset, uint64_t size);
+// Waits for [offset, offset + size) to be on disk and drops it from the page
+// cache, so a long recording doesn't push everything else out of it. A no-op
+// on Windows, where files are written uncached instead.
+void DropWritten(File* file, uint64_t offset, uint64_t size);
+void CloseFile(File* file);
+// Maps an existing file read-only (CloseMapping() undoes it).
+bool MapFileReadOnly(const std::string& path, Mapping* out, std::string* error);
+
+}  // namespace platform
@@ -0,0 +1,538 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "platform.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/magic.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+#endif
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+// libSystem's futex equivalent, the same one libc++ uses for atomic waits
+extern "C" int __ulock_wait(uint32_t operation, void* addr, uint64_t value, uint32_t timeout_us);
+extern "C" int __ulock_wake(uint32_t operation, void* addr, uint64_t wake_value);
+#define UL_COMPARE_AND_WAIT_SHARED 3
+#define ULF_WAKE_ALL 0x00000100
+#endif
+
+namespace platform {
+
+void YieldThread() { sched_yield(); }
+
+void SleepMs(uint32_t ms) {
+  struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t CurrentProcessId() { return (uint32_t)getpid(); }
+
+#if defined(__linux__)
+// helper: field 22 (starttime) of a /proc/<pid>/stat, 0 when unreadable
+static uint64_t ProcStartTime(const std::string& path) {
+  char buf[1024];
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return 0;
+  buf[n] = 0;
+  // the command name can hold anything, fields count from its closing paren
+  const char* p = strrchr(buf, ')');
+  for (int field = 2; p && field < 22; field++) p = strchr(p + 1, ' ');
+  return p ? strtoull(p + 1, nullptr, 10) : 0;
+}
+#endif
+
+ProcessToken CurrentProcessToken() {
+  ProcessToken token;
+#if defined(__linux__)
+  struct stat st;
+  if (stat("/proc/self/ns/pid", &st) == 0) token.ns = (uint64_t)st.st_ino;
+  token.start = ProcStartTime("/proc/self/stat");
+  if (!token.start) token.ns = 0; // without /proc we can't check anyone's either
+#endif
+  return token;
+}
+
+bool ProcessAlive(uint32_t pid, const ProcessToken& token) {
+#if defined(__linux__)
+  if (token.ns) {
+    static const ProcessToken self = CurrentProcessToken();
+    if (token.ns != self.ns) return true; // its pids mean nothing in our namespace
+    // a pid that was reused by now belongs to a process started later
+    uint64_t start = ProcStartTime("/proc/" + std::to_string(pid) + "/stat");
+    if (start) return start == token.start;
+  }
+#else
+  (void)token;
+#endif
+  return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+size_t SmallPageSize() { return (size_t)sysconf(_SC_PAGESIZE); }
+
+bool SetThreadLatency(const ThreadLatency& latency, ThreadLatencyState* state, std::string* error) {
+  ResetThreadLatency(state);
+  bool ok = true;
+  auto fail = [&](const char* what, int err) {
+    if (ok) *error = std::string(what) + " failed: " + strerror(err);
+    ok = false;
+  };
+  if (latency.realtime) {
+#if defined(__APPLE__)
+    qos_class_t qos = QOS_CLASS_DEFAULT;
+    int relative = 0;
+    if (pthread_get_qos_class_np(pthread_self(), &qos, &relative) == 0 && qos != QOS_CLASS_UNSPECIFIED) {
+      state->policy = (int)qos;
+      state->priority = relative;
+    } else {
+      state->policy = (int)QOS_CLASS_DEFAULT;
+    }
+    int err = pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#else
+    struct sched_param param = {};
+    int policy = SCHED_OTHER;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) param = sched_param();
+    state->policy = policy;
+    state->priority = param.sched_priority;
+    param = sched_param();
+    param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO),
+                                    std::min(latency.priority, sched_get_priority_max(SCHED_FIFO)));
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+    if (err) fail("Raising the thread priority", err);
+    state->realtime = err == 0;
+  }
+  if (latency.cores) {
+#if defined(__linux__)
+    static_assert(sizeof(cpu_set_t) <= sizeof(state->affinity), "cpu_set_t outgrew ThreadLatencyState");
+    cpu_set_t set;
+    int err = pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    if (!err) {
+      memcpy(state->affinity, &set, sizeof(set));
+      CPU_ZERO(&set);
+      for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+        if (latency.cores >> i & 1) CPU_SET(i, &set);
+      }
+      err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    if (err) fail("Pinning the thread", err);
+    state->pinned = err == 0;
+#else
+    fail("Pinning the thread", ENOTSUP); // macOS only takes affinity hints
+#endif
+  }
+  return ok;
+}
+
+void ResetThreadLatency(ThreadLatencyState* state) {
+  if (state->realtime) {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np((qos_class_t)state->policy, state->priority);
+#else
+    struct sched_param param = {};
+    param.sched_priority = state->priority;
+    pthread_setschedparam(pthread_self(), state->policy, &param);
+#endif
+  }
+#if defined(__linux__)
+  if (state->pinned) {
+    cpu_set_t set;
+    memcpy(&set, state->affinity, sizeof(set));
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+  *state = ThreadLatencyState();
+}
+
+// shm_open() wants a single leading slash and no others
+static std::string ShmName(const std::string& name) {
+  std::string shm = "/";
+  for (char c : name) shm += (c == '/' || c == '\\') ? '_' : c;
+#if defined(__APPLE__)
+  // PSHMNAMLEN is 31: fall back to a hash of the name
+  if (shm.size() > 31) {
+    uint64_t h = 1469598103934665603ull; // FNV-1a
+    for (char c : name) { h ^= (uint8_t)c; h *= 1099511628211ull; }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/shm_%016llx", (unsigned long long)h);
+    shm = buf;
+  }
+#endif
+  return shm;
+}
+
+// Where a mapping lives: a POSIX shm object, or a file on hugetlbfs for
+// large pages (shm objects can't be MAP_HUGETLB).
+struct Backing {
+  std::string path;
+  bool huge = false;
+};
+
+// helper: the default hugetlbfs mount and its page size, empty without one
+static std::string HugeTlbDir(size_t* pageSize) {
+#if defined(__linux__)
+  struct statfs fs;
+  if (statfs("/dev/hugepages", &fs) == 0 && (uint32_t)fs.f_type == HUGETLBFS_MAGIC) {
+    *pageSize = (size_t)fs.f_bsize;
+    return "/dev/hugepages";
+  }
+#endif
+  *pageSize = 0;
+  return std::string();
+}
+
+static int OpenBacking(const Backing& b, int flags) {
+  return b.huge ? open(b.path.c_str(), flags, 0600) : shm_open(b.path.c_str(), flags, 0600);
+}
+
+static void UnlinkBacking(const Backing& b) {
+  if (b.huge) unlink(b.path.c_str());
+  else shm_unlink(b.path.c_str());
+}
+
+// helper: books a use of the object behind `fd` (see CloseMapping()). False
+// when the last user unlinked it meanwhile: the name is free to create
+// again. *counted: whether the filesystem takes the lock at all (macOS shm
+// objects don't; nobody unlinks those).
+static bool UseBacking(int fd, bool* counted) {
+  *counted = flock(fd, LOCK_SH) == 0;
+  struct stat st;
+  return !*counted || fstat(fd, &st) != 0 || st.st_nlink > 0;
+}
+
+// helper: opens an existing object. -1: none (or just unlinked), -2: not
+// sized by its creator yet
+static int OpenSized(const Backing& b, bool* counted) {
+  int fd = OpenBacking(b, O_RDWR);
+  if (fd < 0) return errno == ENOENT ? -1 : -3;
+  if (!UseBacking(fd, counted)) {
+    close(fd);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) return fd;
+  close(fd);
+  return -2;
+}
+
+bool OpenOrCreateMapping(const std::string& name, uint64_t size, const MappingOptions& options,
+                         Mapping* out, bool* created, std::string* error) {
+  *created = false;
+  size_t hugePage = 0;
+  Backing shm, huge, backing;
+  shm.path = ShmName(name);
+  huge.path = HugeTlbDir(&hugePage);
+  if (!huge.path.empty()) { huge.path += ShmName(name); huge.huge = true; }
+  int fd = -1;
+  bool counted = false;
+  errno = 0;
+
+  for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+    backing = shm;
+    int r = OpenSized(shm, &counted);
+    if (r == -1 && huge.huge) { backing = huge; r = OpenSized(huge, &counted); }
+    if (r >= 0) { fd = r; break; }
+    if (r == -3) break;
+    if (r == -2) { SleepMs(1); continue; } // the creator may not have sized it yet
+    if (options.openOnly) { errno = ENOENT; break; }
+
+    backing = options.largePages && huge.huge ? huge : shm;
+    uint64_t bytes = backing.huge ? (size + hugePage - 1) / hugePage * hugePage : size;
+    fd = OpenBacking(backing, O_RDWR | O_CREAT | O_EXCL);
+    if (fd >= 0) {
+      UseBacking(fd, &counted); // before it is sized, nobody else uses it yet
+      if (ftruncate(fd, (off_t)bytes) != 0) {
+        *error = std::string("ftruncate failed: ") + strerror(errno);
+        close(fd);
+        UnlinkBacking(backing);
+        return false;
+      }
+      *created = true;
+      break;
+    }
+    if (errno != EEXIST) break; // lost the race otherwise, open it
+  }
+  if (fd < 0) {
+    *error = std::string("shm_open failed: ") + strerror(errno ? errno : ETIMEDOUT);
+    return false;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+  if (options.prefault) flags |= MAP_POPULATE;
+#endif
+  void* base = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (base == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    if (*created) UnlinkBacking(backing);
+    if (*created && backing.huge) {
+      // no huge pages reserved (vm.nr_hugepages): normal pages then
+      MappingOptions fallback = options;
+      fallback.largePages = false;
+      return OpenOrCreateMapping(name, size, fallback, out, created, error);
+    }
+    *error = std::string("mmap failed: ") + strerror(err);
+    return false;
+  }
+
+  out->base = base;
+  out->size = (size_t)st.st_size;
+  out->handle = fd;
+  out->name = backing.path;
+  out->counted = counted;
+  out->largePages = backing.huge;
+  out->pageSize = backing.huge ? hugePage : SmallPageSize();
+
+#if defined(MADV_HUGEPAGE)
+  // transparent huge pages for tmpfs, effective with shmem_enabled=advise
+  if (options.largePages && !backing.huge) madvise(base, out->size, MADV_HUGEPAGE);
+#endif
+  if (options.prefault) {
+#if !defined(MAP_POPULATE)
+    TouchPages(base, out->size, out->pageSize, *created);
+#endif
+    out->prefaulted = true;
+    out->locked = mlock(base, out->size) == 0; // RLIMIT_MEMLOCK permitting
+  }
+  return true;
+}
+
+// The last user unlinks the object, like a Windows section that goes away
+// with its last handle. Holding the exclusive lock while unlinking makes a
+// process opening it meanwhile wait, then see it unlinked and create a new one.
+void CloseMapping(Mapping* mapping) {
+  if (mapping->base) munmap(mapping->base, mapping->size);
+  if (mapping->handle > 0) {
+    int fd = (int)mapping->handle;
+    if (mapping->counted && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+      Backing b;
+      b.path = mapping->name;
+      b.huge = mapping->largePages;
+      UnlinkBacking(b);
+    }
+    close(fd);
+  }
+  *mapping = Mapping();
+}
+
+// tmpfs backs pages on first touch, there is nothing to commit
+bool CommitRange(Mapping* /*mapping*/, uint64_t /*offset*/, uint64_t /*size*/) { return true; }
+
+// --- Events: 0/1 words in shared memory, sleeping through the futex ---
+
+struct Event {
+  std::atomic<int32_t>* word;
+  std::atomic<int32_t> localWord;
+  Event* forward;
+};
+
+// the kernel compares the raw int behind the std::atomic
+static int* FutexAddr(std::atomic<int32_t>* word) { return reinterpret_cast<int*>(word); }
+
+static void FutexWait(std::atomic<int32_t>* word, uint64_t timeoutNs) {
+#if defined(__linux__)
+  struct timespec ts = { (time_t)(timeoutNs / 1000000000ull), (long)(timeoutNs % 1000000000ull) };
+  syscall(SYS_futex, FutexAddr(word), FUTEX_WAIT, 0, timeoutNs == UINT64_MAX ? nullptr : &ts, nullptr, 0);
+#elif defined(__APPLE__)
+  uint64_t us = timeoutNs == UINT64_MAX ? 0 : timeoutNs / 1000 + 1;
+  __ulock_wait(UL_COMPARE_AND_WAIT_SHARED, FutexAddr(word), 0, us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+#else
+  // no futex: poll
+  (void)word;
+  SleepMs(timeoutNs < 1000000ull ? 0 : 1);
+#endif
+}
+
+static void FutexWakeAll(std::atomic<int32_t>* word) {
+#if defined(__linux__)
+  syscall(SYS_futex, FutexAddr(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(__APPLE__)
+  __ulock_wake(UL_COMPARE_AND_WAIT_SHARED | ULF_WAKE_ALL, FutexAddr(word), 0);
+#else
+  (void)word;
+#endif
+}
+
+Event* OpenSharedEvent(const std::string& /*name*/, std::atomic<int32_t>* word, bool /*create*/) {
+  if (!word) return nullptr;
+  Event* ev = new Event();
+  ev->word = word;
+  ev->forward = nullptr;
+  return ev;
+}
+
+Event* CreateLocalEvent(Event* forwardTo) {
+  Event* ev = new Event();
+  ev->localWord = 0;
+  ev->word = &ev->localWord;
+  ev->forward = forwardTo;
+  return ev;
+}
+
+void SignalEvent(Event* ev) {
+  // sleepers only sleep on 0, so a 1 -> 1 store needs no wake
+  if (ev->word->exchange(1) == 0) FutexWakeAll(ev->word);
+  if (ev->forward) SignalEvent(ev->forward);
+}
+
+void ClearEvent(Event* ev) { ev->word->store(0); }
+
+WaitStatus WaitEvent(Event* ev, Event* wake, uint32_t timeoutMs) {
+  uint64_t deadline = timeoutMs == kInfinite ? UINT64_MAX : MonotonicNs() + (uint64_t)timeoutMs * 1000000ull;
+  for (;;) {
+    if (wake && wake->word->exchange(0)) return WaitStatus::kWoken;
+    if (ev->word->exchange(0)) return WaitStatus::kSignaled;
+
+    uint64_t left = UINT64_MAX;
+    if (deadline != UINT64_MAX) {
+      uint64_t now = MonotonicNs();
+      if (now >= deadline) return WaitStatus::kTimedOut;
+      left = deadline - now;
+    }
+    FutexWait(ev->word, left);
+  }
+}
+
+void CloseEvent(Event* ev) { delete ev; }
+
+// Linux 5.6+; another process's fd needs ptrace access to it (the same user,
+// and a Yama ptrace_scope that allows it)
+bool ImportHandle(uint32_t pid, uint64_t value, uint64_t* out, std::string* error) {
+#if defined(__linux__)
+  if (value > INT_MAX) {
+    *error = "Invalid file descriptor";
+    return false;
+  }
+  int fd;
+  if (pid == CurrentProcessId()) {
+    fd = fcntl((int)value, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) { *error = "fcntl(F_DUPFD_CLOEXEC) failed"; return false; }
+  } else {
+    int pidfd = (int)syscall(SYS_pidfd_open, (pid_t)pid, 0);
+    if (pidfd < 0) { *error = "pidfd_open failed"; return false; }
+    fd = (int)syscall(SYS_pidfd_getfd, pidfd, (int)value, 0);
+    close(pidfd);
+    if (fd < 0) { *error = "pidfd_getfd failed"; return false; }
+  }
+  *out = (uint64_t)fd;
+  return true;
+#else
+  (void)pid; (void)value; (void)out;
+  *error = "GPU handles can't be imported on this platform";
+  return false;
+#endif
+}
+
+void CloseImportedHandle(uint64_t handle) { close((int)handle); }
+
+bool CreateOutputFile(const std::string& path, File* out, std::string* error, bool /*uncached*/) {
+  // the page cache is trimmed behind the writes instead (DropWritten())
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *error = std::string("open failed: ") + strerror(errno);
+    return false;
+  }
+  out->handle = fd;
+  return true;
+}
+
+bool WriteAt(File* file, uint64_t offset, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (size) {
+    ssize_t n = pwrite((int)file->handle, p, size, (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    offset += (uint64_t)n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+void StartWriteback(File* file, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+  sync_file_range((int)file->handle, (off_t)offset, (off_t)size, SYNC_FILE_RANGE_WRITE);
+#else
+  (void)file; (void)offset; (void)size;
+#endif
+}
+
+void DropWritten(File* file, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+  sync_file_range((int)file->handle, (off_t)offset, (off_t)size,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise((int)file->handle, (off_t)offset, (off_t)size, POSIX_FADV_DONTNEED);
+#else
+  (void)file; (void)offset; (void)size;
+#endif
+}
+
+void CloseFile(File* file) {
+  if (file->handle >= 0) close((int)file->handle);
+  file->handle = -1;
+}
+
+bool MapFileReadOnly(const std::string& path, Mapping* out, std::string* error) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0) {
+    *error = fd < 0 ? std::string("open failed: ") + strerror(errno) : "Empty file";
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  void* base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file
+  if (base == MAP_FAILED) {
+    *error = std::string("mmap failed: ") + strerror(errno);
+    return false;
+  }
+#if defined(MADV_SEQUENTIAL)
+  madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  *out = Mapping();
+  out->base = base;
+  out->size = (size_t)st.st_size;
+  out->name = path;
+  out->pageSize = SmallPageSize();
+  return true;
+}
+
+}  // namespace platform
@@ -0,0 +1,325 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "platform.h"
+#include <Windows.h>
+#include <avrt.h>
+#include <timeapi.h>
+
+namespace platform {
+
+void YieldThread() { Sleep(0); }
+
+void SleepMs(uint32_t ms) { Sleep(ms); }
+
+uint64_t MonotonicNs() {
+  static LARGE_INTEGER freq = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull +
+         (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+}
+
+uint32_t CurrentProcessId() { return GetCurrentProcessId(); }
+
+ProcessToken CurrentProcessToken() { return ProcessToken(); } // no pid namespaces
+
+bool ProcessAlive(uint32_t pid, const ProcessToken& /*token*/) {
+  HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+  // only a pid that doesn't exist is dead: a process in another session or
+  // at a higher integrity level (a service producer) denies access
+  if (!h) return GetLastError() != ERROR_INVALID_PARAMETER;
+  DWORD code = 0;
+  bool dead = GetExitCodeProcess(h, &code) && code != STILL_ACTIVE;
+  CloseHandle(h);
+  return !dead;
+}
+
+#ifndef FILE_MAP_LARGE_PAGES
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif
+
+size_t SmallPageSize() {
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwPageSize;
+}
+
+bool SetThreadLatency(const ThreadLatency& latency, ThreadLatencyState* state, std::string* error) {
+  ResetThreadLatency(state);
+  bool ok = true;
+  auto fail = [&](const char* what) {
+    if (ok) *error = std::string(what) + " failed, error " + std::to_string(GetLastError());
+    ok = false;
+  };
+  if (latency.realtime) {
+    wchar_t task[64] = {};
+    MultiByteToWideChar(CP_UTF8, 0, latency.task.c_str(), -1, task, 63);
+    DWORD taskIndex = 0;
+    HANDLE h = AvSetMmThreadCharacteristicsW(task, &taskIndex);
+    if (h) state->mmcss = (intptr_t)h;
+    else fail("AvSetMmThreadCharacteristics");
+  }
+  if (latency.cores) {
+    DWORD_PTR previous = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)latency.cores);
+    if (previous) {
+      state->pinned = true;
+      state->affinity[0] = previous;
+    } else {
+      fail("SetThreadAffinityMask");
+    }
+  }
+  if (latency.timerResolution) {
+    state->timer = timeBeginPeriod(1) == TIMERR_NOERROR;
+    if (!state->timer) fail("timeBeginPeriod");
+  }
+  return ok;
+}
+
+void ResetThreadLatency(ThreadLatencyState* state) {
+  if (state->mmcss) AvRevertMmThreadCharacteristics((HANDLE)state->mmcss);
+  if (state->pinned) SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)state->affinity[0]);
+  if (state->timer) timeEndPeriod(1);
+  *state = ThreadLatencyState();
+}
+
+// helper: SEC_LARGE_PAGES needs SeLockMemoryPrivilege enabled in our token
+static bool EnableLockMemoryPrivilege() {
+  HANDLE token;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+  TOKEN_PRIVILEGES tp = {};
+  tp.PrivilegeCount = 1;
+  tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  bool ok = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+            AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) &&
+            GetLastError() == ERROR_SUCCESS; // ERROR_NOT_ALL_ASSIGNED: not granted
+  CloseHandle(token);
+  return ok;
+}
+
+// helper: VirtualLock, growing the working set quota once if it is too small
+static void PrefaultView(Mapping* m, bool created) {
+  if (!VirtualLock(m->base, m->size)) {
+    SIZE_T minWs = 0, maxWs = 0;
+    HANDLE self = GetCurrentProcess();
+    if (!GetProcessWorkingSetSize(self, &minWs, &maxWs) ||
+        !SetProcessWorkingSetSize(self, minWs + m->size, maxWs + m->size) ||
+        !VirtualLock(m->base, m->size)) {
+      // not allowed to lock: still take the faults now rather than on frame one
+      TouchPages(m->base, m->size, m->pageSize, created);
+      m->prefaulted = true;
+      return;
+    }
+  }
+  m->prefaulted = m->locked = true;
+}
+
+bool OpenOrCreateMapping(const std::string& name, uint64_t size, const MappingOptions& options,
+                         Mapping* out, bool* created, std::string* error) {
+  *created = false;
+  bool large = false;
+  HANDLE hMap = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+  if (!hMap && options.openOnly) {
+    *error = "OpenFileMapping failed";
+    return false;
+  }
+
+  if (!hMap) {
+    SIZE_T largeMin = options.largePages ? GetLargePageMinimum() : 0;
+    if (largeMin && EnableLockMemoryPrivilege()) {
+      uint64_t largeSize = (size + largeMin - 1) / largeMin * largeMin;
+      hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES,
+                                static_cast<DWORD>(largeSize >> 32), static_cast<DWORD>(largeSize), name.c_str());
+      large = hMap != nullptr;
+    }
+    if (!hMap) {
+      DWORD sizeLow = static_cast<DWORD>(size & 0xFFFFFFFF);
+      DWORD sizeHigh = static_cast<DWORD>((size >> 32) & 0xFFFFFFFF);
+      hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE | (options.reserve ? SEC_RESERVE : 0),
+                                sizeHigh, sizeLow, name.c_str());
+    }
+    if (!hMap) {
+      *error = "CreateFileMapping failed";
+      return false;
+    }
+    *created = GetLastError() != ERROR_ALREADY_EXISTS;
+  }
+
+  void* base = MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS | (large ? FILE_MAP_LARGE_PAGES : 0), 0, 0, 0);
+  if (!base && !large) {
+    // someone else's SEC_LARGE_PAGES section
+    base = MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS | FILE_MAP_LARGE_PAGES, 0, 0, 0);
+    large = base != nullptr;
+  }
+  if (!base) {
+    CloseHandle(hMap);
+    *error = "MapViewOfFile failed";
+    return false;
+  }
+
+  // a SEC_RESERVE view is several regions (committed, reserved), one allocation
+  MEMORY_BASIC_INFORMATION mbi;
+  size_t viewSize = 0;
+  bool reserved = false;
+  while (VirtualQuery((uint8_t*)base + viewSize, &mbi, sizeof(mbi)) && mbi.AllocationBase == base) {
+    reserved = reserved || mbi.State == MEM_RESERVE;
+    viewSize += mbi.RegionSize;
+  }
+
+  out->base = base;
+  out->size = viewSize;
+  out->reserved = reserved;
+  out->handle = reinterpret_cast<intptr_t>(hMap);
+  out->name = name;
+  out->largePages = large;
+  out->pageSize = large ? GetLargePageMinimum() : SmallPageSize();
+  if (out->reserved && options.commitBytes) CommitRange(out, 0, options.commitBytes);
+  if (large) {
+    // large pages are committed up front and never paged out
+    out->prefaulted = out->locked = true;
+  } else if (options.prefault && !out->reserved) {
+    PrefaultView(out, *created);
+  }
+  return true;
+}
+
+// Every view commits the pages it touches; pages another view committed
+// already keep their contents.
+bool CommitRange(Mapping* mapping, uint64_t offset, uint64_t size) {
+  if (!mapping->reserved || !size) return true;
+  if (offset + size > mapping->size) size = mapping->size - offset;
+  return VirtualAlloc((uint8_t*)mapping->base + offset, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+}
+
+void CloseMapping(Mapping* mapping) {
+  if (mapping->base) UnmapViewOfFile(mapping->base);
+  if (mapping->handle) CloseHandle(reinterpret_cast<HANDLE>(mapping->handle));
+  *mapping = Mapping();
+}
+
+struct Event {
+  HANDLE handle;
+};
+
+// Tries the Global\ namespace first (a producer running as a service), then
+// the session's Local\ one.
+Event* OpenSharedEvent(const std::string& name, std::atomic<int32_t>* /*word*/, bool create) {
+  HANDLE h = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, ("Global\\" + name).c_str());
+  if (!h && create) h = CreateEventA(nullptr, FALSE, FALSE, ("Local\\" + name).c_str());
+  if (!h && !create) h = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, ("Local\\" + name).c_str());
+  return h ? new Event{ h } : nullptr;
+}
+
+Event* CreateLocalEvent(Event* /*forwardTo*/) {
+  HANDLE h = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+  return h ? new Event{ h } : nullptr;
+}
+
+void SignalEvent(Event* ev) { SetEvent(ev->handle); }
+
+void ClearEvent(Event* ev) { ResetEvent(ev->handle); }
+
+WaitStatus WaitEvent(Event* ev, Event* wake, uint32_t timeoutMs) {
+  HANDLE handles[2] = { ev->handle, wake ? wake->handle : nullptr };
+  DWORD r = WaitForMultipleObjects(wake ? 2 : 1, handles, FALSE, timeoutMs);
+  if (r == WAIT_OBJECT_0) return WaitStatus::kSignaled;
+  if (r == WAIT_OBJECT_0 + 1) return WaitStatus::kWoken;
+  return WaitStatus::kTimedOut;
+}
+
+void CloseEvent(Event* ev) {
+  if (!ev) return;
+  CloseHandle(ev->handle);
+  delete ev;
+}
+
+bool ImportHandle(uint32_t pid, uint64_t value, uint64_t* out, std::string* error) {
+  HANDLE process = pid == GetCurrentProcessId() ? GetCurrentProcess() : OpenProcess(PROCESS_DUP_HANDLE, FALSE, pid);
+  if (!process) {
+    *error = "OpenProcess failed";
+    return false;
+  }
+  HANDLE local = nullptr;
+  BOOL ok = DuplicateHandle(process, (HANDLE)(uintptr_t)value, GetCurrentProcess(), &local, 0, FALSE, DUPLICATE_SAME_ACCESS);
+  if (pid != GetCurrentProcessId()) CloseHandle(process);
+  if (!ok) {
+    *error = "DuplicateHandle failed";
+    return false;
+  }
+  *out = (uint64_t)(uintptr_t)local;
+  return true;
+}
+
+void CloseImportedHandle(uint64_t handle) { CloseHandle((HANDLE)(uintptr_t)handle); }
+
+bool CreateOutputFile(const std::string& path, File* out, std::string* error, bool uncached) {
+  // the cache manager has no way to drop a range once written: a long
+  // recording would push everything else out of the cache
+  DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+  if (uncached) flags |= FILE_FLAG_NO_BUFFERING;
+  HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, flags, nullptr);
+  if (h == INVALID_HANDLE_VALUE) {
+    *error = "CreateFile failed";
+    return false;
+  }
+  out->handle = reinterpret_cast<intptr_t>(h);
+  return true;
+}
+
+bool WriteAt(File* file, uint64_t offset, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (size) {
+    // positional: the offset rides in the OVERLAPPED
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(offset);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD chunk = size > (1u << 30) ? (1u << 30) : static_cast<DWORD>(size);
+    DWORD written = 0;
+    if (!WriteFile(reinterpret_cast<HANDLE>(file->handle), p, chunk, &written, &ov) || !written) return false;
+    p += written;
+    offset += written;
+    size -= written;
+  }
+  return true;
+}
+
+void StartWriteback(File* /*file*/, uint64_t /*offset*/, uint64_t /*size*/) {}
+
+void DropWritten(File* /*file*/, uint64_t /*offset*/, uint64_t /*size*/) {}
+
+void CloseFile(File* file) {
+  if (file->handle != -1) CloseHandle(reinterpret_cast<HANDLE>(file->handle));
+  file->handle = -1;
+}
+
+bool MapFileReadOnly(const std::string& path, Mapping* out, std::string* error) {
+  HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  LARGE_INTEGER size = {};
+  if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size) || size.QuadPart <= 0) {
+    *error = h == INVALID_HANDLE_VALUE ? "CreateFile failed" : "Empty file";
+    if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+    return false;
+  }
+  HANDLE hMap = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(h); // the section keeps the file
+  void* base = hMap ? MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!base) {
+    if (hMap) CloseHandle(hMap);
+    *error = hMap ? "MapViewOfFile failed" : "CreateFileMapping failed";
+    return false;
+  }
+  *out = Mapping();
+  out->base = base;
+  out->size = static_cast<size_t>(size.QuadPart);
+  out->handle = reinterpret_cast<intptr_t>(hMap);
+  out->name = path;
+  out->pageSize = SmallPageSize();
+  return true;
+}
+
+}  // namespace platform
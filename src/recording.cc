@@ -0,0 +1,206 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "recording.h"
+#include <cstring>
+
+namespace recording {
+
+// write-behind: every frame's bytes are queued for writeback as soon as they
+// are written, and pages further back than this are dropped from the cache
+static const uint64_t CACHE_WINDOW = 64ull << 20;
+
+static uint64_t AlignUp(uint64_t v) { return (v + RECORDING_ALIGN - 1) & ~(uint64_t)(RECORDING_ALIGN - 1); }
+
+static std::string SegmentPath(const std::string& path, uint32_t segment) {
+  return path + "." + std::to_string(segment);
+}
+
+bool Writer::open(const std::string& path, uint64_t segmentBytes, std::string* error, bool uncached) {
+  close();
+  path_ = path;
+  segmentBytes_ = segmentBytes ? segmentBytes : RECORDING_SEGMENT_BYTES;
+  uncached_ = uncached && platform::kUncachedFiles;
+  segment_ = 0;
+  segmentOffset_ = dropped_ = 0;
+  frames_ = bytes_ = 0;
+  lastIndex_ = missed_ = 0;
+  error_.clear();
+
+  if (!platform::CreateOutputFile(path, &index_, error)) return false;
+  RecordingHeader header = {};
+  header.magic = RECORDING_MAGIC;
+  header.version = RECORDING_VERSION;
+  header.entry_size = sizeof(RecordEntry);
+  header.segment_bytes = segmentBytes_;
+  if (!platform::WriteAt(&index_, 0, &header, sizeof(header)) || !openSegment(0)) {
+    *error = error_.empty() ? "Failed to write the recording header" : error_;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Writer::openSegment(uint32_t segment) {
+  closeSegment();
+  segment_ = segment;
+  segmentOffset_ = dropped_ = 0;
+  std::string error;
+  if (!platform::CreateOutputFile(SegmentPath(path_, segment), &segmentFile_, &error, uncached_)) {
+    error_ = error;
+    return false;
+  }
+  return true;
+}
+
+void Writer::closeSegment() {
+  if (segmentFile_.handle == -1) return;
+  if (segmentOffset_ > dropped_) platform::DropWritten(&segmentFile_, dropped_, segmentOffset_ - dropped_);
+  platform::CloseFile(&segmentFile_);
+}
+
+bool Writer::append(RecordEntry entry, const void* data) {
+  if (!error_.empty() || index_.handle == -1) return false;
+
+  // a frame never straddles two segments
+  if (segmentOffset_ && segmentOffset_ + entry.frame_size > segmentBytes_ && !openSegment(segment_ + 1)) return false;
+  entry.segment = segment_;
+  entry.offset = segmentOffset_;
+  size_t bytes = uncached_ ? (size_t)AlignUp(entry.frame_size) : entry.frame_size;
+  if (entry.frame_size && !platform::WriteAt(&segmentFile_, segmentOffset_, data, bytes)) {
+    error_ = "Failed to write frame data";
+    return false;
+  }
+  platform::StartWriteback(&segmentFile_, segmentOffset_, entry.frame_size);
+  segmentOffset_ = AlignUp(segmentOffset_ + entry.frame_size);
+  if (segmentOffset_ - dropped_ > 2 * CACHE_WINDOW) {
+    uint64_t upTo = segmentOffset_ - CACHE_WINDOW;
+    platform::DropWritten(&segmentFile_, dropped_, upTo - dropped_);
+    dropped_ = upTo;
+  }
+
+  // the entry last: it only shows up once its frame is in the file
+  if (!platform::WriteAt(&index_, sizeof(RecordingHeader) + frames_ * sizeof(RecordEntry), &entry, sizeof(entry))) {
+    error_ = "Failed to write the recording index";
+    return false;
+  }
+  frames_++;
+  bytes_ += entry.frame_size;
+  if (lastIndex_ && entry.frame_index > lastIndex_ + 1) missed_ += entry.frame_index - lastIndex_ - 1;
+  lastIndex_ = entry.frame_index;
+  return true;
+}
+
+void Writer::close() {
+  closeSegment();
+  platform::CloseFile(&index_);
+}
+
+bool QueuedWriter::open(const std::string& path, uint64_t segmentBytes, uint32_t depth, bool uncached, Done done,
+                        std::string* error) {
+  close();
+  if (!writer_.open(path, segmentBytes, error, uncached)) return false;
+  done_ = std::move(done);
+  depth_ = depth ? depth : 1;
+  uncached_ = uncached && platform::kUncachedFiles;
+  queued_.clear();
+  inFlight_ = 0;
+  stop_ = failed_ = false;
+  dropped_ = 0;
+  thread_ = std::thread(&QueuedWriter::run, this);
+  return true;
+}
+
+bool QueuedWriter::append(const RecordEntry& entry, const void* data, int32_t tag) {
+  bool misaligned = uncached_ && (reinterpret_cast<uintptr_t>(data) & (RECORDING_ALIGN - 1));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || failed_ || misaligned || inFlight_ >= depth_) {
+      dropped_++;
+      return false;
+    }
+    queued_.push_back({ entry, data, tag });
+    inFlight_++;
+  }
+  cv_.notify_all();
+  return true;
+}
+
+void QueuedWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [&] { return stop_ || !queued_.empty(); });
+    if (queued_.empty()) return; // stopped, everything written
+    Frame f = queued_.front();
+    queued_.pop_front();
+    lock.unlock();
+    bool ok = writer_.append(f.entry, f.data);
+    if (done_) done_(f.tag);
+    lock.lock();
+    failed_ = failed_ || !ok;
+    inFlight_--;
+    cv_.notify_all(); // drain()
+  }
+}
+
+void QueuedWriter::drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&] { return inFlight_ == 0 || !thread_.joinable(); });
+}
+
+void QueuedWriter::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+  writer_.close();
+}
+
+bool Reader::open(const std::string& path, std::string* error) {
+  close();
+  if (!platform::MapFileReadOnly(path, &index_, error)) return false;
+  const RecordingHeader* header = static_cast<const RecordingHeader*>(index_.base);
+  if (index_.size < sizeof(RecordingHeader) || header->magic != RECORDING_MAGIC ||
+      header->version != RECORDING_VERSION || header->entry_size != sizeof(RecordEntry)) {
+    *error = "Not a recording";
+    close();
+    return false;
+  }
+  path_ = path;
+  entries_ = reinterpret_cast<const RecordEntry*>(static_cast<const uint8_t*>(index_.base) + sizeof(RecordingHeader));
+  count_ = (index_.size - sizeof(RecordingHeader)) / sizeof(RecordEntry); // a torn last entry is left out
+  return true;
+}
+
+void Reader::close() {
+  for (platform::Mapping& m : segments_) platform::CloseMapping(&m);
+  segments_.clear();
+  tried_.clear();
+  platform::CloseMapping(&index_);
+  entries_ = nullptr;
+  count_ = 0;
+}
+
+const uint8_t* Reader::frame(uint64_t i) {
+  const RecordEntry& e = entries_[i];
+  if (e.segment >= segments_.size()) {
+    segments_.resize(e.segment + 1);
+    tried_.resize(e.segment + 1, false);
+  }
+  platform::Mapping& m = segments_[e.segment];
+  if (!tried_[e.segment]) {
+    tried_[e.segment] = true;
+    std::string error;
+    platform::MapFileReadOnly(SegmentPath(path_, e.segment), &m, &error);
+  }
+  if (!m.base || e.offset > m.size || e.frame_size > m.size - e.offset) return nullptr;
+  return static_cast<const uint8_t*>(m.base) + e.offset;
+}
+
+}  // namespace recording
@@ -0,0 +1,173 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Frame recordings: an index file `<path>` (RecordingHeader, then one
+// RecordEntry per frame) and the frame bytes in segment files `<path>.0`,
+// `<path>.1`, ... of up to segment_bytes each. Every frame starts on a 4 KB
+// boundary of its segment. Entries are appended after their frame's bytes,
+// so a recording cut short by a crash still reads up to its last entry.
+// QueuedWriter puts a Writer on a thread of its own that writes frames
+// straight from where they are (a pinned ring slot), so nobody waits for the
+// disk and nothing is copied.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "shared_header.h"
+
+#define RECORDING_MAGIC 0x43524853u // 'SHRC'
+#define RECORDING_VERSION 1
+#define RECORDING_ALIGN 4096
+#define RECORDING_SEGMENT_BYTES (1ull << 30)
+
+namespace recording {
+
+struct RecordingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_size;      // sizeof(RecordEntry)
+  uint32_t reserved0;
+  uint64_t segment_bytes;   // segment files roll over past this
+  uint8_t reserved[40];
+};
+
+struct RecordEntry {
+  uint64_t frame_index;     // as published by the recorded producer
+  uint64_t capture_ns;      // publishFrame() captureNs, 0 = none
+  uint64_t publish_ns;      // producer's MonotonicNs() at publish, drives replay pacing
+  uint64_t offset;          // frame start within its segment
+  uint32_t segment;         // `<path>.<segment>`
+  uint32_t frame_size;
+  FrameFormat format;       // the format the frame was written under
+  uint8_t reserved[48];
+};
+
+static_assert(sizeof(RecordingHeader) == 64, "RecordingHeader layout");
+static_assert(sizeof(RecordEntry) == 128, "RecordEntry layout");
+
+// Appends frames to a new recording. Not thread safe: one thread writes.
+class Writer {
+public:
+  ~Writer() { close(); }
+
+  // uncached: the segment files bypass the file cache where DropWritten()
+  // can't trim it (Windows); append() then takes 4 KB aligned data padded
+  // to a multiple of 4 KB.
+  bool open(const std::string& path, uint64_t segmentBytes, std::string* error, bool uncached = false);
+  // Writes `entry.frame_size` bytes at `data` straight to the file, then its
+  // entry; offset/segment are filled in here. False once a write failed.
+  bool append(RecordEntry entry, const void* data);
+  void close();
+
+  uint64_t frames() const { return frames_; }
+  uint64_t bytes() const { return bytes_; }
+  uint32_t segments() const { return segment_ + 1; }
+  // frames missing between the first and the last one recorded (frame_index gaps)
+  uint64_t missed() const { return missed_; }
+  const std::string& error() const { return error_; }
+
+private:
+  bool openSegment(uint32_t segment);
+  void closeSegment();
+
+  std::string path_;
+  uint64_t segmentBytes_ = RECORDING_SEGMENT_BYTES;
+  bool uncached_ = false;
+  platform::File index_;
+  platform::File segmentFile_;
+  uint32_t segment_ = 0;
+  uint64_t segmentOffset_ = 0; // end of the last frame, aligned
+  uint64_t dropped_ = 0;       // segment bytes already out of the page cache
+  uint64_t frames_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t lastIndex_ = 0;
+  uint64_t missed_ = 0;
+  std::string error_;
+};
+
+// Writer on a thread of its own. append() queues a frame that stays where it
+// is (pinned in its ring slot, say) and returns; the thread writes it from
+// there and hands its tag to `done` (to unpin it). Up to `depth` frames are
+// in flight, append() turns down more: like any frame the recording lacks,
+// those count in missed().
+class QueuedWriter {
+public:
+  typedef std::function<void(int32_t tag)> Done;
+
+  ~QueuedWriter() { close(); }
+
+  // uncached: see Writer::open(). Frames then have to start 4 KB aligned and
+  // stay readable up to the next 4 KB boundary (page aligned ring slots do).
+  bool open(const std::string& path, uint64_t segmentBytes, uint32_t depth, bool uncached, Done done,
+            std::string* error);
+  // False when the frame was turned down: `depth` frames in flight, a write
+  // failed, or uncached data that isn't aligned. `done` isn't called then.
+  bool append(const RecordEntry& entry, const void* data, int32_t tag);
+  // Waits until every queued frame is written and done.
+  void drain();
+  // Writes what is still queued and stops the thread.
+  void close();
+
+  // once closed
+  const Writer& writer() const { return writer_; }
+  uint64_t dropped() const { return dropped_; } // of missed(), the frames turned down
+
+private:
+  struct Frame {
+    RecordEntry entry;
+    const void* data;
+    int32_t tag;
+  };
+  void run();
+
+  Writer writer_;
+  Done done_;
+  uint32_t depth_ = 1;
+  bool uncached_ = false;
+  // guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Frame> queued_;
+  uint32_t inFlight_ = 0; // queued or being written
+  bool stop_ = false;
+  bool failed_ = false;
+  uint64_t dropped_ = 0;
+  std::thread thread_;
+};
+
+// Reads a recording through read-only mappings of its files.
+class Reader {
+public:
+  ~Reader() { close(); }
+
+  bool open(const std::string& path, std::string* error);
+  void close();
+
+  uint64_t count() const { return count_; }
+  const RecordEntry& entry(uint64_t i) const { return entries_[i]; }
+  // The bytes of frame `i`, nullptr when its segment is missing or short.
+  const uint8_t* frame(uint64_t i);
+
+private:
+  std::string path_;
+  platform::Mapping index_;
+  const RecordEntry* entries_ = nullptr;
+  uint64_t count_ = 0;
+  std::vector<platform::Mapping> segments_; // mapped on first use
+  std::vector<bool> tried_;
+};
+
+}  // namespace recording
@@ -0,0 +1,318 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Wire layout of the shared mapping: header, ring slot descriptors and reader
+// entries, the optional tile generation table, followed by slot_count frames
+// of slot_capacity bytes each. A stream container mapping starts with a
+// StreamDirectory instead and holds one such layout per named stream.
+// resize() re-allocates into a new mapping <name>@<generation> and points the
+// old header's next_generation at it, readers follow on their next read.
+// A producer rendering on the GPU can register one shared texture per slot
+// (SharedHeader::gpu) and publish frames that skip the CPU buffer.
+// create({ compression }) adds one area per slot behind the slots, where the
+// producer keeps a compressed copy of the slot's frame for readers that asked
+// for one (ReaderDesc::want_compressed).
+// create({ levels }) adds one more area per slot, behind those, holding the
+// frame box-filtered down to 1/2, 1/4, ... the size (readFrame({ level })).
+// create({ stages }) turns the ring into a pipeline: every published frame
+// goes through the named stages (SharedHeader::stages) in order, each one
+// transforming the slot in place, before readers get to see it.
+// Everything that maps it (the addon, bench/shm_bench, the C# viewer) has to
+// agree on this file.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define SHARED_MAGIC 0x5348444D
+#define SHARED_VERSION 14
+#define SHARED_MAX_SLOTS 8
+#define SHARED_DEFAULT_SLOTS 3
+#define SHARED_MAX_READERS 16
+#define SHARED_LATENCY_BUCKETS 16
+#define SHARED_TILE_SIZE 64     // dirty tracking granularity, pixels per tile side
+#define SHARED_MAX_TILES 16384  // tile table capacity (8192x8192 pixels)
+#define SHARED_MAX_LEVELS 4     // downscaled levels per frame, 1/2 .. 1/16 the size
+#define SHARED_MAX_STAGES 8     // pipeline stages per mapping
+
+#define STREAMS_MAGIC 0x53484453 // 'SHDS'
+#define STREAMS_VERSION 1
+#define STREAMS_MAX 64
+#define STREAMS_DEFAULT 16
+#define STREAMS_MAX_WAITERS 16
+#define STREAM_NAME_SIZE 32      // NUL included
+
+// StreamEntry.state
+#define STREAM_FREE 0
+#define STREAM_READY 1
+
+// GpuSurface.kind
+#define GPU_NONE 0
+#define GPU_D3D11_NT_HANDLE 1 // DXGI shared NT handle of an ID3D11Texture2D with a keyed mutex
+#define GPU_DMABUF 2          // Linux dma-buf fd, single plane
+
+// SlotDesc.gpu_flags
+#define FRAME_GPU 1    // the slot's GpuSurface holds the frame
+#define FRAME_NO_CPU 2 // the slot buffer does not (published GPU only)
+#define FRAME_LEVELS 4 // the slot's level area holds this frame's downscaled levels
+
+// SlotDesc.codec
+#define CODEC_NONE 0
+#define CODEC_QOI 1 // qoiformat.org, 8-bit RGB(A)/BGR(A) frames
+#define CODEC_LZ4 2 // LZ4 block format, the other formats
+
+// ReaderDesc.state
+#define READER_FREE 0
+#define READER_ATTACHED 1
+#define READER_CLAIMING 2
+
+// SharedHeader.pixel_format
+#define PIXEL_FORMAT_UNKNOWN 0 // packed, `channels` bytes per pixel (pre-v6 producers)
+#define PIXEL_FORMAT_BGRA8 1
+#define PIXEL_FORMAT_RGBA8 2
+#define PIXEL_FORMAT_BGR8 3
+#define PIXEL_FORMAT_RGB8 4
+#define PIXEL_FORMAT_GRAY8 5
+#define PIXEL_FORMAT_NV12 6    // Y plane, then interleaved UV at half resolution
+#define PIXEL_FORMAT_P010 7    // NV12 with 16-bit samples (10 significant bits)
+#define PIXEL_FORMAT_RGBA16F 8 // half floats
+#define PIXEL_FORMAT_COUNT 9
+#define SHARED_MAX_PLANES 2
+#define SHARED_MAX_ALIGNMENT 4096
+
+// Shared header layout. Naturally aligned, with the lines the producer
+// writes on every publish kept apart from the ones readers write (pins,
+// event words) so neither side keeps stealing the other's cache lines.
+// Fields changed concurrently are std::atomic (lock-free, same layout as the
+// plain type): stores publish with release, loads observe with acquire.
+
+// Frame format, guarded by SharedHeader::format_seq (seqlock)
+struct FrameFormat {
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t pixel_format;  // PIXEL_FORMAT_*
+  uint32_t row_alignment; // every row starts at a multiple of this (1 = packed)
+  uint32_t plane_count;   // 1, or 2 for NV12/P010
+  uint32_t plane_stride[SHARED_MAX_PLANES]; // bytes per row of each plane
+  uint32_t plane_offset[SHARED_MAX_PLANES]; // plane start within the frame
+};
+
+// Ring slot descriptor. The producer owns a slot while its seq is odd;
+// readers pin it through `readers` (bumped before checking seq, the producer
+// checks `readers` after making seq odd) so the producer skips it.
+struct alignas(64) SlotDesc {
+  // producer line
+  std::atomic<uint32_t> seq;        // per-slot sequence counter
+  uint32_t frame_size;              // bytes of the frame stored in the slot
+  std::atomic<uint64_t> frame_index; // frame_index the slot was published with
+  uint64_t offset;                  // slot data offset from the mapping base
+  std::atomic<uint64_t> publish_ns; // MonotonicNs() at publish, for wake latency
+  std::atomic<uint64_t> capture_ns; // capture time the producer passed to publishFrame(), 0 = none
+  uint32_t format_seq;              // SharedHeader::format_seq the frame was written under
+  uint32_t gpu_flags;               // FRAME_GPU / FRAME_NO_CPU / FRAME_LEVELS, 0 = CPU buffer only
+  std::atomic<uint64_t> compressed_index; // frame_index the compressed copy is of, stored last
+  uint32_t compressed_size;         // bytes of it in the slot's compression area
+  uint32_t codec;                   // CODEC_*
+  // reader line
+  std::atomic<int32_t> readers;     // pin count, the producer never hands out a pinned slot
+  uint8_t reserved1[60];
+};
+
+// Reader registration entry, written by its owner only. Every attached
+// reader gets its own event (SHM_EV_<name>_R<index>) so one publish wakes all
+// of them. The counters are reset on attach and can be read by anyone mapping
+// the header (getStats()); latency_hist[b] counts publish-to-wake latencies
+// below 2^b us (b = 0: under 1 us, the last bucket takes everything above).
+struct alignas(64) ReaderDesc {
+  // registration line
+  std::atomic<int32_t> state;       // READER_FREE / READER_ATTACHED / READER_CLAIMING
+  uint32_t pid;                     // owner, a dead owner's entry gets reclaimed
+  std::atomic<uint64_t> last_frame_index; // frame_index of the last frame it consumed
+  std::atomic<int32_t> pins[SHARED_MAX_SLOTS]; // pins it holds, undone on reclaim
+  std::atomic<int32_t> event_word;  // its event on POSIX (futex word)
+  std::atomic<uint32_t> want_compressed; // readCompressed() reader: the producer compresses for it
+  std::atomic<uint32_t> lossless;   // blocking lossless reader: frames past last_frame_index aren't refilled
+  std::atomic<uint32_t> stage;      // pipeline stage it runs (1-based, joinStage()), 0 = a plain reader
+  // counters
+  std::atomic<uint64_t> frames_read;
+  std::atomic<uint64_t> frames_dropped;  // published but never consumed (frame_index gaps)
+  std::atomic<uint64_t> retries;         // pin/format seqlock retries
+  std::atomic<uint64_t> spin_iterations;
+  std::atomic<uint64_t> wakeups;
+  std::atomic<uint64_t> timeouts;
+  std::atomic<uint64_t> latency_sum_ns;
+  std::atomic<uint64_t> latency_max_ns;
+  std::atomic<uint32_t> latency_hist[SHARED_LATENCY_BUCKETS];
+  // owner line: platform::ProcessToken of `pid`, written before it attaches
+  uint64_t owner_ns;
+  uint64_t owner_start;
+  uint8_t reserved2[48];
+};
+
+// Texture the producer registered for a ring slot (setSlotTexture()).
+// `handle` is an NT handle / fd of process `pid` only; consumers import
+// their own copy of it (DuplicateHandle / pidfd_getfd). `serial` is odd while
+// the entry is being rewritten and changes with every registration, so a
+// consumer knows when its import is out of date. Keyed mutexes are taken
+// and released with key 0 by everyone: the ring pins decide who may touch a
+// slot, the mutex only orders the GPU work.
+struct alignas(64) GpuSurface {
+  std::atomic<uint32_t> serial;
+  uint32_t kind;         // GPU_*
+  uint32_t pid;          // process `handle` is valid in
+  uint32_t format;       // DXGI_FORMAT / DRM fourcc
+  uint64_t handle;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;       // dma-buf plane pitch
+  uint32_t offset;       // dma-buf plane offset
+  uint64_t modifier;     // DRM format modifier
+  uint8_t reserved[16];
+};
+
+// Pipeline stage, create({ stages }). Stage s (1-based, stages[s - 1]) takes
+// the frames past its cursor up to the previous stage's cursor (the latest
+// published frame for the first stage), in order, and owns the slot until it
+// moves its cursor on. The last stage's cursor is what readers see
+// (latest_slot), the producer doesn't refill a slot before it gets there.
+// One reader entry runs the stage at a time: it is taken over once that
+// entry no longer runs it (detached, reclaimed from a dead process).
+struct alignas(64) StageDesc {
+  char name[STREAM_NAME_SIZE];
+  std::atomic<uint64_t> frame_index; // cursor: the last frame the stage released
+  std::atomic<int32_t> reader;       // reader entry running it + 1, 0 = nobody
+  uint32_t reserved;
+  std::atomic<uint64_t> frames;      // frames released
+  std::atomic<uint64_t> busy_ns;     // time between acquiring and releasing them
+};
+
+struct SharedHeader {
+  // line 0: fixed at create()
+  uint32_t magic;        // 0x5348444D 'SHDM'
+  uint32_t version;      // 14
+  uint64_t mapping_size; // total mapping size
+  uint32_t slot_count;   // ring slots in use (1..SHARED_MAX_SLOTS)
+  std::atomic<uint32_t> slot_capacity; // bytes usable per slot (committed, on a reserved mapping)
+  uint32_t page_size;    // page size the creator got for the mapping
+  uint32_t tile_count;   // entries of the tile table, 0 = no dirty tracking
+  uint64_t tile_offset;  // tile table offset from the mapping base
+  uint32_t generation;   // 0 for <name>, n for the re-allocated <name>@n
+  uint32_t slot_reserve; // bytes between slots: slot_capacity can grow up to this in place
+  uint64_t compress_offset;   // compression area of slot i: compress_offset + i * compress_capacity
+  uint32_t compress_capacity; // 0 = no compression areas
+  uint32_t stage_count;  // pipeline stages in use, 0 = none (frames go to readers on publish)
+  // line 1: format, rewritten by setFormat()
+  alignas(64) std::atomic<uint32_t> format_seq; // odd while the format is being changed
+  FrameFormat format;
+  // downscaled levels, fixed at create(): level area of slot i at
+  // level_offset + i * level_capacity, 0 levels = none
+  uint32_t level_count;
+  uint32_t level_capacity;
+  uint32_t reserved1;
+  uint64_t level_offset;
+  // line 2: producer, every publish
+  alignas(64) std::atomic<uint64_t> frame_index; // frames published so far, the latest one's index
+  std::atomic<int32_t> latest_slot; // last published slot, -1 before the first publish
+  uint32_t frame_size;   // bytes of the latest published frame
+  std::atomic<uint64_t> ring_full;  // getFrameBuffer() calls that found every slot in use
+  std::atomic<uint64_t> pin_backoffs; // slots given back because a reader pinned them under us
+  std::atomic<uint64_t> full_frame_index; // frames up to this one changed everywhere (no dirty list, setFormat())
+  std::atomic<uint32_t> next_generation; // nonzero: the producer moved to <name>@next_generation
+  std::atomic<uint32_t> compress_skipped; // frames left uncompressed, the compressor was still busy
+  std::atomic<uint64_t> compressed_frames;
+  std::atomic<uint64_t> published_index; // frame_index of the latest publish, stored once its slot is readable
+  // line 3: readers
+  alignas(64) std::atomic<int32_t> event_word; // shared event on POSIX (futex word)
+  uint8_t reserved3[60];
+  SlotDesc slots[SHARED_MAX_SLOTS];
+  ReaderDesc readers[SHARED_MAX_READERS];
+  GpuSurface gpu[SHARED_MAX_SLOTS];
+  StageDesc stages[SHARED_MAX_STAGES];
+};
+
+static_assert(sizeof(SlotDesc) == 128 && sizeof(ReaderDesc) == 256 && sizeof(GpuSurface) == 64 &&
+              sizeof(StageDesc) == 64, "descriptor layout");
+static_assert(offsetof(SharedHeader, format_seq) == 64 && offsetof(SharedHeader, frame_index) == 128 &&
+              offsetof(SharedHeader, event_word) == 192 && offsetof(SharedHeader, slots) == 256, "header layout");
+static_assert(offsetof(SharedHeader, readers) == 1280 && offsetof(SharedHeader, gpu) == 5376 &&
+              offsetof(SharedHeader, stages) == 5888 && sizeof(SharedHeader) == 6400, "header layout");
+static_assert(offsetof(SharedHeader, tile_offset) == 32 && offsetof(SharedHeader, full_frame_index) == 160, "header layout");
+static_assert(offsetof(SharedHeader, level_count) == 108 && offsetof(SharedHeader, level_offset) == 120, "header layout");
+static_assert(offsetof(SharedHeader, generation) == 40 && offsetof(SharedHeader, next_generation) == 168, "header layout");
+static_assert(offsetof(SharedHeader, stage_count) == 60 && offsetof(SharedHeader, published_index) == 184 &&
+              offsetof(ReaderDesc, stage) == 60 && offsetof(ReaderDesc, owner_ns) == 192, "header layout");
+static_assert(offsetof(SharedHeader, compress_offset) == 48 && offsetof(SharedHeader, compressed_frames) == 176 &&
+              offsetof(SlotDesc, compressed_index) == 48, "header layout");
+
+static const size_t HEADER_SIZE = sizeof(SharedHeader); // a multiple of 64
+
+// --- Stream containers ---
+// One mapping, many streams: the directory lists them and stream i's
+// SharedHeader sits at STREAM_DIRECTORY_SIZE + i * region_size. Offsets
+// inside a stream's header (slots, tile table) stay relative to the mapping
+// base. Every publish mirrors the stream's frame_index into its entry and
+// signals the attached waiters, so one wait covers every stream.
+
+struct alignas(64) StreamEntry {
+  std::atomic<int32_t> state;       // STREAM_FREE / STREAM_READY
+  uint32_t reserved0;
+  uint64_t offset;                  // the stream's SharedHeader from the mapping base
+  char name[STREAM_NAME_SIZE];
+  std::atomic<uint64_t> frame_index; // the stream's latest frame_index
+  uint8_t reserved1[8];
+};
+
+// waitStreams() registration, written by its owner only; the waiter's event
+// is SHM_EV_<name>_W<index>
+struct alignas(64) StreamWaiter {
+  std::atomic<int32_t> state;       // READER_FREE / READER_ATTACHED / READER_CLAIMING
+  uint32_t pid;
+  std::atomic<int32_t> event_word;  // its event on POSIX (futex word)
+  uint32_t reserved0;
+  uint64_t owner_ns;                // platform::ProcessToken of `pid`, 0 = unknown
+  uint64_t owner_start;
+  uint8_t reserved[32];
+};
+
+struct StreamDirectory {
+  // line 0: fixed when the container is created
+  std::atomic<uint32_t> magic; // 0x53484453 'SHDS', stored last by the creator
+  uint32_t version;        // 1
+  uint64_t mapping_size;
+  uint32_t stream_capacity; // entries (and regions) in use
+  uint32_t reserved_a;
+  uint64_t region_size;    // bytes per stream, a multiple of 4096
+  std::atomic<uint32_t> lock; // pid adding a stream, 0 = free
+  uint32_t reserved_b;
+  uint64_t lock_ns;        // platform::ProcessToken of the holder, 0 = unknown
+  uint64_t lock_start;
+  uint8_t reserved0[8];
+  // line 1
+  alignas(64) std::atomic<uint64_t> publish_count; // publishes on any stream
+  uint8_t reserved1[56];
+  StreamEntry streams[STREAMS_MAX];
+  StreamWaiter waiters[STREAMS_MAX_WAITERS];
+};
+
+static_assert(sizeof(StreamEntry) == 64 && sizeof(StreamWaiter) == 64, "stream descriptor layout");
+static_assert(offsetof(StreamDirectory, lock) == 32 && offsetof(StreamDirectory, publish_count) == 64 &&
+              offsetof(StreamDirectory, streams) == 128 && sizeof(StreamDirectory) == 5248, "stream directory layout");
+
+static const size_t STREAM_DIRECTORY_SIZE = (sizeof(StreamDirectory) + 4095) / 4096 * 4096;
+
+// Tile table: one generation per SHARED_TILE_SIZE square of the frame, row
+// major over the current format's tile grid. A generation is the low 32 bits
+// of the frame_index that last changed the tile; the producer stores them
+// before publishing that frame. Compare with (int32_t)(gen - since) > 0.
+typedef std::atomic<uint32_t> TileGen;
+
+static inline size_t TileTableBytes(uint32_t tileCount) {
+  return ((size_t)tileCount * sizeof(TileGen) + 63) / 64 * 64;
+}
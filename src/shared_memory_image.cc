@@ -5,392 +5,4184 @@
 
 */
 
-#include <node.h>
-#include <node_buffer.h>
-#include <node_object_wrap.h> // class instances
-#include <Windows.h>
+#include <node_api.h>
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <string>
-#include <emmintrin.h> // _mm_pause()
-
-using v8::FunctionCallbackInfo;
-using v8::FunctionTemplate;
-using v8::Isolate;
-using v8::Local;
-using v8::Object;
-using v8::String;
-using v8::Value;
-using v8::Number;
-using v8::Integer;
-using v8::Boolean;
-using v8::Context;
-using v8::Exception;
-using v8::Function;
-
-#define SHARED_MAGIC 0x5348444D
-
-// helper: portable 64-bit atomic increment
-static inline uint64_t AtomicIncrement64(volatile LONG64* p) {
-#if defined(_WIN64)
-    return InterlockedIncrement64(p);
-#else
-    // 32-bit: implement via CAS loop using InterlockedCompareExchange64
-    LONG64 oldval, newval;
-    do {
-        oldval = *p;
-        newval = oldval + 1;
-    } while (InterlockedCompareExchange64(p, newval, oldval) != oldval);
-    return static_cast<uint64_t>(newval);
-#endif
+#include <vector>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include "platform.h"
+#include "shared_header.h"
+#include "codec.h"
+#include "convert.h"
+#include "recording.h"
+#include "shm_image.h"
+#include "worker_pool.h"
+
+// the wire protocol, shared with native clients
+using shm_image::PIXEL_FORMAT_CHANNELS;
+using shm_image::FrameLayout;
+using shm_image::BytesPerPixel;
+using shm_image::ComputeLayout;
+using shm_image::MakeFormat;
+
+// --- N-API helpers ---
+
+// Arguments of a method call and its `this`; missing ones read as undefined
+struct CallArgs {
+  static const size_t MAX = 8;
+  napi_env env;
+  napi_value self = nullptr;
+  size_t length = 0;
+  napi_value argv[MAX] = {};
+
+  CallArgs(napi_env e, napi_callback_info info) : env(e) {
+    size_t argc = MAX;
+    napi_get_cb_info(env, info, &argc, argv, &self, nullptr); // pads argv with undefined
+    length = std::min(argc, MAX);
+  }
+  size_t Length() const { return length; }
+  napi_value operator[](size_t i) const { return argv[i < MAX ? i : MAX - 1]; }
+};
+
+static napi_valuetype TypeOf(napi_env env, napi_value v) {
+  napi_valuetype type = napi_undefined;
+  if (v) napi_typeof(env, v, &type);
+  return type;
+}
+static bool IsNumber(napi_env env, napi_value v) { return TypeOf(env, v) == napi_number; }
+static bool IsString(napi_env env, napi_value v) { return TypeOf(env, v) == napi_string; }
+static bool IsBigInt(napi_env env, napi_value v) { return TypeOf(env, v) == napi_bigint; }
+static bool IsFunction(napi_env env, napi_value v) { return TypeOf(env, v) == napi_function; }
+static bool IsObject(napi_env env, napi_value v) {
+  napi_valuetype type = TypeOf(env, v);
+  return type == napi_object || type == napi_function;
+}
+static bool IsNullish(napi_env env, napi_value v) {
+  napi_valuetype type = TypeOf(env, v);
+  return type == napi_undefined || type == napi_null;
+}
+static bool IsArray(napi_env env, napi_value v) { bool is = false; napi_is_array(env, v, &is); return is; }
+static bool IsBuffer(napi_env env, napi_value v) { bool is = false; napi_is_buffer(env, v, &is); return is; }
+
+// helper: a number as an integer (truncated), 0 for anything else
+static int64_t Int64(napi_env env, napi_value v) {
+  int64_t n = 0;
+  napi_get_value_int64(env, v, &n);
+  return n;
+}
+
+static double Double(napi_env env, napi_value v) {
+  double n = 0;
+  napi_get_value_double(env, v, &n);
+  return n;
+}
+
+// helper: a BigInt, or a number as one; false for anything else
+static bool Uint64(napi_env env, napi_value v, uint64_t* out) {
+  bool lossless;
+  if (IsBigInt(env, v)) return napi_get_value_bigint_uint64(env, v, out, &lossless) == napi_ok;
+  if (!IsNumber(env, v)) return false;
+  *out = (uint64_t)Int64(env, v);
+  return true;
+}
+
+// helper: JS truthiness of `v`
+static bool Truthy(napi_env env, napi_value v) {
+  napi_value b;
+  bool truthy = false;
+  if (napi_coerce_to_bool(env, v, &b) == napi_ok) napi_get_value_bool(env, b, &truthy);
+  return truthy;
+}
+
+// helper: a string's UTF-8 bytes, empty for anything else
+static std::string Utf8(napi_env env, napi_value v) {
+  size_t length = 0;
+  if (napi_get_value_string_utf8(env, v, nullptr, 0, &length) != napi_ok) return std::string();
+  std::string s(length, '\0');
+  napi_get_value_string_utf8(env, v, &s[0], length + 1, &length);
+  return s;
+}
+
+// helper: obj[key], undefined when obj isn't an object
+static napi_value Get(napi_env env, napi_value obj, const char* key) {
+  napi_value v = nullptr;
+  if (!IsObject(env, obj) || napi_get_named_property(env, obj, key, &v) != napi_ok) napi_get_undefined(env, &v);
+  return v;
+}
+
+static void Set(napi_env env, napi_value obj, const char* key, napi_value value) {
+  napi_set_named_property(env, obj, key, value);
+}
+
+static napi_value Null(napi_env env) { napi_value v; napi_get_null(env, &v); return v; }
+static napi_value Bool(napi_env env, bool b) { napi_value v; napi_get_boolean(env, b, &v); return v; }
+static napi_value Num(napi_env env, double n) { napi_value v; napi_create_double(env, n, &v); return v; }
+static napi_value Int(napi_env env, int32_t n) { napi_value v; napi_create_int32(env, n, &v); return v; }
+static napi_value Uint(napi_env env, uint32_t n) { napi_value v; napi_create_uint32(env, n, &v); return v; }
+static napi_value BigUint(napi_env env, uint64_t n) { napi_value v; napi_create_bigint_uint64(env, n, &v); return v; }
+static napi_value Str(napi_env env, const std::string& s) {
+  napi_value v;
+  napi_create_string_utf8(env, s.data(), s.size(), &v);
+  return v;
+}
+static napi_value NewObject(napi_env env) { napi_value v; napi_create_object(env, &v); return v; }
+static napi_value NewArray(napi_env env) { napi_value v; napi_create_array(env, &v); return v; }
+static void SetIndex(napi_env env, napi_value array, uint32_t i, napi_value value) { napi_set_element(env, array, i, value); }
+
+// helpers: throw, returning nullptr (undefined) for the method to return
+static napi_value ThrowError(napi_env env, const char* message) { napi_throw_error(env, nullptr, message); return nullptr; }
+static napi_value ThrowTypeError(napi_env env, const char* message) { napi_throw_type_error(env, nullptr, message); return nullptr; }
+static napi_value ThrowRangeError(napi_env env, const char* message) { napi_throw_range_error(env, nullptr, message); return nullptr; }
+
+// helpers: an Error / TypeError to reject a promise with
+static napi_value MakeError(napi_env env, const char* message) {
+  napi_value err;
+  napi_create_error(env, nullptr, Str(env, message), &err);
+  return err;
+}
+static napi_value MakeTypeError(napi_env env, const char* message) {
+  napi_value err;
+  napi_create_type_error(env, nullptr, Str(env, message), &err);
+  return err;
+}
+
+// helper: bytes of a Buffer (or any Uint8Array), false for anything else
+static bool BufferData(napi_env env, napi_value v, char** data, size_t* length) {
+  void* p = nullptr;
+  if (!IsBuffer(env, v) || napi_get_buffer_info(env, v, &p, length) != napi_ok) return false;
+  *data = static_cast<char*>(p);
+  return true;
+}
+
+// helper: bytes of a Buffer, any TypedArray or a DataView, false for anything else
+static bool ViewData(napi_env env, napi_value v, char** data, size_t* length) {
+  if (BufferData(env, v, data, length)) return true;
+  bool is = false;
+  void* p = nullptr;
+  if (napi_is_typedarray(env, v, &is) == napi_ok && is) {
+    static const size_t ELEMENT_BYTES[] = { 1, 1, 1, 2, 2, 4, 4, 4, 8, 8, 8 }; // napi_typedarray_type order
+    napi_typedarray_type type;
+    size_t count;
+    if (napi_get_typedarray_info(env, v, &type, &count, &p, nullptr, nullptr) != napi_ok ||
+        (size_t)type >= sizeof(ELEMENT_BYTES) / sizeof(ELEMENT_BYTES[0])) {
+      return false;
+    }
+    *data = static_cast<char*>(p);
+    *length = count * ELEMENT_BYTES[type];
+    return true;
+  }
+  if (napi_is_dataview(env, v, &is) == napi_ok && is) {
+    if (napi_get_dataview_info(env, v, length, &p, nullptr, nullptr) != napi_ok) return false;
+    *data = static_cast<char*>(p);
+    return true;
+  }
+  return false;
+}
+
+// helper: a new zero-filled Buffer of `size` bytes
+static napi_value NewBuffer(napi_env env, size_t size, char** data = nullptr) {
+  napi_value buf;
+  void* p = nullptr;
+  napi_create_buffer(env, size, &p, &buf);
+  if (size) memset(p, 0, size);
+  if (data) *data = static_cast<char*>(p);
+  return buf;
 }
 
-// no-op free for external Buffer
-static void noop_free(char* /*data*/, void* /*hint*/) { /* no-op */ }
-
-// Shared header layout
-#pragma pack(push,1)
-struct SharedHeader {
-  uint32_t magic;        // 0x5348444D 'SHDM'
-  uint32_t version;      // 1
-  volatile LONG seq;     // sequence counter (seqlock)
-  uint32_t width;
-  uint32_t height;
-  uint32_t channels;
-  uint32_t frame_size;   // bytes of current frame
-  uint64_t frame_index;  // ever increasing frame counter
-  uint64_t mapping_size; // total mapping size
-  uint8_t reserved[48];
+static napi_value CopyBuffer(napi_env env, const void* data, size_t size) {
+  napi_value buf;
+  napi_create_buffer_copy(env, size, data, nullptr, &buf);
+  return buf;
+}
+
+// helper: a Buffer taking ownership of the malloc'd `data`, a copy where
+// the runtime doesn't allow external memory
+static napi_value OwnedBuffer(napi_env env, char* data, size_t size) {
+  napi_value buf;
+  napi_status status = napi_create_external_buffer(env, size, data,
+      [](napi_env, void* d, void*) { free(d); }, nullptr, &buf);
+  if (status == napi_ok) return buf;
+  buf = CopyBuffer(env, data, size);
+  free(data);
+  return buf;
+}
+
+// helper: a zero-copy Buffer over mapping memory, which the instance owns
+static napi_value ViewBuffer(napi_env env, char* data, size_t size) {
+  napi_value buf;
+  if (!size) return NewBuffer(env, 0);
+  if (napi_create_external_buffer(env, size, data, nullptr, nullptr, &buf) != napi_ok) {
+    return ThrowError(env, "External buffers are not allowed in this runtime");
+  }
+  return buf;
+}
+
+// READ_STALE: written under an older format than the one to convert from
+// (setFormat() raced the frame), READ_UNSUPPORTED: no such conversion (or
+// level)
+enum ReadResult { READ_OK, READ_CONTENTION, READ_TIMEOUT, READ_STALE, READ_UNSUPPORTED };
+
+// Reader wait strategies, ordered from least to most eager
+enum WaitMode { WAIT_BLOCK, WAIT_ADAPTIVE, WAIT_SPIN, WAIT_BUSY };
+
+struct WaitPolicy {
+  WaitMode mode = WAIT_BLOCK;
+  uint32_t spinUs = 50;    // WAIT_SPIN: pause-spin this long before yielding
+  uint32_t yieldUs = 500;  // WAIT_SPIN: then yield the CPU this long before blocking
+  uint32_t marginUs = 500; // WAIT_ADAPTIVE: start spinning this long before the expected frame
+};
+
+static const char* WAIT_MODE_NAMES[] = { "block", "adaptive", "spin", "busy" };
+
+static const char* PIXEL_FORMAT_NAMES[PIXEL_FORMAT_COUNT] = {
+  "unknown", "bgra8", "rgba8", "bgr8", "rgb8", "gray8", "nv12", "p010", "rgba16f",
+};
+
+// readFrame({ format, premultiply, level, x, y, w, h }): what to convert the
+// frame to while copying it out, PIXEL_FORMAT_UNKNOWN keeps the stored format.
+// Level n > 0 reads the producer's 1/2^n size copy instead of the frame. A
+// region (w > 0) copies just those pixels (of the level), rows packed.
+struct ConvertSpec {
+  uint32_t format = PIXEL_FORMAT_UNKNOWN;
+  bool premultiply = false;
+  uint32_t level = 0;
+  uint32_t x = 0, y = 0, w = 0, h = 0;
+  bool raw() const { return format == PIXEL_FORMAT_UNKNOWN && !premultiply; }
+  bool whole() const { return !level && !w; }
+  bool operator==(const ConvertSpec& o) const {
+    return format == o.format && premultiply == o.premultiply && level == o.level &&
+           x == o.x && y == o.y && w == o.w && h == o.h;
+  }
+  // what a READ_UNSUPPORTED read of this throws
+  const char* unsupported() const {
+    if (level) return "The frame has no such level";
+    if (w) return raw() ? "Cannot read that region of the frame" : "Cannot read that region in that format";
+    return "Cannot convert the frame to that format";
+  }
 };
-#pragma pack(pop)
 
-static const size_t HEADER_SIZE = ((sizeof(SharedHeader) + 63) / 64) * 64;
+// STREAM_AUTO: streaming stores once a copy outgrows the caches
+enum StreamMode { STREAM_OFF, STREAM_ON, STREAM_AUTO };
+static const uint64_t STREAM_AUTO_BYTES = 8u << 20;
+
+// setCopyOptions({ threads, bytesPerThread, streaming }): how a frame is
+// copied out of the mapping. Frames split into one part per bytesPerThread
+// (at most `threads`, 0 = all the pool has), so small ones stay on the
+// reading thread.
+struct CopyPolicy {
+  uint32_t threads = 0;
+  uint32_t bytesPerThread = 2u << 20;
+  StreamMode streaming = STREAM_AUTO;
+};
+
+// One copy of a frame out of the mapping; data is malloc'd, ownership passes
+// to a Buffer. With `into` set (readFrameInto()) data is `into` when the frame
+// fits its intoSize bytes, a malloc'd block otherwise.
+struct FrameCopy {
+  ConvertSpec spec;
+  CopyPolicy policy;
+  ReadResult status = READ_OK;
+  char* into = nullptr;
+  size_t intoSize = 0;
+  char* data = nullptr;
+  uint32_t size = 0;
+  uint64_t frameIndex = 0;
+  uint64_t captureNs = 0;
+  uint64_t publishNs = 0;
+  // the format the frame was written under, read under the same pin
+  // (READ_STALE: replaced since, READ_CONTENTION: the producer kept at it)
+  FrameFormat format = {};
+  ReadResult formatStatus = READ_OK;
+};
+
+// Tile grid of a frame format for dirty tracking
+struct TileGrid {
+  uint32_t cols = 0;
+  uint32_t rows = 0;
+  uint32_t bpp = 0;
+};
+
+// helper: the grid of `fmt`, false when it doesn't fit `tileCount` entries
+static bool MakeTileGrid(const FrameFormat& fmt, uint32_t tileCount, TileGrid* grid) {
+  grid->bpp = BytesPerPixel(fmt.pixel_format, fmt.channels);
+  grid->cols = (fmt.width + SHARED_TILE_SIZE - 1) / SHARED_TILE_SIZE;
+  grid->rows = (fmt.height + SHARED_TILE_SIZE - 1) / SHARED_TILE_SIZE;
+  return grid->bpp && grid->cols && grid->rows && (uint64_t)grid->cols * grid->rows <= tileCount &&
+         fmt.plane_count >= 1 && fmt.plane_count <= SHARED_MAX_PLANES;
+}
+
+// helper: rows and bytes per row of plane `p`; the UV plane of NV12/P010
+// has half the rows, pairs padded to even widths
+static void PlaneExtent(const FrameFormat& fmt, const TileGrid& grid, uint32_t p, uint32_t* rows, uint64_t* rowBytes) {
+  *rows = p ? (fmt.height + 1) / 2 : fmt.height;
+  *rowBytes = p ? (uint64_t)((fmt.width + 1) / 2) * 2 * grid.bpp : (uint64_t)fmt.width * grid.bpp;
+}
+
+// helper: end of the last byte CopyTile() touches
+static uint64_t TiledBytes(const FrameFormat& fmt, const TileGrid& grid) {
+  uint64_t end = 0;
+  for (uint32_t p = 0; p < fmt.plane_count; p++) {
+    uint32_t rows;
+    uint64_t rowBytes;
+    PlaneExtent(fmt, grid, p, &rows, &rowBytes);
+    if (rows) end = std::max(end, fmt.plane_offset[p] + (uint64_t)fmt.plane_stride[p] * (rows - 1) + rowBytes);
+  }
+  return end;
+}
+
+// helper: copies tile (tx, ty) of a `fmt` frame, every plane
+static void CopyTile(const FrameFormat& fmt, const TileGrid& grid, const uint8_t* src, uint8_t* dst, uint32_t tx, uint32_t ty) {
+  for (uint32_t p = 0; p < fmt.plane_count; p++) {
+    uint32_t sub = p ? 2 : 1;
+    uint32_t planeRows;
+    uint64_t rowBytes;
+    PlaneExtent(fmt, grid, p, &planeRows, &rowBytes);
+    uint64_t x0 = (uint64_t)tx * SHARED_TILE_SIZE * grid.bpp;
+    size_t bytes = (size_t)std::min<uint64_t>((uint64_t)SHARED_TILE_SIZE * grid.bpp, rowBytes - x0);
+    uint32_t y0 = ty * SHARED_TILE_SIZE / sub;
+    uint32_t y1 = std::min(planeRows, y0 + SHARED_TILE_SIZE / sub);
+    for (uint32_t y = y0; y < y1; y++) {
+      uint64_t at = fmt.plane_offset[p] + (uint64_t)y * fmt.plane_stride[p] + x0;
+      memcpy(dst + at, src + at, bytes);
+    }
+  }
+}
 
-class SharedMemory : public node::ObjectWrap {
+class SharedMemory {
 public:
-  static void Init(Local<Object> exports);
+  static napi_value Init(napi_env env, napi_value exports);
 
 private:
-  explicit SharedMemory();
+  explicit SharedMemory(napi_env env);
   ~SharedMemory();
+  static void Finalize(napi_env env, void* data, void* hint);
+  static void Cleanup(void* data);
+  static SharedMemory* Unwrap(const CallArgs& args);
 
-  static void New(const FunctionCallbackInfo<Value>& args);
+  static napi_value New(napi_env env, napi_callback_info info);
   
   // Methods mapped to JS
-  static void Create(const FunctionCallbackInfo<Value>& args);
-  static void SetFormat(const FunctionCallbackInfo<Value>& args);
-  static void GetFrameBuffer(const FunctionCallbackInfo<Value>& args);
-  static void GetCapacity(const FunctionCallbackInfo<Value>& args);
-  static void PublishFrame(const FunctionCallbackInfo<Value>& args);
-  static void ReadFrame(const FunctionCallbackInfo<Value>& args);
-  static void Close(const FunctionCallbackInfo<Value>& args);
-  static void GetMetadata(const FunctionCallbackInfo<Value>& args);
+  static napi_value Create(napi_env env, napi_callback_info info);
+  static napi_value SetFormat(napi_env env, napi_callback_info info);
+  static napi_value Resize(napi_env env, napi_callback_info info);
+  static napi_value GetFrameBuffer(napi_env env, napi_callback_info info);
+  static napi_value GetCapacity(napi_env env, napi_callback_info info);
+  static napi_value PublishFrame(napi_env env, napi_callback_info info);
+  static napi_value WriteFrame(napi_env env, napi_callback_info info);
+  static napi_value ReadFrame(napi_env env, napi_callback_info info);
+  static napi_value ReadFrameAsync(napi_env env, napi_callback_info info);
+  static napi_value ReadFrameInto(napi_env env, napi_callback_info info);
+  static napi_value ReadFrames(napi_env env, napi_callback_info info);
+  static napi_value SetWaitPolicy(napi_env env, napi_callback_info info);
+  static napi_value SetReadMode(napi_env env, napi_callback_info info);
+  static napi_value SetLatencyOptions(napi_env env, napi_callback_info info);
+  static napi_value SetCopyOptions(napi_env env, napi_callback_info info);
+  static napi_value GetWaitStats(napi_env env, napi_callback_info info);
+  static napi_value AcquireFrame(napi_env env, napi_callback_info info);
+  static napi_value Release(napi_env env, napi_callback_info info);
+  static napi_value JoinStage(napi_env env, napi_callback_info info);
+  static napi_value LeaveStage(napi_env env, napi_callback_info info);
+  static napi_value AcquireStage(napi_env env, napi_callback_info info);
+  static napi_value ReleaseStage(napi_env env, napi_callback_info info);
+  static napi_value On(napi_env env, napi_callback_info info);
+  static napi_value Off(napi_env env, napi_callback_info info);
+  static napi_value Close(napi_env env, napi_callback_info info);
+  static napi_value GetMetadata(napi_env env, napi_callback_info info);
+  static napi_value GetStats(napi_env env, napi_callback_info info);
+  static napi_value Now(napi_env env, napi_callback_info info);
+  static napi_value Convert(napi_env env, napi_callback_info info);
+  static napi_value WaitStreams(napi_env env, napi_callback_info info);
+  static napi_value ListStreams(napi_env env, napi_callback_info info);
+  static napi_value GetWriteSlot(napi_env env, napi_callback_info info);
+  static napi_value SetSlotTexture(napi_env env, napi_callback_info info);
+  static napi_value AcquireTexture(napi_env env, napi_callback_info info);
+  static napi_value ReadCompressed(napi_env env, napi_callback_info info);
+  static napi_value Decompress(napi_env env, napi_callback_info info);
+  static napi_value Record(napi_env env, napi_callback_info info);
+  static napi_value StopRecording(napi_env env, napi_callback_info info);
+  static napi_value Play(napi_env env, napi_callback_info info);
+  static napi_value StopPlayback(napi_env env, napi_callback_info info);
 
   // Internal helpers
-  SharedHeader* headerPtr() { return reinterpret_cast<SharedHeader*>((uint8_t*)base_); }
-  void* dataPtr() { return (uint8_t*)base_ + HEADER_SIZE; }
+  SharedHeader* headerPtr() { return reinterpret_cast<SharedHeader*>((uint8_t*)base_ + streamOffset_); }
+  uint32_t slotCount();
+  void* slotPtr(uint32_t slot);
   size_t dataCapacity();
+  void commitSlots(uint32_t capacity);
+  bool resizeCapacity(uint64_t capacity, std::string* error);
+  uint32_t nextGeneration();
+  bool moved() { uint32_t g = nextGeneration(); return g && g != staleGeneration_.load(std::memory_order_relaxed); }
+  bool followGeneration();
+  void adoptMapping(platform::Mapping* next, const std::string& name);
+  int32_t acquireWriteSlot();
+  ReadResult pinLatestSlot(int32_t* outSlot);
+  ReadResult pinReadSlot(int32_t* outSlot);
+  void unpinSlot(int32_t slot);
+  ReadResult copyLatestFrame(FrameCopy* copies, size_t count, recording::QueuedWriter* recorder = nullptr);
+  void recordSlot(int32_t slot, recording::QueuedWriter* recorder);
+  void copyOut(int32_t slot, FrameCopy* copy);
+  void attachReader();
+  void startLossless();
+  void detachReader();
+  uint32_t attachedReaders();
+  void notifyReaders(uint32_t stage = 0);
+  bool releaseStage();
+  void leaveStage();
+  platform::Event* waitEvent() { return readerEvent_ ? readerEvent_ : event_; }
+  uint64_t latestFrameIndex();
+  bool readFormat(FrameFormat* out, uint32_t* outSeq);
+  bool waitForFrame(const WaitPolicy& policy, uint32_t timeoutMs, platform::Event* wake, const std::atomic<bool>* cancel);
+  void recordWake(WaitMode woke, uint64_t spins);
+  void consumeSlot(int32_t slot);
+  void addRetries(uint64_t n);
+  void countParallelCopy() { std::lock_guard<std::mutex> lock(statsMutex_); parallelCopies_++; }
+  TileGen* tileTable();
+  int64_t copyChangedTiles(const FrameFormat& fmt, const uint8_t* src, uint8_t* dst, uint32_t frameBytes,
+                           uint64_t since, uint64_t current, uint32_t* tileTotal);
+  void syncWriteSlot(int32_t slot);
+  bool markDirtyTiles(napi_value rects, uint64_t index);
+  ReadResult readIncremental();
+  bool openStream(const std::string& name, uint64_t regionSize, uint32_t streams, bool created,
+                  const std::function<void()>& initHeader, std::string* error);
+  void attachWaiter();
+  void detachWaiter();
+  void notifyWaiters();
+  ReaderDesc* readerDesc() { return readerIndex_ >= 0 ? &headerPtr()->readers[readerIndex_] : nullptr; }
+  bool acquireLatest(const CallArgs& args, int32_t* slot);
+  void closeGpuImports();
+  uint8_t* compressArea(int32_t slot);
+  uint8_t* levelArea(int32_t slot);
+  bool buildLevels(int32_t slot, uint32_t frameBytes);
+  bool compressionWanted();
+  void startCompress(int32_t slot);
+  void compressLoop();
+  void stopCompressor();
+  void writeFormat(const FrameFormat& next);
+  void publishSlot(int32_t slot, uint32_t frameBytes, uint64_t captureNs, uint32_t gpuFlags);
+  bool notPlaying();
+  void playLoop(recording::Reader* reader, double speed, bool loop);
+  void endPlayback(const char* rejectWith);
+  void attachRecorder();
+  void detachRecorder();
+  void stopRecorder();
+  void disconnect();
+
+  // Async delivery: a per-instance watcher thread waits on the frame event
+  // and copies the frame, the JS thread only wraps and delivers it.
+  struct AsyncRequest {
+    uint32_t id;
+    uint64_t deadline;          // monotonic ms, 0 = no timeout
+    WaitPolicy policy;
+    ConvertSpec convert;
+    CopyPolicy copy;
+  };
+  struct AsyncResult {
+    std::vector<std::pair<uint32_t, size_t>> ids; // readFrameAsync() requests served, and their copy
+    bool toListeners = false;    // deliver copies[0] to on('frame') listeners too
+    ReadResult status = READ_OK;
+    std::vector<FrameCopy> copies; // one per distinct conversion asked for
+  };
+
+  void ensureAsync();
+  void ensureWatcher();
+  void stopWatcher();
+  bool pauseWatcher();
+  void resumeWatcher();
+  void watchLoop();
+  void updateAsyncRef();
+  void rejectPending(const char* message);
+  static void OnAsync(napi_env env, napi_value callback, void* context, void* data);
+  void signalAsync() { if (async_) napi_call_threadsafe_function(async_, nullptr, napi_tsfn_nonblocking); }
 
   // Member variables
-  HANDLE hMap_ = nullptr;
+  platform::Mapping mapping_;
   void* base_ = nullptr;
   size_t mapSize_ = 0;
-  HANDLE hEvent_ = nullptr;
-  std::string eventName_;
+  platform::Event* event_ = nullptr;
+  std::string mapName_;
+  int32_t readerIndex_ = -1;        // our entry in SharedHeader::readers
+  platform::Event* readerEvent_ = nullptr;
+  platform::Event* readerEvents_[SHARED_MAX_READERS] = {}; // producer side, opened lazily
+  // stream containers: our stream's header and the directory around it
+  size_t streamOffset_ = 0;
+  StreamDirectory* dir_ = nullptr;
+  int32_t streamIndex_ = -1;
+  std::string containerName_;
+  int32_t waiterIndex_ = -1;        // our entry in StreamDirectory::waiters
+  platform::Event* waiterEvent_ = nullptr;
+  platform::Event* waiterEvents_[STREAMS_MAX_WAITERS] = {}; // producer side, opened lazily
+  uint64_t streamSeen_[STREAMS_MAX] = {}; // frame_index per stream at the last waitStreams()
+  // resize(): generations <rootName_>@<n> of the mapping
+  std::string rootName_;
+  platform::MappingOptions mapOptions_;
+  platform::Mapping rootMapping_;   // generation 0 once we moved off it, it knows the newest one
+  platform::Mapping retired_;       // the generation an acquireFrame() view still points into
+  std::atomic<uint32_t> committed_{0};       // slot bytes committed in our view (reserved mappings)
+  std::atomic<uint32_t> staleGeneration_{0}; // a generation that was gone when we tried to follow it
+  int32_t writeSlot_ = -1;  // slot handed out by getFrameBuffer, not yet published
+  int32_t pinnedSlot_ = -1; // slot held by acquireFrame() until release()
+  // acquireTexture(): our copies of the producer's slot texture handles,
+  // redone when the slot's GpuSurface::serial changes
+  struct GpuImport { uint32_t serial = 0; uint64_t handle = 0; bool open = false; };
+  GpuImport gpuImports_[SHARED_MAX_SLOTS];
+  // create({ compression }): the producer compresses published frames on its
+  // own thread, one at a time, guarded by compressMutex_
+  struct CompressJob { int32_t slot; uint64_t index; uint32_t frameBytes; FrameFormat fmt; };
+  std::thread compressThread_;
+  std::mutex compressMutex_;
+  std::condition_variable compressCv_;
+  CompressJob compressJob_ = {};
+  bool compressBusy_ = false;       // a job is pending or running, its slot pinned
+  bool compressStop_ = false;
+  platform::Event* compressEvents_[SHARED_MAX_READERS] = {}; // compressor thread only
+  bool wantCompressed_ = false;     // readCompressed() reader, kept across generations
+  uint64_t compressedSeen_ = 0;     // frame_index of the last compressed frame read
+  std::atomic<uint64_t> lastSeenIndex_{0}; // frame_index of the last frame we consumed
+  // setReadMode('lossless'): frames are read in order from the cursor
+  // (lastSeenIndex_) instead of skipping to the latest; blockProducer_ keeps
+  // the producer from refilling the ones we haven't read
+  std::atomic<bool> lossless_{false};
+  bool blockProducer_ = true;
+  // joinStage(): the pipeline stage we run (1-based, 0 = none). Frames are
+  // taken from the cursor (lastSeenIndex_) up to the stage before's;
+  // stageSlot_ is the one acquireStage() handed out
+  std::atomic<uint32_t> stage_{0};
+  int32_t stageSlot_ = -1;
+  uint64_t stageAcquiredNs_ = 0;
+
+  // wait policy (setWaitPolicy) and measured wake-ups, guarded by statsMutex_
+  std::mutex statsMutex_;
+  WaitPolicy policy_;
+  WaitPolicy currentPolicy() { std::lock_guard<std::mutex> lock(statsMutex_); return policy_; }
+  CopyPolicy copyPolicy_;
+  CopyPolicy currentCopyPolicy() { std::lock_guard<std::mutex> lock(statsMutex_); return copyPolicy_; }
+  uint64_t parallelCopies_ = 0; // copies split across the worker pool
+  uint64_t tilesCopied_ = 0;    // readFrame({ incremental }) tile copies
+  uint64_t tilesSkipped_ = 0;   // and tiles that were already up to date
+  uint64_t wakeups_[4] = {};   // per WaitMode that delivered the frame
+  uint64_t timeouts_ = 0;
+  uint64_t spinIterations_ = 0;
+  uint64_t latencyCount_ = 0;
+  uint64_t latencySumNs_ = 0;
+  uint64_t latencyMaxNs_ = 0;
+  uint64_t latencyLastNs_ = 0;
+  uint64_t lastPublishNs_ = 0;
+  uint64_t intervalNs_ = 0;    // EWMA of the publish interval, drives WAIT_ADAPTIVE
+  uint64_t framesRead_ = 0;
+  uint64_t framesDropped_ = 0;
+  std::atomic<uint64_t> retries_{0}; // pin/format seqlock retries
+  struct { uint64_t index, captureNs, publishNs, readNs; } lastFrame_ = {}; // last frame consumed
+
+  // watcher thread state, guarded by watchMutex_
+  std::thread watchThread_;
+  std::mutex watchMutex_;
+  std::condition_variable watchCv_;
+  std::vector<AsyncRequest> requests_;
+  std::deque<AsyncResult> results_;
+  bool subscribed_ = false;
+  bool watchStop_ = false;
+  bool remapPending_ = false;      // the watcher waits for the JS thread to follow a resize
+  platform::Event* wake_ = nullptr; // kicks the watcher out of its frame wait
+  std::atomic<bool> watchKick_{false}; // same, for the spinning wait modes
+  // setLatencyOptions(): what the watcher asks of the scheduler, taken up
+  // by the watcher itself whenever latencySeq_ moves
+  platform::ThreadLatency latency_;
+  uint32_t latencySeq_ = 0;
+  bool latencyApplied_ = false;
+  std::string latencyError_;
+  // record(): the watcher pins every frame it consumes once more on the
+  // recorder's reader entry, the recorder's thread writes it from the slot
+  // and unpins it. Replaced only while the watcher is paused; the entry
+  // changes only while the recorder is drained.
+  std::unique_ptr<recording::QueuedWriter> recorder_;
+  int32_t recorderIndex_ = -1;
+
+  // play(): a thread publishing a recording as the producer; the JS
+  // producer methods are off limits while it runs
+  std::thread playThread_;
+  std::atomic<bool> playStop_{false};
+  std::atomic<bool> playDone_{false};  // the thread finished, OnAsync() settles the promise
+  std::atomic<uint64_t> playFrames_{0};
+  std::atomic<uint64_t> playSkipped_{0}; // frames whose segment is missing or short
+
+  // JS thread only
+  napi_env env_;
+  napi_ref wrapper_ = nullptr;     // weak, strong while updateAsyncRef() holds the instance
+  bool cleanedUp_ = false;         // Cleanup() ran: the env is going away
+  napi_threadsafe_function async_ = nullptr; // wakes OnAsync() from the watcher and player threads
+  std::map<uint32_t, napi_deferred> resolvers_;
+  std::vector<napi_ref> listeners_;
+  napi_deferred playResolver_ = nullptr;
+  uint32_t nextRequestId_ = 1;
+  bool asyncRefed_ = false;
+  // readFrame({ incremental }): reader-owned copy updated tile by tile
+  napi_ref incBuffer_ = nullptr;
+  uint32_t incSize_ = 0;
+  uint64_t incIndex_ = 0;        // frame_index the buffer holds, 0 = nothing yet
+  uint32_t incFormatSeq_ = 1;    // format_seq it was copied under (odd: unknown)
 };
 
 // --- Implementation ---
 
-SharedMemory::SharedMemory() {}
+SharedMemory::SharedMemory(napi_env env) : env_(env) {}
 
 SharedMemory::~SharedMemory() {
-  if (base_) UnmapViewOfFile(base_);
-  if (hMap_) CloseHandle(hMap_);
-  if (hEvent_) CloseHandle(hEvent_);
+  if (!cleanedUp_) {
+    napi_remove_env_cleanup_hook(env_, Cleanup, this);
+    Cleanup(this);
+  }
 }
 
-size_t SharedMemory::dataCapacity() {
-  if (mapSize_ <= HEADER_SIZE) return 0;
-  return mapSize_ - HEADER_SIZE;
+void SharedMemory::Finalize(napi_env env, void* data, void* /*hint*/) {
+  SharedMemory* obj = static_cast<SharedMemory*>(data);
+  napi_delete_reference(env, obj->wrapper_);
+  delete obj;
 }
 
-void SharedMemory::Init(Local<Object> exports) {
-  Isolate* isolate = exports->GetIsolate();
-  Local<Context> context = isolate->GetCurrentContext();
+// Stops our threads and drops the mapping, no JS involved: the instance
+// was collected, or its env (a worker's, say) is being torn down with
+// the instance still alive.
+void SharedMemory::Cleanup(void* data) {
+  SharedMemory* obj = static_cast<SharedMemory*>(data);
+  obj->cleanedUp_ = true;
+  obj->playStop_ = true;
+  if (obj->playThread_.joinable()) obj->playThread_.join();
+  obj->stopWatcher();
+  obj->stopRecorder();
+  if (obj->async_) napi_release_threadsafe_function(obj->async_, napi_tsfn_abort);
+  obj->async_ = nullptr;
+  for (napi_ref fn : obj->listeners_) napi_delete_reference(obj->env_, fn);
+  obj->listeners_.clear();
+  obj->disconnect();
+}
 
-  Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New);
-  tpl->SetClassName(String::NewFromUtf8(isolate, "SharedMemory").ToLocalChecked());
-  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+SharedMemory* SharedMemory::Unwrap(const CallArgs& args) {
+  void* obj = nullptr;
+  napi_unwrap(args.env, args.self, &obj);
+  return static_cast<SharedMemory*>(obj);
+}
 
-  // Prototype methods
-  NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "setFormat", SetFormat);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "getFrameBuffer", GetFrameBuffer);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "getCapacity", GetCapacity);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "publishFrame", PublishFrame);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "readFrame", ReadFrame);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
-  NODE_SET_PROTOTYPE_METHOD(tpl, "getMetadata", GetMetadata);
-
-  Local<Function> constructor = tpl->GetFunction(context).ToLocalChecked();
-  exports->Set(context, String::NewFromUtf8(isolate, "SharedMemory").ToLocalChecked(), constructor).Check();
-}
-
-void SharedMemory::New(const FunctionCallbackInfo<Value>& args) {
-  Isolate* isolate = args.GetIsolate();
-  Local<Context> context = isolate->GetCurrentContext();
-
-  if (args.IsConstructCall()) {
-    // been called with 'new SharedMemory()' - ok
-    SharedMemory* obj = new SharedMemory();
-    obj->Wrap(args.This());
-    args.GetReturnValue().Set(args.This());
-  } else {
-    // been called as 'SharedMemory()' without new;
-    // throwing an exception.
-    isolate->ThrowException(Exception::TypeError(
-        String::NewFromUtf8(isolate, "Class constructors cannot be invoked without 'new'").ToLocalChecked()));
+// Drops the mapping and everything tied to it. The watcher must be stopped.
+void SharedMemory::disconnect() {
+  leaveStage();
+  unpinSlot(pinnedSlot_);
+  pinnedSlot_ = -1;
+  detachReader();
+  detachWaiter();
+  for (platform::Event*& ev : readerEvents_) { platform::CloseEvent(ev); ev = nullptr; }
+  for (platform::Event*& ev : waiterEvents_) { platform::CloseEvent(ev); ev = nullptr; }
+  platform::CloseEvent(event_);
+  event_ = nullptr;
+  closeGpuImports();
+  stopCompressor();
+  wantCompressed_ = false;
+  compressedSeen_ = 0;
+  platform::CloseMapping(&mapping_);
+  platform::CloseMapping(&retired_);
+  platform::CloseMapping(&rootMapping_);
+  base_ = nullptr;
+  mapSize_ = 0;
+  committed_ = 0;
+  staleGeneration_ = 0;
+  writeSlot_ = -1;
+  if (incBuffer_) napi_delete_reference(env_, incBuffer_);
+  incBuffer_ = nullptr;
+  incSize_ = 0;
+  incIndex_ = 0;
+  streamOffset_ = 0;
+  dir_ = nullptr;
+  streamIndex_ = -1;
+  memset(streamSeen_, 0, sizeof(streamSeen_));
+}
+
+uint32_t SharedMemory::slotCount() {
+  return base_ ? shm_image::SlotCount(headerPtr(), mapSize_) : 0;
+}
+
+void* SharedMemory::slotPtr(uint32_t slot) {
+  return shm_image::SlotData(base_, mapSize_, headerPtr(), slot);
+}
+
+TileGen* SharedMemory::tileTable() {
+  SharedHeader* hdr = headerPtr();
+  uint32_t count = hdr->tile_count;
+  if (!count || count > SHARED_MAX_TILES || hdr->tile_offset < HEADER_SIZE ||
+      hdr->tile_offset + TileTableBytes(count) > mapSize_) return nullptr;
+  return reinterpret_cast<TileGen*>((uint8_t*)base_ + hdr->tile_offset);
+}
+
+// Brings `dst`, a copy of frame `since`, up to date with `src`, a `fmt`
+// frame of `frameBytes` and index `current`: copies the tiles changed after
+// `since`. Returns how many, -1 when the tile table can't tell (no table or
+// grid, a frame published whole, too old a copy) and all of it has to be
+// copied. *tileTotal = tiles in the grid.
+int64_t SharedMemory::copyChangedTiles(const FrameFormat& fmt, const uint8_t* src, uint8_t* dst, uint32_t frameBytes,
+                                       uint64_t since, uint64_t current, uint32_t* tileTotal) {
+  SharedHeader* hdr = headerPtr();
+  TileGen* gens = tileTable();
+  TileGrid grid;
+  *tileTotal = 0;
+  if (!gens || !MakeTileGrid(fmt, hdr->tile_count, &grid)) return -1;
+  *tileTotal = grid.cols * grid.rows;
+  if (!since || current < since || current - since >= (1ull << 31) ||
+      since < hdr->full_frame_index.load(std::memory_order_relaxed)) return -1;
+  if (TiledBytes(fmt, grid) > frameBytes) return -1;
+
+  int64_t copied = 0;
+  for (uint32_t ty = 0; ty < grid.rows; ty++) {
+    for (uint32_t tx = 0; tx < grid.cols; tx++) {
+      uint32_t gen = gens[ty * grid.cols + tx].load(std::memory_order_relaxed);
+      if ((int32_t)(gen - (uint32_t)since) <= 0) continue;
+      CopyTile(fmt, grid, src, dst, tx, ty);
+      copied++;
+    }
   }
+  return copied;
 }
 
-// --- Method Implementations ---
+// On a reserved mapping every view commits the slot pages before touching
+// them, as resize() grows the slots in place.
+size_t SharedMemory::dataCapacity() {
+  if (slotCount() == 0) return 0;
+  uint32_t capacity = headerPtr()->slot_capacity.load(std::memory_order_acquire);
+  if (mapping_.reserved && capacity > committed_.load(std::memory_order_acquire)) commitSlots(capacity);
+  return capacity;
+}
 
-void SharedMemory::Create(const FunctionCallbackInfo<Value>& args) {
-  Isolate* isolate = args.GetIsolate();
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
+void SharedMemory::commitSlots(uint32_t capacity) {
+  shm_image::CommitSlots(&mapping_, headerPtr(), capacity);
+  committed_.store(capacity, std::memory_order_release);
+}
 
-  if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsNumber()) {
-    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Args: name, size").ToLocalChecked()));
-    return;
+// --- Resizing ---
+
+// Makes every slot `capacity` bytes (a multiple of 64). Up to slot_reserve
+// that happens in place; past it the ring moves into a new generation
+// <root>@<n> with room for `capacity`, the latest frame carried over, and the
+// old header points readers at it. A frame being written (getFrameBuffer())
+// is dropped.
+bool SharedMemory::resizeCapacity(uint64_t capacity, std::string* error) {
+  SharedHeader* hdr = headerPtr();
+  if (dir_) {
+    *error = "Streams cannot be resized";
+    return false;
+  }
+  if (capacity <= hdr->slot_reserve) {
+    hdr->slot_capacity.store((uint32_t)capacity, std::memory_order_release);
+    return true;
+  }
+  if (hdr->stage_count) {
+    *error = "Pipelines cannot move to a new mapping, create them with a larger maxFrameSize";
+    return false;
   }
 
-  // Cleanup if already opened
-  if (obj->base_) { UnmapViewOfFile(obj->base_); obj->base_ = nullptr; }
-  if (obj->hMap_) { CloseHandle(obj->hMap_); obj->hMap_ = nullptr; }
+  uint32_t slots = slotCount();
+  uint64_t slotsOffset = (HEADER_SIZE + TileTableBytes(hdr->tile_count) + 4095) / 4096 * 4096;
+  // page aligned slots, as create() lays them out
+  uint64_t stride = (capacity + 4095) / 4096 * 4096;
+  uint64_t compressCapacity = 0;
+  if (hdr->compress_capacity) {
+    uint64_t align = mapOptions_.reserve ? 4096 : 64;
+    compressCapacity = (codec::Bound(stride) + align - 1) / align * align;
+    if (compressCapacity > UINT32_MAX) {
+      *error = "Invalid frame size";
+      return false;
+    }
+  }
+  uint64_t levelCapacity = shm_image::LevelCapacity(stride, hdr->level_count, mapOptions_.reserve ? 4096 : 64);
+  if (levelCapacity > UINT32_MAX) {
+    *error = "Invalid frame size";
+    return false;
+  }
+  uint64_t mappingSize = slotsOffset + (stride + compressCapacity + levelCapacity) * slots;
+  platform::MappingOptions options = mapOptions_;
+  options.commitBytes = slotsOffset;
+  platform::Mapping next;
+  bool created = false;
+  std::string name;
+  uint32_t gen = std::max(hdr->generation, nextGeneration());
+  // a generation that exists already is a crashed producer's leftover, skip it
+  for (int attempt = 0; attempt < 16 && !created; attempt++) {
+    platform::CloseMapping(&next);
+    name = shm_image::GenerationName(rootName_, ++gen);
+    if (!platform::OpenOrCreateMapping(name, mappingSize, options, &next, &created, error)) {
+      return false;
+    }
+  }
+  if (!created) {
+    platform::CloseMapping(&next);
+    *error = "No free generation to resize into";
+    return false;
+  }
 
-  String::Utf8Value name(isolate, args[0]);
-  std::string mapName(*name);
-  uint64_t requestedSize = (uint64_t)args[1]->IntegerValue(isolate->GetCurrentContext()).FromJust();
+  SharedHeader* to = static_cast<SharedHeader*>(next.base);
+  memset((void*)to, 0, sizeof(SharedHeader));
+  to->magic = SHARED_MAGIC;
+  to->version = SHARED_VERSION;
+  to->mapping_size = next.size;
+  to->slot_count = slots;
+  to->slot_capacity.store((uint32_t)capacity, std::memory_order_relaxed);
+  to->slot_reserve = (uint32_t)stride;
+  to->page_size = (uint32_t)next.pageSize;
+  to->tile_count = hdr->tile_count;
+  to->tile_offset = hdr->tile_count ? HEADER_SIZE : 0;
+  to->generation = gen;
+  to->format_seq.store(hdr->format_seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  memcpy(&to->format, &hdr->format, sizeof(FrameFormat));
+  uint64_t index = hdr->frame_index.load(std::memory_order_relaxed);
+  to->frame_index.store(index, std::memory_order_relaxed);
+  to->published_index.store(index, std::memory_order_relaxed);
+  to->full_frame_index.store(index + 1, std::memory_order_relaxed); // the tile table starts out empty
+  to->ring_full.store(hdr->ring_full.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  to->pin_backoffs.store(hdr->pin_backoffs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  to->latest_slot.store(-1, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < slots; i++) to->slots[i].offset = slotsOffset + stride * i;
+  to->compress_offset = compressCapacity ? slotsOffset + stride * slots : 0;
+  to->compress_capacity = (uint32_t)compressCapacity;
+  to->level_count = levelCapacity ? hdr->level_count : 0;
+  to->level_capacity = (uint32_t)levelCapacity;
+  to->level_offset = levelCapacity ? slotsOffset + (stride + compressCapacity) * slots : 0;
+  to->compressed_frames.store(hdr->compressed_frames.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  to->compress_skipped.store(hdr->compress_skipped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  // same textures, same serials: readers keep their imports
+  memcpy((void*)to->gpu, (const void*)hdr->gpu, sizeof(hdr->gpu));
 
-  uint32_t width = 0, height = 0, channels = 0;
-  if (args.Length() >= 5) {
-    width = (uint32_t)args[2]->IntegerValue(isolate->GetCurrentContext()).FromJust();
-    height = (uint32_t)args[3]->IntegerValue(isolate->GetCurrentContext()).FromJust();
-    channels = (uint32_t)args[4]->IntegerValue(isolate->GetCurrentContext()).FromJust();
+  // the latest frame carries over, so a reader moving over misses nothing;
+  // with one slot we may be rewriting it, then it is lost
+  int32_t latest = hdr->latest_slot.load(std::memory_order_relaxed);
+  const uint8_t* src = latest >= 0 && (uint32_t)latest < slots && latest != writeSlot_
+      ? static_cast<const uint8_t*>(slotPtr((uint32_t)latest)) : nullptr;
+  if (src && hdr->slots[latest].frame_size <= hdr->slot_capacity) {
+    const SlotDesc* from = &hdr->slots[latest];
+    SlotDesc* desc = &to->slots[0];
+    platform::CommitRange(&next, desc->offset, from->frame_size);
+    memcpy((uint8_t*)next.base + desc->offset, src, from->frame_size);
+    desc->frame_size = from->frame_size;
+    desc->format_seq = from->format_seq;
+    desc->gpu_flags = 0; // slot 0's texture isn't the one the frame was rendered into
+    desc->frame_index.store(from->frame_index.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    desc->publish_ns.store(from->publish_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    desc->capture_ns.store(from->capture_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    to->frame_size = from->frame_size;
+    to->latest_slot.store(0, std::memory_order_relaxed);
   }
 
-  obj->hMap_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mapName.c_str());
-  bool isCreator = false;
+  // our write slot stays odd, readers of the old generation never see it
+  writeSlot_ = -1;
+  hdr->next_generation.store(gen, std::memory_order_release);
+  if (rootMapping_.base) static_cast<SharedHeader*>(rootMapping_.base)->next_generation.store(gen, std::memory_order_release);
+  notifyReaders(); // sleeping readers wake up and follow
+  adoptMapping(&next, name);
+  return true;
+}
 
-  if (!obj->hMap_) {
-    DWORD sizeLow = static_cast<DWORD>(requestedSize & 0xFFFFFFFF);
-    DWORD sizeHigh = static_cast<DWORD>((requestedSize >> 32) & 0xFFFFFFFF);
-    obj->hMap_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, sizeHigh, sizeLow, mapName.c_str());
-    if (!obj->hMap_) {
-      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "CreateFileMapping failed").ToLocalChecked()));
-      return;
+// Newest generation the producer moved to past ours, 0 for none: our header
+// points at the one after it, the root's at the newest.
+uint32_t SharedMemory::nextGeneration() {
+  if (!base_ || dir_ || mapSize_ < sizeof(SharedHeader)) return 0;
+  SharedHeader* hdr = headerPtr();
+  uint32_t next = hdr->next_generation.load(std::memory_order_acquire);
+  if (rootMapping_.base) {
+    next = std::max(next, static_cast<SharedHeader*>(rootMapping_.base)->next_generation.load(std::memory_order_acquire));
+  }
+  return next > hdr->generation ? next : 0;
+}
+
+// Moves a reader onto the generation the producer resized into. JS thread
+// only. False when there is none, or it is gone already (we then stay put
+// until the producer moves again).
+bool SharedMemory::followGeneration() {
+  uint32_t gen = nextGeneration();
+  if (!gen || gen == staleGeneration_.load(std::memory_order_relaxed)) return false;
+
+  std::string name = shm_image::GenerationName(rootName_, gen);
+  platform::MappingOptions options = mapOptions_;
+  options.openOnly = true;
+  platform::Mapping next;
+  bool created = false;
+  std::string error;
+  SharedHeader* to = nullptr;
+  if (platform::OpenOrCreateMapping(name, 0, options, &next, &created, &error) && next.size >= sizeof(SharedHeader)) {
+    to = static_cast<SharedHeader*>(next.base);
+  }
+  if (!to || to->magic != SHARED_MAGIC || to->version != SHARED_VERSION || to->generation != gen) {
+    platform::CloseMapping(&next);
+    staleGeneration_.store(gen, std::memory_order_relaxed);
+    return false;
+  }
+  adoptMapping(&next, name);
+  return true;
+}
+
+// Switches this instance over to `next` (mapping `name`), keeping its reader
+// entry, watcher and frame count. The root stays mapped so we keep finding
+// the newest generation; a view acquireFrame() handed out keeps the old
+// generation mapped until release().
+void SharedMemory::adoptMapping(platform::Mapping* next, const std::string& name) {
+  stopCompressor(); // done with our slot, it restarts on the next publish
+  bool watching = pauseWatcher();
+  // the recorder writes straight from the old mapping's slots
+  if (recorder_) recorder_->drain();
+  detachRecorder();
+  bool wasReader = readerIndex_ >= 0;
+  bool held = pinnedSlot_ >= 0;
+  unpinSlot(pinnedSlot_);
+  pinnedSlot_ = -1;
+  detachReader();
+  for (platform::Event*& ev : readerEvents_) { platform::CloseEvent(ev); ev = nullptr; }
+  platform::CloseEvent(event_);
+  platform::CloseMapping(&retired_);
+  if (headerPtr()->generation == 0 && !rootMapping_.base) rootMapping_ = mapping_;
+  else if (held) retired_ = mapping_;
+  else platform::CloseMapping(&mapping_);
+
+  mapping_ = *next;
+  *next = platform::Mapping();
+  base_ = mapping_.base;
+  mapSize_ = mapping_.size;
+  mapName_ = name;
+  committed_.store(0, std::memory_order_relaxed);
+  event_ = platform::OpenSharedEvent(shm_image::SharedEventName(name), &headerPtr()->event_word, true);
+  if (wasReader) attachReader();
+  if (recorder_) attachRecorder();
+  if (watching) resumeWatcher();
+}
+
+// helper: reads { format, alignment } over *format / *alignment, throws on an
+// unknown format or an alignment that isn't a power of two up to 4096
+static bool ParseFormatOptions(napi_env env, napi_value value, uint32_t* format, uint32_t* alignment) {
+  if (!IsObject(env, value)) return true;
+
+  napi_value v = Get(env, value, "format");
+  if (IsString(env, v)) {
+    std::string name = Utf8(env, v);
+    int found = -1;
+    for (int i = 1; i < PIXEL_FORMAT_COUNT; i++) {
+      if (name == PIXEL_FORMAT_NAMES[i]) found = i;
+    }
+    if (found < 0) {
+      ThrowTypeError(env, "Unknown pixel format");
+      return false;
     }
-    isCreator = true;
+    *format = (uint32_t)found;
   }
 
-  obj->base_ = MapViewOfFile(obj->hMap_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
-  if (!obj->base_) {
-    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "MapViewOfFile failed").ToLocalChecked()));
-    return;
+  v = Get(env, value, "alignment");
+  if (IsNumber(env, v)) {
+    int64_t a = Int64(env, v);
+    if (a < 1 || a > SHARED_MAX_ALIGNMENT || (a & (a - 1)) != 0) {
+      ThrowRangeError(env, "alignment must be a power of two up to 4096");
+      return false;
+    }
+    *alignment = (uint32_t)a;
   }
+  return true;
+}
 
-  MEMORY_BASIC_INFORMATION mbi;
-  VirtualQuery(obj->base_, &mbi, sizeof(mbi));
-  obj->mapSize_ = mbi.RegionSize;
+// Seqlock read of the format line: a copy no concurrent setFormat() tore,
+// and the format_seq it belongs to. False if the producer kept rewriting it.
+bool SharedMemory::readFormat(FrameFormat* out, uint32_t* outSeq) {
+  uint64_t retries = 0;
+  bool ok = shm_image::ReadFormat(headerPtr(), out, outSeq, &retries);
+  if (retries) addRetries(retries);
+  return ok;
+}
 
-  // Event setup
-  obj->eventName_ = "Global\\SHM_EV_" + mapName;
-  obj->hEvent_ = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, obj->eventName_.c_str());
-  if (!obj->hEvent_) {
-    obj->eventName_ = "Local\\SHM_EV_" + mapName;
-    obj->hEvent_ = CreateEventA(nullptr, FALSE, FALSE, obj->eventName_.c_str());
+// Picks the slot the producer fills next, -1 when every candidate is pinned
+// (shm_image::AcquireWriteSlot()). The same one until it is published.
+int32_t SharedMemory::acquireWriteSlot() {
+  if (writeSlot_ < 0) writeSlot_ = shm_image::AcquireWriteSlot(headerPtr(), slotCount());
+  return writeSlot_;
+}
+
+// Producer side of dirty tracking: copies into the freshly acquired `slot`
+// what changed between the frame it still holds and the latest one.
+void SharedMemory::syncWriteSlot(int32_t slot) {
+  SharedHeader* hdr = headerPtr();
+  int32_t latest = hdr->latest_slot.load(std::memory_order_relaxed);
+  if (!tileTable() || latest < 0 || latest == slot || (uint32_t)latest >= slotCount()) return;
+  SlotDesc* from = &hdr->slots[latest];
+  SlotDesc* to = &hdr->slots[slot];
+  // after setFormat() the producer writes the new frame whole anyway
+  uint32_t formatSeq = hdr->format_seq.load(std::memory_order_relaxed);
+  if (from->format_seq != formatSeq) return;
+  const uint8_t* src = static_cast<const uint8_t*>(slotPtr((uint32_t)latest));
+  uint8_t* dst = static_cast<uint8_t*>(slotPtr((uint32_t)slot));
+  uint32_t frameBytes = from->frame_size;
+  if (!src || !dst || frameBytes > dataCapacity()) return;
+
+  uint64_t since = to->format_seq == formatSeq ? to->frame_index.load(std::memory_order_relaxed) : 0;
+  uint32_t total;
+  if (copyChangedTiles(hdr->format, src, dst, frameBytes, since, from->frame_index.load(std::memory_order_relaxed), &total) < 0) {
+    memcpy(dst, src, frameBytes);
   }
+}
 
-  SharedHeader* hdr = obj->headerPtr();
-  if (isCreator) {
-    // Initialize header
-    ZeroMemory(hdr, sizeof(SharedHeader));
-    hdr->magic = SHARED_MAGIC;
-    hdr->version = 1;
-    hdr->width = width;
-    hdr->height = height;
-    hdr->channels = channels;
-    hdr->mapping_size = obj->mapSize_;
+// helper: reads { wait, spinUs, yieldUs, marginUs } over *policy, throws on
+// an unknown wait mode. undefined leaves the policy as is.
+static bool ParseWaitPolicy(napi_env env, napi_value value, WaitPolicy* policy) {
+  if (IsNullish(env, value)) return true;
+  if (!IsObject(env, value)) {
+    ThrowTypeError(env, "Wait options must be an object");
+    return false;
+  }
+
+  napi_value mode = Get(env, value, "wait");
+  if (IsString(env, mode)) {
+    std::string name = Utf8(env, mode);
+    int found = -1;
+    for (int i = 0; i < 4; i++) {
+      if (name == WAIT_MODE_NAMES[i]) found = i;
+    }
+    if (found < 0) {
+      ThrowTypeError(env, "wait must be 'block', 'spin', 'busy' or 'adaptive'");
+      return false;
+    }
+    policy->mode = (WaitMode)found;
+  }
+
+  struct { const char* key; uint32_t* field; } fields[] = {
+    { "spinUs", &policy->spinUs }, { "yieldUs", &policy->yieldUs }, { "marginUs", &policy->marginUs },
+  };
+  for (auto& f : fields) {
+    napi_value v = Get(env, value, f.key);
+    if (!IsNumber(env, v)) continue;
+    // a second of spinning is already far more than any frame interval
+    int64_t us = Int64(env, v);
+    if (us < 0 || us > 1000000) {
+      ThrowRangeError(env, (std::string(f.key) + " must be 0..1000000").c_str());
+      return false;
+    }
+    *f.field = (uint32_t)us;
   }
+  return true;
+}
 
-  args.GetReturnValue().Set(String::NewFromUtf8(isolate, "ok").ToLocalChecked());
+// helper: conversion format by name: a PIXEL_FORMAT_* name ("bgra8", or
+// just "bgra") or "i420". -1 if unknown
+static int FindConvertFormat(napi_env env, napi_value value) {
+  std::string name = Utf8(env, value);
+  if (name == "i420") return (int)convert::FORMAT_I420;
+  for (int i = 1; i < PIXEL_FORMAT_COUNT; i++) {
+    if (name == PIXEL_FORMAT_NAMES[i] || name + "8" == PIXEL_FORMAT_NAMES[i]) return i;
+  }
+  return -1;
 }
 
-void SharedMemory::SetFormat(const FunctionCallbackInfo<Value>& args) {
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  if (!obj->base_) return;
+// helper: reads a region { x, y, w, h } over *spec, none without w and h
+static bool ParseRegion(napi_env env, napi_value value, ConvertSpec* spec) {
+  if (!IsObject(env, value)) return true;
+  napi_value w = Get(env, value, "w"), h = Get(env, value, "h");
+  if (!IsNumber(env, w) && !IsNumber(env, h)) return true;
 
-  uint32_t w = args[0]->IntegerValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-  uint32_t h = args[1]->IntegerValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-  uint32_t c = args[2]->IntegerValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+  int64_t r[4] = { 0, 0, IsNumber(env, w) ? Int64(env, w) : 0, IsNumber(env, h) ? Int64(env, h) : 0 };
+  napi_value x = Get(env, value, "x"), y = Get(env, value, "y");
+  if (IsNumber(env, x)) r[0] = Int64(env, x);
+  if (IsNumber(env, y)) r[1] = Int64(env, y);
+  if (r[0] < 0 || r[1] < 0 || r[2] < 1 || r[3] < 1 || r[0] + r[2] > UINT32_MAX || r[1] + r[3] > UINT32_MAX) {
+    ThrowRangeError(env, "A region needs x, y >= 0 and w, h >= 1");
+    return false;
+  }
+  spec->x = (uint32_t)r[0];
+  spec->y = (uint32_t)r[1];
+  spec->w = (uint32_t)r[2];
+  spec->h = (uint32_t)r[3];
+  return true;
+}
 
-  SharedHeader* hdr = obj->headerPtr();
-  InterlockedIncrement(&hdr->seq);
-  MemoryBarrier();
-  hdr->width = w; hdr->height = h; hdr->channels = c;
-  MemoryBarrier();
-  InterlockedIncrement(&hdr->seq);
+// helper: reads { format, premultiply, level, x, y, w, h } over *spec for a
+// converting read
+static bool ParseConvertOptions(napi_env env, napi_value value, ConvertSpec* spec) {
+  if (!IsObject(env, value)) return true;
+  if (!ParseRegion(env, value, spec)) return false;
+
+  napi_value level = Get(env, value, "level");
+  if (IsNumber(env, level)) {
+    int64_t n = Int64(env, level);
+    if (n < 0 || n > SHARED_MAX_LEVELS) {
+      ThrowRangeError(env, "level must be 0..4");
+      return false;
+    }
+    spec->level = (uint32_t)n;
+  }
 
-  if (obj->hEvent_) SetEvent(obj->hEvent_);
-  args.GetReturnValue().Set(true);
+  napi_value v = Get(env, value, "format");
+  if (IsString(env, v)) {
+    int found = FindConvertFormat(env, v);
+    if (found < 0) {
+      ThrowTypeError(env, "Unknown pixel format");
+      return false;
+    }
+    spec->format = (uint32_t)found;
+  }
+  spec->premultiply = Truthy(env, Get(env, value, "premultiply"));
+  return true;
 }
 
-void SharedMemory::GetFrameBuffer(const FunctionCallbackInfo<Value>& args) {
-  Isolate* isolate = args.GetIsolate();
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  
-  if (!obj->base_ || obj->dataCapacity() == 0) {
-    args.GetReturnValue().Set(v8::Null(isolate));
-    return;
+// helper: reads { threads, bytesPerThread, streaming } over *policy;
+// streaming is true, false or 'auto'
+static bool ParseCopyOptions(napi_env env, napi_value value, CopyPolicy* policy) {
+  if (!IsObject(env, value)) return true;
+
+  napi_value v = Get(env, value, "threads");
+  if (IsNumber(env, v)) policy->threads = (uint32_t)std::max<int64_t>(0, Int64(env, v));
+  v = Get(env, value, "bytesPerThread");
+  if (IsNumber(env, v)) {
+    int64_t bytes = Int64(env, v);
+    if (bytes < 4096 || bytes > UINT32_MAX) {
+      ThrowRangeError(env, "bytesPerThread must be at least 4096");
+      return false;
+    }
+    policy->bytesPerThread = (uint32_t)bytes;
   }
+  v = Get(env, value, "streaming");
+  if (TypeOf(env, v) == napi_boolean) {
+    policy->streaming = Truthy(env, v) ? STREAM_ON : STREAM_OFF;
+  } else if (IsString(env, v)) {
+    if (Utf8(env, v) != "auto") {
+      ThrowTypeError(env, "streaming must be true, false or 'auto'");
+      return false;
+    }
+    policy->streaming = STREAM_AUTO;
+  }
+  return true;
+}
 
-  // Zero-Copy view of the memory
-  char* ptr = static_cast<char*>(obj->dataPtr());
-  Local<Object> buf = node::Buffer::New(isolate, ptr, obj->dataCapacity(), noop_free, nullptr).ToLocalChecked();
-  args.GetReturnValue().Set(buf);
+// helper: parts a copy of `bytes` is split into under `policy`
+static uint32_t CopyParts(const CopyPolicy& policy, uint64_t bytes) {
+  uint32_t threads = workers::Concurrency();
+  if (policy.threads && policy.threads < threads) threads = policy.threads;
+  uint64_t parts = bytes / policy.bytesPerThread;
+  return parts < 1 ? 1 : parts < threads ? (uint32_t)parts : threads;
 }
 
-void SharedMemory::GetCapacity(const FunctionCallbackInfo<Value>& args) {
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  args.GetReturnValue().Set(Number::New(args.GetIsolate(), (double)obj->dataCapacity()));
+// helper: whether a copy of `bytes` under `policy` uses non-temporal stores
+static bool StreamCopies(const CopyPolicy& policy, uint64_t bytes) {
+  return policy.streaming == STREAM_ON || (policy.streaming == STREAM_AUTO && bytes >= STREAM_AUTO_BYTES);
 }
 
-void SharedMemory::PublishFrame(const FunctionCallbackInfo<Value>& args) {
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  if (!obj->base_) return;
+// helper: memcpy split over the copy workers in cache-line sized chunks (the
+// last one takes the rest); the parts it took
+static uint32_t ParallelCopy(const CopyPolicy& policy, char* dst, const uint8_t* src, size_t bytes) {
+  bool streaming = StreamCopies(policy, bytes);
+  uint32_t parts = CopyParts(policy, bytes);
+  size_t chunk = bytes / parts / 64 * 64;
+  workers::Run(parts, [&](uint32_t p) {
+    size_t begin = (size_t)p * chunk;
+    size_t len = p + 1 == parts ? bytes - begin : chunk;
+    if (streaming) convert::StreamCopy(dst + begin, src + begin, len);
+    else memcpy(dst + begin, src + begin, len);
+  });
+  return parts;
+}
 
-  uint32_t frameBytes = args[0]->IntegerValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-  if (frameBytes > obj->dataCapacity()) return;
+// helper: runs `plan` split over the copy workers in row ranges (even ones,
+// YUV chroma comes from row pairs); the parts it took
+static uint32_t ParallelConvert(const CopyPolicy& policy, convert::Plan plan, const uint8_t* src, uint8_t* dst) {
+  plan.streaming = StreamCopies(policy, plan.dstBytes);
+  uint32_t parts = CopyParts(policy, std::max<uint64_t>(plan.dstBytes, convert::SourceBytes(plan)));
+  uint32_t rows = (plan.height + parts - 1) / parts;
+  rows += rows & 1;
+  workers::Run(parts, [&](uint32_t p) {
+    uint32_t begin = p * rows;
+    if (begin < plan.height) convert::Run(plan, src, dst, begin, std::min(begin + rows, plan.height));
+  });
+  return parts;
+}
 
-  SharedHeader* hdr = obj->headerPtr();
-  InterlockedIncrement(&hdr->seq); // Start write
-  MemoryBarrier();
-  
-  hdr->frame_size = frameBytes;
-  AtomicIncrement64((volatile LONG64*)&hdr->frame_index);
-  
-  MemoryBarrier();
-  InterlockedIncrement(&hdr->seq); // End write
+// helper: the options object of (timeout?, options?) methods, which also
+// take (options)
+static napi_value OptionsArg(const CallArgs& args) {
+  if (args.Length() > 0 && IsObject(args.env, args[0])) return args[0];
+  return args[1];
+}
 
-  if (obj->hEvent_) SetEvent(obj->hEvent_);
-  args.GetReturnValue().Set(true);
+// Claims a reader entry (a free one, or one left behind by a dead process)
+// so the producer signals our own event. Called before the first wait;
+// without a free entry we keep waiting on the shared event.
+void SharedMemory::attachReader() {
+  if (readerIndex_ >= 0 || !base_ || mapSize_ < sizeof(SharedHeader)) return;
+  readerIndex_ = shm_image::AttachReader(headerPtr(), mapName_, wantCompressed_, &readerEvent_);
+  if (lossless_) startLossless();
 }
 
-void SharedMemory::ReadFrame(const FunctionCallbackInfo<Value>& args) {
-  Isolate* isolate = args.GetIsolate();
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  
-  if (!obj->base_) {
-     isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Not connected").ToLocalChecked()));
-     return;
+// Lossless reads start at the frame after the cursor, or after the latest
+// one for a reader that hasn't read any; a blocking reader's entry holds the
+// producer back from there on.
+void SharedMemory::startLossless() {
+  ReaderDesc* r = readerDesc();
+  if (!r) return;
+  if (lastSeenIndex_ == 0) lastSeenIndex_ = r->last_frame_index.load(std::memory_order_relaxed);
+  else r->last_frame_index.store(lastSeenIndex_, std::memory_order_relaxed);
+  r->lossless.store(blockProducer_ ? 1 : 0, std::memory_order_release);
+}
+
+void SharedMemory::detachReader() {
+  if (readerIndex_ < 0) return;
+  if (base_) shm_image::DetachReader(headerPtr(), readerIndex_);
+  platform::CloseEvent(readerEvent_);
+  readerEvent_ = nullptr;
+  readerIndex_ = -1;
+}
+
+uint32_t SharedMemory::attachedReaders() {
+  if (!base_ || mapSize_ < sizeof(SharedHeader)) return 0;
+  uint32_t n = 0;
+  for (const ReaderDesc& r : headerPtr()->readers) {
+    if (r.state.load(std::memory_order_relaxed) == READER_ATTACHED) n++;
   }
+  return n;
+}
 
-  DWORD timeout = INFINITE;
-  if (args.Length() > 0 && args[0]->IsNumber()) {
-    timeout = args[0]->IntegerValue(isolate->GetCurrentContext()).FromJust();
+// Wakes every attached reader once, plus whoever waits on the shared event;
+// the ones running pipeline stage `stage` instead, when it isn't 0.
+void SharedMemory::notifyReaders(uint32_t stage) {
+  if (mapSize_ < sizeof(SharedHeader)) {
+    if (event_) platform::SignalEvent(event_);
+    return;
   }
+  shm_image::NotifyReaders(headerPtr(), mapName_, event_, readerEvents_, stage);
+}
 
-  // Wait for event (sleeping wait)
-  if (obj->hEvent_) {
-    if (WaitForSingleObject(obj->hEvent_, timeout) == WAIT_TIMEOUT) {
-      args.GetReturnValue().Set(v8::Null(isolate));
-      return;
+// --- Stream containers ---
+
+// Finds the stream `name` in the container, adding it when missing (and
+// setting up the directory when we `created` the mapping). Sets
+// streamOffset_; a new stream's header is set up by `initHeader` before
+// anyone else can find the stream.
+bool SharedMemory::openStream(const std::string& name, uint64_t regionSize, uint32_t streams, bool created,
+                              const std::function<void()>& initHeader, std::string* error) {
+  if (mapSize_ < STREAM_DIRECTORY_SIZE) {
+    *error = "The mapping has no streams";
+    return false;
+  }
+  StreamDirectory* dir = reinterpret_cast<StreamDirectory*>(base_);
+  if (created) {
+    memset((void*)dir, 0, sizeof(StreamDirectory));
+    dir->version = STREAMS_VERSION;
+    dir->mapping_size = mapSize_;
+    dir->stream_capacity = streams;
+    dir->region_size = regionSize;
+    dir->magic.store(STREAMS_MAGIC, std::memory_order_release);
+  } else {
+    // the creator may still be setting the directory up
+    for (int i = 0; i < 1000 && dir->magic.load(std::memory_order_acquire) == 0; i++) platform::SleepMs(1);
+    uint32_t magic = dir->magic.load(std::memory_order_acquire);
+    if (magic != STREAMS_MAGIC) {
+      *error = magic == SHARED_MAGIC ? "The mapping has no streams" : "Stream directory not initialized";
+      return false;
+    }
+    if (dir->version != STREAMS_VERSION || dir->stream_capacity > STREAMS_MAX ||
+        STREAM_DIRECTORY_SIZE + dir->region_size * dir->stream_capacity > mapSize_) {
+      *error = "Unsupported stream directory";
+      return false;
     }
   }
 
-  SharedHeader* hdr = obj->headerPtr();
-  uint32_t startSeq, endSeq;
-  uint32_t frameBytes;
-  const int MAX_RETRIES = 10;
-  int retries = 0;
-  
-  // Seqlock read loop with spin-wait
-  int spinCount = 0;
-  const int SPIN_LIMIT = 2000; // Cycles to spin before yielding
+  // adding a stream takes the directory lock; a dead holder's lock is taken over
+  uint32_t pid = platform::CurrentProcessId();
+  for (;;) {
+    uint32_t holder = 0;
+    if (dir->lock.compare_exchange_weak(holder, pid, std::memory_order_acquire)) break;
+    if (holder && holder != pid && !platform::ProcessAlive(holder, { dir->lock_ns, dir->lock_start })) {
+      dir->lock_ns = dir->lock_start = 0; // not the next holder's
+      dir->lock.compare_exchange_strong(holder, 0);
+      continue;
+    }
+    platform::YieldThread();
+  }
+  platform::ProcessToken self = platform::CurrentProcessToken();
+  dir->lock_ns = self.ns;
+  dir->lock_start = self.start;
 
-  do {
-    if (retries++ > MAX_RETRIES) {
-       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "ReadFrame contention").ToLocalChecked()));
-       return;
+  int32_t found = -1, unused = -1;
+  for (uint32_t i = 0; i < dir->stream_capacity; i++) {
+    StreamEntry* e = &dir->streams[i];
+    if (e->state.load(std::memory_order_acquire) != STREAM_READY) {
+      if (unused < 0) unused = (int32_t)i;
+    } else if (strncmp(e->name, name.c_str(), STREAM_NAME_SIZE) == 0) {
+      found = (int32_t)i;
+      break;
+    }
+  }
+  if (found < 0) {
+    if (unused < 0) *error = "The container has no free stream";
+    else if (regionSize > dir->region_size) *error = "Stream does not fit the container's stream size";
+    if (unused >= 0 && regionSize <= dir->region_size) {
+      StreamEntry* e = &dir->streams[unused];
+      memset(e->name, 0, STREAM_NAME_SIZE);
+      memcpy(e->name, name.data(), name.size());
+      e->offset = STREAM_DIRECTORY_SIZE + dir->region_size * (uint64_t)unused;
+      e->frame_index.store(0, std::memory_order_relaxed);
+      streamOffset_ = (size_t)e->offset;
+      initHeader();
+      e->state.store(STREAM_READY, std::memory_order_release);
+      found = unused;
     }
+  } else {
+    streamOffset_ = (size_t)dir->streams[found].offset;
+  }
+  dir->lock_ns = dir->lock_start = 0; // a holder between its CAS and these stores is checked by pid alone
+  dir->lock.store(0, std::memory_order_release);
+  if (found < 0) return false;
 
-    startSeq = hdr->seq;
-    
-    // if seq number is odd, then write is in progress, waiting...
-    if (startSeq & 1) {
-        if (spinCount < SPIN_LIMIT) {
-            spinCount++;
-            _mm_pause(); 
-            continue;
-        } else {
-            Sleep(0);    // if waited too long
-            spinCount = 0;
-            continue;
-        }
+  dir_ = dir;
+  streamIndex_ = found;
+  return true;
+}
+
+void SharedMemory::attachWaiter() {
+  if (waiterIndex_ >= 0 || !dir_) return;
+  for (int pass = 0; pass < 2 && waiterIndex_ < 0; pass++) {
+    for (int32_t i = 0; i < STREAMS_MAX_WAITERS; i++) {
+      StreamWaiter* w = &dir_->waiters[i];
+      int32_t expected = pass == 0 ? READER_FREE : READER_ATTACHED;
+      if (pass == 1 && (w->state.load() != READER_ATTACHED ||
+                        platform::ProcessAlive(w->pid, { w->owner_ns, w->owner_start }))) continue;
+      if (!w->state.compare_exchange_strong(expected, READER_CLAIMING)) continue;
+
+      std::string name = "SHM_EV_" + containerName_ + "_W" + std::to_string(i);
+      platform::Event* ev = platform::OpenSharedEvent(name, &w->event_word, true);
+      if (!ev) {
+        w->state.store(READER_FREE);
+        continue;
+      }
+      platform::ClearEvent(ev);
+      platform::ProcessToken self = platform::CurrentProcessToken();
+      w->pid = platform::CurrentProcessId();
+      w->owner_ns = self.ns;
+      w->owner_start = self.start;
+      // seq_cst: producers mirror frame_index before looking at waiters,
+      // we look at frame_index after attaching, one side sees the other
+      w->state.store(READER_ATTACHED, std::memory_order_seq_cst);
+      waiterIndex_ = i;
+      waiterEvent_ = ev;
+      break;
     }
+  }
+}
 
-    MemoryBarrier();
-    frameBytes = hdr->frame_size;
-    if (frameBytes > obj->dataCapacity()) frameBytes = 0;
+void SharedMemory::detachWaiter() {
+  if (waiterIndex_ < 0) return;
+  if (dir_) dir_->waiters[waiterIndex_].state.store(READER_FREE, std::memory_order_release);
+  platform::CloseEvent(waiterEvent_);
+  waiterEvent_ = nullptr;
+  waiterIndex_ = -1;
+}
 
-    // Copying data (deep copy)
-    Local<Object> outBuf;
-    if (frameBytes > 0) {
-        outBuf = node::Buffer::Copy(isolate, (char*)obj->dataPtr(), frameBytes).ToLocalChecked();
-    } else {
-        outBuf = node::Buffer::New(isolate, 0).ToLocalChecked();
+// Mirrors our stream's frame_index into the directory and wakes every
+// waitStreams() waiter once.
+void SharedMemory::notifyWaiters() {
+  if (!dir_ || streamIndex_ < 0) return;
+  dir_->streams[streamIndex_].frame_index.store(headerPtr()->frame_index.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+  dir_->publish_count.fetch_add(1, std::memory_order_relaxed);
+  for (int32_t i = 0; i < STREAMS_MAX_WAITERS; i++) {
+    if (dir_->waiters[i].state.load(std::memory_order_seq_cst) != READER_ATTACHED) continue;
+    if (!waiterEvents_[i]) {
+      std::string name = "SHM_EV_" + containerName_ + "_W" + std::to_string(i);
+      waiterEvents_[i] = platform::OpenSharedEvent(name, &dir_->waiters[i].event_word, false);
+      if (!waiterEvents_[i]) continue;
     }
+    platform::SignalEvent(waiterEvents_[i]);
+  }
+}
+
+// waitStreams(timeout?) -> names of the container's streams with frames
+// published since the last call (every stream with frames on the first), or
+// null on timeout. One wait covers all streams; read them through their own
+// instances.
+napi_value SharedMemory::WaitStreams(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
 
-    MemoryBarrier();
-    endSeq = hdr->seq;
+  if (!obj->base_ || !obj->dir_) return ThrowError(env, "Not a stream container");
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[0])) timeout = (uint32_t)Int64(env, args[0]);
+
+  obj->attachWaiter();
+  StreamDirectory* dir = obj->dir_;
+  uint64_t deadline = timeout == platform::kInfinite ? UINT64_MAX : platform::MonotonicNs() + timeout * 1000000ull;
+  for (;;) {
+    napi_value changed = NewArray(env);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < dir->stream_capacity; i++) {
+      StreamEntry* e = &dir->streams[i];
+      if (e->state.load(std::memory_order_acquire) != STREAM_READY) continue;
+      uint64_t index = e->frame_index.load(std::memory_order_seq_cst);
+      if (index <= obj->streamSeen_[i]) continue;
+      obj->streamSeen_[i] = index;
+      SetIndex(env, changed, n++, Str(env, std::string(e->name, strnlen(e->name, STREAM_NAME_SIZE))));
+    }
+    if (n) return changed;
 
-    if (startSeq == endSeq) {
-       // Read successfully
-       args.GetReturnValue().Set(outBuf);
-       return;
+    uint64_t now = platform::MonotonicNs();
+    if (now >= deadline) return Null(env);
+    if (!obj->waiterEvent_) { // every waiter entry taken: poll
+      platform::SleepMs(1);
+      continue;
     }
+    uint32_t left = deadline == UINT64_MAX ? platform::kInfinite : (uint32_t)std::min<uint64_t>((deadline - now + 999999) / 1000000, platform::kInfinite - 1);
+    platform::WaitEvent(obj->waiterEvent_, nullptr, left);
+  }
+}
+
+// listStreams() -> [{ name, frameIndex }] of the container's streams
+napi_value SharedMemory::ListStreams(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  if (!obj->base_ || !obj->dir_) return ThrowError(env, "Not a stream container");
+  napi_value list = NewArray(env);
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < obj->dir_->stream_capacity; i++) {
+    StreamEntry* e = &obj->dir_->streams[i];
+    if (e->state.load(std::memory_order_acquire) != STREAM_READY) continue;
+    napi_value o = NewObject(env);
+    Set(env, o, "name", Str(env, std::string(e->name, strnlen(e->name, STREAM_NAME_SIZE))));
+    Set(env, o, "frameIndex", BigUint(env, e->frame_index.load(std::memory_order_acquire)));
+    SetIndex(env, list, n++, o);
+  }
+  return list;
+}
 
-    // if seq was changed when reading, then image tearing happened, trying again  
-    // Reset spin count to try eagerly again
-    spinCount = 0;
+napi_value SharedMemory::Init(napi_env env, napi_value exports) {
+  struct { const char* name; napi_callback method; } methods[] = {
+    { "create", Create },
+    { "setFormat", SetFormat },
+    { "resize", Resize },
+    { "getFrameBuffer", GetFrameBuffer },
+    { "getCapacity", GetCapacity },
+    { "publishFrame", PublishFrame },
+    { "writeFrame", WriteFrame },
+    { "readFrame", ReadFrame },
+    { "readFrameAsync", ReadFrameAsync },
+    { "readFrameInto", ReadFrameInto },
+    { "readFrames", ReadFrames },
+    { "setWaitPolicy", SetWaitPolicy },
+    { "setReadMode", SetReadMode },
+    { "setLatencyOptions", SetLatencyOptions },
+    { "setCopyOptions", SetCopyOptions },
+    { "getWaitStats", GetWaitStats },
+    { "acquireFrame", AcquireFrame },
+    { "release", Release },
+    { "joinStage", JoinStage },
+    { "leaveStage", LeaveStage },
+    { "acquireStage", AcquireStage },
+    { "releaseStage", ReleaseStage },
+    { "on", On },
+    { "off", Off },
+    { "close", Close },
+    { "getMetadata", GetMetadata },
+    { "getStats", GetStats },
+    { "now", Now },
+    { "convert", Convert },
+    { "waitStreams", WaitStreams },
+    { "listStreams", ListStreams },
+    { "getWriteSlot", GetWriteSlot },
+    { "setSlotTexture", SetSlotTexture },
+    { "acquireTexture", AcquireTexture },
+    { "readCompressed", ReadCompressed },
+    { "decompress", Decompress },
+    { "record", Record },
+    { "stopRecording", StopRecording },
+    { "play", Play },
+    { "stopPlayback", StopPlayback },
+  };
 
-  } while (true);
+  // Prototype methods
+  std::vector<napi_property_descriptor> props;
+  for (auto& m : methods) {
+    props.push_back({ m.name, nullptr, m.method, nullptr, nullptr, nullptr, napi_default, nullptr });
+  }
+  napi_value constructor;
+  napi_define_class(env, "SharedMemory", NAPI_AUTO_LENGTH, New, nullptr, props.size(), props.data(), &constructor);
+  Set(env, exports, "SharedMemory", constructor);
+  return exports;
 }
 
-void SharedMemory::Close(const FunctionCallbackInfo<Value>& args) {
-  SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-  if (obj->base_) { UnmapViewOfFile(obj->base_); obj->base_ = nullptr; }
-  if (obj->hMap_) { CloseHandle(obj->hMap_); obj->hMap_ = nullptr; }
-  if (obj->hEvent_) { CloseHandle(obj->hEvent_); obj->hEvent_ = nullptr; }
-  args.GetReturnValue().Set(true);
+napi_value SharedMemory::New(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  napi_value target = nullptr;
+  napi_get_new_target(env, info, &target);
+
+  if (target) {
+    // been called with 'new SharedMemory()' - ok; every env (the main
+    // thread and each worker) gets instances of its own
+    SharedMemory* obj = new SharedMemory(env);
+    napi_wrap(env, args.self, obj, Finalize, nullptr, &obj->wrapper_);
+    napi_add_env_cleanup_hook(env, Cleanup, obj);
+    return args.self;
+  }
+  // been called as 'SharedMemory()' without new;
+  // throwing an exception.
+  return ThrowTypeError(env, "Class constructors cannot be invoked without 'new'");
 }
 
-void SharedMemory::GetMetadata(const FunctionCallbackInfo<Value>& args) {
-    Isolate* isolate = args.GetIsolate();
-    SharedMemory* obj = ObjectWrap::Unwrap<SharedMemory>(args.Holder());
-    if (!obj->base_) return;
+// --- Method Implementations ---
+
+napi_value SharedMemory::Create(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  if (args.Length() < 2 || !IsString(env, args[0]) || !IsNumber(env, args[1])) {
+    return ThrowTypeError(env, "Args: name, size");
+  }
+
+  // Cleanup if already opened
+  obj->endPlayback("Mapping recreated");
+  obj->stopWatcher();
+  obj->stopRecorder();
+  obj->rejectPending("Mapping recreated");
+  obj->disconnect();
+
+  std::string mapName = Utf8(env, args[0]);
+  obj->mapName_ = mapName;
+  obj->rootName_ = mapName;
+  uint64_t requestedSize = (uint64_t)Int64(env, args[1]);
+
+  uint32_t width = 0, height = 0, channels = 0;
+  if (args.Length() >= 5) {
+    width = (uint32_t)Int64(env, args[2]);
+    height = (uint32_t)Int64(env, args[3]);
+    channels = (uint32_t)Int64(env, args[4]);
+  }
+
+  // Options: { slots, largePages, prefault, format, alignment, dirtyTiles, stream, streams, maxFrameSize, compression,
+  // levels, stages }
+  uint32_t slots = SHARED_DEFAULT_SLOTS;
+  uint64_t maxFrameSize = 0;
+  bool dirtyTiles = false;
+  bool compression = false;
+  int64_t levels = 0;
+  std::vector<std::string> stages;
+  bool badStages = false;
+  std::string stream;
+  uint32_t streams = STREAMS_DEFAULT;
+  platform::MappingOptions mapOptions;
+  uint32_t format = PIXEL_FORMAT_UNKNOWN, alignment = 1;
+  if (args.Length() >= 6 && !ParseFormatOptions(env, args[5], &format, &alignment)) return nullptr;
+  if (args.Length() >= 6 && IsObject(env, args[5])) {
+    napi_value opts = args[5];
+    napi_value v = Get(env, opts, "slots");
+    if (IsNumber(env, v)) slots = (uint32_t)Int64(env, v);
+    v = Get(env, opts, "largePages");
+    mapOptions.largePages = Truthy(env, v);
+    v = Get(env, opts, "prefault");
+    mapOptions.prefault = Truthy(env, v);
+    v = Get(env, opts, "dirtyTiles");
+    dirtyTiles = Truthy(env, v);
+    v = Get(env, opts, "stream");
+    if (IsString(env, v)) stream = Utf8(env, v);
+    v = Get(env, opts, "streams");
+    if (IsNumber(env, v)) streams = (uint32_t)Int64(env, v);
+    v = Get(env, opts, "maxFrameSize");
+    if (IsNumber(env, v)) maxFrameSize = (uint64_t)Int64(env, v);
+    v = Get(env, opts, "compression");
+    compression = Truthy(env, v);
+    v = Get(env, opts, "levels");
+    if (IsNumber(env, v)) levels = Int64(env, v);
+    v = Get(env, opts, "stages");
+    if (IsArray(env, v)) {
+      uint32_t n = 0;
+      napi_get_array_length(env, v, &n);
+      for (uint32_t i = 0; i < n; i++) {
+        napi_value item;
+        napi_get_element(env, v, i, &item);
+        if (!IsString(env, item)) badStages = true;
+        else stages.push_back(Utf8(env, item));
+      }
+      badStages |= stages.empty() || stages.size() > SHARED_MAX_STAGES;
+      for (size_t i = 0; i < stages.size(); i++) {
+        badStages |= stages[i].empty() || stages[i].size() >= STREAM_NAME_SIZE ||
+                     std::find(stages.begin(), stages.begin() + i, stages[i]) != stages.begin() + i;
+      }
+    }
+  }
+  if (slots < 1 || slots > SHARED_MAX_SLOTS) return ThrowRangeError(env, "slots must be 1..8");
+  if (levels < 0 || levels > SHARED_MAX_LEVELS) return ThrowRangeError(env, "levels must be 0..4");
+  if (badStages) return ThrowRangeError(env, "stages must be 1..8 distinct names of up to 31 bytes");
+  // compressed copies, levels and dirty tiles are made on publish, before
+  // the stages have changed the frame
+  if (!stages.empty() && (compression || levels || dirtyTiles)) {
+    return ThrowTypeError(env, "stages cannot be combined with compression, levels or dirtyTiles");
+  }
+  if (!stream.empty() && (stream.size() >= STREAM_NAME_SIZE || streams < 1 || streams > STREAMS_MAX)) {
+    return ThrowRangeError(env, "stream names are up to 31 bytes, streams 1..64");
+  }
+  // a stream's events are named after the container and the stream
+  if (!stream.empty()) obj->mapName_ = mapName + "." + stream;
+  obj->containerName_ = mapName;
+
+  // size is the capacity of one frame; the mapping holds a ring of them
+  uint64_t slotCapacity = ((requestedSize + 63) / 64) * 64;
+  if (slotCapacity == 0 || slotCapacity > UINT32_MAX) return ThrowRangeError(env, "Invalid frame size");
+  // slots are page aligned: each commits on its own pages, and a recording
+  // writes them to unbuffered files as they are. maxFrameSize: slots are
+  // laid out for frames up to that size, but only `size` bytes of each are
+  // committed (SEC_RESERVE on Windows); resize() grows them in place up to it
+  uint64_t slotStride = (slotCapacity + 4095) / 4096 * 4096;
+  if (slotStride > UINT32_MAX) return ThrowRangeError(env, "Invalid frame size");
+  if (maxFrameSize > requestedSize) {
+    slotStride = (maxFrameSize + 4095) / 4096 * 4096;
+    if (slotStride > UINT32_MAX || !stream.empty()) return ThrowRangeError(env, "Invalid maxFrameSize");
+    mapOptions.reserve = true;
+  }
+  mapOptions.commitBytes = HEADER_SIZE + TileTableBytes(SHARED_MAX_TILES); // the header and any tile table
+  obj->mapOptions_ = mapOptions;
+  // the tile table (dirtyTiles) sits between the header and the first slot
+  uint32_t tileCount = dirtyTiles ? SHARED_MAX_TILES : 0;
+  uint64_t slotsOffset = (HEADER_SIZE + TileTableBytes(tileCount) + 4095) / 4096 * 4096;
+  // compression: an area per slot, behind the slots, big enough for any
+  // frame the slot can hold (committed as used on a reserved mapping)
+  uint64_t compressCapacity = 0;
+  if (compression) {
+    uint64_t align = mapOptions.reserve ? 4096 : 64;
+    compressCapacity = (codec::Bound(slotStride) + align - 1) / align * align;
+    if (compressCapacity > UINT32_MAX) return ThrowRangeError(env, "Invalid frame size");
+  }
+  // levels: another area per slot, behind those, holding the frame at 1/2,
+  // 1/4, ... its size (rebuilt on every publish)
+  uint64_t levelCapacity = shm_image::LevelCapacity(slotStride, (uint32_t)levels, mapOptions.reserve ? 4096 : 64);
+  if (levelCapacity > UINT32_MAX) return ThrowRangeError(env, "Invalid frame size");
+  requestedSize = slotsOffset + (slotStride + compressCapacity + levelCapacity) * slots;
+  // a container holds `streams` regions this size behind its directory
+  uint64_t regionSize = (requestedSize + 4095) / 4096 * 4096;
+  if (!stream.empty()) requestedSize = STREAM_DIRECTORY_SIZE + regionSize * streams;
+
+  bool isCreator = false;
+  std::string error;
+  if (!platform::OpenOrCreateMapping(mapName, requestedSize, mapOptions, &obj->mapping_, &isCreator, &error)) {
+    return ThrowError(env, error.c_str());
+  }
+  obj->base_ = obj->mapping_.base;
+  obj->mapSize_ = obj->mapping_.size;
 
+  // Initialize header; offsets inside it count from the mapping base
+  auto initHeader = [&]() {
     SharedHeader* hdr = obj->headerPtr();
-    Local<Object> ret = Object::New(isolate);
-    Local<Context> ctx = isolate->GetCurrentContext();
-    
-    ret->Set(ctx, String::NewFromUtf8(isolate, "width").ToLocalChecked(), Integer::New(isolate, hdr->width));
-    ret->Set(ctx, String::NewFromUtf8(isolate, "height").ToLocalChecked(), Integer::New(isolate, hdr->height));
-    ret->Set(ctx, String::NewFromUtf8(isolate, "channels").ToLocalChecked(), Integer::New(isolate, hdr->channels));
-    ret->Set(ctx, String::NewFromUtf8(isolate, "frame_index").ToLocalChecked(), Number::New(isolate, (double)hdr->frame_index)); // JS Number (lossy > 2^53)
-    
-    args.GetReturnValue().Set(ret);
+    uint64_t base = obj->streamOffset_;
+    FrameFormat initial;
+    MakeFormat(&initial, width, height, channels, format, alignment);
+    shm_image::RingLayout ring;
+    ring.slots = slots;
+    ring.slotCapacity = (uint32_t)slotCapacity;
+    ring.slotReserve = (uint32_t)slotStride;
+    ring.slotsOffset = base + slotsOffset;
+    ring.mappingSize = stream.empty() ? obj->mapSize_ : regionSize;
+    ring.pageSize = (uint32_t)obj->mapping_.pageSize;
+    shm_image::InitHeader(hdr, initial, ring);
+    hdr->tile_count = tileCount;
+    hdr->tile_offset = tileCount ? base + HEADER_SIZE : 0;
+    if (tileCount) memset((uint8_t*)obj->base_ + base + HEADER_SIZE, 0, TileTableBytes(tileCount));
+    hdr->compress_offset = compressCapacity ? base + slotsOffset + slotStride * slots : 0;
+    hdr->compress_capacity = (uint32_t)compressCapacity;
+    hdr->level_count = levelCapacity ? (uint32_t)levels : 0;
+    hdr->level_capacity = (uint32_t)levelCapacity;
+    hdr->level_offset = levelCapacity ? base + slotsOffset + (slotStride + compressCapacity) * slots : 0;
+    hdr->stage_count = (uint32_t)stages.size();
+    for (size_t s = 0; s < stages.size(); s++) memcpy(hdr->stages[s].name, stages[s].data(), stages[s].size());
+  };
+
+  StreamDirectory* dir = obj->mapSize_ >= sizeof(StreamDirectory) ? reinterpret_cast<StreamDirectory*>(obj->base_) : nullptr;
+  if (!stream.empty()) {
+    if (!obj->openStream(stream, regionSize, streams, isCreator, initHeader, &error)) {
+      obj->disconnect();
+      return ThrowError(env, error.c_str());
+    }
+  } else if (isCreator) {
+    initHeader();
+  } else if (dir && dir->magic.load(std::memory_order_acquire) == STREAMS_MAGIC) {
+    obj->disconnect();
+    return ThrowError(env, "The mapping holds streams, open one with { stream }");
+  }
+  SharedHeader* hdr = obj->headerPtr();
+  if (!isCreator && hdr->magic == SHARED_MAGIC && hdr->version != SHARED_VERSION) {
+    obj->disconnect(); // nothing may touch a header laid out differently
+    return ThrowError(env, "Unsupported header version");
+  }
+
+  // Event setup
+  obj->event_ = platform::OpenSharedEvent(shm_image::SharedEventName(obj->mapName_),
+      obj->mapSize_ >= obj->streamOffset_ + sizeof(SharedHeader) ? &hdr->event_word : nullptr, true);
+  // the producer may have resized already: start on the newest generation
+  if (!isCreator) obj->followGeneration();
+
+  return Str(env, "ok");
+}
+
+napi_value SharedMemory::SetFormat(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return nullptr;
+  if (!obj->notPlaying()) return nullptr;
+  uint32_t w = (uint32_t)Int64(env, args[0]);
+  uint32_t h = (uint32_t)Int64(env, args[1]);
+  uint32_t c = (uint32_t)Int64(env, args[2]);
+
+  // Options: { format, alignment, grow }, format and alignment keep their
+  // current value when omitted (the producer is the only writer, it can read
+  // the format line directly). grow: resize() when the format doesn't fit.
+  SharedHeader* hdr = obj->headerPtr();
+  uint32_t format = hdr->format.pixel_format < PIXEL_FORMAT_COUNT ? hdr->format.pixel_format : PIXEL_FORMAT_UNKNOWN;
+  uint32_t alignment = hdr->format.row_alignment ? hdr->format.row_alignment : 1;
+  bool grow = false;
+  if (args.Length() > 3 && !ParseFormatOptions(env, args[3], &format, &alignment)) return nullptr;
+  if (args.Length() > 3) grow = Truthy(env, Get(env, args[3], "grow"));
+  uint64_t frameBytes = ComputeLayout(format, w, h, c ? c : PIXEL_FORMAT_CHANNELS[format], alignment).frameBytes;
+  if (frameBytes > obj->dataCapacity()) {
+    std::string error;
+    if (!grow || frameBytes > UINT32_MAX - 63) {
+      return ThrowRangeError(env, "Format does not fit the slot capacity");
+    }
+    if (!obj->resizeCapacity((frameBytes + 63) / 64 * 64, &error)) return ThrowError(env, error.c_str());
+    hdr = obj->headerPtr();
+  }
+
+  FrameFormat next;
+  MakeFormat(&next, w, h, c, format, alignment);
+  obj->writeFormat(next);
+  return Bool(env, true);
+}
+
+// Producer side: replaces the header's format under the format seqlock.
+void SharedMemory::writeFormat(const FrameFormat& next) {
+  shm_image::WriteFormat(headerPtr(), next);
+  notifyReaders();
+}
+
+// resize(size) -> generation: makes every slot hold frames up to `size`
+// bytes. Within the create() maxFrameSize (or shrinking) the slots change in
+// place; beyond it the ring moves to a new mapping and readers follow on
+// their next read, without missing the frame published last. Buffers from
+// getFrameBuffer() are invalid afterwards.
+napi_value SharedMemory::Resize(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->notPlaying()) return nullptr;
+  if (!obj->base_ || obj->slotCount() == 0) return ThrowError(env, "Not connected");
+  if (args.Length() < 1 || !IsNumber(env, args[0])) return ThrowTypeError(env, "Args: size");
+
+  int64_t size = Int64(env, args[0]);
+  uint64_t capacity = size > 0 ? ((uint64_t)size + 63) / 64 * 64 : 0;
+  if (capacity == 0 || capacity > UINT32_MAX) return ThrowRangeError(env, "Invalid frame size");
+  SharedHeader* hdr = obj->headerPtr();
+  if (ComputeLayout(hdr->format.pixel_format, hdr->format.width, hdr->format.height, hdr->format.channels,
+                    hdr->format.row_alignment ? hdr->format.row_alignment : 1).frameBytes > capacity) {
+    return ThrowRangeError(env, "Format does not fit the slot capacity");
+  }
+
+  std::string error;
+  if (!obj->resizeCapacity(capacity, &error)) return ThrowError(env, error.c_str());
+  return Uint(env, obj->headerPtr()->generation);
+}
+
+// Returns a zero-copy view of the slot the next publishFrame() will publish.
+// The slot changes after every publish, so call this once per frame.
+// getFrameBuffer({ sync }): with dirtyTiles the slot is first brought up to
+// date with the latest frame (only its changed tiles), so a producer just
+// redraws what it passes to publishFrame() as dirty. sync: false skips that
+// for producers that rewrite the whole frame anyway.
+napi_value SharedMemory::GetFrameBuffer(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->notPlaying()) return nullptr;
+  
+  if (!obj->base_ || obj->dataCapacity() == 0) return Null(env);
+
+  bool sync = true;
+  if (args.Length() > 0 && IsObject(env, args[0])) {
+    napi_value v = Get(env, args[0], "sync");
+    if (TypeOf(env, v) != napi_undefined) sync = Truthy(env, v);
+  }
+  bool fresh = obj->writeSlot_ < 0;
+  int32_t slot = obj->acquireWriteSlot();
+  if (slot >= 0 && fresh && sync) obj->syncWriteSlot(slot);
+  char* ptr = slot >= 0 ? static_cast<char*>(obj->slotPtr((uint32_t)slot)) : nullptr;
+  if (!ptr) return Null(env);
+
+  // Zero-Copy view of the memory
+  return ViewBuffer(env, ptr, obj->dataCapacity());
+}
+
+napi_value SharedMemory::GetCapacity(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  return Num(env, (double)obj->dataCapacity());
+}
+
+// publishFrame(size?, { captureNs, dirty, texture, cpu }?): captureNs is when
+// the frame was captured, on the clock of now() (process.hrtime.bigint() on
+// Linux and Windows); readers get it back next to the publish time.
+// texture: the frame was rendered into the slot's setSlotTexture() texture,
+// cpu: false when the slot buffer wasn't written as well (readFrame() and
+// acquireFrame() then hand out an empty frame).
+napi_value SharedMemory::PublishFrame(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_ || !obj->notPlaying()) return nullptr;
+
+  uint64_t captureNs = 0;
+  napi_value dirty = nullptr;
+  uint32_t gpuFlags = 0;
+  if (args.Length() > 1 && IsObject(env, args[1])) {
+    Uint64(env, Get(env, args[1], "captureNs"), &captureNs);
+    dirty = Get(env, args[1], "dirty");
+    if (TypeOf(env, dirty) != napi_undefined && !IsArray(env, dirty)) {
+      return ThrowTypeError(env, "dirty must be an array of { x, y, width, height }");
+    }
+    if (TypeOf(env, dirty) == napi_undefined) dirty = nullptr;
+    if (Truthy(env, Get(env, args[1], "texture"))) {
+      gpuFlags |= FRAME_GPU;
+      napi_value v = Get(env, args[1], "cpu");
+      if (TypeOf(env, v) != napi_undefined && !Truthy(env, v)) gpuFlags |= FRAME_NO_CPU;
+    }
+  }
+
+  // frame size defaults to the one the header's layout describes
+  SharedHeader* hdr = obj->headerPtr();
+  uint32_t frameBytes = args.Length() > 0 && IsNumber(env, args[0])
+      ? (uint32_t)Int64(env, args[0])
+      : (uint32_t)ComputeLayout(hdr->format.pixel_format, hdr->format.width, hdr->format.height, hdr->format.channels,
+                                hdr->format.row_alignment ? hdr->format.row_alignment : 1).frameBytes;
+  if (frameBytes > obj->dataCapacity()) return Bool(env, false); // resize() first
+
+  // publishes the slot handed out by getFrameBuffer()
+  int32_t slot = obj->writeSlot_;
+  if (slot < 0) return Bool(env, false);
+  if ((gpuFlags & FRAME_GPU) && hdr->gpu[slot].kind == GPU_NONE) {
+    return ThrowError(env, "No texture registered for this slot");
+  }
+
+  uint64_t index = hdr->frame_index.load(std::memory_order_relaxed) + 1;
+  if (!dirty || !obj->markDirtyTiles(dirty, index)) {
+    // no dirty list (or no tile table): changed everywhere
+    hdr->full_frame_index.store(index, std::memory_order_relaxed);
+  }
+
+  obj->publishSlot(slot, frameBytes, captureNs, gpuFlags);
+  return Bool(env, true);
+}
+
+// writeFrame(buffer, { from, stride, premultiply, captureNs, dirty, threads,
+// bytesPerThread, streaming }?) -> bool: getFrameBuffer(), copy and
+// publishFrame() in one call. `buffer` (Buffer, TypedArray or DataView) is
+// the frame; from: its pixel format when it isn't the header's, converted on
+// the way in (stride: its row pitch, packed by default). Large frames go in
+// with non-temporal stores, so the copy doesn't evict the producer's own
+// working set. False when every slot is pinned or the frame doesn't fit.
+napi_value SharedMemory::WriteFrame(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_ || !obj->notPlaying()) return nullptr;
+
+  char* src;
+  size_t srcBytes;
+  if (!ViewData(env, args[0], &src, &srcBytes)) return ThrowTypeError(env, "Args: buffer, options?");
+  napi_value opts = args[1];
+  uint64_t captureNs = 0;
+  napi_value dirty = nullptr;
+  int from = -1;
+  uint32_t srcStride = 0;
+  bool premultiply = false;
+  CopyPolicy policy = obj->currentCopyPolicy();
+  if (IsObject(env, opts)) {
+    Uint64(env, Get(env, opts, "captureNs"), &captureNs);
+    dirty = Get(env, opts, "dirty");
+    if (TypeOf(env, dirty) != napi_undefined && !IsArray(env, dirty)) {
+      return ThrowTypeError(env, "dirty must be an array of { x, y, width, height }");
+    }
+    if (TypeOf(env, dirty) == napi_undefined) dirty = nullptr;
+    napi_value v = Get(env, opts, "from");
+    if (IsString(env, v)) {
+      from = FindConvertFormat(env, v);
+      if (from < 0) return ThrowTypeError(env, "Unknown pixel format");
+    }
+    v = Get(env, opts, "stride");
+    if (IsNumber(env, v)) srcStride = (uint32_t)std::max<int64_t>(0, Int64(env, v));
+    premultiply = Truthy(env, Get(env, opts, "premultiply"));
+    if (!ParseCopyOptions(env, opts, &policy)) return nullptr;
+  }
+
+  // converting: into the header's layout, planes and row padding included
+  SharedHeader* hdr = obj->headerPtr();
+  const FrameFormat& fmt = hdr->format; // only we write it
+  convert::Plan plan;
+  uint32_t frameBytes = (uint32_t)std::min<size_t>(srcBytes, UINT32_MAX);
+  bool converting = from >= 0 || premultiply;
+  if (converting) {
+    uint32_t srcFormat = from >= 0 ? (uint32_t)from : fmt.pixel_format;
+    uint32_t srcChannels = from >= 0 ? 0 : fmt.channels;
+    uint32_t dstFormat = fmt.pixel_format;
+    if (dstFormat == PIXEL_FORMAT_UNKNOWN) {
+      dstFormat = fmt.channels == 4 ? PIXEL_FORMAT_RGBA8 : fmt.channels == 3 ? PIXEL_FORMAT_RGB8 : PIXEL_FORMAT_COUNT;
+    }
+    if (!srcStride) srcStride = fmt.width * BytesPerPixel(srcFormat, srcChannels);
+    if (srcFormat >= PIXEL_FORMAT_COUNT || dstFormat >= PIXEL_FORMAT_COUNT ||
+        !convert::MakePlan(srcFormat, srcChannels, dstFormat, fmt.width, fmt.height, srcStride, premultiply, &plan)) {
+      return ThrowTypeError(env, "Cannot convert between those formats");
+    }
+    if (convert::SourceBytes(plan) > srcBytes) return ThrowRangeError(env, "The buffer is smaller than the frame");
+    for (uint32_t i = 0; i < plan.planes && i < SHARED_MAX_PLANES; i++) {
+      plan.dstStride[i] = fmt.plane_stride[i];
+      plan.dstOffset[i] = fmt.plane_offset[i];
+    }
+    frameBytes = (uint32_t)ComputeLayout(fmt.pixel_format, fmt.width, fmt.height, fmt.channels,
+                                         fmt.row_alignment ? fmt.row_alignment : 1).frameBytes;
+  }
+  if (frameBytes > obj->dataCapacity()) return Bool(env, false); // resize() first
+
+  // the whole frame is rewritten, nothing to bring over from the latest one
+  int32_t slot = obj->acquireWriteSlot();
+  uint8_t* dst = slot >= 0 ? static_cast<uint8_t*>(obj->slotPtr((uint32_t)slot)) : nullptr;
+  if (!dst) return Bool(env, false);
+  const uint8_t* from8 = reinterpret_cast<const uint8_t*>(src);
+  uint32_t parts = converting ? ParallelConvert(policy, plan, from8, dst)
+                              : ParallelCopy(policy, reinterpret_cast<char*>(dst), from8, frameBytes);
+  if (parts > 1) obj->countParallelCopy();
+
+  uint64_t index = hdr->frame_index.load(std::memory_order_relaxed) + 1;
+  if (!dirty || !obj->markDirtyTiles(dirty, index)) hdr->full_frame_index.store(index, std::memory_order_relaxed);
+  obj->publishSlot(slot, frameBytes, captureNs, 0);
+  return Bool(env, true);
+}
+
+// Publishes the write slot `slot` holding `frameBytes` bytes and wakes
+// everyone waiting for it.
+void SharedMemory::publishSlot(int32_t slot, uint32_t frameBytes, uint64_t captureNs, uint32_t gpuFlags) {
+  SharedHeader* hdr = headerPtr();
+  // levels are built before the frame goes out, readers never wait for them
+  if (hdr->level_count && !(gpuFlags & FRAME_NO_CPU) && buildLevels(slot, frameBytes)) gpuFlags |= FRAME_LEVELS;
+  shm_image::PublishSlot(hdr, slot, frameBytes, captureNs, gpuFlags);
+  writeSlot_ = -1;
+
+  // a pipeline's frame goes to its first stage, the last one wakes the readers
+  if (hdr->stage_count) {
+    notifyReaders(1);
+    return;
+  }
+  notifyReaders();
+  notifyWaiters();
+  // the raw frame is out; the compressed copy follows on the compressor thread
+  if (hdr->compress_capacity && !(gpuFlags & FRAME_NO_CPU) && compressionWanted()) startCompress(slot);
+}
+
+// Stamps the tiles `rects` ({ x, y, width, height } in pixels) touch with
+// frame `index`. False when there is no tile grid to stamp. Entries that
+// aren't rectangles are skipped.
+bool SharedMemory::markDirtyTiles(napi_value rects, uint64_t index) {
+  SharedHeader* hdr = headerPtr();
+  TileGen* gens = tileTable();
+  TileGrid grid;
+  if (!gens || !MakeTileGrid(hdr->format, hdr->tile_count, &grid)) return false;
+
+  napi_env env = env_;
+  const char* keys[4] = { "x", "y", "width", "height" };
+  uint32_t length = 0;
+  napi_get_array_length(env, rects, &length);
+  for (uint32_t i = 0; i < length; i++) {
+    napi_value item;
+    if (napi_get_element(env, rects, i, &item) != napi_ok || !IsObject(env, item)) continue;
+    int64_t r[4] = {};
+    for (int k = 0; k < 4; k++) r[k] = Int64(env, Get(env, item, keys[k]));
+    // clamp to the frame
+    int64_t x0 = std::max<int64_t>(r[0], 0), y0 = std::max<int64_t>(r[1], 0);
+    int64_t x1 = std::min<int64_t>(r[0] + r[2], hdr->format.width), y1 = std::min<int64_t>(r[1] + r[3], hdr->format.height);
+    if (x1 <= x0 || y1 <= y0) continue;
+    for (int64_t ty = y0 / SHARED_TILE_SIZE; ty <= (y1 - 1) / SHARED_TILE_SIZE; ty++) {
+      for (int64_t tx = x0 / SHARED_TILE_SIZE; tx <= (x1 - 1) / SHARED_TILE_SIZE; tx++) {
+        gens[ty * grid.cols + tx].store((uint32_t)index, std::memory_order_relaxed);
+      }
+    }
+  }
+  return true;
+}
+
+// Pins the latest published slot so the producer cannot refill it.
+// *outSlot is -1 when nothing has been published yet.
+ReadResult SharedMemory::pinLatestSlot(int32_t* outSlot) {
+  uint64_t retries = 0;
+  bool pinned = shm_image::PinLatestSlot(headerPtr(), slotCount(), readerIndex_, outSlot, &retries);
+  if (retries) addRetries(retries);
+  return pinned ? READ_OK : READ_CONTENTION;
+}
+
+// Pins the slot to read next: the latest one, or in lossless mode the
+// oldest one past the cursor (one through the whole pipeline, if there is
+// one). A stage pins the oldest one past its cursor the stage before released.
+ReadResult SharedMemory::pinReadSlot(int32_t* outSlot) {
+  uint32_t stage = stage_;
+  if (!lossless_ && !stage) return pinLatestSlot(outSlot);
+  SharedHeader* hdr = headerPtr();
+  uint64_t until = stage ? shm_image::StageInput(hdr, stage) : shm_image::PipelineIndex(hdr);
+  uint64_t retries = 0;
+  bool pinned = shm_image::PinNextSlot(hdr, slotCount(), readerIndex_, lastSeenIndex_, until, outSlot, &retries);
+  if (retries) addRetries(retries);
+  return pinned ? READ_OK : READ_CONTENTION;
+}
+
+void SharedMemory::addRetries(uint64_t n) {
+  retries_.fetch_add(n, std::memory_order_relaxed);
+  if (ReaderDesc* r = readerDesc()) r->retries.fetch_add(n, std::memory_order_relaxed);
+}
+
+// Books the frame in the pinned `slot` as consumed: frame_index gaps since
+// the previous one count as drops, its timestamps go to getStats().
+void SharedMemory::consumeSlot(int32_t slot) {
+  SlotDesc* desc = &headerPtr()->slots[slot];
+  uint64_t index = desc->frame_index.load(std::memory_order_relaxed);
+  uint64_t last = lastSeenIndex_.exchange(index);
+  uint64_t dropped = last && index > last + 1 ? index - last - 1 : 0;
+  {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    framesRead_++;
+    framesDropped_ += dropped;
+    lastFrame_.index = index;
+    lastFrame_.captureNs = desc->capture_ns.load(std::memory_order_relaxed);
+    lastFrame_.publishNs = desc->publish_ns.load(std::memory_order_relaxed);
+    lastFrame_.readNs = platform::MonotonicNs();
+  }
+  if (ReaderDesc* r = readerDesc()) {
+    r->last_frame_index.store(index, std::memory_order_relaxed);
+    r->frames_read.fetch_add(1, std::memory_order_relaxed);
+    if (dropped) r->frames_dropped.fetch_add(dropped, std::memory_order_relaxed);
+  }
+}
+
+void SharedMemory::unpinSlot(int32_t slot) {
+  if (!base_ || slot < 0 || (uint32_t)slot >= slotCount()) return;
+  shm_image::UnpinSlot(headerPtr(), readerIndex_, slot);
+}
+
+// Copies the frame to read next (the latest published one, the next one in
+// lossless mode) out once per entry of `copies`, each converted as its spec
+// says. The slot is pinned for the duration of the copies, so they all show
+// the same frame and nothing is retried.
+// Used off the JS thread.
+// A recorder gets the frame queued for its recording under the same pin.
+ReadResult SharedMemory::copyLatestFrame(FrameCopy* copies, size_t count, recording::QueuedWriter* recorder) {
+  int32_t slot;
+  ReadResult result = pinReadSlot(&slot);
+  if (result != READ_OK || slot < 0) return result;
+
+  FrameFormat fmt = {};
+  uint32_t formatSeq = 0;
+  ReadResult formatStatus = !readFormat(&fmt, &formatSeq) ? READ_CONTENTION
+                          : formatSeq != headerPtr()->slots[slot].format_seq ? READ_STALE : READ_OK;
+  for (size_t i = 0; i < count; i++) {
+    copies[i].format = fmt;
+    copies[i].formatStatus = formatStatus;
+    copyOut(slot, &copies[i]);
+  }
+  if (recorder) recordSlot(slot, recorder);
+  consumeSlot(slot);
+  unpinSlot(slot);
+  return READ_OK;
+}
+
+// helper: copy->data = the frame in the pinned `slot`, converted on the way
+// (nullptr for an empty frame)
+void SharedMemory::copyOut(int32_t slot, FrameCopy* copy) {
+  SlotDesc* desc = &headerPtr()->slots[slot];
+  uint32_t frameBytes = desc->frame_size;
+  const uint8_t* src = static_cast<const uint8_t*>(slotPtr((uint32_t)slot));
+  if (frameBytes > dataCapacity() || !src) frameBytes = 0;
+  copy->data = nullptr;
+  copy->size = 0;
+  copy->status = READ_OK;
+  copy->frameIndex = desc->frame_index.load(std::memory_order_relaxed);
+  copy->captureNs = desc->capture_ns.load(std::memory_order_relaxed);
+  copy->publishNs = desc->publish_ns.load(std::memory_order_relaxed);
+  if (desc->gpu_flags & FRAME_NO_CPU) return; // only acquireTexture() has it
+  auto allocate = [copy](size_t bytes) {
+    return copy->into && bytes <= copy->intoSize ? copy->into : static_cast<char*>(malloc(bytes));
+  };
+
+  // a level: its packed rows stand in for the frame from here on
+  FrameFormat fmt;
+  bool haveFormat = false;
+  if (copy->spec.level) {
+    uint32_t formatSeq;
+    if (!readFormat(&fmt, &formatSeq)) { copy->status = READ_CONTENTION; return; }
+    if (formatSeq != desc->format_seq) { copy->status = READ_STALE; return; }
+    SharedHeader* hdr = headerPtr();
+    shm_image::LevelLayout level;
+    const uint8_t* area = (desc->gpu_flags & FRAME_LEVELS) && copy->spec.level <= hdr->level_count ? levelArea(slot) : nullptr;
+    if (!area || !shm_image::ComputeLevel(fmt, copy->spec.level, &level) || level.offset + level.bytes > hdr->level_capacity) {
+      copy->status = READ_UNSUPPORTED;
+      return;
+    }
+    src = area + level.offset;
+    frameBytes = (uint32_t)level.bytes;
+    fmt.width = level.width;
+    fmt.height = level.height;
+    fmt.plane_stride[0] = level.stride;
+    haveFormat = true;
+  }
+  // a region: packed formats, the frame's rows from the region's first pixel
+  uint32_t regionRow = 0;
+  if (copy->spec.w) {
+    uint32_t formatSeq;
+    if (!haveFormat && !readFormat(&fmt, &formatSeq)) { copy->status = READ_CONTENTION; return; }
+    if (!haveFormat && formatSeq != desc->format_seq) { copy->status = READ_STALE; return; }
+    haveFormat = true;
+    uint32_t bpp = BytesPerPixel(fmt.pixel_format, fmt.channels);
+    uint64_t skip = (uint64_t)copy->spec.y * fmt.plane_stride[0] + (uint64_t)copy->spec.x * bpp;
+    regionRow = copy->spec.w * bpp;
+    if (fmt.plane_count > 1 || !bpp || copy->spec.x + copy->spec.w > fmt.width || copy->spec.y + copy->spec.h > fmt.height ||
+        skip + (uint64_t)(copy->spec.h - 1) * fmt.plane_stride[0] + regionRow > frameBytes) {
+      copy->status = READ_UNSUPPORTED;
+      return;
+    }
+    src += skip;
+    frameBytes -= (uint32_t)skip;
+    fmt.width = copy->spec.w;
+    fmt.height = copy->spec.h;
+  }
+
+  if (copy->spec.raw() && regionRow) {
+    // the region's rows, packed
+    uint32_t height = fmt.height, stride = fmt.plane_stride[0];
+    uint64_t bytes = (uint64_t)regionRow * height;
+    if (bytes > UINT32_MAX) { copy->status = READ_UNSUPPORTED; return; }
+    copy->data = allocate((size_t)bytes);
+    if (!copy->data) { copy->status = READ_CONTENTION; return; }
+    uint32_t parts = std::min(CopyParts(copy->policy, bytes), height);
+    uint32_t rows = (height + parts - 1) / parts;
+    char* dst = copy->data;
+    workers::Run(parts, [&](uint32_t p) {
+      for (uint32_t y = p * rows; y < std::min(height, (p + 1) * rows); y++) {
+        memcpy(dst + (size_t)y * regionRow, src + (size_t)y * stride, regionRow);
+      }
+    });
+    if (parts > 1) countParallelCopy();
+    copy->size = (uint32_t)bytes;
+    return;
+  }
+
+  if (copy->spec.raw()) {
+    // Copying data (deep copy)
+    if (frameBytes == 0) return;
+    copy->data = allocate(frameBytes);
+    if (!copy->data) { copy->status = READ_CONTENTION; return; }
+    if (ParallelCopy(copy->policy, copy->data, src, frameBytes) > 1) countParallelCopy();
+    copy->size = frameBytes;
+    return;
+  }
+
+  // converting: the stored layout has to be the one the frame was written with
+  uint32_t formatSeq;
+  if (!haveFormat && !readFormat(&fmt, &formatSeq)) { copy->status = READ_CONTENTION; return; }
+  if (!haveFormat && formatSeq != desc->format_seq) { copy->status = READ_STALE; return; }
+
+  convert::Plan plan;
+  if (!convert::MakePlan(fmt.pixel_format, fmt.channels, copy->spec.format, fmt.width, fmt.height,
+                         fmt.plane_stride[0], copy->spec.premultiply, &plan) ||
+      convert::SourceBytes(plan) > frameBytes || plan.dstBytes > UINT32_MAX) {
+    copy->status = READ_UNSUPPORTED;
+    return;
+  }
+  if (plan.dstBytes == 0) return;
+  copy->data = allocate((size_t)plan.dstBytes);
+  if (!copy->data) { copy->status = READ_CONTENTION; return; }
+  // one pass: the conversion reads straight from the slot
+  if (ParallelConvert(copy->policy, plan, src, reinterpret_cast<uint8_t*>(copy->data)) > 1) countParallelCopy();
+  copy->size = (uint32_t)plan.dstBytes;
+}
+
+// readFrame({ incremental }): brings incBuffer_, a reader-owned copy of the
+// last frame read, up to date with the latest frame, copying only the tiles
+// changed since (everything without a tile table). JS thread only.
+ReadResult SharedMemory::readIncremental() {
+  int32_t slot;
+  ReadResult result = pinReadSlot(&slot);
+  if (result != READ_OK || slot < 0) return result;
+
+  SlotDesc* desc = &headerPtr()->slots[slot];
+  uint32_t frameBytes = desc->frame_size;
+  const uint8_t* src = static_cast<const uint8_t*>(slotPtr((uint32_t)slot));
+  if (frameBytes > dataCapacity() || !src || (desc->gpu_flags & FRAME_NO_CPU)) frameBytes = 0;
+  uint64_t index = desc->frame_index.load(std::memory_order_relaxed);
+  FrameFormat fmt;
+  uint32_t formatSeq;
+  if (!readFormat(&fmt, &formatSeq) || formatSeq != desc->format_seq) formatSeq = 1; // odd: copy it all next time too
+
+  char* data = nullptr;
+  if (!incBuffer_ || incSize_ != frameBytes) {
+    if (incBuffer_) napi_delete_reference(env_, incBuffer_);
+    napi_create_reference(env_, NewBuffer(env_, frameBytes, &data), 1, &incBuffer_);
+    incSize_ = frameBytes;
+    incIndex_ = 0;
+  } else {
+    napi_value buf;
+    size_t length;
+    napi_get_reference_value(env_, incBuffer_, &buf);
+    BufferData(env_, buf, &data, &length);
+  }
+  uint8_t* dst = reinterpret_cast<uint8_t*>(data);
+  uint32_t total = 0;
+  int64_t copied = incFormatSeq_ == formatSeq && !(formatSeq & 1)
+      ? copyChangedTiles(fmt, src, dst, frameBytes, incIndex_, index, &total) : -1;
+  if (copied < 0) {
+    if (frameBytes) memcpy(dst, src, frameBytes);
+    copied = total;
+  }
+  incIndex_ = index;
+  incFormatSeq_ = formatSeq;
+  {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    tilesCopied_ += (uint64_t)copied;
+    tilesSkipped_ += total - (uint64_t)copied;
+  }
+
+  consumeSlot(slot);
+  unpinSlot(slot);
+  return READ_OK;
+}
+
+// readFrame(timeout?, options?) -> Buffer | null; options.regions: [{ x, y,
+// w, h }, ...] -> an array of Buffers instead, one per region, all of the
+// same frame.
+napi_value SharedMemory::ReadFrame(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  
+  if (!obj->base_) return ThrowError(env, "Not connected");
+
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[0])) timeout = (uint32_t)Int64(env, args[0]);
+  WaitPolicy policy = obj->currentPolicy();
+  FrameCopy copy;
+  copy.policy = obj->currentCopyPolicy();
+  if (!ParseWaitPolicy(env, OptionsArg(args), &policy)) return nullptr;
+  if (!ParseConvertOptions(env, OptionsArg(args), &copy.spec)) return nullptr;
+  if (!ParseCopyOptions(env, OptionsArg(args), &copy.policy)) return nullptr;
+  bool incremental = Truthy(env, Get(env, OptionsArg(args), "incremental"));
+  napi_value regions = Get(env, OptionsArg(args), "regions");
+  bool many = IsArray(env, regions);
+  std::vector<FrameCopy> copies(1, copy);
+  if (many) {
+    uint32_t length = 0;
+    napi_get_array_length(env, regions, &length);
+    copies.assign(length, copy);
+    for (uint32_t i = 0; i < length; i++) {
+      napi_value region;
+      napi_get_element(env, regions, i, &region);
+      if (!ParseRegion(env, region, &copies[i].spec)) return nullptr;
+      if (!copies[i].spec.w) return ThrowTypeError(env, "regions are { x, y, w, h }");
+    }
+  }
+  if (incremental && (many || !(copy.spec.raw() && copy.spec.whole()))) {
+    return ThrowTypeError(env, "incremental reads copy whole frames");
+  }
+
+  // Wait for a new frame; a stale one (setFormat() raced it) can't be
+  // converted, the next one can
+  obj->attachReader();
+  uint64_t deadline = timeout == platform::kInfinite ? UINT64_MAX : platform::MonotonicNs() + timeout * 1000000ull;
+  ReadResult result;
+  do {
+    uint64_t now = platform::MonotonicNs();
+    uint32_t left = deadline == UINT64_MAX ? platform::kInfinite : now < deadline ? (uint32_t)((deadline - now) / 1000000) : 0;
+    if (!obj->waitForFrame(policy, left, nullptr, nullptr)) return Null(env);
+    // the producer resized: read from its new generation
+    if (obj->followGeneration()) {
+      result = READ_STALE;
+      continue;
+    }
+    if (incremental) {
+      result = obj->readIncremental();
+      break;
+    }
+    if (copies.empty()) {
+      result = READ_OK; // no regions: nothing to wait for but the frame
+      break;
+    }
+    result = obj->copyLatestFrame(copies.data(), copies.size());
+    const char* failed = nullptr;
+    for (FrameCopy& c : copies) {
+      if (result == READ_OK && c.status != READ_OK) {
+        result = c.status;
+        failed = c.spec.unsupported();
+      }
+    }
+    if (result != READ_OK) {
+      for (FrameCopy& c : copies) {
+        free(c.data);
+        c.data = nullptr;
+      }
+    }
+    if (result == READ_UNSUPPORTED) return ThrowTypeError(env, failed ? failed : copy.spec.unsupported());
+  } while (result == READ_STALE);
+
+  if (result != READ_OK) return ThrowError(env, "ReadFrame contention");
+
+  if (incremental) {
+    napi_value buf = nullptr;
+    if (obj->incBuffer_) napi_get_reference_value(env, obj->incBuffer_, &buf);
+    return buf ? buf : NewBuffer(env, 0);
+  }
+
+  // Buffers take ownership of the malloc'd blocks
+  auto take = [&](FrameCopy& c) { return c.data ? OwnedBuffer(env, c.data, c.size) : NewBuffer(env, 0); };
+  if (!many) return take(copies[0]);
+  napi_value ret = NewArray(env);
+  for (uint32_t i = 0; i < copies.size(); i++) SetIndex(env, ret, i, take(copies[i]));
+  return ret;
+}
+
+// readFrameInto(buffer, offset?, timeout?, options?) -> { buffer, offset, bytes, frameIndex, captureNs,
+// publishNs, width, height, format } | null: readFrame() without the Buffer per frame, the frame
+// (converted as readFrame() would) copied to `offset` in the caller's Buffer,
+// TypedArray or DataView. Should the frame outgrow the room past `offset`, it
+// comes back in a new Buffer at offset 0 instead, to pass in next time.
+napi_value SharedMemory::ReadFrameInto(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+
+  char* into;
+  size_t intoLength;
+  if (!ViewData(env, args[0], &into, &intoLength)) {
+    return ThrowTypeError(env, "Args: buffer, offset?, timeout?, options?");
+  }
+  int64_t offset = IsNumber(env, args[1]) ? Int64(env, args[1]) : 0;
+  if (offset < 0 || (uint64_t)offset > intoLength) return ThrowRangeError(env, "offset is outside the buffer");
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[2])) timeout = (uint32_t)Int64(env, args[2]);
+  napi_value options = IsObject(env, args[2]) ? args[2] : args[3];
+  WaitPolicy policy = obj->currentPolicy();
+  FrameCopy copy;
+  copy.policy = obj->currentCopyPolicy();
+  copy.into = into + offset;
+  copy.intoSize = intoLength - (size_t)offset;
+  if (!ParseWaitPolicy(env, options, &policy)) return nullptr;
+  if (!ParseConvertOptions(env, options, &copy.spec)) return nullptr;
+  if (!ParseCopyOptions(env, options, &copy.policy)) return nullptr;
+
+  // as readFrame(): a stale frame can't be converted, the next one can
+  obj->attachReader();
+  uint64_t deadline = timeout == platform::kInfinite ? UINT64_MAX : platform::MonotonicNs() + timeout * 1000000ull;
+  ReadResult result;
+  do {
+    uint64_t now = platform::MonotonicNs();
+    uint32_t left = deadline == UINT64_MAX ? platform::kInfinite : now < deadline ? (uint32_t)((deadline - now) / 1000000) : 0;
+    if (!obj->waitForFrame(policy, left, nullptr, nullptr)) return Null(env);
+    if (obj->followGeneration()) {
+      result = READ_STALE;
+      continue;
+    }
+    result = obj->copyLatestFrame(&copy, 1);
+    if (result == READ_OK) result = copy.status;
+    if (result == READ_OK && copy.formatStatus != READ_OK) {
+      // the metadata has to describe these bytes: no format, no frame
+      if (copy.data != copy.into) free(copy.data);
+      copy.data = nullptr;
+      result = copy.formatStatus;
+    }
+  } while (result == READ_STALE);
+
+  bool grown = copy.data && copy.data != copy.into;
+  if (result != READ_OK) {
+    if (grown) free(copy.data);
+    if (result == READ_UNSUPPORTED) return ThrowTypeError(env, copy.spec.unsupported());
+    return ThrowError(env, "ReadFrame contention");
+  }
+
+  FrameFormat fmt = copy.format;
+  shm_image::LevelLayout level;
+  if (copy.spec.level && shm_image::ComputeLevel(fmt, copy.spec.level, &level)) {
+    fmt.width = level.width;
+    fmt.height = level.height;
+  }
+  if (copy.spec.w) {
+    fmt.width = copy.spec.w;
+    fmt.height = copy.spec.h;
+  }
+  uint32_t format = copy.spec.raw() ? fmt.pixel_format : copy.spec.format;
+  napi_value ret = NewObject(env);
+  Set(env, ret, "buffer", grown ? OwnedBuffer(env, copy.data, copy.size) : args[0]);
+  Set(env, ret, "offset", Num(env, grown ? 0 : (double)offset));
+  Set(env, ret, "bytes", Uint(env, copy.size));
+  Set(env, ret, "frameIndex", BigUint(env, copy.frameIndex));
+  Set(env, ret, "captureNs", BigUint(env, copy.captureNs));
+  Set(env, ret, "publishNs", BigUint(env, copy.publishNs));
+  Set(env, ret, "width", Uint(env, fmt.width));
+  Set(env, ret, "height", Uint(env, fmt.height));
+  Set(env, ret, "format", Str(env, format == convert::FORMAT_I420 ? "i420"
+      : PIXEL_FORMAT_NAMES[format < PIXEL_FORMAT_COUNT ? format : PIXEL_FORMAT_UNKNOWN]));
+  return ret;
+}
+
+// readFrames(maxCount, into, timeout?, options?) -> [{ offset, size, frameIndex, captureNs, publishNs }] | null:
+// the frames published since the last one this reader consumed that the ring
+// still holds, oldest first, copied back to back into the Buffer `into` (at
+// most maxCount, as many as fit). Waits like readFrame() for the first one.
+// Frames the producer refilled before we got to them, or wrote under an older
+// format, are skipped and count as dropped, so the array can come back empty.
+napi_value SharedMemory::ReadFrames(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+
+  char* into;
+  size_t intoLength;
+  if (!IsNumber(env, args[0]) || !BufferData(env, args[1], &into, &intoLength)) {
+    return ThrowTypeError(env, "Args: maxCount, into, timeout?, options?");
+  }
+  int64_t maxCount = Int64(env, args[0]);
+  if (maxCount < 1) return ThrowRangeError(env, "maxCount must be at least 1");
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[2])) timeout = (uint32_t)Int64(env, args[2]);
+  napi_value options = IsObject(env, args[2]) ? args[2] : args[3];
+  WaitPolicy policy = obj->currentPolicy();
+  if (!ParseWaitPolicy(env, options, &policy)) return nullptr;
+
+  obj->attachReader();
+  do {
+    if (!obj->waitForFrame(policy, timeout, nullptr, nullptr)) return Null(env);
+  } while (obj->followGeneration());
+
+  // the unread frames still in the ring, oldest first
+  SharedHeader* hdr = obj->headerPtr();
+  uint32_t count = obj->slotCount();
+  uint64_t last = obj->lastSeenIndex_.load();
+  uint64_t until = shm_image::PipelineIndex(hdr); // a pipeline's frames are unread once through every stage
+  std::vector<std::pair<uint64_t, int32_t>> unread;
+  for (uint32_t s = 0; s < count; s++) {
+    uint64_t index = hdr->slots[s].frame_index.load(std::memory_order_acquire);
+    if (index > last && index <= until) unread.push_back({ index, (int32_t)s });
+  }
+  std::sort(unread.begin(), unread.end());
+  FrameFormat fmt;
+  uint32_t formatSeq = 1;
+  if (!obj->readFormat(&fmt, &formatSeq)) return ThrowError(env, "ReadFrame contention");
+
+  napi_value frames = NewArray(env);
+  uint32_t n = 0;
+  size_t offset = 0;
+  for (auto& u : unread) {
+    if (n == maxCount) break;
+    int32_t slot = u.second;
+    if (!shm_image::PinSlot(hdr, obj->readerIndex_, slot)) continue; // being refilled
+    SlotDesc* desc = &hdr->slots[slot];
+    if (desc->frame_index.load(std::memory_order_relaxed) != u.first || desc->format_seq != formatSeq) {
+      obj->unpinSlot(slot);
+      continue;
+    }
+    uint32_t frameBytes = desc->frame_size;
+    const uint8_t* src = static_cast<const uint8_t*>(obj->slotPtr((uint32_t)slot));
+    if (frameBytes > obj->dataCapacity() || !src || (desc->gpu_flags & FRAME_NO_CPU)) frameBytes = 0;
+    if (frameBytes > intoLength - offset) {
+      obj->unpinSlot(slot);
+      if (n == 0) return ThrowRangeError(env, "The buffer cannot hold the next frame");
+      break;
+    }
+    if (frameBytes) memcpy(into + offset, src, frameBytes);
+    napi_value f = NewObject(env);
+    Set(env, f, "offset", Num(env, (double)offset));
+    Set(env, f, "size", Uint(env, frameBytes));
+    Set(env, f, "frameIndex", BigUint(env, u.first));
+    Set(env, f, "captureNs", BigUint(env, desc->capture_ns.load(std::memory_order_relaxed)));
+    Set(env, f, "publishNs", BigUint(env, desc->publish_ns.load(std::memory_order_relaxed)));
+    SetIndex(env, frames, n++, f);
+    offset += frameBytes;
+    obj->consumeSlot(slot);
+    obj->unpinSlot(slot);
+  }
+  return frames;
+}
+
+// helper for acquireFrame()/acquireTexture() (timeout?, options?): waits for
+// a new frame and pins the latest slot until release() or the next acquire.
+// False when the method returns null, or throws.
+bool SharedMemory::acquireLatest(const CallArgs& args, int32_t* slot) {
+  napi_env env = args.env;
+  if (!base_) {
+     ThrowError(env, "Not connected");
+     return false;
+  }
+
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[0])) timeout = (uint32_t)Int64(env, args[0]);
+  WaitPolicy policy = currentPolicy();
+  if (!ParseWaitPolicy(env, OptionsArg(args), &policy)) return false;
+
+  attachReader();
+  do {
+    if (!waitForFrame(policy, timeout, nullptr, nullptr)) return false;
+  } while (followGeneration());
+
+  unpinSlot(pinnedSlot_);
+  pinnedSlot_ = -1;
+  platform::CloseMapping(&retired_); // the previous view is gone now
+
+  if (pinReadSlot(slot) != READ_OK) {
+    ThrowError(env, "ReadFrame contention");
+    return false;
+  }
+  if (*slot < 0) return false;
+  pinnedSlot_ = *slot;
+  consumeSlot(*slot);
+  return true;
+}
+
+// acquireFrame(timeout?, options?) -> Buffer|null: zero-copy view of the latest frame.
+// The slot stays pinned (the producer skips it) until release() or the next
+// acquireFrame(); the view must not be used after that.
+napi_value SharedMemory::AcquireFrame(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  int32_t slot;
+  if (!obj->acquireLatest(args, &slot)) return Null(env);
+
+  SlotDesc* desc = &obj->headerPtr()->slots[slot];
+  uint32_t frameBytes = desc->frame_size;
+  char* ptr = static_cast<char*>(obj->slotPtr((uint32_t)slot));
+  if (frameBytes > obj->dataCapacity() || !ptr || (desc->gpu_flags & FRAME_NO_CPU)) frameBytes = 0;
+
+  return ViewBuffer(env, ptr, frameBytes);
+}
+
+napi_value SharedMemory::Release(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  bool held = obj->pinnedSlot_ >= 0 || obj->retired_.base;
+  obj->unpinSlot(obj->pinnedSlot_);
+  obj->pinnedSlot_ = -1;
+  platform::CloseMapping(&obj->retired_);
+  return Bool(env, held);
+}
+
+// --- Pipelines ---
+
+// helper: a stage's name, its NUL is optional at full length
+static std::string StageName(const StageDesc& desc) {
+  return std::string(desc.name, strnlen(desc.name, STREAM_NAME_SIZE));
+}
+
+// Moves our stage's cursor on to the frame acquireStage() handed out and
+// wakes whoever comes next: the next stage, or the readers after the last.
+// False when we hold none.
+bool SharedMemory::releaseStage() {
+  if (stageSlot_ < 0) return false;
+  SharedHeader* hdr = headerPtr();
+  uint32_t stage = stage_;
+  shm_image::ReleaseStage(hdr, stage, stageSlot_, platform::MonotonicNs() - stageAcquiredNs_);
+  unpinSlot(stageSlot_);
+  stageSlot_ = -1;
+  if (stage < hdr->stage_count) {
+    notifyReaders(stage + 1);
+  } else {
+    notifyReaders();
+    notifyWaiters();
+  }
+  return true;
+}
+
+// Gives our stage up. A frame still held isn't released: whoever runs the
+// stage next gets it again, as with a stage that crashed.
+void SharedMemory::leaveStage() {
+  uint32_t stage = stage_;
+  if (!stage) return;
+  unpinSlot(stageSlot_);
+  stageSlot_ = -1;
+  if (base_ && readerIndex_ >= 0) shm_image::LeaveStage(headerPtr(), stage, readerIndex_);
+  stage_ = 0;
+}
+
+// joinStage(name) -> true: runs stage `name` of the pipeline create({ stages })
+// set up, from the frame after the stage's cursor on. One process runs a
+// stage at a time; frames are taken with acquireStage() from then on.
+napi_value SharedMemory::JoinStage(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!IsString(env, args[0])) return ThrowTypeError(env, "Args: name");
+  if (!obj->base_) return ThrowError(env, "Not connected");
+
+  SharedHeader* hdr = obj->headerPtr();
+  uint32_t stage = shm_image::FindStage(hdr, Utf8(env, args[0]));
+  if (!stage) return ThrowError(env, "The mapping has no such stage");
+  if (stage == obj->stage_) return Bool(env, true);
+  obj->leaveStage();
+  obj->attachReader();
+  ReaderDesc* r = obj->readerDesc();
+  if (!r) return ThrowError(env, "No free reader entry");
+  if (!shm_image::ClaimStage(hdr, stage, obj->readerIndex_)) return ThrowError(env, "Another process runs the stage");
+
+  // our pins go on our reader entry; the stage cursors hold the producer back
+  uint64_t cursor = hdr->stages[stage - 1].frame_index.load(std::memory_order_acquire);
+  obj->lastSeenIndex_ = cursor;
+  r->last_frame_index.store(cursor, std::memory_order_relaxed);
+  r->lossless.store(0, std::memory_order_relaxed);
+  obj->stage_ = stage;
+  return Bool(env, true);
+}
+
+napi_value SharedMemory::LeaveStage(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  bool joined = obj->stage_ != 0;
+  obj->leaveStage();
+  return Bool(env, joined);
+}
+
+// acquireStage(timeout?, options?) -> Buffer|null: writable zero-copy view of
+// our stage's next frame, in order, once the stage before released it (the
+// producer published it, for the first stage). Waits as setWaitPolicy() or
+// `options` say, null on timeout. The frame is transformed in place and
+// handed on with releaseStage(); the next acquireStage() does that first.
+napi_value SharedMemory::AcquireStage(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+  if (!obj->stage_) return ThrowError(env, "No stage joined");
+
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[0])) timeout = (uint32_t)Int64(env, args[0]);
+  WaitPolicy policy = obj->currentPolicy();
+  if (!ParseWaitPolicy(env, OptionsArg(args), &policy)) return nullptr;
+  obj->releaseStage();
+
+  int32_t slot;
+  if (!obj->waitForFrame(policy, timeout, nullptr, nullptr)) return Null(env);
+  if (obj->pinReadSlot(&slot) != READ_OK) return ThrowError(env, "AcquireStage contention");
+  if (slot < 0) return Null(env);
+  obj->stageSlot_ = slot;
+  obj->stageAcquiredNs_ = platform::MonotonicNs();
+  obj->consumeSlot(slot);
+
+  SlotDesc* desc = &obj->headerPtr()->slots[slot];
+  uint32_t frameBytes = desc->frame_size;
+  char* ptr = static_cast<char*>(obj->slotPtr((uint32_t)slot));
+  if (frameBytes > obj->dataCapacity() || !ptr || (desc->gpu_flags & FRAME_NO_CPU)) frameBytes = 0;
+  return ViewBuffer(env, ptr, frameBytes);
+}
+
+// releaseStage() -> bool: hands the frame acquireStage() returned on to the
+// next stage (to the readers, from the last one); its view must not be used
+// after that. False when there is none.
+napi_value SharedMemory::ReleaseStage(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  return Bool(env, obj->base_ && obj->releaseStage());
+}
+
+// getWriteSlot() -> index of the ring slot the next publishFrame() publishes
+// (the one getFrameBuffer() hands out), -1 when every slot is in use. GPU
+// producers render into that slot's texture.
+napi_value SharedMemory::GetWriteSlot(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  int32_t slot = obj->base_ ? obj->acquireWriteSlot() : -1;
+  return Int(env, slot);
+}
+
+// setSlotTexture(slot, { handle, width, height, format, stride?, offset?, modifier? } | null):
+// registers the texture the producer renders slot `slot` into, as a shared
+// NT handle (Windows, D3D11 texture with a keyed mutex) or a dma-buf fd
+// (Linux) of this process, which it keeps open while registered. format is
+// the DXGI_FORMAT / DRM fourcc. null unregisters the slot's texture.
+napi_value SharedMemory::SetSlotTexture(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+  if (!obj->notPlaying()) return nullptr;
+  int64_t slot = args.Length() > 0 && IsNumber(env, args[0]) ? Int64(env, args[0]) : -1;
+  if (slot < 0 || slot >= (int64_t)obj->slotCount()) return ThrowRangeError(env, "Invalid slot");
+
+  uint32_t kind = GPU_NONE;
+  uint64_t fields[7] = {}; // handle, width, height, format, stride, offset, modifier
+  if (args.Length() > 1 && IsObject(env, args[1])) {
+    const char* keys[7] = { "handle", "width", "height", "format", "stride", "offset", "modifier" };
+    for (int i = 0; i < 7; i++) {
+      napi_value v = Get(env, args[1], keys[i]);
+      bool valid = IsBigInt(env, v) || (IsNumber(env, v) && Int64(env, v) >= 0);
+      if (valid) Uint64(env, v, &fields[i]);
+      else if (i < 4) return ThrowTypeError(env, "Texture needs handle, width, height and format");
+    }
+    if (fields[1] > UINT32_MAX || fields[2] > UINT32_MAX || fields[3] > UINT32_MAX || fields[4] > UINT32_MAX || fields[5] > UINT32_MAX) {
+      return ThrowRangeError(env, "Invalid texture description");
+    }
+#ifdef _WIN32
+    kind = GPU_D3D11_NT_HANDLE;
+#else
+    kind = GPU_DMABUF;
+#endif
+  } else if (args.Length() < 2 || TypeOf(env, args[1]) != napi_null) {
+    return ThrowTypeError(env, "Texture must be an object or null");
+  }
+
+  GpuSurface* g = &obj->headerPtr()->gpu[slot];
+  uint32_t serial = g->serial.load(std::memory_order_relaxed);
+  g->serial.store(serial + 1, std::memory_order_relaxed); // odd: readers retry
+  std::atomic_thread_fence(std::memory_order_release);
+  g->kind = kind;
+  g->pid = platform::CurrentProcessId();
+  g->handle = fields[0];
+  g->width = (uint32_t)fields[1];
+  g->height = (uint32_t)fields[2];
+  g->format = (uint32_t)fields[3];
+  g->stride = (uint32_t)fields[4];
+  g->offset = (uint32_t)fields[5];
+  g->modifier = fields[6];
+  g->serial.store(serial + 2, std::memory_order_release);
+  return nullptr;
+}
+
+// acquireTexture(timeout?, options?) -> { slot, handle, width, height, format, stride,
+// offset, modifier, kind, cpu, frameIndex } | null: pins the latest frame like
+// acquireFrame() and hands out the texture it was rendered into. `handle` is
+// this process's own copy (NT handle / fd), owned by the instance and valid
+// until close() or the producer re-registers the slot; open it with
+// OpenSharedResource1 / import the dma-buf. A frame published without a texture
+// comes back with handle 0n, cpu tells whether the slot buffer has it too.
+napi_value SharedMemory::AcquireTexture(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  int32_t slot;
+  if (!obj->acquireLatest(args, &slot)) return Null(env);
+  SharedHeader* hdr = obj->headerPtr();
+  SlotDesc* desc = &hdr->slots[slot];
+  GpuSurface* g = &hdr->gpu[slot];
+
+  // seqlock read of the registration
+  uint32_t serial = 0, kind = GPU_NONE, pid = 0, fields[6] = {};
+  uint64_t handle = 0, modifier = 0;
+  bool stable = false;
+  for (int attempt = 0; attempt < 1000 && !stable; attempt++) {
+    serial = g->serial.load(std::memory_order_acquire);
+    if (serial & 1) { platform::CpuRelax(); continue; }
+    kind = g->kind;
+    pid = g->pid;
+    handle = g->handle;
+    modifier = g->modifier;
+    fields[0] = g->width; fields[1] = g->height; fields[2] = g->format;
+    fields[3] = g->stride; fields[4] = g->offset;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    stable = g->serial.load(std::memory_order_relaxed) == serial;
+  }
+  if (!stable) return ThrowError(env, "AcquireTexture contention");
+
+  uint64_t local = 0;
+  if (kind != GPU_NONE && (desc->gpu_flags & FRAME_GPU)) {
+    GpuImport* imp = &obj->gpuImports_[slot];
+    if (imp->open && imp->serial != serial) {
+      platform::CloseImportedHandle(imp->handle);
+      imp->open = false;
+    }
+    if (!imp->open) {
+      std::string error;
+      if (!platform::ImportHandle(pid, handle, &imp->handle, &error)) return ThrowError(env, error.c_str());
+      imp->serial = serial;
+      imp->open = true;
+    }
+    local = imp->handle;
+  } else {
+    kind = GPU_NONE;
+  }
+
+  static const char* KIND_NAMES[] = { "none", "d3d11", "dmabuf" };
+  napi_value ret = NewObject(env);
+  Set(env, ret, "slot", Int(env, slot));
+  Set(env, ret, "kind", Str(env, KIND_NAMES[kind <= GPU_DMABUF ? kind : GPU_NONE]));
+  Set(env, ret, "handle", BigUint(env, local));
+  const char* keys[5] = { "width", "height", "format", "stride", "offset" };
+  for (int i = 0; i < 5; i++) Set(env, ret, keys[i], Uint(env, fields[i]));
+  Set(env, ret, "modifier", BigUint(env, modifier));
+  Set(env, ret, "cpu", Bool(env, !(desc->gpu_flags & FRAME_NO_CPU)));
+  Set(env, ret, "frameIndex", BigUint(env, desc->frame_index.load(std::memory_order_relaxed)));
+  return ret;
+}
+
+void SharedMemory::closeGpuImports() {
+  for (GpuImport& imp : gpuImports_) {
+    if (imp.open) platform::CloseImportedHandle(imp.handle);
+    imp = GpuImport();
+  }
+}
+
+// Slot `slot`'s compression area, nullptr when there is none.
+uint8_t* SharedMemory::compressArea(int32_t slot) {
+  SharedHeader* hdr = headerPtr();
+  uint64_t offset = hdr->compress_offset + (uint64_t)slot * hdr->compress_capacity;
+  if (!hdr->compress_capacity || slot < 0 || offset + hdr->compress_capacity > mapSize_) return nullptr;
+  if (!platform::CommitRange(&mapping_, offset, hdr->compress_capacity)) return nullptr;
+  return static_cast<uint8_t*>(base_) + offset;
+}
+
+// Slot `slot`'s level area, nullptr when there is none.
+uint8_t* SharedMemory::levelArea(int32_t slot) {
+  SharedHeader* hdr = headerPtr();
+  uint8_t* area = slot >= 0 ? shm_image::LevelData(base_, mapSize_, hdr, (uint32_t)slot) : nullptr;
+  if (!area || !platform::CommitRange(&mapping_, area - static_cast<uint8_t*>(base_), hdr->level_capacity)) return nullptr;
+  return area;
+}
+
+// Box-filters the frame in the write slot `slot` into its level area, each
+// level from the one before. False when the format has no levels or they
+// don't fit; the slot is still ours, so no reader sees them half built.
+bool SharedMemory::buildLevels(int32_t slot, uint32_t frameBytes) {
+  SharedHeader* hdr = headerPtr();
+  const FrameFormat& fmt = hdr->format; // only we write it
+  shm_image::LevelLayout level;
+  uint32_t count = std::min<uint32_t>(hdr->level_count, SHARED_MAX_LEVELS);
+  if (!shm_image::ComputeLevel(fmt, 1, &level) || (uint64_t)fmt.plane_stride[0] * fmt.height > frameBytes ||
+      shm_image::LevelBytes(fmt, count) > hdr->level_capacity) {
+    return false;
+  }
+  const uint8_t* src = static_cast<const uint8_t*>(slotPtr((uint32_t)slot));
+  uint8_t* area = levelArea(slot);
+  if (!src || !area) return false;
+
+  uint32_t bpp = BytesPerPixel(fmt.pixel_format, fmt.channels);
+  uint32_t srcStride = fmt.plane_stride[0];
+  CopyPolicy policy = currentCopyPolicy();
+  for (uint32_t l = 1; l <= count && shm_image::ComputeLevel(fmt, l, &level); l++) {
+    uint8_t* dst = area + level.offset;
+    // row ranges, like the copies readers make
+    uint32_t parts = std::min(CopyParts(policy, level.bytes * 4), level.height);
+    uint32_t rows = (level.height + parts - 1) / parts;
+    workers::Run(parts, [&](uint32_t p) {
+      uint32_t begin = p * rows;
+      uint32_t end = std::min(level.height, begin + rows);
+      if (begin < end) convert::Downscale2x(src, srcStride, dst, level.stride, level.width, bpp, begin, end);
+    });
+    src = dst;
+    srcStride = level.stride;
+  }
+  return true;
+}
+
+// True while an attached reader asked for compressed frames.
+bool SharedMemory::compressionWanted() {
+  for (const ReaderDesc& r : headerPtr()->readers) {
+    if (r.state.load(std::memory_order_acquire) == READER_ATTACHED && r.want_compressed.load(std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Hands the just published `slot` to the compressor thread, pinned so we
+// don't refill it meanwhile. A frame published while the previous one is
+// still being compressed goes without a compressed copy. JS thread only.
+void SharedMemory::startCompress(int32_t slot) {
+  SharedHeader* hdr = headerPtr();
+  {
+    std::lock_guard<std::mutex> lock(compressMutex_);
+    if (compressBusy_) {
+      hdr->compress_skipped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    SlotDesc* desc = &hdr->slots[slot];
+    desc->readers.fetch_add(1, std::memory_order_seq_cst);
+    compressJob_.slot = slot;
+    compressJob_.index = desc->frame_index.load(std::memory_order_relaxed);
+    compressJob_.frameBytes = desc->frame_size;
+    compressJob_.fmt = hdr->format; // we are the only writer
+    compressBusy_ = true;
+  }
+  if (!compressThread_.joinable()) compressThread_ = std::thread([this] { compressLoop(); });
+  compressCv_.notify_all();
+}
+
+void SharedMemory::compressLoop() {
+  std::unique_lock<std::mutex> lock(compressMutex_);
+  for (;;) {
+    compressCv_.wait(lock, [this] { return compressBusy_ || compressStop_; });
+    if (!compressBusy_) return;
+    CompressJob job = compressJob_;
+    lock.unlock();
+
+    SharedHeader* hdr = headerPtr();
+    SlotDesc* desc = &hdr->slots[job.slot];
+    uint8_t* dst = compressArea(job.slot);
+    const uint8_t* src = static_cast<const uint8_t*>(slotPtr((uint32_t)job.slot));
+    uint32_t codecId = codec::Pick(job.fmt);
+    size_t size = dst && src ? codec::Compress(codecId, job.fmt, src, job.frameBytes, dst, hdr->compress_capacity) : 0;
+    if (size) {
+      desc->compressed_size = (uint32_t)size;
+      desc->codec = codecId;
+      desc->compressed_index.store(job.index, std::memory_order_release); // readers take it from here
+      hdr->compressed_frames.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      hdr->compress_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+    desc->readers.fetch_sub(1, std::memory_order_release);
+
+    // wake the readers waiting for it, on events of our own
+    for (int32_t i = 0; i < SHARED_MAX_READERS && size; i++) {
+      ReaderDesc* r = &hdr->readers[i];
+      if (r->state.load(std::memory_order_acquire) != READER_ATTACHED || !r->want_compressed.load(std::memory_order_relaxed)) continue;
+      if (!compressEvents_[i]) {
+        compressEvents_[i] = platform::OpenSharedEvent(shm_image::ReaderEventName(mapName_, i), &r->event_word, false);
+        if (!compressEvents_[i]) continue;
+      }
+      platform::SignalEvent(compressEvents_[i]);
+    }
+
+    lock.lock();
+    compressBusy_ = false;
+  }
+}
+
+// Finishes the pending compression and stops the thread. JS thread only.
+void SharedMemory::stopCompressor() {
+  if (compressThread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(compressMutex_);
+      compressStop_ = true;
+    }
+    compressCv_.notify_all();
+    compressThread_.join();
+    compressStop_ = false;
+  }
+  for (platform::Event*& ev : compressEvents_) { platform::CloseEvent(ev); ev = nullptr; }
+}
+
+// readCompressed(timeout?, options?) -> { codec, data, size, frameIndex, width, height, format } | null:
+// the producer's compressed copy of the latest frame, once per frame (a
+// producer created with { compression: true }). The first call subscribes
+// this reader: the producer only compresses while somebody is subscribed,
+// and skips frames published while it is still busy. `data` is a copy in the
+// "qoi" or "lz4" format, `size` the frame's raw size; decompress() undoes it.
+napi_value SharedMemory::ReadCompressed(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+  uint32_t timeout = platform::kInfinite;
+  if (IsNumber(env, args[0])) timeout = (uint32_t)Int64(env, args[0]);
+  uint64_t deadline = timeout == platform::kInfinite ? 0 : platform::MonotonicNs() / 1000000 + timeout;
+
+  obj->wantCompressed_ = true;
+  obj->attachReader();
+  if (ReaderDesc* r = obj->readerDesc()) r->want_compressed.store(1, std::memory_order_relaxed);
+
+  for (;;) {
+    obj->followGeneration();
+    SharedHeader* hdr = obj->headerPtr();
+    if (!hdr->compress_capacity) return ThrowError(env, "The producer was created without compression");
+    int32_t slot;
+    if (obj->pinLatestSlot(&slot) != READ_OK) return ThrowError(env, "ReadFrame contention");
+    if (slot >= 0) {
+      SlotDesc* desc = &hdr->slots[slot];
+      uint64_t index = desc->frame_index.load(std::memory_order_relaxed);
+      const uint8_t* src = index > obj->compressedSeen_ && desc->compressed_index.load(std::memory_order_acquire) == index
+          ? obj->compressArea(slot) : nullptr;
+      if (src && desc->compressed_size <= hdr->compress_capacity && desc->codec != CODEC_NONE) {
+        napi_value data = CopyBuffer(env, src, desc->compressed_size);
+        uint32_t codecId = desc->codec, frameBytes = desc->frame_size;
+        FrameFormat fmt = {};
+        obj->readFormat(&fmt, nullptr);
+        obj->consumeSlot(slot);
+        obj->unpinSlot(slot);
+        obj->compressedSeen_ = index;
+
+        uint32_t format = fmt.pixel_format < PIXEL_FORMAT_COUNT ? fmt.pixel_format : PIXEL_FORMAT_UNKNOWN;
+        napi_value ret = NewObject(env);
+        Set(env, ret, "codec", Str(env, codec::Name(codecId)));
+        Set(env, ret, "data", data);
+        Set(env, ret, "size", Uint(env, frameBytes));
+        Set(env, ret, "frameIndex", BigUint(env, index));
+        Set(env, ret, "width", Uint(env, fmt.width));
+        Set(env, ret, "height", Uint(env, fmt.height));
+        Set(env, ret, "format", Str(env, PIXEL_FORMAT_NAMES[format]));
+        return ret;
+      }
+      obj->unpinSlot(slot);
+    }
+
+    // the compressor signals our event once it is done; without a reader
+    // entry we only hear about publishes, so poll
+    uint64_t now = platform::MonotonicNs() / 1000000;
+    if (deadline && now >= deadline) return Null(env);
+    uint32_t wait = deadline ? (uint32_t)(deadline - now) : platform::kInfinite;
+    if (!obj->readerEvent_) wait = std::min<uint32_t>(wait, 10);
+    platform::WaitEvent(obj->waitEvent(), nullptr, wait);
+  }
+}
+
+// decompress({ codec, data, size, format }) -> Buffer: a readCompressed()
+// result back to the frame (QOI: packed rows in the frame's channel order).
+napi_value SharedMemory::Decompress(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  napi_value codecName = Get(env, args[0], "codec");
+  napi_value format = Get(env, args[0], "format");
+  char* data;
+  size_t srcBytes;
+  if (!IsString(env, codecName) || !BufferData(env, Get(env, args[0], "data"), &data, &srcBytes)) {
+    return ThrowTypeError(env, "Expected a readCompressed() result");
+  }
+  std::string name = Utf8(env, codecName);
+  uint32_t codecId = CODEC_NONE;
+  for (uint32_t c : { CODEC_QOI, CODEC_LZ4 }) if (name == codec::Name(c)) codecId = c;
+  std::string formatName = IsString(env, format) ? Utf8(env, format) : "";
+  bool swapRB = formatName == PIXEL_FORMAT_NAMES[PIXEL_FORMAT_BGRA8] || formatName == PIXEL_FORMAT_NAMES[PIXEL_FORMAT_BGR8];
+
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+  size_t rawBytes = (size_t)std::max<int64_t>(0, Int64(env, Get(env, args[0], "size")));
+  size_t outBytes = codec::DecompressedSize(codecId, src, srcBytes, rawBytes);
+  char* dst = nullptr;
+  napi_value out = codecId != CODEC_NONE && outBytes <= UINT32_MAX ? NewBuffer(env, outBytes, &dst) : nullptr;
+  if (!out || !codec::Decompress(codecId, src, srcBytes, swapRB, reinterpret_cast<uint8_t*>(dst), outBytes)) {
+    return ThrowError(env, "Corrupt compressed frame");
+  }
+  return out;
+}
+
+// setWaitPolicy({ wait, spinUs, yieldUs, marginUs }): default for this
+// reader's readFrame/acquireFrame/readFrameAsync and on('frame')
+napi_value SharedMemory::SetWaitPolicy(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  WaitPolicy policy = obj->currentPolicy();
+  if (!ParseWaitPolicy(env, args[0], &policy)) return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(obj->statsMutex_);
+    obj->policy_ = policy;
+  }
+  if (obj->wake_) { obj->watchKick_ = true; platform::SignalEvent(obj->wake_); }
+  return Bool(env, true);
+}
+
+// setCopyOptions({ threads, bytesPerThread, streaming }): default for this
+// reader's copies out of the mapping (readFrame, readFrameAsync, on('frame'))
+napi_value SharedMemory::SetCopyOptions(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  if (!IsObject(env, args[0])) return ThrowTypeError(env, "Copy options must be an object");
+  CopyPolicy policy = obj->currentCopyPolicy();
+  if (!ParseCopyOptions(env, args[0], &policy)) return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(obj->statsMutex_);
+    obj->copyPolicy_ = policy;
+  }
+  return Bool(env, true);
+}
+
+// setLatencyOptions({ realtime, task, priority, cores, timerResolution }):
+// what the thread behind on('frame') and readFrameAsync() asks of the
+// scheduler while it waits. realtime: MMCSS under `task` ('Pro Audio', the
+// default, 'Capture', ...) on Windows, SCHED_FIFO at `priority` (1..99,
+// default 10) on Linux; cores: indices (0..63) of the cores it may run on;
+// timerResolution: the 1 ms system timer on Windows. The watcher takes them
+// up at its next wakeup, getWaitStats().latency says whether the OS agreed.
+napi_value SharedMemory::SetLatencyOptions(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  platform::ThreadLatency latency;
+  napi_value opts = args[0];
+  if (IsObject(env, opts)) {
+    latency.realtime = Truthy(env, Get(env, opts, "realtime"));
+    latency.timerResolution = Truthy(env, Get(env, opts, "timerResolution"));
+    napi_value v = Get(env, opts, "task");
+    if (IsString(env, v)) latency.task = Utf8(env, v);
+    if (latency.task.empty() || latency.task.size() > 63) return ThrowRangeError(env, "task is 1..63 bytes");
+    v = Get(env, opts, "priority");
+    if (IsNumber(env, v)) {
+      int64_t priority = Int64(env, v);
+      if (priority < 1 || priority > 99) return ThrowRangeError(env, "priority must be 1..99");
+      latency.priority = (int)priority;
+    }
+    v = Get(env, opts, "cores");
+    if (IsArray(env, v)) {
+      uint32_t length = 0;
+      napi_get_array_length(env, v, &length);
+      for (uint32_t i = 0; i < length; i++) {
+        napi_value core;
+        napi_get_element(env, v, i, &core);
+        int64_t n = IsNumber(env, core) ? Int64(env, core) : -1;
+        if (n < 0 || n > 63) return ThrowRangeError(env, "cores are 0..63");
+        latency.cores |= 1ull << n;
+      }
+    } else if (TypeOf(env, v) != napi_undefined) {
+      return ThrowTypeError(env, "cores must be an array of core indices");
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    obj->latency_ = latency;
+    obj->latencySeq_++;
+  }
+  // a watcher asleep in its frame wait picks them up now
+  obj->watchCv_.notify_all();
+  obj->watchKick_ = true;
+  if (obj->wake_) platform::SignalEvent(obj->wake_);
+  return nullptr;
+}
+
+// setReadMode(mode, { block }?): 'latest' (the default) skips to the newest
+// frame, counting the ones in between as dropped; 'lossless' reads every
+// frame in order from this reader's cursor. With block (the default) the
+// producer doesn't refill a slot we haven't read (getFrameBuffer() returns
+// null while the ring is full of them); without, frames it refilled before
+// we got to them count as dropped.
+napi_value SharedMemory::SetReadMode(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  std::string mode = Utf8(env, args[0]);
+  if (mode != "latest" && mode != "lossless") return ThrowTypeError(env, "Read mode must be 'latest' or 'lossless'");
+  napi_value block = Get(env, args[1], "block");
+  obj->blockProducer_ = TypeOf(env, block) == napi_undefined || Truthy(env, block);
+  obj->lossless_ = mode == "lossless";
+  if (ReaderDesc* r = obj->base_ ? obj->readerDesc() : nullptr) {
+    if (obj->lossless_) obj->startLossless();
+    else r->lossless.store(0, std::memory_order_release);
+  }
+  return Bool(env, true);
+}
+
+// getWaitStats(reset?) -> publish-to-wake latency and how frames were waited for
+napi_value SharedMemory::GetWaitStats(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  // setLatencyOptions(): applied is false until the watcher took them up
+  napi_value latency = NewObject(env);
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    Set(env, latency, "realtime", Bool(env, obj->latency_.realtime));
+    Set(env, latency, "applied", Bool(env, obj->latencyApplied_ && obj->watchThread_.joinable()));
+    Set(env, latency, "error", obj->latencyError_.empty() ? Null(env) : Str(env, obj->latencyError_));
+  }
+  std::lock_guard<std::mutex> lock(obj->statsMutex_);
+
+  napi_value ret = NewObject(env);
+  auto set = [&](const char* key, double value) {
+    Set(env, ret, key, Num(env, value));
+  };
+  Set(env, ret, "wait", Str(env, WAIT_MODE_NAMES[obj->policy_.mode]));
+  Set(env, ret, "readMode", Str(env, obj->lossless_ ? "lossless" : "latest"));
+  // the cursor, and how far the producer is past it
+  uint64_t cursor = obj->lastSeenIndex_;
+  uint64_t latest = obj->base_ ? obj->latestFrameIndex() : 0;
+  Set(env, ret, "cursor", BigUint(env, cursor));
+  set("behind", (double)(latest > cursor ? latest - cursor : 0));
+  Set(env, ret, "latency", latency);
+  set("blockWakeups", (double)obj->wakeups_[WAIT_BLOCK]);
+  set("adaptiveWakeups", (double)obj->wakeups_[WAIT_ADAPTIVE]);
+  set("spinWakeups", (double)obj->wakeups_[WAIT_SPIN]);
+  set("busyWakeups", (double)obj->wakeups_[WAIT_BUSY]);
+  set("timeouts", (double)obj->timeouts_);
+  set("spinIterations", (double)obj->spinIterations_);
+  set("lastLatencyUs", obj->latencyLastNs_ / 1000.0);
+  set("avgLatencyUs", obj->latencyCount_ ? obj->latencySumNs_ / 1000.0 / obj->latencyCount_ : 0.0);
+  set("maxLatencyUs", obj->latencyMaxNs_ / 1000.0);
+  set("frameIntervalUs", obj->intervalNs_ / 1000.0);
+  set("framesRead", (double)obj->framesRead_);
+  set("framesDropped", (double)obj->framesDropped_);
+  set("retries", (double)obj->retries_.load());
+  set("parallelCopies", (double)obj->parallelCopies_);
+  set("tilesCopied", (double)obj->tilesCopied_);
+  set("tilesSkipped", (double)obj->tilesSkipped_);
+
+  if (TypeOf(env, args[0]) == napi_boolean && Truthy(env, args[0])) {
+    memset(obj->wakeups_, 0, sizeof(obj->wakeups_));
+    obj->timeouts_ = obj->spinIterations_ = 0;
+    obj->framesRead_ = obj->framesDropped_ = 0;
+    obj->retries_ = 0;
+    obj->parallelCopies_ = 0;
+    obj->tilesCopied_ = obj->tilesSkipped_ = 0;
+    obj->latencyCount_ = obj->latencySumNs_ = obj->latencyMaxNs_ = obj->latencyLastNs_ = 0;
+  }
+  return ret;
+}
+
+// --- Recording ---
+
+// helper: hands the frame in the pinned `slot` to the recording, pinned once
+// more on the recorder's entry until its thread has written it out. Frames
+// without CPU bytes, written under a format already replaced or finding the
+// recorder a ring behind are left out (they show up as missed frames).
+void SharedMemory::recordSlot(int32_t slot, recording::QueuedWriter* recorder) {
+  SlotDesc* desc = &headerPtr()->slots[slot];
+  uint32_t frameBytes = desc->frame_size;
+  const void* src = slotPtr((uint32_t)slot);
+  if (recorderIndex_ < 0 || (desc->gpu_flags & FRAME_NO_CPU) || !src || frameBytes > dataCapacity()) return;
+  recording::RecordEntry entry = {};
+  uint32_t formatSeq;
+  if (!readFormat(&entry.format, &formatSeq) || formatSeq != desc->format_seq) return;
+  entry.frame_index = desc->frame_index.load(std::memory_order_relaxed);
+  entry.capture_ns = desc->capture_ns.load(std::memory_order_relaxed);
+  entry.publish_ns = desc->publish_ns.load(std::memory_order_relaxed);
+  entry.frame_size = frameBytes;
+  // can't fail: our own pin keeps the producer off the slot
+  if (!shm_image::PinSlot(headerPtr(), recorderIndex_, slot)) return;
+  if (!recorder->append(entry, src, slot)) shm_image::UnpinSlot(headerPtr(), recorderIndex_, slot);
+}
+
+// helper: gives the recorder a reader entry of its own on the current
+// mapping, booking its pins (a crash of ours gets them undone)
+void SharedMemory::attachRecorder() {
+  platform::Event* ev = nullptr;
+  recorderIndex_ = shm_image::AttachReader(headerPtr(), mapName_, false, &ev);
+  platform::CloseEvent(ev); // nobody waits on it
+}
+
+// helper: the recorder must be drained
+void SharedMemory::detachRecorder() {
+  if (recorderIndex_ >= 0 && base_) shm_image::DetachReader(headerPtr(), recorderIndex_);
+  recorderIndex_ = -1;
+}
+
+void SharedMemory::stopRecorder() {
+  if (recorder_) recorder_->close();
+  recorder_.reset();
+  detachRecorder();
+}
+
+// record(path, { segmentBytes }?): writes every frame this instance
+// consumes from now on to the recording `path` (an index file, frame data in
+// `<path>.<n>` segments of segmentBytes, 1 GB by default). Frames go from
+// their slot straight to the file, on a thread of the recorder's own that
+// keeps them pinned meanwhile, so readFrameAsync() and on('frame') never wait
+// for the disk and nothing is copied. The recorder holds up to slots - 2
+// frames, leaving the producer a slot to write; frames finding it that far
+// behind are dropped (more slots, more slack). Slots are page aligned, so on
+// Windows the segments are written unbuffered, out of the file cache.
+napi_value SharedMemory::Record(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_) return ThrowError(env, "Not connected");
+  if (args.Length() < 1 || !IsString(env, args[0])) return ThrowTypeError(env, "Args: path, options?");
+  uint64_t segmentBytes = 0;
+  if (args.Length() > 1 && IsObject(env, args[1])) {
+    napi_value v = Get(env, args[1], "segmentBytes");
+    if (IsNumber(env, v)) {
+      int64_t n = Int64(env, v);
+      if (n < RECORDING_ALIGN) return ThrowRangeError(env, "segmentBytes must be at least 4096");
+      segmentBytes = (uint64_t)n;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    if (obj->recorder_) return ThrowError(env, "Already recording");
+  }
+
+  uint32_t slots = obj->slotCount();
+  uint32_t depth = slots > 2 ? slots - 2 : 1;
+  std::unique_ptr<recording::QueuedWriter> writer(new recording::QueuedWriter());
+  std::string error;
+  auto done = [obj](int32_t slot) { shm_image::UnpinSlot(obj->headerPtr(), obj->recorderIndex_, slot); };
+  if (!writer->open(Utf8(env, args[0]), segmentBytes, depth, true, done, &error)) return ThrowError(env, error.c_str());
+  obj->attachRecorder();
+  if (obj->recorderIndex_ < 0) return ThrowError(env, "No free reader entry");
+
+  obj->ensureWatcher();
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    obj->recorder_ = std::move(writer);
+  }
+  obj->watchCv_.notify_one();
+  return Bool(env, true);
+}
+
+// stopRecording() -> { frames, bytes, segments, missed, dropped, error } | null,
+// null when nothing was recording; waits for the queued frames to be written.
+// missed: frames published between the first and the last recorded one that
+// didn't make it into the recording, dropped: those of them that found the
+// recorder a ring behind.
+napi_value SharedMemory::StopRecording(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  // the watcher may be queueing a frame: take the recorder off it in between
+  bool watching = obj->pauseWatcher();
+  std::unique_ptr<recording::QueuedWriter> writer;
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    writer = std::move(obj->recorder_);
+  }
+  if (watching) obj->resumeWatcher();
+  if (!writer) return Null(env);
+  writer->close();
+  obj->detachRecorder();
+  const recording::Writer& written = writer->writer();
+
+  napi_value ret = NewObject(env);
+  Set(env, ret, "frames", Num(env, (double)written.frames()));
+  Set(env, ret, "bytes", Num(env, (double)written.bytes()));
+  Set(env, ret, "segments", Uint(env, written.segments()));
+  Set(env, ret, "missed", Num(env, (double)written.missed()));
+  Set(env, ret, "dropped", Num(env, (double)writer->dropped()));
+  Set(env, ret, "error", written.error().empty() ? Null(env) : Str(env, written.error()));
+  return ret;
+}
+
+// helper: throws when play() owns the producer side
+bool SharedMemory::notPlaying() {
+  if (!playThread_.joinable()) return true;
+  ThrowError(env_, "A recording is playing");
+  return false;
+}
+
+// Publishes the recording's frames in order, spaced like they were
+// published originally (divided by `speed`, 0 = as fast as the ring takes
+// them). Owns `reader`.
+void SharedMemory::playLoop(recording::Reader* reader, double speed, bool loop) {
+  std::unique_ptr<recording::Reader> owned(reader);
+  SharedHeader* hdr = headerPtr();
+  uint64_t count = reader->count();
+
+  do {
+    uint64_t startNs = platform::MonotonicNs();
+    uint64_t firstNs = count ? reader->entry(0).publish_ns : 0;
+    for (uint64_t i = 0; i < count && !playStop_; i++) {
+      const recording::RecordEntry& e = reader->entry(i);
+      const uint8_t* data = reader->frame(i);
+      if (!data || e.frame_size > dataCapacity()) {
+        playSkipped_++;
+        continue;
+      }
+
+      // wait for the frame's turn: sleep most of the way, yield the rest
+      if (speed > 0 && e.publish_ns > firstNs) {
+        uint64_t due = startNs + (uint64_t)((double)(e.publish_ns - firstNs) / speed);
+        for (uint64_t now = platform::MonotonicNs(); now < due && !playStop_; now = platform::MonotonicNs()) {
+          if (due - now > 2000000) platform::SleepMs((uint32_t)((due - now) / 1000000) - 1);
+          else platform::YieldThread();
+        }
+      }
+
+      if (memcmp(&hdr->format, &e.format, sizeof(FrameFormat)) != 0) writeFormat(e.format);
+      int32_t slot;
+      while ((slot = acquireWriteSlot()) < 0 && !playStop_) platform::SleepMs(1); // every slot pinned
+      if (slot < 0) break;
+      memcpy(slotPtr((uint32_t)slot), data, e.frame_size);
+
+      // capture time keeps its distance to the publish, on today's clock
+      uint64_t now = platform::MonotonicNs();
+      uint64_t captureNs = e.capture_ns && e.capture_ns <= e.publish_ns ? now - (e.publish_ns - e.capture_ns) : 0;
+      hdr->full_frame_index.store(hdr->frame_index.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      publishSlot(slot, e.frame_size, captureNs, 0);
+      playFrames_++;
+    }
+  } while (loop && count && !playStop_);
+
+  playDone_ = true;
+  signalAsync();
+}
+
+// Joins the player and settles play()'s promise: resolved with the frame
+// counts, or rejected with `rejectWith`.
+void SharedMemory::endPlayback(const char* rejectWith) {
+  playStop_ = true;
+  if (playThread_.joinable()) playThread_.join();
+  playStop_ = false;
+  playDone_ = false;
+  if (!playResolver_) return;
+
+  napi_env env = env_;
+  napi_deferred resolver = playResolver_;
+  playResolver_ = nullptr;
+  if (rejectWith) {
+    napi_reject_deferred(env, resolver, MakeError(env, rejectWith));
+  } else {
+    napi_value ret = NewObject(env);
+    Set(env, ret, "frames", Num(env, (double)playFrames_.load()));
+    Set(env, ret, "skipped", Num(env, (double)playSkipped_.load()));
+    napi_resolve_deferred(env, resolver, ret);
+  }
+  updateAsyncRef();
+}
+
+// play(path, { speed, loop }?) -> Promise<{ frames, skipped }>: publishes a
+// record() recording into this (producer) mapping on a thread of its own,
+// formats included. speed: 1 keeps the original pacing, 2 plays twice as
+// fast, 0 as fast as readers release the slots. loop: start over at the end,
+// until stopPlayback(). The slots grow to the largest recorded frame first.
+napi_value SharedMemory::Play(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_ || obj->slotCount() == 0) return ThrowError(env, "Not connected");
+  if (args.Length() < 1 || !IsString(env, args[0])) return ThrowTypeError(env, "Args: path, options?");
+  if (!obj->notPlaying()) return nullptr;
+
+  double speed = 1;
+  bool loop = false;
+  if (args.Length() > 1 && IsObject(env, args[1])) {
+    napi_value v = Get(env, args[1], "speed");
+    if (IsNumber(env, v)) speed = Double(env, v);
+    if (!(speed >= 0)) return ThrowRangeError(env, "speed must be >= 0");
+    loop = Truthy(env, Get(env, args[1], "loop"));
+  }
+
+  std::unique_ptr<recording::Reader> reader(new recording::Reader());
+  std::string error;
+  if (!reader->open(Utf8(env, args[0]), &error)) return ThrowError(env, error.c_str());
+  uint64_t largest = 0;
+  for (uint64_t i = 0; i < reader->count(); i++) largest = std::max<uint64_t>(largest, reader->entry(i).frame_size);
+  if (largest > obj->dataCapacity() && !obj->resizeCapacity((largest + 63) / 64 * 64, &error)) {
+    return ThrowError(env, error.c_str());
+  }
+
+  napi_value promise;
+  obj->ensureAsync();
+  napi_create_promise(env, &obj->playResolver_, &promise);
+  obj->playFrames_ = 0;
+  obj->playSkipped_ = 0;
+  obj->updateAsyncRef();
+  obj->playThread_ = std::thread(&SharedMemory::playLoop, obj, reader.release(), speed, loop);
+  return promise;
+}
+
+// stopPlayback(): ends play(), its promise resolves with the frames so far
+napi_value SharedMemory::StopPlayback(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  bool playing = obj->playThread_.joinable();
+  obj->endPlayback(nullptr);
+  return Bool(env, playing);
+}
+
+// --- Async delivery ---
+
+// The threadsafe function our threads wake OnAsync() with, on the loop of
+// the env (main thread or worker) that owns the instance
+void SharedMemory::ensureAsync() {
+  if (async_) return;
+  napi_create_threadsafe_function(env_, nullptr, nullptr, Str(env_, "SharedMemory"), 0, 1,
+                                  nullptr, nullptr, this, OnAsync, &async_);
+  napi_unref_threadsafe_function(env_, async_); // see updateAsyncRef()
+}
+
+void SharedMemory::ensureWatcher() {
+  ensureAsync();
+  attachReader();
+  if (!watchThread_.joinable()) resumeWatcher();
+}
+
+// Stops the watcher thread, keeping the reads it has queued and the frames
+// it copied. Returns whether it was running.
+bool SharedMemory::pauseWatcher() {
+  bool running = watchThread_.joinable();
+  if (running) {
+    {
+      std::lock_guard<std::mutex> lock(watchMutex_);
+      watchStop_ = true;
+    }
+    watchCv_.notify_all();
+    watchKick_ = true;
+    if (wake_) platform::SignalEvent(wake_);
+    watchThread_.join();
+  }
+  platform::CloseEvent(wake_);
+  wake_ = nullptr;
+  return running;
+}
+
+void SharedMemory::resumeWatcher() {
+  // the watcher waits on waitEvent(), so create the wake event after attaching
+  if (!wake_) wake_ = platform::CreateLocalEvent(waitEvent());
+  {
+    std::lock_guard<std::mutex> lock(watchMutex_);
+    watchStop_ = false;
+    remapPending_ = false;
+  }
+  watchThread_ = std::thread(&SharedMemory::watchLoop, this);
+}
+
+void SharedMemory::stopWatcher() {
+  pauseWatcher();
+
+  std::lock_guard<std::mutex> lock(watchMutex_);
+  for (AsyncResult& r : results_) {
+    for (FrameCopy& c : r.copies) free(c.data);
+  }
+  results_.clear();
+  requests_.clear();
+  subscribed_ = false;
+}
+
+// The newest frame we may read: the latest published one, for a pipeline
+// stage the last one the stage before released.
+uint64_t SharedMemory::latestFrameIndex() {
+  SharedHeader* hdr = headerPtr();
+  if (uint32_t stage = stage_) return shm_image::StageInput(hdr, stage);
+  int32_t slot = hdr->latest_slot.load(std::memory_order_acquire);
+  if (slot < 0 || (uint32_t)slot >= slotCount()) return 0;
+  return hdr->slots[slot].frame_index.load(std::memory_order_acquire);
+}
+
+// Waits until a frame newer than the last one this instance consumed is
+// published, the way `policy` says. `wake`/`cancel` interrupt the wait (the
+// watcher thread uses them). Returns false on timeout or interruption.
+bool SharedMemory::waitForFrame(const WaitPolicy& policy, uint32_t timeoutMs, platform::Event* wake, const std::atomic<bool>* cancel) {
+  platform::Event* ev = waitEvent();
+  uint64_t now = platform::MonotonicNs();
+  uint64_t deadline = timeoutMs == platform::kInfinite ? UINT64_MAX : now + (uint64_t)timeoutMs * 1000000ull;
+  uint64_t spins = 0;
+
+  // a resize counts as news, the caller follows it
+  auto fresh = [&]() { return latestFrameIndex() > lastSeenIndex_ || moved(); };
+  auto woke = [&](WaitMode how) {
+    if (ev) platform::ClearEvent(ev); // consumed by polling, don't wake the next wait for it
+    recordWake(how, spins);
+    return true;
+  };
+  auto timedOut = [&]() {
+    if (ReaderDesc* r = readerDesc()) {
+      r->timeouts.fetch_add(1, std::memory_order_relaxed);
+      r->spin_iterations.fetch_add(spins, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    timeouts_++;
+    spinIterations_ += spins;
+    return false;
+  };
+  // spins until a new frame, `until` or interruption
+  auto spinUntil = [&](uint64_t until, bool yield) {
+    for (;;) {
+      for (int i = 0; i < 64; i++, spins++) {
+        if (fresh()) return true;
+        if (yield) platform::YieldThread(); else platform::CpuRelax();
+      }
+      if ((cancel && *cancel) || platform::MonotonicNs() >= until) return fresh();
+    }
+  };
+  // sleeping wait on the reader event, polls when there is none
+  auto block = [&](uint64_t until) -> int { // 1 frame, 0 timeout, -1 interrupted
+    for (;;) {
+      if (fresh()) return 1;
+      now = platform::MonotonicNs();
+      if (now >= until && until != UINT64_MAX) return 0;
+      uint32_t ms = until == UINT64_MAX ? platform::kInfinite : (uint32_t)((until - now + 999999) / 1000000);
+      if (!ev) {
+        platform::SleepMs(ms < 1 ? ms : 1);
+        if (cancel && *cancel) return -1;
+        continue;
+      }
+
+      platform::WaitStatus r = platform::WaitEvent(ev, wake, ms);
+      if (r == platform::WaitStatus::kWoken || (cancel && *cancel)) return -1;
+      // signaled without a fresh frame (setFormat, a stale signal): wait again
+    }
+  };
+
+  switch (policy.mode) {
+  case WAIT_BUSY:
+    // burn the core until the frame lands
+    if (spinUntil(deadline, false)) return woke(WAIT_BUSY);
+    return timedOut();
+
+  case WAIT_SPIN: {
+    uint64_t spinEnd = now + policy.spinUs * 1000ull;
+    if (spinUntil(spinEnd < deadline ? spinEnd : deadline, false)) return woke(WAIT_SPIN);
+    uint64_t yieldEnd = platform::MonotonicNs() + policy.yieldUs * 1000ull;
+    if (spinUntil(yieldEnd < deadline ? yieldEnd : deadline, true)) return woke(WAIT_SPIN);
+    break;
+  }
+
+  case WAIT_ADAPTIVE: {
+    // sleep until shortly before the next frame is due, then spin for it
+    uint64_t last, interval;
+    {
+      std::lock_guard<std::mutex> lock(statsMutex_);
+      last = lastPublishNs_;
+      interval = intervalNs_;
+    }
+    if (!interval || fresh()) break;
+    uint64_t margin = policy.marginUs * 1000ull;
+    uint64_t due = last + interval;
+    if (due > now + margin) {
+      int r = block(due - margin < deadline ? due - margin : deadline);
+      if (r > 0) return woke(WAIT_BLOCK);
+      if (r < 0) return false;
+    }
+    uint64_t spinEnd = platform::MonotonicNs() + 2 * margin;
+    if (spinUntil(spinEnd < deadline ? spinEnd : deadline, false)) return woke(WAIT_ADAPTIVE);
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  int r = block(deadline);
+  if (r > 0) return woke(WAIT_BLOCK);
+  return r == 0 ? timedOut() : false;
+}
+
+// helper: ReaderDesc::latency_hist bucket, log2 of the latency in us
+static uint32_t LatencyBucket(uint64_t latencyNs) {
+  uint32_t b = 0;
+  for (uint64_t us = latencyNs / 1000; us && b < SHARED_LATENCY_BUCKETS - 1; us >>= 1) b++;
+  return b;
+}
+
+// Measures publish-to-wake latency of the frame we are about to consume.
+void SharedMemory::recordWake(WaitMode woke, uint64_t spins) {
+  uint64_t now = platform::MonotonicNs();
+  SharedHeader* hdr = headerPtr();
+  int32_t slot = hdr->latest_slot.load(std::memory_order_acquire);
+  uint64_t published = (slot >= 0 && (uint32_t)slot < slotCount()) ? hdr->slots[slot].publish_ns.load(std::memory_order_relaxed) : 0;
+
+  if (ReaderDesc* r = readerDesc()) {
+    r->wakeups.fetch_add(1, std::memory_order_relaxed);
+    r->spin_iterations.fetch_add(spins, std::memory_order_relaxed);
+    if (published && published <= now) {
+      uint64_t latency = now - published;
+      r->latency_sum_ns.fetch_add(latency, std::memory_order_relaxed);
+      uint64_t max = r->latency_max_ns.load(std::memory_order_relaxed);
+      while (latency > max && !r->latency_max_ns.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {}
+      r->latency_hist[LatencyBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(statsMutex_);
+  wakeups_[woke]++;
+  spinIterations_ += spins;
+  if (!published || published > now) return;
+
+  uint64_t latency = now - published;
+  latencyCount_++;
+  latencySumNs_ += latency;
+  latencyLastNs_ = latency;
+  if (latency > latencyMaxNs_) latencyMaxNs_ = latency;
+
+  if (lastPublishNs_ && published > lastPublishNs_) {
+    uint64_t interval = published - lastPublishNs_;
+    intervalNs_ = intervalNs_ ? (intervalNs_ * 7 + interval) / 8 : interval;
+  }
+  lastPublishNs_ = published;
+}
+
+void SharedMemory::watchLoop() {
+  std::unique_lock<std::mutex> lock(watchMutex_);
+  platform::ThreadLatencyState latency;
+  uint32_t latencySeq = latencySeq_ - 1; // this thread has none yet
+
+  while (!watchStop_) {
+    if (latencySeq != latencySeq_) {
+      latencySeq = latencySeq_;
+      latencyError_.clear();
+      latencyApplied_ = platform::SetThreadLatency(latency_, &latency, &latencyError_);
+    }
+    if (requests_.empty() && !subscribed_ && !recorder_) {
+      watchCv_.wait(lock);
+      continue;
+    }
+
+    // sleep until a frame arrives or the earliest pending read expires,
+    // with the most eager policy anyone asked for
+    uint64_t now = platform::MonotonicNs() / 1000000;
+    uint32_t timeout = platform::kInfinite;
+    WaitPolicy policy;
+    AsyncResult result;
+    if (subscribed_) {
+      policy = currentPolicy();
+      result.copies.emplace_back(); // listeners get the frame as stored
+      result.copies.back().policy = currentCopyPolicy();
+    }
+    for (const AsyncRequest& r : requests_) {
+      if (r.policy.mode > policy.mode) policy = r.policy;
+      bool known = false;
+      for (const FrameCopy& c : result.copies) known = known || c.spec == r.convert;
+      if (!known) {
+        result.copies.emplace_back();
+        result.copies.back().spec = r.convert;
+        result.copies.back().policy = r.copy; // the first request asking decides how
+      }
+      if (!r.deadline) continue;
+      uint32_t left = r.deadline > now ? (uint32_t)(r.deadline - now) : 0;
+      if (left < timeout) timeout = left;
+    }
+
+    recording::QueuedWriter* recorder = recorder_.get();
+    watchKick_ = false;
+    lock.unlock();
+    bool gotFrame = waitForFrame(policy, timeout, wake_, &watchKick_);
+    if (gotFrame && moved()) {
+      // the producer resized: the JS thread moves us over, pausing this
+      // thread and starting a new one
+      lock.lock();
+      remapPending_ = true;
+      signalAsync();
+      watchCv_.wait(lock, [&] { return watchStop_; });
+      break;
+    }
+    // one pinned frame, copied once per distinct conversion
+    if (gotFrame) result.status = copyLatestFrame(result.copies.data(), result.copies.size(), recorder);
+    lock.lock();
+
+    if (watchStop_) {
+      for (FrameCopy& c : result.copies) free(c.data);
+      break;
+    }
+
+    if (gotFrame) {
+      // the frame goes to every pending read and to the listeners; reads
+      // that came in meanwhile or got a stale frame wait for the next one
+      for (size_t i = 0; i < requests_.size();) {
+        size_t c = 0;
+        while (c < result.copies.size() && !(result.copies[c].spec == requests_[i].convert)) c++;
+        if (c == result.copies.size() || (result.status == READ_OK && result.copies[c].status == READ_STALE)) {
+          i++;
+          continue;
+        }
+        result.ids.push_back({ requests_[i].id, c });
+        requests_.erase(requests_.begin() + i);
+      }
+      result.toListeners = subscribed_ && !result.copies.empty() && result.copies[0].spec.raw() &&
+                           result.copies[0].spec.whole();
+      if (result.ids.empty() && !result.toListeners) { // only recorded
+        for (FrameCopy& c : result.copies) free(c.data);
+        continue;
+      }
+      results_.push_back(result);
+      signalAsync();
+      continue;
+    }
+
+    // expire timed out reads
+    AsyncResult expired;
+    expired.status = READ_TIMEOUT;
+    now = platform::MonotonicNs() / 1000000;
+    for (size_t i = 0; i < requests_.size();) {
+      if (requests_[i].deadline && requests_[i].deadline <= now) {
+        expired.ids.push_back({ requests_[i].id, 0 });
+        requests_.erase(requests_.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    if (!expired.ids.empty()) {
+      results_.push_back(expired);
+      signalAsync();
+    }
+  }
+  platform::ResetThreadLatency(&latency); // the timer resolution is process wide
+}
+
+// Keeps the instance and the event loop alive only while someone waits.
+void SharedMemory::updateAsyncRef() {
+  bool demand = !resolvers_.empty() || !listeners_.empty() || playResolver_;
+  uint32_t refs;
+  if (demand && !asyncRefed_) {
+    napi_reference_ref(env_, wrapper_, &refs);
+    napi_ref_threadsafe_function(env_, async_);
+    asyncRefed_ = true;
+  } else if (!demand && asyncRefed_) {
+    if (async_) napi_unref_threadsafe_function(env_, async_);
+    asyncRefed_ = false;
+    napi_reference_unref(env_, wrapper_, &refs);
+  }
+}
+
+void SharedMemory::rejectPending(const char* message) {
+  if (resolvers_.empty() && listeners_.empty()) return;
+
+  for (auto& it : resolvers_) napi_reject_deferred(env_, it.second, MakeError(env_, message));
+  resolvers_.clear();
+  for (napi_ref fn : listeners_) napi_delete_reference(env_, fn);
+  listeners_.clear();
+  updateAsyncRef();
+}
+
+void SharedMemory::OnAsync(napi_env env, napi_value /*callback*/, void* context, void* /*data*/) {
+  SharedMemory* obj = static_cast<SharedMemory*>(context);
+  if (!env || obj->cleanedUp_) return; // torn down, the queue is being drained
+
+  std::deque<AsyncResult> results;
+  bool remap;
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    results.swap(obj->results_);
+    remap = obj->remapPending_;
+  }
+  // a generation gone already: the watcher goes back to the one it has
+  if (remap && !obj->followGeneration()) {
+    obj->pauseWatcher();
+    obj->resumeWatcher();
+  }
+
+  napi_value self = nullptr;
+  napi_get_reference_value(env, obj->wrapper_, &self);
+  for (AsyncResult& r : results) {
+    // per copy, everyone but its last consumer gets a copy of it, the last
+    // one takes the block
+    std::vector<size_t> consumers(r.copies.size(), 0);
+    for (auto& id : r.ids) {
+      if (id.second < consumers.size()) consumers[id.second]++;
+    }
+    if (r.toListeners) consumers[0] += obj->listeners_.size();
+    auto deliver = [&](size_t c) -> napi_value {
+      FrameCopy& copy = r.copies[c];
+      if (!copy.data) return NewBuffer(env, 0);
+      if (--consumers[c] > 0) return CopyBuffer(env, copy.data, copy.size);
+      char* owned = copy.data;
+      copy.data = nullptr;
+      return OwnedBuffer(env, owned, copy.size);
+    };
+
+    for (auto& id : r.ids) {
+      auto it = obj->resolvers_.find(id.first);
+      if (it == obj->resolvers_.end()) continue;
+      napi_deferred resolver = it->second;
+      obj->resolvers_.erase(it);
+
+      ReadResult status = r.status == READ_OK && id.second < r.copies.size() ? r.copies[id.second].status : r.status;
+      if (status == READ_TIMEOUT) {
+        napi_resolve_deferred(env, resolver, Null(env));
+      } else if (status == READ_UNSUPPORTED) {
+        const char* message = id.second < r.copies.size() ? r.copies[id.second].spec.unsupported()
+                                                            : "Cannot convert the frame to that format";
+        napi_reject_deferred(env, resolver, MakeTypeError(env, message));
+      } else if (status != READ_OK) {
+        napi_reject_deferred(env, resolver, MakeError(env, "ReadFrame contention"));
+      } else {
+        napi_resolve_deferred(env, resolver, deliver(id.second));
+      }
+    }
+
+    // listeners skip frames the watcher could not read consistently
+    if (r.toListeners && r.status == READ_OK && r.copies[0].status == READ_OK) {
+      std::vector<napi_value> listeners;
+      for (napi_ref l : obj->listeners_) {
+        napi_value fn;
+        if (napi_get_reference_value(env, l, &fn) == napi_ok && fn) listeners.push_back(fn);
+      }
+      for (napi_value fn : listeners) {
+        napi_value argv[1] = { deliver(0) };
+        // a throwing listener surfaces as an uncaught exception
+        if (napi_call_function(env, self, fn, 1, argv, nullptr) == napi_pending_exception) {
+          napi_value error;
+          napi_get_and_clear_last_exception(env, &error);
+          napi_fatal_exception(env, error);
+        }
+      }
+    }
+    for (FrameCopy& c : r.copies) free(c.data); // consumers went away meanwhile
+  }
+
+  if (obj->playDone_.exchange(false)) obj->endPlayback(nullptr);
+  obj->updateAsyncRef();
+}
+
+// readFrameAsync(timeout?, options?) -> Promise<Buffer|null>, same options and semantics
+// as readFrame() but the wait and the copy happen off the event loop.
+napi_value SharedMemory::ReadFrameAsync(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  WaitPolicy policy = obj->currentPolicy();
+  ConvertSpec spec;
+  CopyPolicy copyPolicy = obj->currentCopyPolicy();
+  if (!ParseWaitPolicy(env, OptionsArg(args), &policy)) return nullptr;
+  if (!ParseConvertOptions(env, OptionsArg(args), &spec)) return nullptr;
+  if (!ParseCopyOptions(env, OptionsArg(args), &copyPolicy)) return nullptr;
+
+  napi_deferred resolver;
+  napi_value promise;
+  napi_create_promise(env, &resolver, &promise);
+
+  if (!obj->base_) {
+    napi_reject_deferred(env, resolver, MakeError(env, "Not connected"));
+    return promise;
+  }
+
+  uint64_t deadline = 0;
+  if (IsNumber(env, args[0])) {
+    int64_t timeout = Int64(env, args[0]);
+    if (timeout >= 0 && (uint32_t)timeout != platform::kInfinite) deadline = platform::MonotonicNs() / 1000000 + (uint64_t)timeout;
+  }
+
+  uint32_t id = obj->nextRequestId_++;
+  if (obj->nextRequestId_ == 0) obj->nextRequestId_ = 1;
+  obj->resolvers_[id] = resolver;
+
+  obj->ensureWatcher();
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    obj->requests_.push_back({ id, deadline, policy, spec, copyPolicy });
+  }
+  obj->watchCv_.notify_one();
+  obj->watchKick_ = true;
+  platform::SignalEvent(obj->wake_); // recompute the watcher's timeout and policy
+  obj->updateAsyncRef();
+  return promise;
+}
+
+// on('frame', cb): cb(buffer) for every frame, delivered on the JS thread
+napi_value SharedMemory::On(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  if (args.Length() < 2 || !IsString(env, args[0]) || !IsFunction(env, args[1])) {
+    return ThrowTypeError(env, "Args: event, listener");
+  }
+  if (Utf8(env, args[0]) != "frame") return ThrowTypeError(env, "Unknown event");
+  if (!obj->base_) return ThrowError(env, "Not connected");
+
+  napi_ref listener;
+  napi_create_reference(env, args[1], 1, &listener);
+  obj->listeners_.push_back(listener);
+  obj->ensureWatcher();
+  {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    obj->subscribed_ = true;
+  }
+  obj->watchCv_.notify_one();
+  obj->updateAsyncRef();
+  return args.self; // chainable, like EventEmitter
+}
+
+// off('frame', cb?) removes one listener, or all of them without cb
+napi_value SharedMemory::Off(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+
+  if (args.Length() > 1 && IsFunction(env, args[1])) {
+    for (size_t i = 0; i < obj->listeners_.size(); i++) {
+      napi_value fn;
+      bool same = false;
+      if (napi_get_reference_value(env, obj->listeners_[i], &fn) == napi_ok && fn) napi_strict_equals(env, fn, args[1], &same);
+      if (same) {
+        napi_delete_reference(env, obj->listeners_[i]);
+        obj->listeners_.erase(obj->listeners_.begin() + i);
+        break;
+      }
+    }
+  } else {
+    for (napi_ref fn : obj->listeners_) napi_delete_reference(env, fn);
+    obj->listeners_.clear();
+  }
+
+  if (obj->listeners_.empty()) {
+    std::lock_guard<std::mutex> lock(obj->watchMutex_);
+    obj->subscribed_ = false;
+  }
+  if (obj->async_) obj->updateAsyncRef();
+  return args.self;
+}
+
+napi_value SharedMemory::Close(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  obj->endPlayback("Closed");
+  obj->stopWatcher();
+  obj->stopRecorder();
+  obj->rejectPending("Closed");
+  obj->disconnect();
+  return Bool(env, true);
+}
+
+napi_value SharedMemory::GetMetadata(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+    SharedMemory* obj = Unwrap(args);
+    if (!obj->base_) return nullptr;
+
+    // one consistent snapshot of the format, re-read if setFormat() raced us
+    SharedHeader* hdr = obj->headerPtr();
+    FrameFormat fmt;
+    uint32_t formatSeq;
+    if (!obj->readFormat(&fmt, &formatSeq)) return ThrowError(env, "GetMetadata contention");
+
+    napi_value ret = NewObject(env);
+    
+    Set(env, ret, "width", Uint(env, fmt.width));
+    Set(env, ret, "height", Uint(env, fmt.height));
+    Set(env, ret, "channels", Uint(env, fmt.channels));
+    Set(env, ret, "frame_index", BigUint(env, hdr->frame_index.load(std::memory_order_acquire)));
+    Set(env, ret, "formatSeq", Uint(env, formatSeq));
+    // timestamps of the latest published frame (0n before the first one)
+    int32_t latest = hdr->latest_slot.load(std::memory_order_acquire);
+    bool published = latest >= 0 && (uint32_t)latest < obj->slotCount();
+    Set(env, ret, "publishNs", BigUint(env, published ? hdr->slots[latest].publish_ns.load(std::memory_order_relaxed) : 0));
+    Set(env, ret, "captureNs", BigUint(env, published ? hdr->slots[latest].capture_ns.load(std::memory_order_relaxed) : 0));
+    Set(env, ret, "slots", Uint(env, obj->slotCount()));
+    Set(env, ret, "readers", Uint(env, obj->attachedReaders()));
+    // what create() actually got: large pages are a request, not a guarantee
+    uint32_t pageSize = hdr->page_size ? hdr->page_size : (uint32_t)obj->mapping_.pageSize;
+    Set(env, ret, "largePages", Bool(env, obj->mapping_.largePages || pageSize > platform::SmallPageSize()));
+    Set(env, ret, "pageSize", Uint(env, pageSize));
+    Set(env, ret, "prefaulted", Bool(env, obj->mapping_.prefaulted));
+    Set(env, ret, "locked", Bool(env, obj->mapping_.locked));
+
+    // frame layout: rows of plane i start at planes[i].offset + y * planes[i].stride
+    uint32_t format = fmt.pixel_format < PIXEL_FORMAT_COUNT ? fmt.pixel_format : PIXEL_FORMAT_UNKNOWN;
+    uint32_t planeCount = fmt.plane_count <= SHARED_MAX_PLANES ? fmt.plane_count : 0;
+    napi_value planes = NewArray(env);
+    for (uint32_t i = 0; i < planeCount; i++) {
+      napi_value plane = NewObject(env);
+      Set(env, plane, "offset", Uint(env, fmt.plane_offset[i]));
+      Set(env, plane, "stride", Uint(env, fmt.plane_stride[i]));
+      SetIndex(env, planes, i, plane);
+    }
+    Set(env, ret, "format", Str(env, PIXEL_FORMAT_NAMES[format]));
+    Set(env, ret, "stride", Uint(env, fmt.plane_stride[0]));
+    Set(env, ret, "alignment", Uint(env, fmt.row_alignment));
+    Set(env, ret, "planes", planes);
+    Set(env, ret, "simd", Str(env, convert::Isa()));
+    Set(env, ret, "copyThreads", Uint(env, workers::Concurrency()));
+    Set(env, ret, "dirtyTiles", Bool(env, obj->tileTable() != nullptr));
+    Set(env, ret, "generation", Uint(env, hdr->generation));
+    Set(env, ret, "maxFrameSize", Uint(env, hdr->slot_reserve));
+    uint32_t textures = 0;
+    for (uint32_t i = 0; i < obj->slotCount(); i++) textures += hdr->gpu[i].kind != GPU_NONE;
+    Set(env, ret, "textures", Uint(env, textures));
+    Set(env, ret, "compression", Bool(env, hdr->compress_capacity != 0));
+    // readFrame({ level }) sizes: levels[l - 1] is level l of the current format
+    napi_value levels = NewArray(env);
+    shm_image::LevelLayout level;
+    uint32_t levelCount = std::min<uint32_t>(hdr->level_count, SHARED_MAX_LEVELS);
+    for (uint32_t l = 1; l <= levelCount && shm_image::ComputeLevel(fmt, l, &level); l++) {
+      napi_value entry = NewObject(env);
+      Set(env, entry, "width", Uint(env, level.width));
+      Set(env, entry, "height", Uint(env, level.height));
+      SetIndex(env, levels, l - 1, entry);
+    }
+    Set(env, ret, "levels", levels);
+    // create({ stages }): each stage's cursor and who runs it (pid 0 = nobody)
+    napi_value stageList = NewArray(env);
+    for (uint32_t s = 0; s < std::min<uint32_t>(hdr->stage_count, SHARED_MAX_STAGES); s++) {
+      const StageDesc* desc = &hdr->stages[s];
+      napi_value entry = NewObject(env);
+      Set(env, entry, "name", Str(env, StageName(*desc)));
+      Set(env, entry, "frameIndex", BigUint(env, desc->frame_index.load(std::memory_order_acquire)));
+      Set(env, entry, "pid", Uint(env, shm_image::StagePid(hdr, s + 1)));
+      Set(env, entry, "frames", BigUint(env, desc->frames.load(std::memory_order_relaxed)));
+      Set(env, entry, "busyNs", BigUint(env, desc->busy_ns.load(std::memory_order_relaxed)));
+      SetIndex(env, stageList, s, entry);
+    }
+    Set(env, ret, "stages", stageList);
+    Set(env, ret, "stage", obj->stage_ ? Str(env, StageName(hdr->stages[obj->stage_ - 1])) : Null(env));
+    if (obj->dir_) {
+      StreamEntry* e = &obj->dir_->streams[obj->streamIndex_];
+      Set(env, ret, "stream", Str(env, std::string(e->name, strnlen(e->name, STREAM_NAME_SIZE))));
+    }
+    
+    return ret;
+}
+
+// getStats() -> the shared counters: producer side, every attached reader's
+// entry (whichever process owns it) and the last frame this instance read.
+// Counters only grow, scrapers diff them.
+napi_value SharedMemory::GetStats(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+  SharedMemory* obj = Unwrap(args);
+  if (!obj->base_ || obj->mapSize_ < sizeof(SharedHeader)) return nullptr;
+
+  SharedHeader* hdr = obj->headerPtr();
+  auto set = [&](napi_value o, const char* key, napi_value value) { Set(env, o, key, value); };
+  auto num = [&](uint64_t v) { return Num(env, (double)v); };
+  auto big = [&](uint64_t v) { return BigUint(env, v); };
+
+  napi_value ret = NewObject(env);
+  set(ret, "framesPublished", num(hdr->frame_index.load(std::memory_order_relaxed)));
+  set(ret, "ringFull", num(hdr->ring_full.load(std::memory_order_relaxed)));
+  set(ret, "pinBackoffs", num(hdr->pin_backoffs.load(std::memory_order_relaxed)));
+  set(ret, "compressedFrames", num(hdr->compressed_frames.load(std::memory_order_relaxed)));
+  set(ret, "compressSkipped", num(hdr->compress_skipped.load(std::memory_order_relaxed)));
+
+  napi_value readers = NewArray(env);
+  uint32_t n = 0;
+  for (int32_t i = 0; i < SHARED_MAX_READERS; i++) {
+    ReaderDesc* r = &hdr->readers[i];
+    if (r->state.load(std::memory_order_acquire) != READER_ATTACHED) continue;
+
+    napi_value o = NewObject(env);
+    uint64_t wakeups = r->wakeups.load(std::memory_order_relaxed);
+    uint64_t latencySum = r->latency_sum_ns.load(std::memory_order_relaxed);
+    napi_value hist = NewArray(env);
+    uint64_t measured = 0;
+    for (uint32_t b = 0; b < SHARED_LATENCY_BUCKETS; b++) {
+      uint32_t count = r->latency_hist[b].load(std::memory_order_relaxed);
+      measured += count;
+      SetIndex(env, hist, b, Uint(env, count));
+    }
+    set(o, "index", Int(env, i));
+    set(o, "pid", Uint(env, r->pid));
+    set(o, "self", Bool(env, i == obj->readerIndex_));
+    set(o, "lastFrameIndex", big(r->last_frame_index.load(std::memory_order_relaxed)));
+    set(o, "framesRead", num(r->frames_read.load(std::memory_order_relaxed)));
+    set(o, "framesDropped", num(r->frames_dropped.load(std::memory_order_relaxed)));
+    set(o, "retries", num(r->retries.load(std::memory_order_relaxed)));
+    set(o, "spinIterations", num(r->spin_iterations.load(std::memory_order_relaxed)));
+    set(o, "wakeups", num(wakeups));
+    set(o, "timeouts", num(r->timeouts.load(std::memory_order_relaxed)));
+    set(o, "avgLatencyUs", Num(env, measured ? latencySum / 1000.0 / measured : 0.0));
+    set(o, "maxLatencyUs", Num(env, r->latency_max_ns.load(std::memory_order_relaxed) / 1000.0));
+    set(o, "latencyHistogram", hist); // [b]: latencies below 2^b us
+    SetIndex(env, readers, n++, o);
+  }
+  set(ret, "readers", readers);
+
+  std::lock_guard<std::mutex> lock(obj->statsMutex_);
+  if (obj->lastFrame_.index) {
+    napi_value frame = NewObject(env);
+    set(frame, "index", big(obj->lastFrame_.index));
+    set(frame, "captureNs", big(obj->lastFrame_.captureNs));
+    set(frame, "publishNs", big(obj->lastFrame_.publishNs));
+    set(frame, "readNs", big(obj->lastFrame_.readNs));
+    set(ret, "lastFrame", frame);
+  } else {
+    set(ret, "lastFrame", Null(env));
+  }
+  return ret;
+}
+
+// now() -> BigInt, the clock publishNs/captureNs are on
+napi_value SharedMemory::Now(napi_env env, napi_callback_info /*info*/) {
+  return BigUint(env, platform::MonotonicNs());
+}
+
+// convert(buffer, { from, format, width, height, stride?, premultiply? }) ->
+// Buffer: the conversion kernels readFrame({ format }) uses, for pixels that
+// are already out of the mapping. Needs no connection.
+napi_value SharedMemory::Convert(napi_env env, napi_callback_info info) {
+  CallArgs args(env, info);
+
+  char* src;
+  size_t srcBytes;
+  if (!BufferData(env, args[0], &src, &srcBytes) || !IsObject(env, args[1])) {
+    return ThrowTypeError(env, "Args: buffer, options");
+  }
+  napi_value opts = args[1];
+  auto get = [&](const char* key) { return Get(env, opts, key); };
+
+  ConvertSpec spec;
+  if (!ParseConvertOptions(env, opts, &spec)) return nullptr;
+  if (!spec.whole()) return ThrowTypeError(env, "convert() takes whole frames");
+  napi_value from = get("from");
+  int srcFormat = IsString(env, from) ? FindConvertFormat(env, from) : -1;
+  if (srcFormat < 0 || srcFormat >= PIXEL_FORMAT_COUNT) return ThrowTypeError(env, "Unknown pixel format");
+  uint32_t width = (uint32_t)Int64(env, get("width"));
+  uint32_t height = (uint32_t)Int64(env, get("height"));
+  uint32_t stride = IsNumber(env, get("stride")) ? (uint32_t)Int64(env, get("stride"))
+                                                 : width * PIXEL_FORMAT_CHANNELS[srcFormat];
+
+  convert::Plan plan;
+  if (!convert::MakePlan((uint32_t)srcFormat, 0, spec.format, width, height, stride, spec.premultiply, &plan)) {
+    return ThrowTypeError(env, "Cannot convert between those formats");
+  }
+  if (convert::SourceBytes(plan) > srcBytes) {
+    return ThrowRangeError(env, "Buffer is smaller than width, height and stride say");
+  }
+
+  char* dst;
+  napi_value out = NewBuffer(env, (size_t)plan.dstBytes, &dst);
+  convert::Run(plan, reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(dst), 0, plan.height);
+  return out;
 }
 
 
-NODE_MODULE(NODE_GYP_MODULE_NAME, SharedMemory::Init)
\ No newline at end of file
+// context-aware: loaded once per env, the main thread's and each worker's
+NAPI_MODULE_INIT() {
+  return SharedMemory::Init(env, exports);
+}
\ No newline at end of file
@@ -0,0 +1,738 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "shm_image.h"
+#include <algorithm>
+#include <cstring>
+
+namespace shm_image {
+
+// --- Formats ---
+
+uint32_t BytesPerPixel(uint32_t format, uint32_t channels) {
+  switch (format) {
+  case PIXEL_FORMAT_BGRA8: case PIXEL_FORMAT_RGBA8: return 4;
+  case PIXEL_FORMAT_BGR8: case PIXEL_FORMAT_RGB8: return 3;
+  case PIXEL_FORMAT_GRAY8: case PIXEL_FORMAT_NV12: return 1;
+  case PIXEL_FORMAT_P010: return 2;
+  case PIXEL_FORMAT_RGBA16F: return 8;
+  default: return channels;
+  }
+}
+
+FrameLayout ComputeLayout(uint32_t format, uint32_t w, uint32_t h, uint32_t channels, uint32_t alignment) {
+  auto align = [&](uint64_t n) { return (n + alignment - 1) / alignment * alignment; };
+  FrameLayout layout;
+  uint32_t bpp = BytesPerPixel(format, channels);
+
+  layout.stride[0] = (uint32_t)align((uint64_t)w * bpp);
+  layout.frameBytes = (uint64_t)layout.stride[0] * h;
+  if (format == PIXEL_FORMAT_NV12 || format == PIXEL_FORMAT_P010) {
+    // one UV pair per 2x2 block, same row bytes as Y for even widths
+    layout.planes = 2;
+    layout.stride[1] = (uint32_t)align((uint64_t)((w + 1) / 2) * 2 * bpp);
+    layout.offset[1] = (uint32_t)align(layout.frameBytes);
+    layout.frameBytes = layout.offset[1] + (uint64_t)layout.stride[1] * ((h + 1) / 2);
+  }
+  return layout;
+}
+
+void MakeFormat(FrameFormat* f, uint32_t w, uint32_t h, uint32_t c, uint32_t format, uint32_t alignment) {
+  if (format != PIXEL_FORMAT_UNKNOWN && c == 0) c = PIXEL_FORMAT_CHANNELS[format];
+  FrameLayout layout = ComputeLayout(format, w, h, c, alignment);
+  f->width = w;
+  f->height = h;
+  f->channels = c;
+  f->pixel_format = format;
+  f->row_alignment = alignment;
+  f->plane_count = layout.planes;
+  for (uint32_t i = 0; i < SHARED_MAX_PLANES; i++) {
+    f->plane_stride[i] = layout.stride[i];
+    f->plane_offset[i] = layout.offset[i];
+  }
+}
+
+bool ReadFormat(const SharedHeader* hdr, FrameFormat* out, uint32_t* seq, uint64_t* retries) {
+  for (int attempt = 0; attempt < 1000; attempt++) {
+    uint32_t before = hdr->format_seq.load(std::memory_order_acquire);
+    if (!(before & 1)) {
+      memcpy(out, &hdr->format, sizeof(FrameFormat));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (hdr->format_seq.load(std::memory_order_relaxed) == before) {
+        if (retries) *retries = (uint64_t)attempt;
+        if (seq) *seq = before;
+        return true;
+      }
+    }
+    platform::CpuRelax();
+  }
+  if (retries) *retries = 1000;
+  return false;
+}
+
+void WriteFormat(SharedHeader* hdr, const FrameFormat& format) {
+  uint32_t seq = hdr->format_seq.load(std::memory_order_relaxed);
+  hdr->format_seq.store(seq + 1, std::memory_order_relaxed); // odd: readers retry
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&hdr->format, &format, sizeof(FrameFormat));
+  // a new tile grid: the next frame counts as changed everywhere
+  hdr->full_frame_index.store(hdr->frame_index.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  hdr->format_seq.store(seq + 2, std::memory_order_release);
+}
+
+// --- Levels ---
+
+bool ComputeLevel(const FrameFormat& format, uint32_t level, LevelLayout* out) {
+  switch (format.pixel_format) {
+  case PIXEL_FORMAT_UNKNOWN:
+    if (format.channels < 1 || format.channels > 4) return false;
+    break;
+  case PIXEL_FORMAT_BGRA8: case PIXEL_FORMAT_RGBA8: case PIXEL_FORMAT_BGR8: case PIXEL_FORMAT_RGB8:
+  case PIXEL_FORMAT_GRAY8:
+    break;
+  default:
+    return false;
+  }
+  if (level < 1 || level > SHARED_MAX_LEVELS) return false;
+  uint32_t bpp = BytesPerPixel(format.pixel_format, format.channels);
+  uint64_t offset = 0;
+  for (uint32_t l = 1; l <= level; l++) {
+    LevelLayout layout;
+    layout.width = format.width >> l;
+    layout.height = format.height >> l;
+    if (!layout.width || !layout.height) return false;
+    layout.stride = layout.width * bpp;
+    layout.offset = offset;
+    layout.bytes = (uint64_t)layout.stride * layout.height;
+    offset += (layout.bytes + 63) / 64 * 64;
+    *out = layout;
+  }
+  return true;
+}
+
+uint64_t LevelBytes(const FrameFormat& format, uint32_t count) {
+  LevelLayout last;
+  uint64_t bytes = 0;
+  for (uint32_t l = 1; l <= count && ComputeLevel(format, l, &last); l++) bytes = last.offset + last.bytes;
+  return bytes;
+}
+
+uint64_t LevelCapacity(uint64_t frameCapacity, uint32_t count, uint32_t align) {
+  // each level has at most a quarter of the previous one's pixels
+  if (!count) return 0;
+  uint64_t bytes = frameCapacity / 3 + 64 * (uint64_t)count;
+  return (bytes + align - 1) / align * align;
+}
+
+uint8_t* LevelData(void* base, size_t mapSize, const SharedHeader* hdr, uint32_t slot) {
+  uint64_t offset = hdr->level_offset + (uint64_t)slot * hdr->level_capacity;
+  if (!hdr->level_count || !hdr->level_capacity || offset < HEADER_SIZE || offset + hdr->level_capacity > mapSize) {
+    return nullptr;
+  }
+  return static_cast<uint8_t*>(base) + offset;
+}
+
+// --- Names ---
+
+std::string SharedEventName(const std::string& mapName) { return "SHM_EV_" + mapName; }
+
+std::string ReaderEventName(const std::string& mapName, int32_t index) {
+  return "SHM_EV_" + mapName + "_R" + std::to_string(index);
+}
+
+std::string GenerationName(const std::string& root, uint32_t generation) {
+  return generation ? root + "@" + std::to_string(generation) : root;
+}
+
+// --- Ring ---
+
+void InitHeader(SharedHeader* hdr, const FrameFormat& format, const RingLayout& ring) {
+  memset((void*)hdr, 0, sizeof(SharedHeader));
+  hdr->magic = SHARED_MAGIC;
+  hdr->version = SHARED_VERSION;
+  hdr->format = format;
+  hdr->mapping_size = ring.mappingSize;
+  hdr->slot_count = ring.slots;
+  hdr->slot_capacity.store(ring.slotCapacity, std::memory_order_relaxed);
+  hdr->slot_reserve = std::max(ring.slotReserve, ring.slotCapacity);
+  hdr->page_size = ring.pageSize;
+  hdr->latest_slot.store(-1, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < ring.slots; i++) {
+    hdr->slots[i].offset = ring.slotsOffset + (uint64_t)hdr->slot_reserve * i;
+  }
+}
+
+bool CheckHeader(const void* base, size_t mapSize, std::string* error) {
+  const StreamDirectory* dir = mapSize >= sizeof(StreamDirectory) ? static_cast<const StreamDirectory*>(base) : nullptr;
+  const SharedHeader* hdr = static_cast<const SharedHeader*>(base);
+  if (dir && dir->magic.load(std::memory_order_acquire) == STREAMS_MAGIC) {
+    *error = "The mapping holds streams";
+  } else if (mapSize < sizeof(SharedHeader) || hdr->magic != SHARED_MAGIC) {
+    *error = "Not a frame mapping";
+  } else if (hdr->version != SHARED_VERSION) {
+    *error = "Unsupported header version";
+  } else {
+    return true;
+  }
+  return false;
+}
+
+uint32_t SlotCount(const SharedHeader* hdr, size_t viewSize) {
+  if (!hdr || viewSize <= HEADER_SIZE) return 0;
+  uint32_t n = hdr->slot_count;
+  return n > SHARED_MAX_SLOTS ? 0 : n;
+}
+
+uint8_t* SlotData(void* base, size_t mapSize, const SharedHeader* hdr, uint32_t slot) {
+  uint64_t offset = hdr->slots[slot].offset;
+  if (offset < HEADER_SIZE || offset + hdr->slot_capacity.load(std::memory_order_relaxed) > mapSize) return nullptr;
+  return static_cast<uint8_t*>(base) + offset;
+}
+
+void CommitSlots(platform::Mapping* mapping, const SharedHeader* hdr, uint32_t capacity) {
+  uint32_t count = SlotCount(hdr, mapping->size);
+  for (uint32_t i = 0; i < count; i++) platform::CommitRange(mapping, hdr->slots[i].offset, capacity);
+}
+
+// helper: the frame_index every live blocking lossless reader has read up
+// to, UINT64_MAX without one
+static uint64_t LosslessFloor(const SharedHeader* hdr) {
+  uint64_t floor = UINT64_MAX;
+  for (const ReaderDesc& r : hdr->readers) {
+    if (r.state.load(std::memory_order_acquire) != READER_ATTACHED || !r.lossless.load(std::memory_order_relaxed)) continue;
+    if (!ReaderAlive(r)) continue; // it can't read any more, don't wait for it
+    floor = std::min<uint64_t>(floor, r.last_frame_index.load(std::memory_order_acquire));
+  }
+  return floor;
+}
+
+int32_t AcquireWriteSlot(SharedHeader* hdr, uint32_t count) {
+  if (count == 0) return -1;
+  int32_t latest = hdr->latest_slot.load(std::memory_order_relaxed);
+  uint64_t floor = std::min(LosslessFloor(hdr), PipelineIndex(hdr)); // past a pipeline's end: not through every stage yet
+  uint32_t tried = 0; // bitmask of rejected slots
+
+  for (;;) {
+    int32_t best = -1;
+    for (uint32_t i = 0; i < count; i++) {
+      if ((int32_t)i == latest && count > 1) continue;
+      if ((tried & (1u << i)) || hdr->slots[i].readers.load(std::memory_order_relaxed) != 0) continue;
+      if (hdr->slots[i].frame_index.load(std::memory_order_relaxed) > floor) continue; // still unread
+      if (best < 0 || hdr->slots[i].frame_index.load(std::memory_order_relaxed) <
+                      hdr->slots[best].frame_index.load(std::memory_order_relaxed)) best = (int32_t)i;
+    }
+    if (best < 0) {
+      hdr->ring_full.fetch_add(1, std::memory_order_relaxed);
+      return -1;
+    }
+
+    SlotDesc* desc = &hdr->slots[best];
+    // odd: owned by the producer. A reader may have pinned it meanwhile;
+    // PinLatestSlot() bumps readers before checking seq, and both sides use
+    // seq_cst, so one side always sees the other
+    desc->seq.fetch_add(1, std::memory_order_seq_cst);
+    if (desc->readers.load(std::memory_order_seq_cst) != 0) {
+      desc->seq.fetch_add(1, std::memory_order_release); // back off, contents untouched
+      hdr->pin_backoffs.fetch_add(1, std::memory_order_relaxed);
+      tried |= 1u << best;
+      continue;
+    }
+    return best;
+  }
+}
+
+void PublishSlot(SharedHeader* hdr, int32_t slot, uint32_t frameBytes, uint64_t captureNs, uint32_t gpuFlags) {
+  SlotDesc* desc = &hdr->slots[slot];
+  desc->frame_size = frameBytes;
+  desc->format_seq = hdr->format_seq.load(std::memory_order_relaxed);
+  desc->gpu_flags = gpuFlags;
+  desc->frame_index.store(hdr->frame_index.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  desc->publish_ns.store(platform::MonotonicNs(), std::memory_order_relaxed);
+  desc->capture_ns.store(captureNs, std::memory_order_relaxed);
+  hdr->frame_size = frameBytes;
+
+  desc->seq.fetch_add(1, std::memory_order_release); // even: readable again
+  hdr->published_index.store(desc->frame_index.load(std::memory_order_relaxed), std::memory_order_release);
+  // publish; a pipeline's frame goes to its first stage instead, readers see
+  // it once the last stage released it
+  if (!hdr->stage_count) hdr->latest_slot.store(slot, std::memory_order_release);
+}
+
+bool PinLatestSlot(SharedHeader* hdr, uint32_t count, int32_t readerIndex, int32_t* outSlot, uint64_t* retriesOut) {
+  const int MAX_RETRIES = 10;
+  const int SPIN_LIMIT = 2000; // cycles to spin before yielding
+  int retries = 0;
+  int spinCount = 0;
+
+  *outSlot = -1;
+  *retriesOut = 0;
+  for (;;) {
+    int32_t slot = hdr->latest_slot.load(std::memory_order_acquire);
+    if (slot < 0 || (uint32_t)slot >= count) return true; // nothing published yet
+    SlotDesc* desc = &hdr->slots[slot];
+
+    desc->readers.fetch_add(1, std::memory_order_seq_cst);
+    if ((desc->seq.load(std::memory_order_seq_cst) & 1) == 0) {
+      if (readerIndex >= 0) hdr->readers[readerIndex].pins[slot].fetch_add(1, std::memory_order_relaxed);
+      *retriesOut = (uint64_t)retries * SPIN_LIMIT + spinCount;
+      *outSlot = slot;
+      return true;
+    }
+    desc->readers.fetch_sub(1, std::memory_order_relaxed);
+
+    // if seq number is odd, the producer lapped us and refills this slot (or
+    // owns the only slot), waiting...
+    if (spinCount < SPIN_LIMIT) {
+      spinCount++;
+      platform::CpuRelax();
+      continue;
+    }
+    if (retries++ > MAX_RETRIES) {
+      *retriesOut = (uint64_t)retries * SPIN_LIMIT;
+      return false;
+    }
+    platform::YieldThread(); // if waited too long
+    spinCount = 0;
+  }
+}
+
+bool PinNextSlot(SharedHeader* hdr, uint32_t count, int32_t readerIndex, uint64_t after, uint64_t until,
+                 int32_t* outSlot, uint64_t* retriesOut) {
+  const int MAX_RETRIES = 10;
+  int retries = 0;
+
+  *outSlot = -1;
+  *retriesOut = 0;
+  for (;;) {
+    // the oldest frame past `after`; a slot being refilled no longer holds one
+    int32_t slot = -1;
+    uint64_t index = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      const SlotDesc* desc = &hdr->slots[i];
+      uint64_t f = desc->frame_index.load(std::memory_order_acquire);
+      if (f <= after || f > until || (slot >= 0 && f >= index) || (desc->seq.load(std::memory_order_acquire) & 1)) continue;
+      slot = (int32_t)i;
+      index = f;
+    }
+    if (slot < 0) return true;
+
+    if (PinSlot(hdr, readerIndex, slot)) {
+      if (hdr->slots[slot].frame_index.load(std::memory_order_acquire) == index) {
+        *retriesOut = (uint64_t)retries;
+        *outSlot = slot;
+        return true;
+      }
+      UnpinSlot(hdr, readerIndex, slot); // refilled between the scan and the pin
+    }
+    if (retries++ > MAX_RETRIES) {
+      *retriesOut = (uint64_t)retries;
+      return false;
+    }
+    platform::CpuRelax();
+  }
+}
+
+bool PinSlot(SharedHeader* hdr, int32_t readerIndex, int32_t slot) {
+  SlotDesc* desc = &hdr->slots[slot];
+  desc->readers.fetch_add(1, std::memory_order_seq_cst);
+  if (desc->seq.load(std::memory_order_seq_cst) & 1) {
+    desc->readers.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (readerIndex >= 0) hdr->readers[readerIndex].pins[slot].fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void UnpinSlot(SharedHeader* hdr, int32_t readerIndex, int32_t slot) {
+  if (readerIndex >= 0) hdr->readers[readerIndex].pins[slot].fetch_sub(1, std::memory_order_relaxed);
+  hdr->slots[slot].readers.fetch_sub(1, std::memory_order_release); // our reads happen before the refill
+}
+
+// --- Readers ---
+
+int32_t AttachReader(SharedHeader* hdr, const std::string& mapName, bool wantCompressed, platform::Event** event) {
+  for (int pass = 0; pass < 2; pass++) {
+    for (int32_t i = 0; i < SHARED_MAX_READERS; i++) {
+      ReaderDesc* r = &hdr->readers[i];
+      if (pass == 0) {
+        int32_t expected = READER_FREE;
+        if (!r->state.compare_exchange_strong(expected, READER_CLAIMING)) continue;
+      } else {
+        if (r->state.load() != READER_ATTACHED || ReaderAlive(*r)) continue;
+        int32_t expected = READER_ATTACHED;
+        if (!r->state.compare_exchange_strong(expected, READER_CLAIMING)) continue;
+        ReleaseReaderPins(hdr, r);
+      }
+
+      // event first, so the producer can open it as soon as we're attached
+      platform::Event* ev = platform::OpenSharedEvent(ReaderEventName(mapName, i), &r->event_word, true);
+      if (!ev) {
+        r->state.store(READER_FREE);
+        continue;
+      }
+      platform::ClearEvent(ev); // may be a previous owner's, still held open by the producer
+
+      platform::ProcessToken self = platform::CurrentProcessToken();
+      r->pid = platform::CurrentProcessId();
+      r->owner_ns = self.ns;
+      r->owner_start = self.start;
+      // a pipeline's readers start behind the frames still in its stages
+      uint64_t latest = std::min(hdr->frame_index.load(std::memory_order_relaxed), PipelineIndex(hdr));
+      r->last_frame_index.store(latest, std::memory_order_relaxed);
+      for (std::atomic<uint64_t>* c : { &r->frames_read, &r->frames_dropped, &r->retries, &r->spin_iterations,
+                                        &r->wakeups, &r->timeouts, &r->latency_sum_ns, &r->latency_max_ns }) {
+        c->store(0, std::memory_order_relaxed);
+      }
+      for (std::atomic<uint32_t>& b : r->latency_hist) b.store(0, std::memory_order_relaxed);
+      r->want_compressed.store(wantCompressed ? 1 : 0, std::memory_order_relaxed);
+      r->lossless.store(0, std::memory_order_relaxed);
+      r->stage.store(0, std::memory_order_relaxed);
+      r->state.store(READER_ATTACHED, std::memory_order_release);
+      *event = ev;
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool ReaderAlive(const ReaderDesc& reader) {
+  return platform::ProcessAlive(reader.pid, { reader.owner_ns, reader.owner_start });
+}
+
+void DetachReader(SharedHeader* hdr, int32_t index) {
+  ReaderDesc* r = &hdr->readers[index];
+  ReleaseReaderPins(hdr, r);
+  r->state.store(READER_FREE, std::memory_order_release);
+}
+
+void ReleaseReaderPins(SharedHeader* hdr, ReaderDesc* reader) {
+  for (uint32_t s = 0; s < SHARED_MAX_SLOTS; s++) {
+    int32_t n = reader->pins[s].exchange(0);
+    if (n > 0) hdr->slots[s].readers.fetch_sub(n, std::memory_order_release);
+  }
+}
+
+void NotifyReaders(SharedHeader* hdr, const std::string& mapName, platform::Event* shared, platform::Event** readerEvents,
+                   uint32_t stage) {
+  if (shared && !stage) platform::SignalEvent(shared);
+  for (int32_t i = 0; i < SHARED_MAX_READERS; i++) {
+    if (hdr->readers[i].state.load(std::memory_order_acquire) != READER_ATTACHED) continue;
+    if (hdr->readers[i].stage.load(std::memory_order_relaxed) != stage) continue;
+    if (!readerEvents[i]) {
+      readerEvents[i] = platform::OpenSharedEvent(ReaderEventName(mapName, i), &hdr->readers[i].event_word, false);
+      if (!readerEvents[i]) continue;
+    }
+    platform::SignalEvent(readerEvents[i]);
+  }
+}
+
+// --- Pipelines ---
+
+uint32_t FindStage(const SharedHeader* hdr, const std::string& name) {
+  uint32_t count = std::min<uint32_t>(hdr->stage_count, SHARED_MAX_STAGES);
+  for (uint32_t s = 0; s < count; s++) {
+    const char* n = hdr->stages[s].name;
+    if (std::string(n, strnlen(n, STREAM_NAME_SIZE)) == name) return s + 1;
+  }
+  return 0;
+}
+
+// helper: whether stage owner `owner` (a reader entry + 1) still runs `stage`
+static bool RunsStage(const SharedHeader* hdr, int32_t owner, uint32_t stage) {
+  if (owner < 1 || owner > SHARED_MAX_READERS) return false;
+  const ReaderDesc& r = hdr->readers[owner - 1];
+  return r.state.load(std::memory_order_acquire) == READER_ATTACHED &&
+         r.stage.load(std::memory_order_acquire) == stage && ReaderAlive(r);
+}
+
+bool ClaimStage(SharedHeader* hdr, uint32_t stage, int32_t readerIndex) {
+  StageDesc* desc = &hdr->stages[stage - 1];
+  std::atomic<uint32_t>* ours = &hdr->readers[readerIndex].stage;
+  // our entry runs the stage before it owns it: whoever sees us as the owner
+  // also sees us running it
+  ours->store(stage, std::memory_order_seq_cst);
+  int32_t owner = desc->reader.load(std::memory_order_acquire);
+  while (owner != readerIndex + 1 && !RunsStage(hdr, owner, stage)) {
+    if (desc->reader.compare_exchange_weak(owner, readerIndex + 1, std::memory_order_acq_rel)) return true;
+  }
+  if (owner == readerIndex + 1) return true;
+  ours->store(0, std::memory_order_relaxed);
+  return false;
+}
+
+void LeaveStage(SharedHeader* hdr, uint32_t stage, int32_t readerIndex) {
+  int32_t owner = readerIndex + 1;
+  hdr->stages[stage - 1].reader.compare_exchange_strong(owner, 0, std::memory_order_release);
+  hdr->readers[readerIndex].stage.store(0, std::memory_order_release);
+}
+
+uint32_t StagePid(const SharedHeader* hdr, uint32_t stage) {
+  int32_t owner = hdr->stages[stage - 1].reader.load(std::memory_order_acquire);
+  return RunsStage(hdr, owner, stage) ? hdr->readers[owner - 1].pid : 0;
+}
+
+uint64_t StageInput(const SharedHeader* hdr, uint32_t stage) {
+  if (stage <= 1) return hdr->published_index.load(std::memory_order_acquire);
+  return hdr->stages[stage - 2].frame_index.load(std::memory_order_acquire);
+}
+
+uint64_t PipelineIndex(const SharedHeader* hdr) {
+  uint32_t count = hdr->stage_count;
+  if (!count || count > SHARED_MAX_STAGES) return UINT64_MAX;
+  return hdr->stages[count - 1].frame_index.load(std::memory_order_acquire);
+}
+
+void ReleaseStage(SharedHeader* hdr, uint32_t stage, int32_t slot, uint64_t busyNs) {
+  StageDesc* desc = &hdr->stages[stage - 1];
+  desc->frames.fetch_add(1, std::memory_order_relaxed);
+  desc->busy_ns.fetch_add(busyNs, std::memory_order_relaxed);
+  // our writes to the slot happen before the next stage's reads
+  desc->frame_index.store(hdr->slots[slot].frame_index.load(std::memory_order_relaxed), std::memory_order_release);
+  if (stage == hdr->stage_count) hdr->latest_slot.store(slot, std::memory_order_release); // through: publish to readers
+}
+
+// --- Writer ---
+
+bool Writer::open(const std::string& name, const WriterOptions& options, std::string* error) {
+  close();
+  if (options.slots < 1 || options.slots > SHARED_MAX_SLOTS) {
+    *error = "slots must be 1..8";
+    return false;
+  }
+  if (options.pixelFormat >= PIXEL_FORMAT_COUNT || options.alignment < 1 ||
+      options.alignment > SHARED_MAX_ALIGNMENT || (options.alignment & (options.alignment - 1))) {
+    *error = "Invalid format";
+    return false;
+  }
+  FrameFormat format;
+  MakeFormat(&format, options.width, options.height, options.channels, options.pixelFormat, options.alignment);
+  uint64_t capacity = std::max<uint64_t>(options.frameCapacity, ComputeLayout(format.pixel_format, format.width,
+      format.height, format.channels, format.row_alignment).frameBytes);
+  capacity = (capacity + 63) / 64 * 64;
+  if (capacity == 0 || capacity > UINT32_MAX) {
+    *error = "Invalid frame size";
+    return false;
+  }
+
+  // page aligned slots, laid out as the addon does
+  uint64_t slotsOffset = (HEADER_SIZE + 4095) / 4096 * 4096;
+  uint64_t stride = (capacity + 4095) / 4096 * 4096;
+  if (stride > UINT32_MAX) {
+    *error = "Invalid frame size";
+    return false;
+  }
+  uint64_t needed = slotsOffset + stride * options.slots;
+
+  bool created = false;
+  platform::MappingOptions mapOptions;
+  if (!platform::OpenOrCreateMapping(name, needed, mapOptions, &mapping_, &created, error)) return false;
+  hdr_ = static_cast<SharedHeader*>(mapping_.base);
+  // a reader may have created it without setting it up
+  if (created || (mapping_.size >= needed && hdr_->magic == 0)) {
+    RingLayout ring;
+    ring.slots = options.slots;
+    ring.slotCapacity = (uint32_t)capacity;
+    ring.slotReserve = (uint32_t)stride;
+    ring.slotsOffset = slotsOffset;
+    ring.mappingSize = mapping_.size;
+    ring.pageSize = (uint32_t)mapping_.pageSize;
+    InitHeader(hdr_, format, ring);
+  } else if (!CheckHeader(mapping_.base, mapping_.size, error) || !SlotCount(hdr_, mapping_.size)) {
+    // another producer's mapping with the same protocol is taken over as is
+    if (error->empty()) *error = "Not a frame mapping";
+    close();
+    return false;
+  }
+  name_ = name;
+  event_ = platform::OpenSharedEvent(SharedEventName(name), &hdr_->event_word, true);
+  return true;
+}
+
+void Writer::close() {
+  if (hdr_ && writeSlot_ >= 0) hdr_->slots[writeSlot_].seq.fetch_add(1, std::memory_order_release); // unpublished, back to even
+  writeSlot_ = -1;
+  for (platform::Event*& ev : readerEvents_) { platform::CloseEvent(ev); ev = nullptr; }
+  platform::CloseEvent(event_);
+  event_ = nullptr;
+  platform::CloseMapping(&mapping_);
+  hdr_ = nullptr;
+}
+
+bool Writer::setFormat(uint32_t w, uint32_t h, uint32_t pixelFormat, uint32_t alignment) {
+  if (!hdr_ || pixelFormat >= PIXEL_FORMAT_COUNT || !alignment || (alignment & (alignment - 1))) return false;
+  FrameFormat next;
+  MakeFormat(&next, w, h, 0, pixelFormat, alignment);
+  if (ComputeLayout(pixelFormat, w, h, next.channels, alignment).frameBytes > capacity()) return false;
+  WriteFormat(hdr_, next);
+  NotifyReaders(hdr_, name_, event_, readerEvents_, 0);
+  return true;
+}
+
+uint8_t* Writer::frameBuffer() {
+  if (!hdr_) return nullptr;
+  if (writeSlot_ < 0) writeSlot_ = AcquireWriteSlot(hdr_, SlotCount(hdr_, mapping_.size));
+  return writeSlot_ >= 0 ? SlotData(mapping_.base, mapping_.size, hdr_, (uint32_t)writeSlot_) : nullptr;
+}
+
+bool Writer::publish(uint32_t frameBytes, uint64_t captureNs) {
+  if (!hdr_ || writeSlot_ < 0) return false;
+  const FrameFormat& f = hdr_->format;
+  if (!frameBytes) frameBytes = (uint32_t)ComputeLayout(f.pixel_format, f.width, f.height, f.channels,
+                                                        f.row_alignment ? f.row_alignment : 1).frameBytes;
+  if (frameBytes > capacity()) return false;
+  hdr_->full_frame_index.store(hdr_->frame_index.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  PublishSlot(hdr_, writeSlot_, frameBytes, captureNs, 0);
+  writeSlot_ = -1;
+  NotifyReaders(hdr_, name_, event_, readerEvents_, hdr_->stage_count ? 1 : 0);
+  return true;
+}
+
+// --- Reader ---
+
+bool Reader::open(const std::string& name, std::string* error) {
+  close();
+  platform::MappingOptions options;
+  options.openOnly = true;
+  platform::Mapping mapping;
+  bool created = false;
+  if (!platform::OpenOrCreateMapping(name, 0, options, &mapping, &created, error)) return false;
+  if (!CheckHeader(mapping.base, mapping.size, error)) {
+    platform::CloseMapping(&mapping);
+    return false;
+  }
+  root_ = name;
+  if (!attach(&mapping, name)) {
+    *error = "No free reader entry";
+    close();
+    return false;
+  }
+  follow(); // the producer may have resized already
+  return true;
+}
+
+// helper: makes `mapping` (mapping `name`) ours and registers on it
+bool Reader::attach(platform::Mapping* mapping, const std::string& name) {
+  SharedHeader* hdr = static_cast<SharedHeader*>(mapping->base);
+  platform::Event* ev = nullptr;
+  int32_t index = AttachReader(hdr, name, false, &ev);
+  if (index < 0) return false;
+
+  if (hdr_) DetachReader(hdr_, index_);
+  platform::CloseEvent(event_);
+  if (hdr_ && hdr_->generation == 0 && !rootMapping_.base) rootMapping_ = mapping_;
+  else platform::CloseMapping(&mapping_);
+  mapping_ = *mapping;
+  *mapping = platform::Mapping();
+  hdr_ = hdr;
+  index_ = index;
+  event_ = ev;
+  committed_ = 0;
+  return true;
+}
+
+// helper: moves onto the generation the producer resized into, if any
+bool Reader::follow() {
+  uint32_t next = hdr_->next_generation.load(std::memory_order_acquire);
+  if (rootMapping_.base) {
+    next = std::max(next, static_cast<SharedHeader*>(rootMapping_.base)->next_generation.load(std::memory_order_acquire));
+  }
+  if (next <= hdr_->generation) return false;
+
+  std::string name = GenerationName(root_, next);
+  platform::MappingOptions options;
+  options.openOnly = true;
+  platform::Mapping mapping;
+  bool created = false;
+  std::string error;
+  if (!platform::OpenOrCreateMapping(name, 0, options, &mapping, &created, &error)) return false;
+  SharedHeader* to = static_cast<SharedHeader*>(mapping.base);
+  if (!CheckHeader(mapping.base, mapping.size, &error) || to->generation != next || !attach(&mapping, name)) {
+    platform::CloseMapping(&mapping);
+    return false;
+  }
+  return true;
+}
+
+void Reader::close() {
+  if (hdr_ && index_ >= 0) DetachReader(hdr_, index_);
+  index_ = -1;
+  platform::CloseEvent(event_);
+  event_ = nullptr;
+  platform::CloseMapping(&mapping_);
+  platform::CloseMapping(&rootMapping_);
+  hdr_ = nullptr;
+  lastIndex_ = 0;
+}
+
+bool Reader::wait(uint32_t timeoutMs) {
+  if (!hdr_) return false;
+  uint64_t deadline = timeoutMs == platform::kInfinite ? UINT64_MAX : platform::MonotonicNs() + (uint64_t)timeoutMs * 1000000ull;
+  for (;;) {
+    if (follow()) return true;
+    int32_t slot = hdr_->latest_slot.load(std::memory_order_acquire);
+    if (slot >= 0 && (uint32_t)slot < SlotCount(hdr_, mapping_.size) &&
+        hdr_->slots[slot].frame_index.load(std::memory_order_acquire) > lastIndex_) return true;
+    uint64_t now = platform::MonotonicNs();
+    if (now >= deadline) return false;
+    uint32_t ms = deadline == UINT64_MAX ? platform::kInfinite : (uint32_t)((deadline - now + 999999) / 1000000);
+    platform::WaitEvent(event_, nullptr, ms);
+  }
+}
+
+int64_t Reader::read(void* dst, size_t capacity, FrameInfo* info) {
+  if (!hdr_) return -1;
+  follow();
+  uint32_t slotCapacity = hdr_->slot_capacity.load(std::memory_order_acquire);
+  if (mapping_.reserved && slotCapacity > committed_) {
+    CommitSlots(&mapping_, hdr_, slotCapacity);
+    committed_ = slotCapacity;
+  }
+
+  int32_t slot;
+  uint64_t retries;
+  bool pinned = PinLatestSlot(hdr_, SlotCount(hdr_, mapping_.size), index_, &slot, &retries);
+  ReaderDesc* r = &hdr_->readers[index_];
+  if (retries) r->retries.fetch_add(retries, std::memory_order_relaxed);
+  if (!pinned) return -1;
+  if (slot < 0) return 0;
+
+  SlotDesc* desc = &hdr_->slots[slot];
+  const uint8_t* src = SlotData(mapping_.base, mapping_.size, hdr_, (uint32_t)slot);
+  uint64_t index = desc->frame_index.load(std::memory_order_relaxed);
+  FrameInfo frame;
+  frame.frameIndex = index;
+  frame.captureNs = desc->capture_ns.load(std::memory_order_relaxed);
+  frame.publishNs = desc->publish_ns.load(std::memory_order_relaxed);
+  frame.frameSize = desc->frame_size <= slotCapacity && src ? desc->frame_size : 0;
+  frame.gpuFlags = desc->gpu_flags;
+  uint32_t formatSeq = 0;
+  bool formatRead = ReadFormat(hdr_, &frame.format, &formatSeq, &retries);
+  bool stale = formatRead && formatSeq != desc->format_seq; // setFormat() since, its format is gone
+  bool gpuOnly = (frame.gpuFlags & FRAME_NO_CPU) != 0;      // only in the slot's texture
+  if (gpuOnly) frame.frameSize = 0;
+  if (info) *info = frame;
+
+  int64_t result = 0;
+  if (index <= lastIndex_) {
+    result = 0; // seen it
+  } else if (!formatRead || (!stale && frame.frameSize > capacity)) {
+    result = -1;
+  } else {
+    if (!stale) memcpy(dst, src, frame.frameSize);
+    uint64_t dropped = lastIndex_ && index > lastIndex_ + 1 ? index - lastIndex_ - 1 : 0;
+    lastIndex_ = index;
+    r->last_frame_index.store(index, std::memory_order_relaxed);
+    if (stale) dropped++;
+    else r->frames_read.fetch_add(1, std::memory_order_relaxed);
+    if (dropped) r->frames_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    result = stale ? 0 : gpuOnly ? kReadGpuOnly : frame.frameSize;
+  }
+  UnpinSlot(hdr_, index_, slot);
+  return result;
+}
+
+}  // namespace shm_image
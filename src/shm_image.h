@@ -0,0 +1,260 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Client library for the shared memory frame ring, for native producers and
+// consumers that don't go through Node. The protocol (header layout, slot
+// seqlocks and pins, the format seqlock, reader entries and event names,
+// resize generations) lives here as free functions over a mapped
+// SharedHeader; the Node addon is built on the same functions, Writer and
+// Reader wrap them for everyone else. shm_image_c.h is the C ABI.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "platform.h"
+#include "shared_header.h"
+
+namespace shm_image {
+
+// components per pixel, reported as `channels`
+static const uint32_t PIXEL_FORMAT_CHANNELS[PIXEL_FORMAT_COUNT] = { 0, 4, 4, 3, 3, 1, 3, 3, 4 };
+
+struct FrameLayout {
+  uint32_t planes = 1;
+  uint32_t stride[SHARED_MAX_PLANES] = {};
+  uint32_t offset[SHARED_MAX_PLANES] = {};
+  uint64_t frameBytes = 0;
+};
+
+// --- Formats ---
+
+// Bytes per pixel of the first plane (the second plane of NV12/P010 has the
+// same bytes per pixel in half the rows); `channels` for PIXEL_FORMAT_UNKNOWN.
+uint32_t BytesPerPixel(uint32_t format, uint32_t channels);
+// Plane strides/offsets of a w x h frame, rows padded to `alignment`.
+FrameLayout ComputeLayout(uint32_t format, uint32_t w, uint32_t h, uint32_t channels, uint32_t alignment);
+// Fills in a format and its layout; c = 0 takes the format's channels.
+void MakeFormat(FrameFormat* f, uint32_t w, uint32_t h, uint32_t c, uint32_t format, uint32_t alignment);
+
+// Seqlock read of the format line: a copy no concurrent WriteFormat() tore,
+// and the format_seq it belongs to. *retries gets the attempts that were
+// torn. False if the producer kept rewriting it.
+bool ReadFormat(const SharedHeader* hdr, FrameFormat* out, uint32_t* seq, uint64_t* retries);
+// Producer: replaces the format under the seqlock. The next frame counts as
+// changed everywhere.
+void WriteFormat(SharedHeader* hdr, const FrameFormat& format);
+
+// --- Levels ---
+
+// Level `level` (1..SHARED_MAX_LEVELS) of a frame: the frame box-filtered to
+// 1/2^level its width and height (rounded down), packed rows, at `offset` in
+// the slot's level area behind levels 1..level-1 (each 64-byte aligned).
+struct LevelLayout {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t stride = 0;
+  uint64_t offset = 0;
+  uint64_t bytes = 0;
+};
+// False for formats without levels (planar or 16-bit ones) and levels that
+// would be less than a pixel wide or high.
+bool ComputeLevel(const FrameFormat& format, uint32_t level, LevelLayout* out);
+// Level area bytes levels 1..count of `format` take, 0 when it has none.
+uint64_t LevelBytes(const FrameFormat& format, uint32_t count);
+// Level area bytes per slot for frames up to `frameCapacity` bytes (any format
+// with levels), each level area `align`ed.
+uint64_t LevelCapacity(uint64_t frameCapacity, uint32_t count, uint32_t align);
+// Level area of `slot` in a view starting at `base`, nullptr when there is none.
+uint8_t* LevelData(void* base, size_t mapSize, const SharedHeader* hdr, uint32_t slot);
+
+// --- Names ---
+
+// The event every publish signals, and the one of reader entry `index`
+std::string SharedEventName(const std::string& mapName);
+std::string ReaderEventName(const std::string& mapName, int32_t index);
+// Mapping of resize generation `generation` (0 is the root itself)
+std::string GenerationName(const std::string& root, uint32_t generation);
+
+// --- Ring ---
+
+struct RingLayout {
+  uint32_t slots = SHARED_DEFAULT_SLOTS;
+  uint32_t slotCapacity = 0;  // usable bytes per slot
+  uint32_t slotReserve = 0;   // bytes between slots, >= slotCapacity
+  uint64_t slotsOffset = 0;   // first slot, from the mapping base
+  uint64_t mappingSize = 0;
+  uint32_t pageSize = 0;
+};
+
+// Sets up a fresh header at `hdr`, every field `ring` doesn't cover zeroed
+// (no tile table, no compression areas, generation 0).
+void InitHeader(SharedHeader* hdr, const FrameFormat& format, const RingLayout& ring);
+// Checks a header someone else set up. False (with *error) for a foreign
+// mapping, another protocol version or a stream container.
+bool CheckHeader(const void* base, size_t mapSize, std::string* error);
+
+// Slots the header describes, 0 for a view too small or a bad count.
+uint32_t SlotCount(const SharedHeader* hdr, size_t viewSize);
+// Data of `slot` in a view starting at `base`, nullptr when it lies outside.
+uint8_t* SlotData(void* base, size_t mapSize, const SharedHeader* hdr, uint32_t slot);
+// Commits `capacity` bytes of every slot in a reserved view.
+void CommitSlots(platform::Mapping* mapping, const SharedHeader* hdr, uint32_t capacity);
+
+// Producer: the slot to fill next, owned (seq odd) on return. Never the
+// latest published one, a pinned one, one a blocking lossless reader has yet
+// to read or one still in a pipeline, otherwise the least recently
+// published. -1 when every candidate is taken.
+int32_t AcquireWriteSlot(SharedHeader* hdr, uint32_t slotCount);
+// Producer: publishes the acquired `slot` holding `frameBytes` bytes (to the
+// first stage of a pipeline). The caller wakes the readers (NotifyReaders()).
+void PublishSlot(SharedHeader* hdr, int32_t slot, uint32_t frameBytes, uint64_t captureNs, uint32_t gpuFlags);
+
+// Reader: pins the latest published slot (*slot = -1 before the first
+// publish), booked on reader entry `readerIndex` (-1 = none) so a crashed
+// reader's pins can be undone. False when the producer kept refilling it.
+bool PinLatestSlot(SharedHeader* hdr, uint32_t slotCount, int32_t readerIndex, int32_t* slot, uint64_t* retries);
+// Reader: pins the oldest published slot past frame `after` and up to frame
+// `until` (lossless reads, pipeline stages), *slot = -1 when there is none.
+// False when the producer kept refilling it.
+bool PinNextSlot(SharedHeader* hdr, uint32_t slotCount, int32_t readerIndex, uint64_t after, uint64_t until,
+                 int32_t* slot, uint64_t* retries);
+// Reader: pins `slot` whatever it holds, false while the producer refills it.
+// The caller checks its frame_index after pinning (batch reads of the ring).
+bool PinSlot(SharedHeader* hdr, int32_t readerIndex, int32_t slot);
+void UnpinSlot(SharedHeader* hdr, int32_t readerIndex, int32_t slot);
+
+// --- Readers ---
+
+// Claims a reader entry (a free one, or one of a dead process) and creates
+// its event. Returns the index, -1 when the table is full.
+int32_t AttachReader(SharedHeader* hdr, const std::string& mapName, bool wantCompressed, platform::Event** event);
+void DetachReader(SharedHeader* hdr, int32_t index);
+// Whether the process owning `reader` may still be running (by its pid and
+// owner token).
+bool ReaderAlive(const ReaderDesc& reader);
+void ReleaseReaderPins(SharedHeader* hdr, ReaderDesc* reader);
+// Producer: wakes every attached reader running pipeline stage `stage` once
+// (0: the plain readers, plus whoever waits on `shared`). `readerEvents`
+// (SHARED_MAX_READERS entries) caches the reader events, they are opened on
+// first use.
+void NotifyReaders(SharedHeader* hdr, const std::string& mapName, platform::Event* shared, platform::Event** readerEvents,
+                   uint32_t stage);
+
+// --- Pipelines ---
+// Stages are 1-based, stage s is hdr->stages[s - 1]. A process runs a stage
+// through a reader entry of its own (ReaderDesc::stage), which books its pins
+// and gets it woken when the stage before releases a frame.
+
+// The stage called `name`, 0 when the pipeline has none.
+uint32_t FindStage(const SharedHeader* hdr, const std::string& name);
+// Makes reader entry `readerIndex` the one running `stage` (and sets its
+// ReaderDesc::stage), false while another attached, live entry runs it.
+bool ClaimStage(SharedHeader* hdr, uint32_t stage, int32_t readerIndex);
+void LeaveStage(SharedHeader* hdr, uint32_t stage, int32_t readerIndex);
+// The process running `stage`, 0 for none.
+uint32_t StagePid(const SharedHeader* hdr, uint32_t stage);
+// The newest frame `stage` may take: the last one the stage before released,
+// the latest published one for the first stage.
+uint64_t StageInput(const SharedHeader* hdr, uint32_t stage);
+// The last frame through every stage, UINT64_MAX without a pipeline.
+uint64_t PipelineIndex(const SharedHeader* hdr);
+// Moves `stage`'s cursor on to the frame in (pinned) `slot`, `busyNs` after
+// acquiring it; the last stage publishes it to the readers. The caller
+// unpins the slot and wakes the next stage.
+void ReleaseStage(SharedHeader* hdr, uint32_t stage, int32_t slot, uint64_t busyNs);
+
+// --- Clients ---
+
+struct WriterOptions {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t channels = 0;          // 0 = the format's
+  uint32_t pixelFormat = PIXEL_FORMAT_BGRA8;
+  uint32_t alignment = 1;         // row alignment, a power of two up to 4096
+  uint32_t slots = SHARED_DEFAULT_SLOTS;
+  uint64_t frameCapacity = 0;     // bytes per slot, 0 = the format's frame size
+};
+
+// Producer on a mapping of its own (or one set up with the same protocol).
+// Not thread safe.
+class Writer {
+public:
+  ~Writer() { close(); }
+
+  bool open(const std::string& name, const WriterOptions& options, std::string* error);
+  void close();
+
+  // False when the format doesn't fit the slots.
+  bool setFormat(uint32_t w, uint32_t h, uint32_t pixelFormat, uint32_t alignment);
+  FrameFormat format() const { return hdr_ ? hdr_->format : FrameFormat(); }
+  uint32_t capacity() const { return hdr_ ? hdr_->slot_capacity.load(std::memory_order_relaxed) : 0; }
+  // The slot the next frame goes into, the same one until publish();
+  // nullptr while every slot is pinned by readers.
+  uint8_t* frameBuffer();
+  // Publishes frameBuffer() holding `frameBytes` (0 = the format's frame size).
+  bool publish(uint32_t frameBytes, uint64_t captureNs);
+  SharedHeader* header() { return hdr_; }
+
+private:
+  platform::Mapping mapping_;
+  SharedHeader* hdr_ = nullptr;
+  std::string name_;
+  platform::Event* event_ = nullptr;
+  platform::Event* readerEvents_[SHARED_MAX_READERS] = {};
+  int32_t writeSlot_ = -1;
+};
+
+// Reader::read(): a new frame that is only in its slot's texture (FRAME_NO_CPU).
+constexpr int64_t kReadGpuOnly = -2;
+
+struct FrameInfo {
+  uint64_t frameIndex = 0;
+  uint64_t captureNs = 0;
+  uint64_t publishNs = 0;
+  uint32_t frameSize = 0;
+  uint32_t gpuFlags = 0;
+  FrameFormat format = {};
+};
+
+// Consumer with a reader entry of its own; follows the producer into new
+// generations when it resizes. Not thread safe.
+class Reader {
+public:
+  ~Reader() { close(); }
+
+  // Opens an existing mapping, false when there is none (yet).
+  bool open(const std::string& name, std::string* error);
+  void close();
+
+  // Waits until a frame newer than the last read() one is out (true), or
+  // `timeoutMs` passed.
+  bool wait(uint32_t timeoutMs);
+  // Copies the latest frame into dst. Returns its size, 0 when there is no
+  // new frame, -1 on contention or when dst is too small (info->frameSize
+  // then says how big it has to be), kReadGpuOnly for a new frame published
+  // GPU only (info filled, nothing copied). A frame written under a format
+  // setFormat() has replaced since is skipped as dropped: 0.
+  int64_t read(void* dst, size_t capacity, FrameInfo* info);
+  SharedHeader* header() { return hdr_; }
+
+private:
+  bool follow();
+  bool attach(platform::Mapping* mapping, const std::string& name);
+
+  std::string root_;
+  platform::Mapping rootMapping_;  // generation 0, it knows the newest one
+  platform::Mapping mapping_;
+  SharedHeader* hdr_ = nullptr;
+  uint32_t committed_ = 0;
+  int32_t index_ = -1;
+  platform::Event* event_ = nullptr;
+  uint64_t lastIndex_ = 0;
+};
+
+}  // namespace shm_image
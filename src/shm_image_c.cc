@@ -0,0 +1,132 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#define SHMI_BUILDING
+#include "shm_image_c.h"
+#include "shm_image.h"
+
+struct shmi_writer { shm_image::Writer impl; };
+struct shmi_reader { shm_image::Reader impl; };
+static_assert(SHMI_READ_GPU_ONLY == shm_image::kReadGpuOnly, "read results");
+
+static thread_local std::string lastError;
+
+static int Fail(const char* message) {
+  lastError = message;
+  return 0;
+}
+
+extern "C" {
+
+shmi_writer* shmi_writer_open(const char* name, uint32_t width, uint32_t height, uint32_t pixel_format,
+                              uint32_t slots, uint64_t frame_capacity) {
+  if (!name) {
+    Fail("name is NULL");
+    return nullptr;
+  }
+  shm_image::WriterOptions options;
+  options.width = width;
+  options.height = height;
+  options.pixelFormat = pixel_format;
+  options.slots = slots ? slots : SHARED_DEFAULT_SLOTS;
+  options.frameCapacity = frame_capacity;
+  shmi_writer* writer = new shmi_writer();
+  if (!writer->impl.open(name, options, &lastError)) {
+    delete writer;
+    return nullptr;
+  }
+  return writer;
+}
+
+void shmi_writer_close(shmi_writer* writer) { delete writer; }
+
+int shmi_writer_set_format(shmi_writer* writer, uint32_t width, uint32_t height, uint32_t pixel_format, uint32_t row_alignment) {
+  if (!writer) return Fail("writer is NULL");
+  if (!writer->impl.setFormat(width, height, pixel_format, row_alignment ? row_alignment : 1)) {
+    return Fail("Invalid format, or it does not fit the slot capacity");
+  }
+  return 1;
+}
+
+void* shmi_writer_frame_buffer(shmi_writer* writer, uint32_t* capacity) {
+  if (!writer) {
+    Fail("writer is NULL");
+    return nullptr;
+  }
+  uint8_t* buffer = writer->impl.frameBuffer();
+  if (!buffer) Fail("Every slot is in use");
+  if (capacity) *capacity = buffer ? writer->impl.capacity() : 0;
+  return buffer;
+}
+
+int shmi_writer_publish(shmi_writer* writer, uint32_t frame_size, uint64_t capture_ns) {
+  if (!writer) return Fail("writer is NULL");
+  if (!writer->impl.publish(frame_size, capture_ns)) return Fail("No frame buffer to publish, or the frame does not fit");
+  return 1;
+}
+
+shmi_reader* shmi_reader_open(const char* name) {
+  if (!name) {
+    Fail("name is NULL");
+    return nullptr;
+  }
+  shmi_reader* reader = new shmi_reader();
+  if (!reader->impl.open(name, &lastError)) {
+    delete reader;
+    return nullptr;
+  }
+  return reader;
+}
+
+void shmi_reader_close(shmi_reader* reader) { delete reader; }
+
+int shmi_reader_wait(shmi_reader* reader, uint32_t timeout_ms) {
+  if (!reader) return Fail("reader is NULL");
+  return reader->impl.wait(timeout_ms) ? 1 : 0;
+}
+
+int64_t shmi_reader_read(shmi_reader* reader, void* dst, size_t capacity, shmi_frame_info* info) {
+  if (!reader) {
+    Fail("reader is NULL");
+    return -1;
+  }
+  shm_image::FrameInfo frame;
+  int64_t n = reader->impl.read(dst, capacity, &frame);
+  if (n == -1) Fail(frame.frameSize > capacity ? "Buffer too small" : "Read contention");
+  if (info) {
+    info->frame_index = frame.frameIndex;
+    info->capture_ns = frame.captureNs;
+    info->publish_ns = frame.publishNs;
+    info->frame_size = frame.frameSize;
+    info->width = frame.format.width;
+    info->height = frame.format.height;
+    info->pixel_format = frame.format.pixel_format;
+    info->plane_count = frame.format.plane_count;
+    for (int i = 0; i < 2; i++) {
+      info->plane_stride[i] = frame.format.plane_stride[i];
+      info->plane_offset[i] = frame.format.plane_offset[i];
+    }
+  }
+  return n;
+}
+
+int shmi_thread_set_latency(int realtime, const char* task, int priority, uint64_t cores, int timer_resolution) {
+  static thread_local platform::ThreadLatencyState state;
+  platform::ThreadLatency latency;
+  latency.realtime = realtime != 0;
+  if (task && *task) latency.task = task;
+  if (priority > 0) latency.priority = priority;
+  latency.cores = cores;
+  latency.timerResolution = timer_resolution != 0;
+  return platform::SetThreadLatency(latency, &state, &lastError) ? 1 : 0;
+}
+
+uint64_t shmi_now_ns(void) { return platform::MonotonicNs(); }
+
+const char* shmi_last_error(void) { return lastError.c_str(); }
+
+}  // extern "C"
@@ -0,0 +1,96 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+/* C ABI of the shm_image client library, for producers and consumers in
+   other languages and toolchains. Handles are opaque; functions returning
+   int give 1 on success and 0 on failure, shmi_last_error() says why (per
+   thread). Pixel formats are the PIXEL_FORMAT_* values of shared_header.h:
+   1 bgra8, 2 rgba8, 3 bgr8, 4 rgb8, 5 gray8, 6 nv12, 7 p010, 8 rgba16f. */
+
+#ifndef SHM_IMAGE_C_H
+#define SHM_IMAGE_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(SHMI_SHARED)
+#  if defined(SHMI_BUILDING)
+#    define SHMI_API __declspec(dllexport)
+#  else
+#    define SHMI_API __declspec(dllimport)
+#  endif
+#elif defined(SHMI_SHARED)
+#  define SHMI_API __attribute__((visibility("default")))
+#else
+#  define SHMI_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shmi_writer shmi_writer;
+typedef struct shmi_reader shmi_reader;
+
+typedef struct shmi_frame_info {
+  uint64_t frame_index;
+  uint64_t capture_ns;   /* 0 = none */
+  uint64_t publish_ns;   /* shmi_now_ns() clock */
+  uint32_t frame_size;
+  uint32_t width;
+  uint32_t height;
+  uint32_t pixel_format;
+  uint32_t plane_count;
+  uint32_t plane_stride[2];
+  uint32_t plane_offset[2];
+} shmi_frame_info;
+
+/* Opens (creates) mapping `name` with `slots` ring slots (0 = 3) for frames
+   of width x height in `pixel_format`; frame_capacity > 0 sizes the slots
+   for larger formats later. NULL on failure. */
+SHMI_API shmi_writer* shmi_writer_open(const char* name, uint32_t width, uint32_t height, uint32_t pixel_format,
+                                       uint32_t slots, uint64_t frame_capacity);
+SHMI_API void shmi_writer_close(shmi_writer* writer);
+SHMI_API int shmi_writer_set_format(shmi_writer* writer, uint32_t width, uint32_t height, uint32_t pixel_format,
+                                    uint32_t row_alignment);
+/* The slot buffer to write the next frame into (*capacity bytes), the same
+   until shmi_writer_publish(). NULL while readers pin every slot. */
+SHMI_API void* shmi_writer_frame_buffer(shmi_writer* writer, uint32_t* capacity);
+/* frame_size 0 = the current format's frame size */
+SHMI_API int shmi_writer_publish(shmi_writer* writer, uint32_t frame_size, uint64_t capture_ns);
+
+/* Opens an existing mapping as a reader. NULL on failure. */
+SHMI_API shmi_reader* shmi_reader_open(const char* name);
+SHMI_API void shmi_reader_close(shmi_reader* reader);
+/* 1 once a frame newer than the last one read is published, 0 on timeout */
+SHMI_API int shmi_reader_wait(shmi_reader* reader, uint32_t timeout_ms);
+/* Copies the latest frame into dst: its size, 0 when there is no new frame,
+   -1 on contention or when dst is too small (info->frame_size is the size
+   needed), SHMI_READ_GPU_ONLY for a new frame published GPU only (nothing
+   copied). A frame written under a format since replaced is skipped as
+   dropped (0). info may be NULL. */
+#define SHMI_READ_GPU_ONLY (-2)
+SHMI_API int64_t shmi_reader_read(shmi_reader* reader, void* dst, size_t capacity, shmi_frame_info* info);
+
+/* Asks the scheduler for bounded latency on the calling thread, e.g. the one
+   in shmi_reader_wait(). realtime registers it with MMCSS under `task` (NULL
+   = "Pro Audio") on Windows, SCHED_FIFO at `priority` (0 = 10) on Linux;
+   cores is an affinity mask (bit i = core i, 0 = any); timer_resolution
+   holds the 1 ms system timer on Windows. A call replaces what the thread
+   had, all zeros puts it back (do that before the thread exits). 0 when the
+   OS refused some of it, the rest still holds. */
+SHMI_API int shmi_thread_set_latency(int realtime, const char* task, int priority, uint64_t cores,
+                                     int timer_resolution);
+
+SHMI_API uint64_t shmi_now_ns(void);
+SHMI_API const char* shmi_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHM_IMAGE_C_H */
@@ -0,0 +1,106 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+#include "worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace workers {
+
+// past a few threads a copy is bound by memory bandwidth anyway
+static const uint32_t MAX_WORKERS = 7;
+
+struct Pool {
+  std::mutex runMutex;     // one job at a time
+  std::mutex mutex;        // guards everything below
+  std::condition_variable wakeCv;
+  std::condition_variable doneCv;
+  const std::function<void(uint32_t)>* job = nullptr;
+  uint32_t parts = 0;
+  std::atomic<uint32_t> next{0};
+  uint32_t finished = 0;   // parts done
+  uint32_t active = 0;     // workers inside the current job
+  uint64_t generation = 0; // bumped per job
+  std::vector<std::thread> threads;
+};
+
+// helper: picks parts until there are none left
+static void Drain(Pool* pool, const std::function<void(uint32_t)>* fn, uint32_t parts) {
+  for (uint32_t p; (p = pool->next.fetch_add(1, std::memory_order_relaxed)) < parts;) {
+    (*fn)(p);
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if (++pool->finished == parts) pool->doneCv.notify_all();
+  }
+}
+
+static void WorkerLoop(Pool* pool) {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  for (;;) {
+    pool->wakeCv.wait(lock, [&] { return pool->generation != seen && pool->job; });
+    seen = pool->generation;
+    const std::function<void(uint32_t)>* fn = pool->job;
+    uint32_t parts = pool->parts;
+    pool->active++;
+    lock.unlock();
+    Drain(pool, fn, parts);
+    lock.lock();
+    // Run() waits for us to leave, so `fn` never outlives its job
+    if (--pool->active == 0) pool->doneCv.notify_all();
+  }
+}
+
+// The pool is never torn down: its threads sleep on wakeCv until the
+// process exits.
+static Pool* GetPool() {
+  static Pool* pool = [] {
+    Pool* p = new Pool();
+    uint32_t hw = std::thread::hardware_concurrency();
+    uint32_t n = hw > 1 ? std::min(hw - 1, MAX_WORKERS) : 0;
+    for (uint32_t i = 0; i < n; i++) {
+      p->threads.emplace_back(WorkerLoop, p);
+      p->threads.back().detach();
+    }
+    return p;
+  }();
+  return pool;
+}
+
+uint32_t Concurrency() {
+  return (uint32_t)GetPool()->threads.size() + 1;
+}
+
+void Run(uint32_t parts, const std::function<void(uint32_t)>& fn) {
+  Pool* pool = parts > 1 ? GetPool() : nullptr;
+  std::unique_lock<std::mutex> run;
+  if (pool && !pool->threads.empty()) run = std::unique_lock<std::mutex>(pool->runMutex, std::try_to_lock);
+  if (!run.owns_lock()) {
+    for (uint32_t p = 0; p < parts; p++) fn(p);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->job = &fn;
+    pool->parts = parts;
+    pool->next.store(0, std::memory_order_relaxed);
+    pool->finished = 0;
+    pool->generation++;
+  }
+  pool->wakeCv.notify_all();
+  Drain(pool, &fn, parts);
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->doneCv.wait(lock, [&] { return pool->finished == parts && pool->active == 0; });
+  pool->job = nullptr;
+}
+
+}  // namespace workers
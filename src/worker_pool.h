@@ -0,0 +1,27 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Small persistent worker pool for splitting one big copy (or conversion)
+// across cores. One process-wide pool, started on first use; a job is a
+// number of parts the workers and the calling thread pick off together.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace workers {
+
+// Runs fn(part) for every part in [0, parts) on the pool and the calling
+// thread, returns once all of them ran. While another thread's job holds the
+// pool the caller runs its parts alone.
+void Run(uint32_t parts, const std::function<void(uint32_t)>& fn);
+
+// Threads a Run() can use, the caller included (1 without a pool).
+uint32_t Concurrency();
+
+}  // namespace workers
@@ -0,0 +1,270 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// Round trips through the frame codecs (src/codec.cc): every frame QOI or
+// LZ4 compresses has to come back byte for byte, and the streams have to be
+// ones any QOI / LZ4 decoder takes. Exits non-zero on the first failure.
+//
+//   codec_test
+
+#include "../src/codec.h"
+#include "../src/shm_image.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                    \
+  do {                                                      \
+    if (!(cond)) {                                          \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+      fprintf(stderr, __VA_ARGS__);                         \
+      fprintf(stderr, "\n");                                \
+      failures++;                                           \
+    }                                                       \
+  } while (0)
+
+// xorshift, so the noise is the same on every run
+static uint32_t Random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static FrameFormat Format(uint32_t pixelFormat, uint32_t w, uint32_t h, uint32_t stride) {
+  FrameFormat f;
+  shm_image::MakeFormat(&f, w, h, 0, pixelFormat, 1);
+  if (stride) f.plane_stride[0] = stride;
+  return f;
+}
+
+// --- QOI ---
+
+// helper: compresses `frame` of `fmt`, decompresses it and compares the
+// packed rows (QOI drops the row padding)
+static void QoiRoundTrip(const char* what, const FrameFormat& fmt, const std::vector<uint8_t>& frame) {
+  CHECK(codec::Pick(fmt) == CODEC_QOI, "%s: picked %s", what, codec::Name(codec::Pick(fmt)));
+  std::vector<uint8_t> packed((size_t)codec::Bound(frame.size()));
+  size_t size = codec::Compress(CODEC_QOI, fmt, frame.data(), (uint32_t)frame.size(), packed.data(), packed.size());
+  CHECK(size > 0, "%s: didn't compress", what);
+  if (!size) return;
+
+  uint32_t bpp = shm_image::BytesPerPixel(fmt.pixel_format, fmt.channels);
+  size_t rowBytes = (size_t)fmt.width * bpp;
+  CHECK(codec::DecompressedSize(CODEC_QOI, packed.data(), size, 0) == rowBytes * fmt.height, "%s: size", what);
+  std::vector<uint8_t> out(rowBytes * fmt.height);
+  bool swap = fmt.pixel_format == PIXEL_FORMAT_BGRA8 || fmt.pixel_format == PIXEL_FORMAT_BGR8;
+  CHECK(codec::Decompress(CODEC_QOI, packed.data(), size, swap, out.data(), out.size()), "%s: didn't decompress", what);
+  for (uint32_t y = 0; y < fmt.height; y++) {
+    if (memcmp(out.data() + y * rowBytes, frame.data() + (size_t)y * fmt.plane_stride[0], rowBytes) != 0) {
+      CHECK(false, "%s: row %u differs", what, y);
+      return;
+    }
+  }
+}
+
+// helper: a w x h frame of `fmt`, one row colour per `runs` pixels, the row
+// padding filled with noise QOI must not pick up
+static std::vector<uint8_t> RunFrame(const FrameFormat& fmt, uint32_t runs, uint32_t* seed) {
+  uint32_t bpp = shm_image::BytesPerPixel(fmt.pixel_format, fmt.channels);
+  std::vector<uint8_t> frame((size_t)fmt.plane_stride[0] * fmt.height);
+  for (uint8_t& b : frame) b = (uint8_t)Random(seed);
+  uint32_t colour = 0;
+  for (uint32_t y = 0; y < fmt.height; y++) {
+    for (uint32_t x = 0; x < fmt.width; x++) {
+      if ((y * fmt.width + x) % runs == 0) colour = Random(seed);
+      uint8_t* p = frame.data() + (size_t)y * fmt.plane_stride[0] + (size_t)x * bpp;
+      memcpy(p, &colour, bpp);
+    }
+  }
+  return frame;
+}
+
+static void TestQoi() {
+  uint32_t seed = 42;
+
+  // one RGB pixel (1, 2, 3) after the implicit (0, 0, 0, 255): QOI_OP_LUMA
+  {
+    FrameFormat fmt = Format(PIXEL_FORMAT_RGB8, 1, 1, 0);
+    const uint8_t pixel[3] = { 1, 2, 3 };
+    const uint8_t expected[] = { 'q', 'o', 'i', 'f', 0, 0, 0, 1, 0, 0, 0, 1, 3, 0, 0xa2, 0x79, 0, 0, 0, 0, 0, 0, 0, 1 };
+    uint8_t packed[64];
+    size_t size = codec::Compress(CODEC_QOI, fmt, pixel, 3, packed, sizeof(packed));
+    CHECK(size == sizeof(expected) && memcmp(packed, expected, size) == 0, "1x1 RGB: %zu bytes", size);
+  }
+
+  // runs: 62 is the longest QOI_OP_RUN, one more needs a second op
+  for (uint32_t run : { 1u, 61u, 62u, 63u, 124u, 125u }) {
+    FrameFormat fmt = Format(PIXEL_FORMAT_RGBA8, run, 1, 0);
+    std::vector<uint8_t> frame((size_t)run * 4, 0);
+    for (uint32_t x = 0; x < run; x++) frame[x * 4 + 3] = 255; // the implicit previous pixel throughout
+    std::vector<uint8_t> packed((size_t)codec::Bound(frame.size())); // room for the worst case, or it won't start
+    size_t size = codec::Compress(CODEC_QOI, fmt, frame.data(), (uint32_t)frame.size(), packed.data(), packed.size());
+    size_t ops = (run + 61) / 62;
+    CHECK(size == 14 + ops + 8, "run of %u: %zu bytes", run, size);
+    CHECK(size && packed[14] == (run >= 62 ? 0xfd : (uint8_t)(0xc0 | (run - 1))), "run of %u: op %02x", run, packed[14]);
+    char what[32];
+    snprintf(what, sizeof(what), "run of %u", run);
+    QoiRoundTrip(what, fmt, frame);
+  }
+
+  // every pixel format QOI takes, packed and with row padding, over runs of
+  // every length around 62, index hits and noise
+  for (uint32_t pf : { PIXEL_FORMAT_BGRA8, PIXEL_FORMAT_RGBA8, PIXEL_FORMAT_BGR8, PIXEL_FORMAT_RGB8 }) {
+    for (uint32_t pad : { 0u, 1u, 13u, 64u }) {
+      uint32_t w = 97, h = 31;
+      uint32_t bpp = shm_image::BytesPerPixel(pf, 0);
+      FrameFormat fmt = Format(pf, w, h, w * bpp + pad);
+      for (uint32_t runs : { 1u, 2u, 61u, 62u, 63u, 200u }) {
+        char what[64];
+        snprintf(what, sizeof(what), "format %u, padding %u, runs of %u", pf, pad, runs);
+        QoiRoundTrip(what, fmt, RunFrame(fmt, runs, &seed));
+      }
+    }
+  }
+
+  // alpha changes (QOI_OP_RGBA) and small steps (QOI_OP_DIFF / QOI_OP_LUMA)
+  {
+    FrameFormat fmt = Format(PIXEL_FORMAT_RGBA8, 256, 4, 0);
+    std::vector<uint8_t> frame(256 * 4 * 4);
+    for (size_t i = 0; i < frame.size(); i++) frame[i] = (uint8_t)(i / 4 * (i % 4 == 3 ? 7 : 1) + (Random(&seed) & 3));
+    QoiRoundTrip("gradients", fmt, frame);
+  }
+
+  // a frame that doesn't fit the capacity is turned down, not overrun
+  {
+    FrameFormat fmt = Format(PIXEL_FORMAT_RGB8, 64, 64, 0);
+    std::vector<uint8_t> frame(64 * 64 * 3);
+    for (uint8_t& b : frame) b = (uint8_t)Random(&seed);
+    std::vector<uint8_t> packed(frame.size());
+    CHECK(codec::Compress(CODEC_QOI, fmt, frame.data(), (uint32_t)frame.size(), packed.data(), packed.size()) == 0,
+          "noise fit in its own size");
+  }
+}
+
+// --- LZ4 ---
+
+// helper: walks an LZ4 block, true when it keeps the format's end-of-block
+// rules: the last sequence is literals only, at least LASTLITERALS (5) of
+// them, and the last match starts at least MFLIMIT (12) bytes before the end
+static bool Lz4Conforms(const uint8_t* p, size_t size, size_t rawBytes) {
+  const uint8_t* end = p + size;
+  size_t o = 0, lastMatch = 0;
+  bool matched = false;
+  while (p < end) {
+    uint8_t token = *p++;
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do { if (p >= end) return false; b = *p++; literals += b; } while (b == 255);
+    }
+    if ((size_t)(end - p) < literals) return false;
+    p += literals;
+    o += literals;
+    if (p == end) {
+      if (rawBytes >= 13 && literals < 5) return false;
+      break;
+    }
+    if (end - p < 2) return false;
+    p += 2;
+    size_t match = (token & 15) + 4;
+    if ((token & 15) == 15) {
+      uint8_t b;
+      do { if (p >= end) return false; b = *p++; match += b; } while (b == 255);
+    }
+    lastMatch = o;
+    matched = true;
+    o += match;
+  }
+  return o == rawBytes && (!matched || lastMatch + 12 <= rawBytes);
+}
+
+static void Lz4RoundTrip(const char* what, const std::vector<uint8_t>& data) {
+  FrameFormat fmt = Format(PIXEL_FORMAT_NV12, 16, 16, 0);
+  CHECK(codec::Pick(fmt) == CODEC_LZ4, "%s: picked %s", what, codec::Name(codec::Pick(fmt)));
+  std::vector<uint8_t> packed((size_t)codec::Bound(data.size()));
+  size_t size = codec::Compress(CODEC_LZ4, fmt, data.data(), (uint32_t)data.size(), packed.data(), packed.size());
+  CHECK(size > 0, "%s: didn't compress", what);
+  if (!size) return;
+  CHECK(Lz4Conforms(packed.data(), size, data.size()), "%s: breaks the block format's end rules", what);
+  std::vector<uint8_t> out(data.size());
+  CHECK(codec::Decompress(CODEC_LZ4, packed.data(), size, false, out.data(), out.size()), "%s: didn't decompress", what);
+  CHECK(out == data, "%s: differs", what);
+}
+
+static void TestLz4() {
+  uint32_t seed = 7;
+
+  // all the sizes around the end-of-block limits, compressible and not
+  for (size_t n = 1; n <= 80; n++) {
+    std::vector<uint8_t> same(n, 'a'), noise(n), pattern(n);
+    for (size_t i = 0; i < n; i++) {
+      noise[i] = (uint8_t)Random(&seed);
+      pattern[i] = (uint8_t)("abcabcabd"[i % 9]);
+    }
+    char what[48];
+    snprintf(what, sizeof(what), "%zu same bytes", n);
+    Lz4RoundTrip(what, same);
+    snprintf(what, sizeof(what), "%zu noise bytes", n);
+    Lz4RoundTrip(what, noise);
+    snprintf(what, sizeof(what), "%zu pattern bytes", n);
+    Lz4RoundTrip(what, pattern);
+  }
+
+  // 20 'a': one literal, a 14 byte overlapping match, the last 5 as literals
+  {
+    std::vector<uint8_t> data(20, 'a');
+    const uint8_t expected[] = { 0x1a, 'a', 0x01, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+    uint8_t packed[64];
+    size_t size = codec::Compress(CODEC_LZ4, FrameFormat(), data.data(), 20, packed, sizeof(packed));
+    CHECK(size == sizeof(expected) && memcmp(packed, expected, size) == 0, "20 'a': %zu bytes", size);
+  }
+
+  // literal and match lengths past 15 and 15 + 255, offsets up to 65535
+  {
+    std::vector<uint8_t> data;
+    for (int i = 0; i < 300; i++) data.push_back((uint8_t)Random(&seed));
+    data.insert(data.end(), 1000, 0x11);
+    std::vector<uint8_t> far(70000);
+    for (uint8_t& b : far) b = (uint8_t)Random(&seed);
+    data.insert(data.end(), far.begin(), far.end());
+    data.insert(data.end(), far.begin(), far.begin() + 4000); // 70000 back: too far, literals
+    data.insert(data.end(), far.end() - 60000, far.end() - 56000); // within reach
+    Lz4RoundTrip("long runs", data);
+  }
+
+  // frame-like data: rows of a gradient with noise in the low bits
+  {
+    std::vector<uint8_t> data(1920 * 1080 * 3 / 2);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)((i % 1920) / 8 + (Random(&seed) & 1));
+    Lz4RoundTrip("NV12 frame", data);
+  }
+
+  // a stream pointing before its start or past its end is rejected
+  {
+    const uint8_t bad[] = { 0x10, 'a', 0x02, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' }; // offset 2 after 1 byte
+    uint8_t out[64];
+    CHECK(!codec::Decompress(CODEC_LZ4, bad, sizeof(bad), false, out, 10), "offset before the start taken");
+    const uint8_t good[] = { 0x1a, 'a', 0x01, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+    CHECK(!codec::Decompress(CODEC_LZ4, good, sizeof(good), false, out, 19), "output past the capacity taken");
+  }
+}
+
+int main() {
+  TestQoi();
+  TestLz4();
+  if (failures) {
+    fprintf(stderr, "codec_test: %d failed\n", failures);
+    return 1;
+  }
+  printf("codec_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,236 @@
+﻿/*
+    gon_iss (c) 2025
+
+    https://github.com/true-goniss/shared-memory-image
+
+*/
+
+// The ring protocol through the client library (shm_image::Writer / Reader)
+// on a real named mapping: publish/read, the cursor, pins the producer has
+// to skip, format changes, and torn-frame checks with the producer and the
+// readers on threads of their own. Exits non-zero on any failure.
+//
+//   ring_test
+
+#include "../src/platform.h"
+#include "../src/shm_image.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                    \
+  do {                                                      \
+    if (!(cond)) {                                          \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+      fprintf(stderr, __VA_ARGS__);                         \
+      fprintf(stderr, "\n");                                \
+      failures++;                                           \
+    }                                                       \
+  } while (0)
+
+static const uint32_t W = 64, H = 48;
+static const size_t FRAME = W * H * 4;
+
+static std::string Name(const char* what) {
+  return std::string("ring_test_") + what + "_" + std::to_string(platform::CurrentProcessId());
+}
+
+// helper: frame `stamp`, every byte the same so a torn one shows
+static bool Publish(shm_image::Writer* writer, uint8_t stamp) {
+  uint8_t* slot = writer->frameBuffer();
+  if (!slot) return false;
+  memset(slot, stamp, FRAME);
+  return writer->publish(0, 1000 + stamp);
+}
+
+static bool Uniform(const std::vector<uint8_t>& frame, size_t bytes, uint8_t* stamp) {
+  *stamp = frame[0];
+  for (size_t i = 1; i < bytes; i++) {
+    if (frame[i] != *stamp) return false;
+  }
+  return true;
+}
+
+static void TestPublishRead() {
+  shm_image::WriterOptions options;
+  options.width = W;
+  options.height = H;
+  shm_image::Writer writer;
+  shm_image::Reader reader;
+  std::string error;
+  std::string name = Name("read");
+  CHECK(writer.open(name, options, &error), "writer: %s", error.c_str());
+  CHECK(reader.open(name, &error), "reader: %s", error.c_str());
+  if (!writer.header() || !reader.header()) return;
+
+  std::vector<uint8_t> frame(FRAME);
+  shm_image::FrameInfo info;
+  CHECK(!reader.wait(0), "a frame before the first publish");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == 0, "read before the first publish");
+
+  CHECK(Publish(&writer, 7), "publish");
+  CHECK(reader.wait(0), "no frame after publish");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == (int64_t)FRAME, "read");
+  uint8_t stamp;
+  CHECK(Uniform(frame, FRAME, &stamp) && stamp == 7, "frame holds %u", stamp);
+  CHECK(info.frameIndex == 1 && info.captureNs == 1007 && info.publishNs, "frame %llu", (unsigned long long)info.frameIndex);
+  CHECK(info.format.width == W && info.format.height == H && info.format.pixel_format == PIXEL_FORMAT_BGRA8, "format");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == 0, "the same frame twice");
+  CHECK(!reader.wait(0), "a frame that was read already");
+
+  // latest-only: frames nobody read count as dropped on the reader entry
+  for (uint8_t i = 1; i <= 3; i++) CHECK(Publish(&writer, (uint8_t)(10 + i)), "publish %u", i);
+  CHECK(reader.read(frame.data(), frame.size(), &info) == (int64_t)FRAME && info.frameIndex == 4, "latest is %llu",
+        (unsigned long long)info.frameIndex);
+  CHECK(Uniform(frame, FRAME, &stamp) && stamp == 13, "latest holds %u", stamp);
+  uint64_t dropped = 0;
+  for (const ReaderDesc& r : reader.header()->readers) {
+    if (r.state.load() == READER_ATTACHED) dropped += r.frames_dropped.load();
+  }
+  CHECK(reader.header()->readers[0].state.load() == READER_ATTACHED, "the reader isn't entry 0");
+  CHECK(dropped == 2, "%llu dropped", (unsigned long long)dropped);
+
+  // a dst too small is turned down, saying how big it has to be
+  CHECK(Publish(&writer, 14), "publish");
+  CHECK(reader.read(frame.data(), 16, &info) == -1 && info.frameSize == FRAME, "read into 16 bytes");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == (int64_t)FRAME && info.frameIndex == 5, "read after a short dst");
+
+  // a new format reaches the next frame
+  CHECK(writer.setFormat(W / 2, H / 2, PIXEL_FORMAT_RGBA8, 1), "setFormat");
+  CHECK(Publish(&writer, 20), "publish after setFormat");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == (int64_t)(FRAME / 4), "read after setFormat");
+  CHECK(info.format.width == W / 2 && info.format.pixel_format == PIXEL_FORMAT_RGBA8, "format after setFormat");
+  CHECK(!writer.setFormat(W * 2, H * 2, PIXEL_FORMAT_RGBA8, 1), "a format past the slots taken");
+
+  // a frame whose format was replaced after it went out is skipped as dropped
+  CHECK(Publish(&writer, 21), "publish");
+  CHECK(writer.setFormat(W, H, PIXEL_FORMAT_BGRA8, 1), "setFormat");
+  uint64_t before = reader.header()->readers[0].frames_dropped.load();
+  CHECK(reader.wait(0), "no frame after publish");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == 0 && info.frameIndex == 7, "a frame under a replaced format");
+  CHECK(!reader.wait(0) && reader.read(frame.data(), frame.size(), &info) == 0, "the skipped frame came back");
+  CHECK(reader.header()->readers[0].frames_dropped.load() == before + 1, "the skipped frame isn't dropped");
+
+  // a frame published GPU only is new, but there is nothing to copy
+  SharedHeader* hdr = writer.header();
+  int32_t slot = shm_image::AcquireWriteSlot(hdr, hdr->slot_count);
+  CHECK(slot >= 0, "no slot");
+  if (slot >= 0) shm_image::PublishSlot(hdr, slot, (uint32_t)FRAME, 0, FRAME_GPU | FRAME_NO_CPU);
+  CHECK(reader.wait(0), "no frame after a GPU publish");
+  CHECK(reader.read(frame.data(), frame.size(), &info) == shm_image::kReadGpuOnly && info.frameIndex == 8 &&
+        info.frameSize == 0 && (info.gpuFlags & FRAME_NO_CPU), "a GPU only frame");
+  CHECK(!reader.wait(0) && reader.read(frame.data(), frame.size(), &info) == 0, "the GPU only frame twice");
+}
+
+static void TestPins() {
+  shm_image::WriterOptions options;
+  options.width = W;
+  options.height = H;
+  options.slots = 3;
+  shm_image::Writer writer;
+  std::string error;
+  CHECK(writer.open(Name("pins"), options, &error), "writer: %s", error.c_str());
+  SharedHeader* hdr = writer.header();
+  if (!hdr) return;
+
+  CHECK(Publish(&writer, 1), "publish");
+  int32_t pinned = -1;
+  uint64_t retries = 0;
+  CHECK(shm_image::PinLatestSlot(hdr, hdr->slot_count, -1, &pinned, &retries) && pinned >= 0, "pin");
+  // the producer goes round the other slots and leaves the pinned one be
+  for (uint8_t i = 2; i < 40; i++) {
+    int32_t slot = shm_image::AcquireWriteSlot(hdr, hdr->slot_count);
+    CHECK(slot >= 0 && slot != pinned, "frame %u went to slot %d, pinned %d", i, slot, pinned);
+    if (slot < 0) break;
+    shm_image::PublishSlot(hdr, slot, (uint32_t)FRAME, 0, 0);
+  }
+  CHECK(hdr->slots[pinned].frame_index.load() == 1, "the pinned slot was refilled");
+  shm_image::UnpinSlot(hdr, -1, pinned);
+
+  // with the slots other than the latest pinned there is nothing to write into
+  int32_t latest = hdr->latest_slot.load();
+  std::vector<int32_t> held;
+  for (int32_t s = 0; s < (int32_t)hdr->slot_count; s++) {
+    if (s == latest) continue;
+    CHECK(shm_image::PinSlot(hdr, -1, s), "pin slot %d", s);
+    held.push_back(s);
+  }
+  CHECK(writer.frameBuffer() == nullptr, "a slot with every other one pinned");
+  shm_image::UnpinSlot(hdr, -1, held.back());
+  CHECK(Publish(&writer, 50), "publish after an unpin");
+  CHECK(hdr->latest_slot.load() == held.back(), "published into slot %d", hdr->latest_slot.load());
+  held.pop_back();
+  for (int32_t s : held) shm_image::UnpinSlot(hdr, -1, s);
+}
+
+// Producer and readers on threads of their own, every frame one byte value
+// throughout: a reader that ever sees two values read a slot being refilled.
+static void TestTornFrames() {
+  shm_image::WriterOptions options;
+  options.width = W;
+  options.height = H;
+  options.slots = 3;
+  shm_image::Writer writer;
+  std::string error;
+  std::string name = Name("torn");
+  CHECK(writer.open(name, options, &error), "writer: %s", error.c_str());
+  if (!writer.header()) return;
+
+  const uint32_t readers = 3, count = 3000;
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> attached{0};
+  std::atomic<uint32_t> torn{0}, backwards{0}, frames{0};
+  std::vector<std::thread> threads;
+  for (uint32_t r = 0; r < readers; r++) {
+    threads.emplace_back([&]() {
+      shm_image::Reader reader;
+      std::string error;
+      bool opened = reader.open(name, &error);
+      attached++;
+      if (!opened) return;
+      std::vector<uint8_t> frame(FRAME);
+      uint64_t last = 0;
+      while (!stop.load()) {
+        if (!reader.wait(5)) continue;
+        shm_image::FrameInfo info;
+        int64_t n = reader.read(frame.data(), frame.size(), &info);
+        if (n <= 0) continue;
+        uint8_t stamp;
+        if (!Uniform(frame, (size_t)n, &stamp) || stamp != (uint8_t)info.frameIndex) torn++;
+        if (info.frameIndex <= last) backwards++;
+        last = info.frameIndex;
+        frames++;
+      }
+    });
+  }
+  while (attached.load() < readers) platform::YieldThread();
+
+  uint32_t published = 0;
+  while (published < count) {
+    if (Publish(&writer, (uint8_t)(published + 1))) published++;
+    else platform::YieldThread();
+  }
+  platform::SleepMs(20);
+  stop = true;
+  for (std::thread& t : threads) t.join();
+  CHECK(torn.load() == 0, "%u torn frames", torn.load());
+  CHECK(backwards.load() == 0, "%u frames out of order", backwards.load());
+  CHECK(frames.load() > 0, "nothing read");
+}
+
+int main() {
+  TestPublishRead();
+  TestPins();
+  TestTornFrames();
+  if (failures) {
+    fprintf(stderr, "ring_test: %d failed\n", failures);
+    return 1;
+  }
+  printf("ring_test: ok\n");
+  return 0;
+}
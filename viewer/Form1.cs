@@ -26,6 +26,9 @@ namespace shared_memory_viewer
         [DllImport("kernel32.dll", SetLastError = true)]
         static extern IntPtr VirtualQuery(IntPtr lpAddress, out MEMORY_BASIC_INFORMATION lpBuffer, UIntPtr dwLength);
 
+        [DllImport("kernel32.dll", SetLastError = true)]
+        static extern IntPtr VirtualAlloc(IntPtr lpAddress, UIntPtr dwSize, uint flAllocationType, uint flProtect);
+
         private long dataCapacity = 0;
 
         // Windows API
@@ -47,56 +50,232 @@ namespace shared_memory_viewer
         [DllImport("kernel32.dll", SetLastError = true)]
         static extern uint WaitForSingleObject(IntPtr hHandle, uint dwMilliseconds);
 
+        [DllImport("kernel32.dll", EntryPoint = "RtlMoveMemory")]
+        static extern void CopyMemory(IntPtr dest, IntPtr src, UIntPtr count);
+
+        [DllImport("avrt.dll", CharSet = CharSet.Unicode, SetLastError = true)]
+        static extern IntPtr AvSetMmThreadCharacteristics(string taskName, ref uint taskIndex);
+
+        [DllImport("avrt.dll", SetLastError = true)]
+        static extern bool AvRevertMmThreadCharacteristics(IntPtr avrtHandle);
+
+        [DllImport("winmm.dll")]
+        static extern uint timeBeginPeriod(uint uPeriod);
+
+        [DllImport("winmm.dll")]
+        static extern uint timeEndPeriod(uint uPeriod);
+
         // Constants
         const uint FILE_MAP_READ = 0x0004;
+        const uint FILE_MAP_LARGE_PAGES = 0x20000000;
         const uint EVENT_MODIFY_STATE = 0x0002;
         const uint SYNCHRONIZE = 0x00100000;
         const uint INFINITE = 0xFFFFFFFF;
         const uint WAIT_OBJECT_0 = 0;
         const uint WAIT_TIMEOUT = 0x102;
+        const uint MEM_COMMIT = 0x1000;
+        const uint MEM_RESERVE = 0x2000;
+        const uint PAGE_READONLY = 0x02;
 
+        // resize() moves the producer to <rootName>@<generation>, mapName is the one we read
+        private string rootName = "MySharedMemory";
         private string mapName = "MySharedMemory";
-        private string eventName = "Global\\SHM_EV_MySharedMemory";
+        private string eventName = "SHM_EV_MySharedMemory";
 
         const uint MAGIC = 0x5348444D; // 'SHDM'
-        const int HEADER_SIZE = 128;
+        const uint VERSION = 14;
+        const int HEADER_SIZE = 6400; // stage table included
+        const int NEXT_GENERATION_OFFSET = 168; // offset of SharedHeader.next_generation
+
+        // SharedHeader.pixel_format values the viewer can show
+        const uint PIXEL_FORMAT_UNKNOWN = 0; // packed RGB(A), `channels` bytes per pixel
+        const uint PIXEL_FORMAT_BGRA8 = 1;
+        const uint PIXEL_FORMAT_RGBA8 = 2;
+        const uint PIXEL_FORMAT_BGR8 = 3;
+        const uint PIXEL_FORMAT_RGB8 = 4;
+        const int MAX_PLANES = 2;
+        const int MAX_SLOTS = 8;
+        const int MAX_READERS = 16;
+        const int LATENCY_BUCKETS = 16;
+        const int FORMAT_SEQ_OFFSET = 64; // offset of SharedHeader.format_seq
+        const int SLOTS_OFFSET = 256;   // offset of SharedHeader.slots
+        const int SLOT_DESC_SIZE = 128;
+        // the fields the render loop reads every frame, see ReadFrameInfo()
+        const int SLOT_COUNT_OFFSET = 16, GENERATION_OFFSET = 40;
+        const int WIDTH_OFFSET = 68, HEIGHT_OFFSET = 72, CHANNELS_OFFSET = 76, PIXEL_FORMAT_OFFSET = 80, STRIDE_OFFSET = 92;
+        const int LATEST_SLOT_OFFSET = 136;
+        const int SLOT_FRAME_SIZE = 4, SLOT_FRAME_INDEX = 8, SLOT_OFFSET = 16, SLOT_FORMAT_SEQ = 40, SLOT_GPU_FLAGS = 44; // within a SlotDesc
+        const uint FRAME_NO_CPU = 2; // SlotDesc.gpu_flags: a GPU only frame, nothing to show
+
+        // Ring slot descriptor (same as node module): a producer line and a
+        // reader line, 64 bytes each
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        struct SlotDesc
+        {
+            public uint seq;
+            public uint frame_size;
+            public ulong frame_index;
+            public ulong offset;
+            public ulong publish_ns;
+            public ulong capture_ns;
+            public uint format_seq;
+            public uint gpu_flags;
+            public ulong compressed_index;
+            public uint compressed_size;
+            public uint codec;
+            public int readers;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 60)]
+            public byte[] reserved1;
+        }
+
+        // Reader registration entry (same as node module). The viewer maps the
+        // view read-only, so it does not register and waits on the shared event.
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        struct ReaderDesc
+        {
+            public int state;
+            public uint pid;
+            public ulong last_frame_index;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = MAX_SLOTS)]
+            public int[] pins;
+            public int event_word;
+            public uint want_compressed;
+            public uint lossless;
+            public uint stage;
+            // counters
+            public ulong frames_read;
+            public ulong frames_dropped;
+            public ulong retries;
+            public ulong spin_iterations;
+            public ulong wakeups;
+            public ulong timeouts;
+            public ulong latency_sum_ns;
+            public ulong latency_max_ns;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = LATENCY_BUCKETS)]
+            public uint[] latency_hist;
+            // owner: pid namespace and start time of `pid` (Linux producers only)
+            public ulong owner_ns;
+            public ulong owner_start;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 48)]
+            public byte[] reserved2;
+        }
 
-        // Header structure (same as node module)
+        // Header structure (same as node module), one 64-byte line per group
         [StructLayout(LayoutKind.Sequential, Pack = 1)]
         struct SharedHeader
         {
+            // fixed at create()
             public uint magic;
             public uint version;
-            public int seq;
+            public ulong mapping_size;
+            public uint slot_count;
+            public uint slot_capacity;
+            public uint page_size;
+            public uint tile_count;
+            public ulong tile_offset;
+            public uint generation;
+            public uint slot_reserve;
+            public ulong compress_offset;
+            public uint compress_capacity;
+            public uint stage_count; // pipeline: latest_slot only moves once a frame is through every stage
+            // format, odd format_seq while the producer rewrites it
+            public uint format_seq;
             public uint width;
             public uint height;
             public uint channels;
-            public uint frame_size;
+            public uint pixel_format;
+            public uint row_alignment;
+            public uint plane_count;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = MAX_PLANES)]
+            public uint[] plane_stride;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = MAX_PLANES)]
+            public uint[] plane_offset;
+            // downscaled levels, fixed at create()
+            public uint level_count;
+            public uint level_capacity;
+            public uint reserved1;
+            public ulong level_offset;
+            // per publish
             public ulong frame_index;
-            public ulong mapping_size;
-            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 48)]
-            public byte[] reserved;
+            public int latest_slot;
+            public uint frame_size;
+            public ulong ring_full;
+            public ulong pin_backoffs;
+            public ulong full_frame_index;
+            public uint next_generation;
+            public uint compress_skipped;
+            public ulong compressed_frames;
+            public ulong published_index;
+            // readers
+            public int event_word;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = 60)]
+            public byte[] reserved3;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = MAX_SLOTS)]
+            public SlotDesc[] slots;
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = MAX_READERS)]
+            public ReaderDesc[] readers;
         }
 
         private IntPtr hMap = IntPtr.Zero;
         private IntPtr baseAddress = IntPtr.Zero;
         private IntPtr hEvent = IntPtr.Zero;
+        // generation 0, kept once we moved off it: its header names the newest generation
+        private IntPtr hRootMap = IntPtr.Zero;
+        private IntPtr rootAddress = IntPtr.Zero;
+        private uint staleGeneration = 0; // gone by the time we tried to open it
+        private bool reservedView = false; // SEC_RESERVE producer ({ maxFrameSize }), slots are committed as they grow
         private PictureBox pictureBox;
         private Thread renderThread;
         private bool isRunning = false;
 
+        // What the render loop needs of the header, read field by field
+        // (Marshal.PtrToStructure of the whole header allocates every time)
+        struct FrameInfo
+        {
+            public uint formatSeq, width, height, channels, pixelFormat, stride;
+            public uint generation, nextGeneration;
+            public int slot;          // latest published slot, -1 for none
+            public uint seq, frameBytes, slotFormatSeq, gpuFlags;
+            public ulong frameIndex, offset;
+        }
+
+        // Frames are copied from the view straight into a pool of bitmaps: the
+        // one on screen and the one being filled. A frame arriving while the UI
+        // thread has not shown the previous one yet is dropped.
+        private readonly Bitmap[] bitmapPool = new Bitmap[2];
+        private int poolWidth, poolHeight;
+        private PixelFormat poolFormat;
+        private volatile Bitmap shownBitmap;  // set on the UI thread
+        private Bitmap readyBitmap;           // handed to PresentFrame()
+        private int presentPending = 0;       // 1 while a PresentFrame() is queued
+        private long droppedFrames = 0;
+        private readonly Action presentFrame; // cached, so a frame doesn't allocate a delegate
+        private readonly BitmapData lockData = new BitmapData();
+        private byte[] rowBuffer;             // one row, for the R/B swap
+
         // metadata
         private int width = 800;
         private int height = 600;
         private int channels = 3;
         private int stride;
+        private int bytesPerPixel = 3;
+        private bool swapRB = true; // RGB-ordered source, GDI wants BGR
 
         public Form1()
         {
             InitializeComponent();
             this.FormClosing += Form1_FormClosing;
+            presentFrame = PresentFrame;
 
-            this.Text = "Shared Memory Viewer";
+            // one viewer per stream: viewer.exe <mapping name>
+            string[] args = Environment.GetCommandLineArgs();
+            if (args.Length > 1)
+            {
+                rootName = mapName = args[1];
+                eventName = "SHM_EV_" + args[1];
+            }
+
+            this.Text = "Shared Memory Viewer - " + rootName;
             this.Size = new Size(800, 600);
 
             pictureBox = new PictureBox
@@ -135,6 +314,18 @@ namespace shared_memory_viewer
             Cleanup();
         }
 
+        // producers created with { largePages: true } need a large-page view,
+        // SEC_RESERVE ones ({ maxFrameSize }) the header committed in it
+        private static IntPtr MapView(IntPtr map)
+        {
+            IntPtr view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, UIntPtr.Zero);
+            if (view == IntPtr.Zero)
+                view = MapViewOfFile(map, FILE_MAP_READ | FILE_MAP_LARGE_PAGES, 0, 0, UIntPtr.Zero);
+            if (view != IntPtr.Zero)
+                VirtualAlloc(view, (UIntPtr)HEADER_SIZE, MEM_COMMIT, PAGE_READONLY);
+            return view;
+        }
+
         private bool InitializeSharedMemory()
         {
             // Open shared memory
@@ -146,7 +337,7 @@ namespace shared_memory_viewer
             }
 
             // Map view of file
-            baseAddress = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, UIntPtr.Zero);
+            baseAddress = MapView(hMap);
             if (baseAddress == IntPtr.Zero)
             {
                 MessageBox.Show($"Failed to map view of file: {Marshal.GetLastWin32Error()}", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
@@ -156,7 +347,7 @@ namespace shared_memory_viewer
             }
 
             // Open notify event
-            hEvent = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, false, eventName);
+            hEvent = OpenNotifyEvent(eventName);
             if (hEvent == IntPtr.Zero)
             {
                 // Ain't fatal
@@ -170,27 +361,116 @@ namespace shared_memory_viewer
                 MessageBox.Show("Invalid magic in shared memory header", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
                 return false;
             }
+            if (header.version != VERSION)
+            {
+                MessageBox.Show($"Unsupported shared memory header version {header.version}", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
+                return false;
+            }
+
+            // the producer may have resized already
+            uint next = NextGeneration(header.generation, header.next_generation);
+            if (next != 0 && FollowGeneration(next)) header = ReadHeader();
 
             width = (int)header.width;
             height = (int)header.height;
             channels = (int)header.channels;
-            stride = width * channels;
+            UpdateLayout(header.pixel_format, header.channels, header.plane_stride != null ? header.plane_stride[0] : 0);
 
             return true;
         }
 
+        // the producer's event lives in Global\ when it runs as a service, else in the session
+        private static IntPtr OpenNotifyEvent(string name)
+        {
+            IntPtr ev = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, false, "Global\\" + name);
+            if (ev == IntPtr.Zero) ev = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, false, "Local\\" + name);
+            return ev;
+        }
+
+        // newest generation the producer moved to past ours, 0 for none
+        private uint NextGeneration(uint generation, uint next)
+        {
+            if (rootAddress != IntPtr.Zero) next = Math.Max(next, (uint)Marshal.ReadInt32(rootAddress, NEXT_GENERATION_OFFSET));
+            return next > generation && next != staleGeneration ? next : 0;
+        }
+
+        // helper: switches the view over to the generation the producer resized into
+        private bool FollowGeneration(uint generation)
+        {
+            string name = rootName + "@" + generation;
+            IntPtr map = OpenFileMapping(FILE_MAP_READ, false, name);
+            IntPtr view = map != IntPtr.Zero ? MapView(map) : IntPtr.Zero;
+            if (view == IntPtr.Zero)
+            {
+                if (map != IntPtr.Zero) CloseHandle(map);
+                staleGeneration = generation;
+                return false;
+            }
+
+            if (rootAddress == IntPtr.Zero && mapName == rootName)
+            {
+                hRootMap = hMap;
+                rootAddress = baseAddress;
+            }
+            else
+            {
+                UnmapViewOfFile(baseAddress);
+                CloseHandle(hMap);
+            }
+            hMap = map;
+            baseAddress = view;
+            mapName = name;
+            eventName = "SHM_EV_" + name;
+            if (hEvent != IntPtr.Zero) CloseHandle(hEvent);
+            hEvent = OpenNotifyEvent(eventName);
+            UpdateCapacityFromView();
+            return true;
+        }
+
+        // picks bytes per pixel, row stride and channel order from the header;
+        // false for formats GDI can't show (planar YUV, half floats)
+        private bool UpdateLayout(uint format, uint formatChannels, uint planeStride)
+        {
+            if (format == PIXEL_FORMAT_UNKNOWN)
+                bytesPerPixel = (int)formatChannels;
+            else if (format == PIXEL_FORMAT_BGRA8 || format == PIXEL_FORMAT_RGBA8)
+                bytesPerPixel = 4;
+            else if (format == PIXEL_FORMAT_BGR8 || format == PIXEL_FORMAT_RGB8)
+                bytesPerPixel = 3;
+            else
+                return false;
+
+            swapRB = format != PIXEL_FORMAT_BGRA8 && format != PIXEL_FORMAT_BGR8;
+            stride = planeStride != 0 ? (int)planeStride : width * bytesPerPixel;
+            return bytesPerPixel == 3 || bytesPerPixel == 4;
+        }
+
         private bool UpdateCapacityFromView()
         {
             try
             {
                 if (baseAddress == IntPtr.Zero) { dataCapacity = 0; return false; }
+                // a SEC_RESERVE view is several regions (committed, reserved) of one allocation
                 MEMORY_BASIC_INFORMATION mbi;
                 UIntPtr size = (UIntPtr)Marshal.SizeOf(typeof(MEMORY_BASIC_INFORMATION));
-                IntPtr res = VirtualQuery(baseAddress, out mbi, size);
-                if (res == IntPtr.Zero) { dataCapacity = 0; return false; }
-                ulong regionSize = mbi.RegionSize.ToUInt64();
-                if (regionSize <= (ulong)HEADER_SIZE) { dataCapacity = 0; return false; }
-                dataCapacity = (long)regionSize - HEADER_SIZE;
+                ulong viewSize = 0;
+                reservedView = false;
+                while (VirtualQuery(new IntPtr(baseAddress.ToInt64() + (long)viewSize), out mbi, size) != IntPtr.Zero &&
+                       mbi.AllocationBase == baseAddress)
+                {
+                    reservedView |= mbi.State == MEM_RESERVE;
+                    viewSize += mbi.RegionSize.ToUInt64();
+                }
+                if (viewSize <= (ulong)HEADER_SIZE) { dataCapacity = 0; return false; }
+                // every ring slot has the same capacity, the tile table may sit before the first
+                SharedHeader header = ReadHeader();
+                if (header.slot_count == 0 || header.slot_count > MAX_SLOTS) { dataCapacity = 0; return false; }
+                ulong slotsEnd = header.slots[header.slot_count - 1].offset + (ulong)header.slot_capacity;
+                if (header.slots[0].offset < (ulong)HEADER_SIZE || slotsEnd > viewSize) { dataCapacity = 0; return false; }
+                // our view commits the slot pages before reading them
+                for (int i = 0; reservedView && i < (int)header.slot_count; i++)
+                    VirtualAlloc(IntPtr.Add(baseAddress, (int)header.slots[i].offset), (UIntPtr)header.slot_capacity, MEM_COMMIT, PAGE_READONLY);
+                dataCapacity = header.slot_capacity;
                 return true;
             }
             catch
@@ -209,10 +489,22 @@ namespace shared_memory_viewer
                 if (baseAddress != IntPtr.Zero) { UnmapViewOfFile(baseAddress); baseAddress = IntPtr.Zero; }
                 if (hMap != IntPtr.Zero) { CloseHandle(hMap); hMap = IntPtr.Zero; }
                 
-                // open again
+                // open again; a generation the producer left is gone, the root names the current one
                 hMap = OpenFileMapping(FILE_MAP_READ, false, mapName);
+                if (hMap == IntPtr.Zero && hRootMap != IntPtr.Zero)
+                {
+                    hMap = hRootMap;
+                    baseAddress = rootAddress;
+                    hRootMap = rootAddress = IntPtr.Zero;
+                    mapName = rootName;
+                    eventName = "SHM_EV_" + rootName;
+                    if (hEvent != IntPtr.Zero) CloseHandle(hEvent);
+                    hEvent = OpenNotifyEvent(eventName);
+                    UpdateCapacityFromView();
+                    return true;
+                }
                 if (hMap == IntPtr.Zero) return false;
-                baseAddress = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, UIntPtr.Zero);
+                baseAddress = MapView(hMap);
                 if (baseAddress == IntPtr.Zero) { CloseHandle(hMap); hMap = IntPtr.Zero; return false; }
                 UpdateCapacityFromView();
                 return true;
@@ -231,7 +523,7 @@ namespace shared_memory_viewer
         private void StartRendering()
         {
             isRunning = true;
-            renderThread = new Thread(RenderLoop);
+            renderThread = new Thread(RenderThreadMain);
             renderThread.IsBackground = true;
             renderThread.Start();
         }
@@ -245,10 +537,53 @@ namespace shared_memory_viewer
             }
         }
 
+        // helper: the header fields of the latest published frame
+        private void ReadFrameInfo(ref FrameInfo f)
+        {
+            f.formatSeq = (uint)Marshal.ReadInt32(baseAddress, FORMAT_SEQ_OFFSET);
+            f.width = (uint)Marshal.ReadInt32(baseAddress, WIDTH_OFFSET);
+            f.height = (uint)Marshal.ReadInt32(baseAddress, HEIGHT_OFFSET);
+            f.channels = (uint)Marshal.ReadInt32(baseAddress, CHANNELS_OFFSET);
+            f.pixelFormat = (uint)Marshal.ReadInt32(baseAddress, PIXEL_FORMAT_OFFSET);
+            f.stride = (uint)Marshal.ReadInt32(baseAddress, STRIDE_OFFSET);
+            f.generation = (uint)Marshal.ReadInt32(baseAddress, GENERATION_OFFSET);
+            f.nextGeneration = (uint)Marshal.ReadInt32(baseAddress, NEXT_GENERATION_OFFSET);
+            f.slot = Marshal.ReadInt32(baseAddress, LATEST_SLOT_OFFSET);
+            uint slotCount = (uint)Marshal.ReadInt32(baseAddress, SLOT_COUNT_OFFSET);
+            if (f.slot < 0 || f.slot >= MAX_SLOTS || (uint)f.slot >= slotCount) { f.slot = -1; return; }
+            int desc = SLOTS_OFFSET + f.slot * SLOT_DESC_SIZE;
+            f.seq = (uint)Marshal.ReadInt32(baseAddress, desc);
+            f.frameBytes = (uint)Marshal.ReadInt32(baseAddress, desc + SLOT_FRAME_SIZE);
+            f.frameIndex = (ulong)Marshal.ReadInt64(baseAddress, desc + SLOT_FRAME_INDEX);
+            f.offset = (ulong)Marshal.ReadInt64(baseAddress, desc + SLOT_OFFSET);
+            f.slotFormatSeq = (uint)Marshal.ReadInt32(baseAddress, desc + SLOT_FORMAT_SEQ);
+            f.gpuFlags = (uint)Marshal.ReadInt32(baseAddress, desc + SLOT_GPU_FLAGS);
+        }
+
+        // The render thread runs as an MMCSS "Playback" task with the 1 ms
+        // timer, so a loaded machine doesn't deschedule it between frames
+        // (the addon's setLatencyOptions() does the same for its watcher).
+        private void RenderThreadMain()
+        {
+            uint taskIndex = 0;
+            IntPtr mmcss = AvSetMmThreadCharacteristics("Playback", ref taskIndex);
+            if (mmcss == IntPtr.Zero) Debug.WriteLine("MMCSS registration failed: " + Marshal.GetLastWin32Error());
+            timeBeginPeriod(1);
+            try
+            {
+                RenderLoop();
+            }
+            finally
+            {
+                timeEndPeriod(1);
+                if (mmcss != IntPtr.Zero) AvRevertMmThreadCharacteristics(mmcss);
+            }
+        }
+
         private void RenderLoop()
         {
             ulong lastFrameIndex = 0;
-            byte[] imageData = null;
+            FrameInfo f = default;
 
             UpdateCapacityFromView();
 
@@ -258,90 +593,84 @@ namespace shared_memory_viewer
                 if (hEvent != IntPtr.Zero)
                 {
                     uint result = WaitForSingleObject(hEvent, 100);
-                    if (result == WAIT_TIMEOUT)
-                    {
-                        Thread.Sleep(1);
-                        continue;
-                    }
+                    if (result == WAIT_TIMEOUT) continue;
                 }
                 else
                 {
                     Thread.Sleep(16);
                 }
 
-                // seqlock read header
-                SharedHeader header = default;
-                int start, end = 0;
-                uint frameBytes = 0;
-                ulong frameIndex = 0;
-                int attempts = 0;
+                // pick the latest published ring slot; the pixel copy below is
+                // validated against the same slot seq
+                bool stable = false;
                 const int maxAttempts = 10;
-
-                do
+                for (int attempts = 0; attempts < maxAttempts && !stable; attempts++)
                 {
-                    if (++attempts > maxAttempts) { Debug.WriteLine("Failed to read stable frame"); break; }
-                    header = ReadHeader();
-                    start = header.seq;
-                    if ((start & 1) != 0) { Thread.Sleep(0); continue; }
-                    frameBytes = header.frame_size;
-                    frameIndex = header.frame_index;
-                    Thread.MemoryBarrier();
-                    header = ReadHeader();
-                    end = header.seq;
-                } while (start != end);
-
-                // update cached metadata from header!
-                int newWidth = (int)header.width;
-                int newHeight = (int)header.height;
-                int newChannels = (int)header.channels;
+                    ReadFrameInfo(ref f);
+                    if (f.slot < 0) break;
+                    // a format being rewritten, a frame written under another format, or a slot being refilled
+                    stable = (f.formatSeq & 1) == 0 && f.slotFormatSeq == f.formatSeq && (f.seq & 1) == 0;
+                    if (!stable) Thread.Sleep(0);
+                }
 
-                // check header format
-                if (newWidth <= 0 || newHeight <= 0 || (newChannels != 3 && newChannels != 4))
+                // the producer resized into a new mapping
+                uint nextGeneration = NextGeneration(f.generation, f.nextGeneration);
+                if (nextGeneration != 0 && FollowGeneration(nextGeneration)) continue;
+                if (!stable)
                 {
-                    Debug.WriteLine($"Invalid header format: w={newWidth}, h={newHeight}, ch={newChannels} — skipping frame");
-                    // trying to reopen on invalid format
-                    ReopenMapping();
+                    if (f.slot >= 0) Debug.WriteLine("Failed to read stable frame");
                     continue;
                 }
 
-                bool fmtChanged = (width != newWidth) || (height != newHeight) || (channels != newChannels);
-                width = newWidth;
-                height = newHeight;
-                channels = newChannels;
-                stride = width * channels;
-
-                // recompute expected bytes / check frameBytes
-                long expected = (long)width * (long)height * (long)channels;
-                Debug.WriteLine($"HDR: w={width} h={height} ch={channels} frame_size={frameBytes} capacity={dataCapacity} lastIdx={header.frame_index}");
-                Debug.WriteLine($"Expected bytes = {expected}");
-                if (frameBytes != expected)
+                // check magic
+                if ((uint)Marshal.ReadInt32(baseAddress, 0) != MAGIC)
                 {
-                    Debug.WriteLine("WARNING: frame_size != expected -- skipping frame (possible race or writer bug)");
+                    Debug.WriteLine("Invalid magic; attempting reopen...");
                     ReopenMapping();
+                    Thread.Sleep(5);
                     continue;
                 }
 
-                // check magic
-                if (header.magic != MAGIC)
+                // check header format
+                if (f.pixelFormat > PIXEL_FORMAT_RGB8)
                 {
-                    Debug.WriteLine("Invalid magic; attempting reopen...");
+                    Debug.WriteLine($"Pixel format {f.pixelFormat} can't be displayed; skipping frame");
+                    continue;
+                }
+                if (f.width == 0 || f.height == 0 || f.width > int.MaxValue || f.height > int.MaxValue ||
+                    (f.pixelFormat == PIXEL_FORMAT_UNKNOWN && f.channels != 3 && f.channels != 4))
+                {
+                    Debug.WriteLine($"Invalid header format: w={f.width}, h={f.height}, ch={f.channels} — skipping frame");
+                    // trying to reopen on invalid format
                     ReopenMapping();
-                    Thread.Sleep(5);
                     continue;
                 }
 
-                // check that frameBytes fits into capacity
-                if (dataCapacity == 0) UpdateCapacityFromView();
+                // update cached metadata from header!
+                width = (int)f.width;
+                height = (int)f.height;
+                channels = (int)f.channels;
+                UpdateLayout(f.pixelFormat, f.channels, f.stride);
 
-                if (frameBytes == 0)
+                // recompute expected bytes / check frameBytes
+                long expected = (long)stride * (long)height;
+                if (f.frameBytes != expected)
+                {
+                    Debug.WriteLine($"WARNING: frame_size {f.frameBytes} != expected {expected} -- skipping frame (possible race or writer bug)");
+                    ReopenMapping();
+                    continue;
+                }
+                if (f.frameBytes == 0)
                 {
                     // nothing to do
                     continue;
                 }
 
-                if (frameBytes > (uint)dataCapacity)
+                // check that frameBytes fits into capacity; slots resized in place
+                if (f.frameBytes > (uint)dataCapacity) UpdateCapacityFromView();
+                if (f.frameBytes > (uint)dataCapacity)
                 {
-                    Debug.WriteLine($"Frame size {frameBytes} > capacity {dataCapacity}; attempting reopen");
+                    Debug.WriteLine($"Frame size {f.frameBytes} > capacity {dataCapacity}; attempting reopen");
                     bool ok = ReopenMapping();
                     if (!ok)
                     {
@@ -351,47 +680,32 @@ namespace shared_memory_viewer
                 }
 
                 // If we've already seen this frame index, skip
-                if (frameIndex == lastFrameIndex) continue;
-                lastFrameIndex = frameIndex;
+                if (f.frameIndex == lastFrameIndex) continue;
+                lastFrameIndex = f.frameIndex;
+                // the producer published this one as a shared texture only
+                if ((f.gpuFlags & FRAME_NO_CPU) != 0) continue;
 
-                // prepare buffer
-                try
+                // the UI thread is behind: drop the frame rather than queue it
+                if (Volatile.Read(ref presentPending) != 0)
                 {
-                    if (imageData == null || imageData.Length != (int)frameBytes)
-                        imageData = new byte[frameBytes];
-
-                    IntPtr dataPtr = IntPtr.Add(baseAddress, HEADER_SIZE);
-
-                    Debug.WriteLine($"HDR: w={header.width} h={header.height} ch={header.channels} frame_size={frameBytes} capacity={dataCapacity} lastIdx={header.frame_index}");
-
+                    droppedFrames++;
+                    continue;
+                }
 
-                    Debug.WriteLine($"Expected bytes = {expected}");
-                    if (frameBytes != expected)
+                Bitmap bmp;
+                try
+                {
+                    bmp = NextBitmap(width, height, bytesPerPixel == 3 ? PixelFormat.Format24bppRgb : PixelFormat.Format32bppArgb);
+                    if (!CopyFrame(ref f, bmp))
                     {
-                        Debug.WriteLine("WARNING: frame_size != expected -- skipping frame");
-                        
-                        // recreate suspected -> reconnect
-                        ReopenMapping();
+                        lastFrameIndex = 0;
                         continue;
                     }
-                    // Copy guarded by capacity check above
-                    Marshal.Copy(dataPtr, imageData, 0, (int)frameBytes);
-
-                    // swap R <-> B if needed
-                    if (channels >= 3)
-                    {
-                        for (int i = 0; i + 2 < frameBytes; i += channels)
-                        {
-                            byte tmp = imageData[i];
-                            imageData[i] = imageData[i + 2];
-                            imageData[i + 2] = tmp;
-                        }
-                    }
                 }
                 catch (AccessViolationException ave)
                 {
-                    Debug.WriteLine("AccessViolation during Marshal.Copy: " + ave.Message);
-                    
+                    Debug.WriteLine("AccessViolation while copying the frame: " + ave.Message);
+
                     // Reopen, skip frame
                     ReopenMapping();
                     continue;
@@ -402,70 +716,110 @@ namespace shared_memory_viewer
                     continue;
                 }
 
-                // Build bitmap copy via LockBits
-                this.Invoke(new Action(() =>
+                readyBitmap = bmp;
+                Volatile.Write(ref presentPending, 1);
+                try
                 {
-                    try
-                    {
-                        int w = width;
-                        int h = height;
-                        int bytesPerPixel = (channels == 3) ? 3 : 4;
-                        long expectedBytes = (long)w * h * bytesPerPixel;
-                        if (imageData == null || imageData.Length < expectedBytes)
-                        {
-                            Debug.WriteLine("Image buffer too small for expected size; skipping frame");
-                            return;
-                        }
+                    this.BeginInvoke(presentFrame);
+                }
+                catch (InvalidOperationException)
+                {
+                    // the form is going away
+                    Volatile.Write(ref presentPending, 0);
+                }
+            }
+        }
+
+        // The pool bitmap that is not on screen, the pool rebuilt when the frame
+        // size or pixel format changes. Render thread, with no present pending.
+        private Bitmap NextBitmap(int w, int h, PixelFormat pf)
+        {
+            if (bitmapPool[0] == null || poolWidth != w || poolHeight != h || poolFormat != pf)
+            {
+                for (int i = 0; i < bitmapPool.Length; i++)
+                {
+                    // the one on screen goes once PresentFrame() replaced it
+                    if (bitmapPool[i] != null && bitmapPool[i] != shownBitmap) bitmapPool[i].Dispose();
+                    bitmapPool[i] = new Bitmap(w, h, pf);
+                }
+                poolWidth = w;
+                poolHeight = h;
+                poolFormat = pf;
+            }
+            return bitmapPool[0] == shownBitmap ? bitmapPool[1] : bitmapPool[0];
+        }
 
-                        PixelFormat pf = (channels == 3) ? PixelFormat.Format24bppRgb : PixelFormat.Format32bppArgb;
-                        Bitmap clone = new Bitmap(w, h, pf);
-                        var rect = new Rectangle(0, 0, w, h);
-                        var bmpData = clone.LockBits(rect, ImageLockMode.WriteOnly, pf);
-                        try
+        // Copies the frame `f` describes from the view into `bmp` (swapping R/B
+        // for RGB sources), false when the producer refilled the slot or changed
+        // the format meanwhile.
+        private bool CopyFrame(ref FrameInfo f, Bitmap bmp)
+        {
+            var rect = new Rectangle(0, 0, width, height);
+            bmp.LockBits(rect, ImageLockMode.WriteOnly, bmp.PixelFormat, lockData);
+            try
+            {
+                IntPtr src = new IntPtr(baseAddress.ToInt64() + (long)f.offset);
+                int rowBytes = width * bytesPerPixel;
+                // aligned producer rows that match GDI's stride: one copy
+                if (!swapRB && lockData.Stride == stride)
+                {
+                    CopyMemory(lockData.Scan0, src, (UIntPtr)(ulong)((long)stride * height));
+                }
+                else
+                {
+                    if (swapRB && (rowBuffer == null || rowBuffer.Length < rowBytes)) rowBuffer = new byte[rowBytes];
+                    for (int y = 0; y < height; y++)
+                    {
+                        // Scan0 + y * Stride is row y, top-down or bottom-up
+                        IntPtr srcRow = new IntPtr(src.ToInt64() + (long)y * stride);
+                        IntPtr dstRow = new IntPtr(lockData.Scan0.ToInt64() + (long)y * lockData.Stride);
+                        if (!swapRB)
                         {
-                            int srcStride = w * bytesPerPixel;
-                            int dstStride = Math.Abs(bmpData.Stride);
-                            IntPtr dstScan0 = bmpData.Scan0;
-
-                            // if stride matches, then the easy way
-                            if (dstStride == srcStride)
-                            {
-                                Marshal.Copy(imageData, 0, dstScan0, (int)expectedBytes);
-                            }
-                            else
-                            {
-                                // keep the negative dst.Stride (top-down)
-                                bool dstTopDown = bmpData.Stride < 0;
-                                IntPtr dstRowPtr = dstTopDown
-                                    ? IntPtr.Add(dstScan0, (h - 1) * dstStride) // start from the last line
-                                    : dstScan0;
-
-                                for (int y = 0; y < h; y++)
-                                {
-                                    int srcOffset = y * srcStride;
-                                    Marshal.Copy(imageData, srcOffset, dstRowPtr, srcStride);
-
-                                    // move the pointer to the next line up or down
-                                    dstRowPtr = dstTopDown ? IntPtr.Subtract(dstRowPtr, dstStride) : IntPtr.Add(dstRowPtr, dstStride);
-                                }
-                            }
+                            CopyMemory(dstRow, srcRow, (UIntPtr)rowBytes);
+                            continue;
                         }
-                        finally
+                        Marshal.Copy(srcRow, rowBuffer, 0, rowBytes);
+                        for (int i = 0; i < rowBytes; i += bytesPerPixel)
                         {
-                            clone.UnlockBits(bmpData);
+                            byte tmp = rowBuffer[i];
+                            rowBuffer[i] = rowBuffer[i + 2];
+                            rowBuffer[i + 2] = tmp;
                         }
-
-                        // swap-picture atomically
-                        var old = pictureBox.Image;
-                        pictureBox.Image = clone;
-                        old?.Dispose();
-                    }
-                    catch (Exception ex)
-                    {
-                        Debug.WriteLine("Error creating bitmap in UI thread: " + ex.ToString());
+                        Marshal.Copy(rowBuffer, 0, dstRow, rowBytes);
                     }
-                }));
+                }
+            }
+            finally
+            {
+                bmp.UnlockBits(lockData);
+            }
+
+            // the producer lapped the ring while we were copying
+            Thread.MemoryBarrier();
+            if ((uint)Marshal.ReadInt32(baseAddress, SLOTS_OFFSET + f.slot * SLOT_DESC_SIZE) != f.seq)
+            {
+                Debug.WriteLine("Slot overwritten during copy; skipping frame");
+                return false;
+            }
+            // width/height/stride used above must be the ones the frame was written with
+            if ((uint)Marshal.ReadInt32(baseAddress, FORMAT_SEQ_OFFSET) != f.formatSeq)
+            {
+                Debug.WriteLine("Format changed during copy; skipping frame");
+                return false;
             }
+            return true;
+        }
+
+        // UI thread: puts the bitmap the render loop filled on screen
+        private void PresentFrame()
+        {
+            Bitmap bmp = readyBitmap;
+            Image old = pictureBox.Image;
+            pictureBox.Image = bmp;
+            shownBitmap = bmp;
+            // left over from a pool rebuilt for another frame size
+            if (old != null && old != bmp && Array.IndexOf(bitmapPool, old) < 0) old.Dispose();
+            Volatile.Write(ref presentPending, 0);
         }
 
         private void Cleanup()
@@ -482,6 +836,18 @@ namespace shared_memory_viewer
                 hMap = IntPtr.Zero;
             }
 
+            if (rootAddress != IntPtr.Zero)
+            {
+                UnmapViewOfFile(rootAddress);
+                rootAddress = IntPtr.Zero;
+            }
+
+            if (hRootMap != IntPtr.Zero)
+            {
+                CloseHandle(hRootMap);
+                hRootMap = IntPtr.Zero;
+            }
+
             if (hEvent != IntPtr.Zero)
             {
                 CloseHandle(hEvent);